@@ -200,7 +200,7 @@ public:
             return true;
         }
         KFileItem fileItem = model()->itemForSourceIndex(index);
-        QDate date = TimeUtils::dateTimeForFileItem(fileItem).date();
+        QDate date = TimeUtils::cachedDateTimeForFileItem(fileItem).date();
         switch (mMode) {
         case GreaterOrEqual:
             return date >= mDate;
@@ -211,6 +211,11 @@ public:
         }
     }
 
+    bool needsDates() const override
+    {
+        return mDate.isValid();
+    }
+
     void setDate(const QDate &date)
     {
         mDate = date;
@@ -1995,24 +1995,29 @@ void MainWindow::preloadNextUrl()
         return;
     }
 
+    // In view mode, preload the images around the current one, sorted by
+    // distance. Otherwise preload the selected one.
+    QList<QModelIndex> indexes;
     if (d->mCurrentMainPageId == ViewMainPageId) {
-        // If we are in view mode, preload the next url, otherwise preload the
-        // selected one
-        int offset = d->mPreloadDirectionIsForward ? 1 : -1;
-        index = d->mDirModel->sibling(index.row() + offset, index.column(), index);
-        if (!index.isValid()) {
-            return;
+        const QList<int> offsets = Preloader::preloadOffsets(d->mPreloadDirectionIsForward);
+        for (int offset : offsets) {
+            indexes << d->mDirModel->sibling(index.row() + offset, index.column(), index);
         }
+    } else {
+        indexes << index;
     }
 
-    KFileItem item = d->mDirModel->itemForIndex(index);
-    if (!ArchiveUtils::fileItemIsDirOrArchive(item)) {
-        QUrl url = item.url();
-        if (url.isLocalFile()) {
-            QSize size = d->mViewStackedWidget->size();
-            d->mPreloader->preload(url, size);
+    QList<QUrl> urls;
+    for (const QModelIndex &preloadIndex : std::as_const(indexes)) {
+        if (!preloadIndex.isValid()) {
+            continue;
+        }
+        KFileItem item = d->mDirModel->itemForIndex(preloadIndex);
+        if (!ArchiveUtils::fileItemIsDirOrArchive(item) && item.url().isLocalFile()) {
+            urls << item.url();
         }
     }
+    d->mPreloader->preload(urls, d->mViewStackedWidget->size());
 }
 
 // Set a sane initial window size
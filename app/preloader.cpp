@@ -22,12 +22,17 @@ Foundation, Inc., 51 Franklin Street, Fifth Floor, Cambridge, MA 02110-1301, USA
 #include "preloader.h"
 
 // Qt
+#include <QHash>
+#include <QSize>
+#include <QUrl>
 
 // KF
 
 // Local
 #include "gwenview_app_debug.h"
 #include <lib/document/documentfactory.h>
+#include <lib/gwenviewconfig.h>
+#include <lib/memoryutils.h>
 
 namespace Gwenview
 {
@@ -42,16 +47,64 @@ namespace Gwenview
 
 struct PreloaderPrivate {
     Preloader *q = nullptr;
-    Document::Ptr mDocument;
     QSize mSize;
+    QList<QUrl> mPendingUrls;
+    // The document currently being preloaded
+    Document::Ptr mDocument;
+    QHash<QUrl, Document::Ptr> mPreloadedDocuments;
+    // Estimated memory usage of preloaded documents and of mDocument
+    QHash<QUrl, qulonglong> mReservedBytes;
+    qulonglong mBudget = 0;
+
+    qulonglong reservedBytes() const
+    {
+        qulonglong total = 0;
+        for (qulonglong bytes : mReservedBytes) {
+            total += bytes;
+        }
+        return total;
+    }
 
     void forgetDocument()
     {
-        // Forget about the document. Keeping a reference to it would prevent it
-        // from being garbage collected.
         QObject::disconnect(mDocument.data(), nullptr, q, nullptr);
         mDocument = nullptr;
     }
+
+    void cancelDocument()
+    {
+        // Forget about the document. Keeping a reference to it would prevent it
+        // from being garbage collected.
+        mReservedBytes.remove(mDocument->url());
+        mDocument->releaseDecodePriority(q);
+        forgetDocument();
+    }
+
+    void keepDocument()
+    {
+        const QUrl url = mDocument->url();
+        mReservedBytes[url] = qMax(mReservedBytes.value(url), qulonglong(mDocument->memoryUsage()));
+        mPreloadedDocuments.insert(url, mDocument);
+        forgetDocument();
+    }
+
+    void preloadNext()
+    {
+        while (!mDocument && !mPendingUrls.isEmpty()) {
+            const QUrl url = mPendingUrls.takeFirst();
+            if (mPreloadedDocuments.contains(url)) {
+                continue;
+            }
+            LOG("url=" << url);
+            mDocument = DocumentFactory::instance()->load(url);
+            // Views holding the document keep it more urgent
+            mDocument->setDecodePriority(q, DecodeScheduler::PreloadPriority);
+            QObject::connect(mDocument.data(), &Document::metaInfoUpdated, q, &Preloader::doPreload);
+            QObject::connect(mDocument.data(), &Document::metaInfoLoaded, q, &Preloader::doPreload);
+            QObject::connect(mDocument.data(), &Document::loadingFailed, q, &Preloader::doPreload);
+            q->doPreload();
+        }
+    }
 };
 
 Preloader::Preloader(QObject *parent)
@@ -66,21 +119,58 @@ Preloader::~Preloader()
     delete d;
 }
 
-void Preloader::preload(const QUrl &url, const QSize &size)
+void Preloader::preload(const QList<QUrl> &urls, const QSize &size)
 {
-    LOG("url=" << url);
-    if (d->mDocument) {
-        disconnect(d->mDocument.data(), nullptr, this, nullptr);
+    LOG("urls=" << urls);
+    d->mSize = size;
+
+    for (auto it = d->mPreloadedDocuments.begin(); it != d->mPreloadedDocuments.end();) {
+        if (urls.contains(it.key())) {
+            ++it;
+        } else {
+            LOG("forgetting" << it.key());
+            d->mReservedBytes.remove(it.key());
+            it.value()->releaseDecodePriority(this);
+            it = d->mPreloadedDocuments.erase(it);
+        }
     }
 
-    d->mDocument = DocumentFactory::instance()->load(url);
-    d->mSize = size;
-    connect(d->mDocument.data(), &Document::metaInfoUpdated, this, &Preloader::doPreload);
+    if (d->mDocument && !urls.contains(d->mDocument->url())) {
+        LOG("cancelling" << d->mDocument->url());
+        d->cancelDocument();
+    }
+
+    // Memory used by the documents we keep is not free anymore, count it in
+    // the budget
+    const qulonglong freeMemory = MemoryUtils::getFreeMemory();
+    d->mBudget = freeMemory / 100 * GwenviewConfig::preloadMemoryPercent() + d->reservedBytes();
+    LOG("budget=" << d->mBudget << "reserved=" << d->reservedBytes());
 
-    if (d->mDocument->size().isValid()) {
-        LOG("size is already available");
-        doPreload();
+    d->mPendingUrls = urls;
+    d->preloadNext();
+}
+
+QList<QUrl> Preloader::preloadedUrls() const
+{
+    return d->mPreloadedDocuments.keys();
+}
+
+QList<int> Preloader::preloadOffsets(bool forward)
+{
+    // Alternate between both directions, nearest images first
+    const int direction = forward ? 1 : -1;
+    const int ahead = GwenviewConfig::preloadAhead();
+    const int behind = GwenviewConfig::preloadBehind();
+    QList<int> offsets;
+    for (int distance = 1; distance <= qMax(ahead, behind); ++distance) {
+        if (distance <= ahead) {
+            offsets << distance * direction;
+        }
+        if (distance <= behind) {
+            offsets << -distance * direction;
+        }
     }
+    return offsets;
 }
 
 void Preloader::doPreload()
@@ -91,25 +181,72 @@ void Preloader::doPreload()
 
     if (d->mDocument->loadingState() == Document::LoadingFailed) {
         LOG("loading failed");
-        d->forgetDocument();
+        d->cancelDocument();
+        d->preloadNext();
         return;
     }
 
     if (!d->mDocument->size().isValid()) {
-        LOG("size not available yet");
+        if (d->mDocument->loadingState() == Document::MetaInfoLoaded || d->mDocument->loadingState() == Document::Loaded) {
+            LOG("document has no size, nothing to preload");
+            d->cancelDocument();
+            d->preloadNext();
+        } else {
+            LOG("size not available yet");
+        }
         return;
     }
 
-    qreal zoom = qMin(d->mSize.width() / qreal(d->mDocument->width()), d->mSize.height() / qreal(d->mDocument->height()));
+    const qreal zoom = qMin(d->mSize.width() / qreal(d->mDocument->width()), d->mSize.height() / qreal(d->mDocument->height()));
+    const bool downSampled = zoom < Document::maxDownSampledZoom();
 
-    if (zoom < Document::maxDownSampledZoom()) {
+    qulonglong estimate = qulonglong(d->mDocument->width()) * d->mDocument->height() * 4;
+    if (downSampled) {
+        estimate = qulonglong(estimate * zoom * zoom);
+    }
+    if (d->reservedBytes() + estimate > d->mBudget) {
+        // Urls are sorted by priority, do not let further documents take the
+        // memory this one could not get
+        LOG("not enough memory to preload" << d->mDocument->url() << "estimate=" << estimate);
+        d->cancelDocument();
+        d->mPendingUrls.clear();
+        return;
+    }
+    d->mReservedBytes.insert(d->mDocument->url(), estimate);
+
+    disconnect(d->mDocument.data(), nullptr, this, nullptr);
+    connect(d->mDocument.data(), &Document::loadingFailed, this, &Preloader::slotDocumentPreloaded);
+
+    bool ready;
+    if (downSampled) {
         LOG("preloading down sampled, zoom=" << zoom);
-        d->mDocument->prepareDownSampledImageForZoom(zoom);
+        connect(d->mDocument.data(), &Document::downSampledImageReady, this, &Preloader::slotDocumentPreloaded);
+        ready = d->mDocument->prepareDownSampledImageForZoom(zoom);
     } else {
         LOG("preloading full image");
+        connect(d->mDocument.data(), &Document::loaded, this, &Preloader::slotDocumentPreloaded);
         d->mDocument->startLoadingFullImage();
+        ready = d->mDocument->loadingState() == Document::Loaded;
+    }
+
+    if (ready) {
+        slotDocumentPreloaded();
+    }
+}
+
+void Preloader::slotDocumentPreloaded()
+{
+    if (!d->mDocument) {
+        return;
+    }
+    if (d->mDocument->loadingState() == Document::LoadingFailed) {
+        LOG("loading failed");
+        d->cancelDocument();
+    } else {
+        LOG("preloaded" << d->mDocument->url());
+        d->keepDocument();
     }
-    d->forgetDocument();
+    d->preloadNext();
 }
 
 } // namespace
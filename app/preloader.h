@@ -22,6 +22,7 @@ Foundation, Inc., 51 Franklin Street, Fifth Floor, Cambridge, MA 02110-1301, USA
 #define PRELOADER_H
 
 // Qt
+#include <QList>
 #include <QObject>
 
 // KF
@@ -37,7 +38,13 @@ namespace Gwenview
 struct PreloaderPrivate;
 
 /**
- * This class preloads a document to fit a specific size.
+ * This class preloads documents to fit a specific size.
+ *
+ * Documents are preloaded one at a time, in the order they are passed to
+ * preload(). Preloaded documents are kept referenced until they leave the
+ * preload window, so that DocumentFactory does not garbage collect them.
+ * The amount of memory they use is limited to a percentage of the free
+ * memory.
  */
 class Preloader : public QObject
 {
@@ -46,10 +53,27 @@ public:
     explicit Preloader(QObject *parent);
     ~Preloader() override;
 
-    void preload(const QUrl &, const QSize &);
+    /**
+     * Replaces the preload window with @p urls, ordered by priority. Pending
+     * or preloaded documents which are not part of @p urls are forgotten.
+     */
+    void preload(const QList<QUrl> &urls, const QSize &size);
+
+    /**
+     * Returns the urls of the documents which are preloaded
+     */
+    QList<QUrl> preloadedUrls() const;
+
+    /**
+     * Returns the offsets from the current image of the images to preload
+     * while browsing @p forward or backward, ordered by priority. They follow
+     * the PreloadAhead and PreloadBehind settings.
+     */
+    static QList<int> preloadOffsets(bool forward);
 
 private Q_SLOTS:
     void doPreload();
+    void slotDocumentPreloaded();
 
 private:
     PreloaderPrivate *const d;
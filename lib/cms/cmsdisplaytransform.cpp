@@ -0,0 +1,241 @@
+// SPDX-FileCopyrightText: 2026 Gwenview Developers
+// SPDX-License-Identifier: GPL-2.0-or-later
+
+// Self
+#include "cmsdisplaytransform.h"
+
+// STL
+#include <algorithm>
+
+// Qt
+#include <QElapsedTimer>
+#include <QImage>
+#include <QList>
+#include <QThreadPool>
+#include <QtConcurrentMap>
+
+// lcms
+#include <lcms2.h>
+
+namespace Gwenview
+{
+
+namespace Cms
+{
+
+// Number of nodes along each axis of the lookup table
+static const int LutSize = 33;
+
+// Images smaller than this, in pixels, are transformed in the calling thread:
+// splitting them would cost more than it saves.
+static const qsizetype MinParallelPixelCount = 512 * 512;
+
+// Minimum number of rows in a band
+static const int MinBandHeight = 32;
+
+/**
+ * For each 8-bit value, the index of the lookup table node right below it and
+ * the distance to that node, in 1/256th of the distance between two nodes.
+ */
+struct LutPositions {
+    int index[256];
+    int fraction[256];
+
+    LutPositions()
+    {
+        for (int value = 0; value < 256; ++value) {
+            const int position = value * (LutSize - 1) * 256 / 255;
+            index[value] = position >> 8;
+            fraction[value] = position & 0xff;
+            if (index[value] == LutSize - 1) {
+                // Interpolate from the node before the last one instead, so
+                // that index[value] + 1 is always valid
+                index[value] = LutSize - 2;
+                fraction[value] = 256;
+            }
+        }
+    }
+};
+
+static const LutPositions &lutPositions()
+{
+    static const LutPositions positions;
+    return positions;
+}
+
+bool DisplayTransform::canUseLut(cmsUInt32Number cmsFormat)
+{
+    switch (cmsFormat) {
+    case TYPE_BGRA_8:
+    case TYPE_RGBA_8:
+    case TYPE_RGB_8:
+    case TYPE_BGR_8:
+        return true;
+    default:
+        // Let lcms handle other formats
+        return false;
+    }
+}
+
+DisplayTransform::DisplayTransform(cmsHTRANSFORM handle, cmsUInt32Number cmsFormat)
+    : mHandle(handle)
+{
+    if (!canUseLut(cmsFormat)) {
+        return;
+    }
+    mBytesPerPixel = T_BYTES(cmsFormat) * (T_CHANNELS(cmsFormat) + T_EXTRA(cmsFormat));
+    buildLut();
+}
+
+DisplayTransform::~DisplayTransform()
+{
+    cmsDeleteTransform(mHandle);
+}
+
+cmsHTRANSFORM DisplayTransform::handle() const
+{
+    return mHandle;
+}
+
+bool DisplayTransform::hasLut() const
+{
+    return !mLut.empty();
+}
+
+void DisplayTransform::buildLut()
+{
+    // Run every node of the grid through lcms. Color channels are always the
+    // first three bytes of the supported formats, so there is no need to care
+    // about their order: the lookup table maps bytes to bytes.
+    const int nodeCount = LutSize * LutSize * LutSize;
+    std::vector<quint8> nodes(nodeCount * mBytesPerPixel, 0xff);
+    quint8 *node = nodes.data();
+    for (int x = 0; x < LutSize; ++x) {
+        for (int y = 0; y < LutSize; ++y) {
+            for (int z = 0; z < LutSize; ++z, node += mBytesPerPixel) {
+                node[0] = quint8(qRound(x * 255.0 / (LutSize - 1)));
+                node[1] = quint8(qRound(y * 255.0 / (LutSize - 1)));
+                node[2] = quint8(qRound(z * 255.0 / (LutSize - 1)));
+            }
+        }
+    }
+    cmsDoTransform(mHandle, nodes.data(), nodes.data(), nodeCount);
+
+    mLut.resize(nodeCount * 3);
+    for (int idx = 0; idx < nodeCount; ++idx) {
+        std::copy_n(nodes.data() + idx * mBytesPerPixel, 3, mLut.data() + idx * 3);
+    }
+}
+
+void DisplayTransform::applyLut(uchar *line, int width) const
+{
+    const LutPositions &positions = lutPositions();
+    const quint8 *lut = mLut.data();
+    // Offsets between two neighbour nodes along each axis
+    const int strideX = LutSize * LutSize * 3;
+    const int strideY = LutSize * 3;
+    const int strideZ = 3;
+
+    for (int column = 0; column < width; ++column, line += mBytesPerPixel) {
+        const int fx = positions.fraction[line[0]];
+        const int fy = positions.fraction[line[1]];
+        const int fz = positions.fraction[line[2]];
+        const quint8 *origin = lut + positions.index[line[0]] * strideX + positions.index[line[1]] * strideY + positions.index[line[2]] * strideZ;
+
+        // Tetrahedral interpolation: pick the tetrahedron of the cube which
+        // contains the pixel by sorting the fractions, then walk from the
+        // origin to the opposite corner along the axes in that order.
+        int first, second, third;
+        int firstOffset, secondOffset;
+        if (fx >= fy) {
+            if (fy >= fz) {
+                first = fx, second = fy, third = fz;
+                firstOffset = strideX, secondOffset = strideX + strideY;
+            } else if (fx >= fz) {
+                first = fx, second = fz, third = fy;
+                firstOffset = strideX, secondOffset = strideX + strideZ;
+            } else {
+                first = fz, second = fx, third = fy;
+                firstOffset = strideZ, secondOffset = strideZ + strideX;
+            }
+        } else {
+            if (fx >= fz) {
+                first = fy, second = fx, third = fz;
+                firstOffset = strideY, secondOffset = strideY + strideX;
+            } else if (fy >= fz) {
+                first = fy, second = fz, third = fx;
+                firstOffset = strideY, secondOffset = strideY + strideZ;
+            } else {
+                first = fz, second = fy, third = fx;
+                firstOffset = strideZ, secondOffset = strideZ + strideY;
+            }
+        }
+        const quint8 *firstCorner = origin + firstOffset;
+        const quint8 *secondCorner = origin + secondOffset;
+        const quint8 *lastCorner = origin + strideX + strideY + strideZ;
+
+        const int w0 = 256 - first;
+        const int w1 = first - second;
+        const int w2 = second - third;
+        const int w3 = third;
+        for (int channel = 0; channel < 3; ++channel) {
+            line[channel] = quint8((origin[channel] * w0 + firstCorner[channel] * w1 + secondCorner[channel] * w2 + lastCorner[channel] * w3 + 128) >> 8);
+        }
+    }
+}
+
+void DisplayTransform::applyToLines(uchar *bits, int width, int lineCount, qsizetype bytesPerLine) const
+{
+    if (mLut.empty()) {
+        cmsDoTransformLineStride(mHandle, bits, bits, width, lineCount, bytesPerLine, bytesPerLine, 0, 0);
+        return;
+    }
+    for (int row = 0; row < lineCount; ++row) {
+        applyLut(bits + row * bytesPerLine, width);
+    }
+}
+
+void DisplayTransform::apply(QImage &image) const
+{
+    const int width = image.width();
+    const int height = image.height();
+    const qsizetype bytesPerLine = image.bytesPerLine();
+    uchar *bits = image.bits();
+    if (!bits) {
+        return;
+    }
+
+    QElapsedTimer timer;
+    timer.start();
+    const auto updateStatistics = [&]() {
+        ++mImageCount;
+        mPixelCount += quint64(width) * height;
+        mElapsedNsecs += timer.nsecsElapsed();
+    };
+
+    if (qsizetype(width) * height < MinParallelPixelCount) {
+        applyToLines(bits, width, height, bytesPerLine);
+        updateStatistics();
+        return;
+    }
+
+    // Split the image in bands of rows, one per available thread
+    const int bandCount = qBound(1, QThreadPool::globalInstance()->maxThreadCount(), height / MinBandHeight);
+    const int bandHeight = (height + bandCount - 1) / bandCount;
+    QList<int> bandStarts;
+    for (int row = 0; row < height; row += bandHeight) {
+        bandStarts << row;
+    }
+    QtConcurrent::blockingMap(bandStarts, [&](const int &row) {
+        applyToLines(bits + row * bytesPerLine, width, qMin(bandHeight, height - row), bytesPerLine);
+    });
+    updateStatistics();
+}
+
+DisplayTransform::Statistics DisplayTransform::statistics() const
+{
+    return {mImageCount, mPixelCount, mElapsedNsecs};
+}
+
+} // namespace Cms
+} // namespace Gwenview
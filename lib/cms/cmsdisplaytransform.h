@@ -0,0 +1,101 @@
+// SPDX-FileCopyrightText: 2026 Gwenview Developers
+// SPDX-License-Identifier: GPL-2.0-or-later
+
+#ifndef CMSDISPLAYTRANSFORM_H
+#define CMSDISPLAYTRANSFORM_H
+
+#include <lib/gwenviewlib_export.h>
+
+// STL
+#include <atomic>
+#include <vector>
+
+// Qt
+#include <QtGlobal>
+
+class QImage;
+
+using cmsHTRANSFORM = void *;
+using cmsUInt32Number = unsigned int;
+
+namespace Gwenview
+{
+
+namespace Cms
+{
+
+/**
+ * Wrapper for an lcms transform used to display images.
+ *
+ * Large images are split in bands of rows which are transformed in parallel.
+ * For 8-bit RGB and RGBA pixel formats, the transform is sampled once into a
+ * 3D lookup table, which is then applied with tetrahedral interpolation
+ * instead of going through lcms for each pixel. The lookup table is applied
+ * with scalar code, one pixel at a time.
+ *
+ * Instances are immutable and can be used from several threads at once.
+ */
+class GWENVIEWLIB_EXPORT DisplayTransform
+{
+public:
+    /**
+     * What apply() did since the transform was created
+     */
+    struct Statistics {
+        quint64 imageCount = 0;
+        quint64 pixelCount = 0;
+        qint64 elapsedNsecs = 0;
+    };
+
+    /**
+     * Returns true if transforms for @p cmsFormat are applied through a
+     * lookup table. Such transforms should not be precalculated by lcms: the
+     * lookup table would interpolate between values lcms interpolated.
+     */
+    static bool canUseLut(cmsUInt32Number cmsFormat);
+
+    /**
+     * Takes ownership of @p handle, which must have been created for
+     * @p cmsFormat as both input and output format, and without the lcms
+     * cache.
+     */
+    DisplayTransform(cmsHTRANSFORM handle, cmsUInt32Number cmsFormat);
+    ~DisplayTransform();
+
+    cmsHTRANSFORM handle() const;
+
+    /**
+     * Returns true if the transform is applied through a lookup table.
+     */
+    bool hasLut() const;
+
+    /**
+     * Applies the transform in place. @p image must be in a format matching
+     * the format the transform has been created for.
+     */
+    void apply(QImage &image) const;
+
+    Statistics statistics() const;
+
+private:
+    Q_DISABLE_COPY(DisplayTransform)
+
+    void buildLut();
+    void applyToLines(uchar *bits, int width, int lineCount, qsizetype bytesPerLine) const;
+    void applyLut(uchar *line, int width) const;
+
+    cmsHTRANSFORM mHandle;
+    int mBytesPerPixel = 0;
+    // Transformed values of the first three bytes of each pixel, for each
+    // node of the grid. Empty if the format is not supported.
+    std::vector<quint8> mLut;
+
+    mutable std::atomic<quint64> mImageCount{0};
+    mutable std::atomic<quint64> mPixelCount{0};
+    mutable std::atomic<qint64> mElapsedNsecs{0};
+};
+
+} // namespace Cms
+} // namespace Gwenview
+
+#endif /* CMSDISPLAYTRANSFORM_H */
@@ -36,6 +36,9 @@ extern "C" {
 
 // Qt
 #include <QBuffer>
+#include <QCryptographicHash>
+#include <QList>
+#include <QtEndian>
 
 // lcms
 #include <lcms2.h>
@@ -105,9 +108,151 @@ static cmsHPROFILE loadFromJpegData(const QByteArray &data)
     return profile;
 }
 
+//- TIFF -----------------------------------------------------------------------
+static cmsHPROFILE loadFromTiffData(const QByteArray &data)
+{
+    const auto *bytes = reinterpret_cast<const uchar *>(data.constData());
+    const qint64 size = data.size();
+    if (size < 8) {
+        return nullptr;
+    }
+    bool littleEndian;
+    if (data.startsWith("II")) {
+        littleEndian = true;
+    } else if (data.startsWith("MM")) {
+        littleEndian = false;
+    } else {
+        return nullptr;
+    }
+    auto readUInt16 = [&](qint64 pos) {
+        return littleEndian ? qFromLittleEndian<quint16>(bytes + pos) : qFromBigEndian<quint16>(bytes + pos);
+    };
+    auto readUInt32 = [&](qint64 pos) {
+        return littleEndian ? qFromLittleEndian<quint32>(bytes + pos) : qFromBigEndian<quint32>(bytes + pos);
+    };
+    // BigTIFF files use 43 and a different layout
+    if (readUInt16(2) != 42) {
+        return nullptr;
+    }
+
+    // The profile is stored in the first IFD, as the InterColorProfile tag
+    const qint64 ifdPos = readUInt32(4);
+    if (ifdPos + 2 > size) {
+        return nullptr;
+    }
+    const int entryCount = readUInt16(ifdPos);
+    for (int idx = 0; idx < entryCount; ++idx) {
+        const qint64 entryPos = ifdPos + 2 + idx * 12;
+        if (entryPos + 12 > size) {
+            return nullptr;
+        }
+        if (readUInt16(entryPos) != 34675) {
+            continue;
+        }
+        // The tag type is BYTE or UNDEFINED, so count is the size in bytes
+        const qint64 length = readUInt32(entryPos + 4);
+        const qint64 offset = length <= 4 ? entryPos + 8 : readUInt32(entryPos + 8);
+        if (offset + length > size) {
+            return nullptr;
+        }
+        LOG("Found a profile, length:" << length);
+        return cmsOpenProfileFromMem(bytes + offset, length);
+    }
+    return nullptr;
+}
+
+//- WebP -----------------------------------------------------------------------
+static cmsHPROFILE loadFromWebpData(const QByteArray &data)
+{
+    if (data.size() < 12 || !data.startsWith("RIFF") || data.mid(8, 4) != "WEBP") {
+        return nullptr;
+    }
+    // Chunks are made of a fourcc, a little-endian size and the payload,
+    // padded to an even size. The profile is in the ICCP chunk.
+    const auto *bytes = reinterpret_cast<const uchar *>(data.constData());
+    qint64 pos = 12;
+    while (pos + 8 <= data.size()) {
+        const qint64 length = qFromLittleEndian<quint32>(bytes + pos + 4);
+        if (pos + 8 + length > data.size()) {
+            return nullptr;
+        }
+        if (qstrncmp(data.constData() + pos, "ICCP", 4) == 0) {
+            LOG("Found a profile, length:" << length);
+            return cmsOpenProfileFromMem(bytes + pos + 8, length);
+        }
+        // The profile comes before the image data
+        if (qstrncmp(data.constData() + pos, "VP8 ", 4) == 0 || qstrncmp(data.constData() + pos, "VP8L", 4) == 0) {
+            return nullptr;
+        }
+        pos += 8 + length + (length & 1);
+    }
+    return nullptr;
+}
+
+//- HEIF, AVIF -----------------------------------------------------------------
+/**
+ * Looks for the profile in the ISO base media file format boxes between
+ * @p pos and @p end. The profile is stored in a meta/iprp/ipco/colr box,
+ * @p depth is the index of the box to look for in this path.
+ */
+static cmsHPROFILE loadFromBmffBoxes(const uchar *pos, const uchar *end, int depth)
+{
+    static const char *const path[] = {"meta", "iprp", "ipco", "colr"};
+    while (end - pos >= 8) {
+        quint64 boxSize = qFromBigEndian<quint32>(pos);
+        qint64 headerSize = 8;
+        if (boxSize == 1) {
+            if (end - pos < 16) {
+                return nullptr;
+            }
+            boxSize = qFromBigEndian<quint64>(pos + 8);
+            headerSize = 16;
+        } else if (boxSize == 0) {
+            // Box extends to the end of the file
+            boxSize = end - pos;
+        }
+        if (boxSize < quint64(headerSize) || boxSize > quint64(end - pos)) {
+            return nullptr;
+        }
+        const uchar *payload = pos + headerSize;
+        const uchar *boxEnd = pos + boxSize;
+
+        if (qstrncmp(reinterpret_cast<const char *>(pos + 4), path[depth], 4) == 0) {
+            if (depth == 3) {
+                // There can be several colr boxes, only some of them contain a
+                // profile rather than nclx color information
+                const char *colorType = reinterpret_cast<const char *>(payload);
+                if (boxEnd - payload > 4 && (qstrncmp(colorType, "prof", 4) == 0 || qstrncmp(colorType, "rICC", 4) == 0)) {
+                    LOG("Found a profile, length:" << boxEnd - payload - 4);
+                    return cmsOpenProfileFromMem(payload + 4, boxEnd - payload - 4);
+                }
+            } else {
+                // meta is a full box: its children come after a version and
+                // flags field
+                const uchar *children = depth == 0 ? payload + 4 : payload;
+                if (children <= boxEnd) {
+                    cmsHPROFILE profile = loadFromBmffBoxes(children, boxEnd, depth + 1);
+                    if (profile) {
+                        return profile;
+                    }
+                }
+            }
+        }
+        pos = boxEnd;
+    }
+    return nullptr;
+}
+
+static cmsHPROFILE loadFromBmffData(const QByteArray &data)
+{
+    const auto *bytes = reinterpret_cast<const uchar *>(data.constData());
+    return loadFromBmffBoxes(bytes, bytes + data.size(), 0);
+}
+
 //- Profile class --------------------------------------------------------------
 struct ProfilePrivate {
     cmsHPROFILE mProfile;
+    QByteArray mId;
 
     void reset()
     {
@@ -117,6 +262,32 @@ struct ProfilePrivate {
         mProfile = nullptr;
     }
 
+    void computeId()
+    {
+        if (!mProfile) {
+            return;
+        }
+        if (cmsMD5computeID(mProfile)) {
+            cmsUInt8Number id[16];
+            cmsGetHeaderProfileID(mProfile, id);
+            mId = QByteArray(reinterpret_cast<const char *>(id), sizeof(id));
+            return;
+        }
+        // Hash the serialized profile ourselves, profiles without an id
+        // must not end up sharing the transforms of each other
+        cmsUInt32Number size = 0;
+        if (!cmsSaveProfileToMem(mProfile, nullptr, &size) || size == 0) {
+            qCWarning(GWENVIEW_LIB_LOG) << "Could not compute the id of a color profile";
+            return;
+        }
+        QByteArray data(size, Qt::Uninitialized);
+        if (!cmsSaveProfileToMem(mProfile, data.data(), &size)) {
+            qCWarning(GWENVIEW_LIB_LOG) << "Could not compute the id of a color profile";
+            return;
+        }
+        mId = QCryptographicHash::hash(data, QCryptographicHash::Md5);
+    }
+
     QString readInfo(cmsInfoType info)
     {
         GV_RETURN_VALUE_IF_FAIL(mProfile, QString());
@@ -136,6 +307,8 @@ Profile::Profile(cmsHPROFILE hProfile)
     : d(new ProfilePrivate)
 {
     d->mProfile = hProfile;
+    // Computed right away, so that id() can be called from any thread
+    d->computeId();
 }
 
 Profile::~Profile()
@@ -152,6 +325,12 @@ Profile::Ptr Profile::loadFromImageData(const QByteArray &data, const QByteArray
         hProfile = loadFromPngData(data);
     } else if (format == "jpeg") {
         hProfile = loadFromJpegData(data);
+    } else if (format == "tif" || format == "tiff") {
+        hProfile = loadFromTiffData(data);
+    } else if (format == "webp") {
+        hProfile = loadFromWebpData(data);
+    } else if (format == "heif" || format == "heic" || format == "avif" || format == "avifs") {
+        hProfile = loadFromBmffData(data);
     }
     if (hProfile) {
         ptr = new Profile(hProfile);
@@ -159,6 +338,12 @@ Profile::Ptr Profile::loadFromImageData(const QByteArray &data, const QByteArray
     return ptr;
 }
 
+bool Profile::canLoadFromImageData(const QByteArray &format)
+{
+    static const QList<QByteArray> formats = {"png", "jpeg", "tif", "tiff", "webp", "heif", "heic", "avif", "avifs"};
+    return formats.contains(format);
+}
+
 Profile::Ptr Profile::loadFromExiv2Image(const Exiv2::Image *image)
 {
     Profile::Ptr ptr;
@@ -206,6 +391,11 @@ cmsHPROFILE Profile::handle() const
     return d->mProfile;
 }
 
+QByteArray Profile::id() const
+{
+    return d->mId;
+}
+
 QString Profile::copyright() const
 {
     return d->readInfo(cmsInfoCopyright);
@@ -269,7 +459,10 @@ Profile::Ptr Profile::getMonitorProfile()
 
 Profile::Ptr Profile::getSRgbProfile()
 {
-    return Profile::Ptr(new Profile(cmsCreate_sRGBProfile()));
+    // Share a single instance: the creation date is part of the profile, so
+    // profiles created at different times would not get the same id().
+    static const Profile::Ptr profile(new Profile(cmsCreate_sRGBProfile()));
+    return profile;
 }
 
 } // namespace Cms
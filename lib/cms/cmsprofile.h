@@ -64,7 +64,23 @@ public:
 
     cmsHPROFILE handle() const;
 
+    /**
+     * Returns the MD5 of the profile content. Two profiles with the same id
+     * produce the same color transforms. Empty if it could not be computed.
+     */
+    QByteArray id() const;
+
+    /**
+     * Reads the profile embedded in @p data, without decoding the image.
+     * Supports PNG, JPEG, TIFF, WebP, HEIF and AVIF.
+     */
     static Profile::Ptr loadFromImageData(const QByteArray &data, const QByteArray &format);
+
+    /**
+     * Returns true if loadFromImageData() knows where images of @p format
+     * store their profile, so that an image it finds no profile in has none
+     */
+    static bool canLoadFromImageData(const QByteArray &format);
     static Profile::Ptr loadFromExiv2Image(const Exiv2::Image *image);
     static Profile::Ptr loadFromICC(const QByteArray &data);
     static Profile::Ptr getMonitorProfile();
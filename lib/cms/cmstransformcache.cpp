@@ -0,0 +1,134 @@
+// SPDX-FileCopyrightText: 2026 Gwenview Developers
+// SPDX-License-Identifier: GPL-2.0-or-later
+
+// Self
+#include "cmstransformcache.h"
+
+// Qt
+#include <QHash>
+#include <QHashFunctions>
+#include <QMutex>
+
+// lcms
+#include <lcms2.h>
+
+// Local
+#include "gwenview_lib_debug.h"
+#include <lib/gwenviewconfig.h>
+
+namespace Gwenview
+{
+
+namespace Cms
+{
+
+// There are rarely more than a couple of profiles and formats in use at the
+// same time, start from scratch if we ever go past this.
+static const int MAX_CACHED_TRANSFORMS = 32;
+
+struct TransformKey {
+    QByteArray sourceId;
+    QByteArray monitorId;
+    cmsUInt32Number intent;
+    cmsUInt32Number format;
+};
+
+static bool operator==(const TransformKey &a, const TransformKey &b)
+{
+    return a.sourceId == b.sourceId && a.monitorId == b.monitorId && a.intent == b.intent && a.format == b.format;
+}
+
+static size_t qHash(const TransformKey &key, size_t seed = 0)
+{
+    return qHashMulti(seed, key.sourceId, key.monitorId, key.intent, key.format);
+}
+
+struct TransformCachePrivate {
+    QMutex mMutex;
+    Profile::Ptr mMonitorProfile;
+    QHash<TransformKey, TransformCache::Transform> mTransforms;
+};
+
+TransformCache::TransformCache()
+    : d(new TransformCachePrivate)
+{
+}
+
+TransformCache::~TransformCache()
+{
+    delete d;
+}
+
+TransformCache *TransformCache::instance()
+{
+    static TransformCache cache;
+    return &cache;
+}
+
+Profile::Ptr TransformCache::monitorProfile()
+{
+    QMutexLocker locker(&d->mMutex);
+    if (!d->mMonitorProfile) {
+        d->mMonitorProfile = Profile::getMonitorProfile();
+    }
+    return d->mMonitorProfile;
+}
+
+void TransformCache::resetMonitorProfile()
+{
+    QMutexLocker locker(&d->mMutex);
+    d->mMonitorProfile = nullptr;
+    d->mTransforms.clear();
+}
+
+TransformCache::Transform TransformCache::displayTransform(const Profile::Ptr &profile, cmsUInt32Number cmsFormat, cmsUInt32Number intent)
+{
+    const Profile::Ptr monitor = monitorProfile();
+    if (!profile || !monitor) {
+        return {};
+    }
+
+    // Profiles without an id cannot be told apart, do not cache their
+    // transforms
+    const bool cacheable = !profile->id().isEmpty() && !monitor->id().isEmpty();
+    const TransformKey key{profile->id(), monitor->id(), intent, cmsFormat};
+    if (cacheable) {
+        QMutexLocker locker(&d->mMutex);
+        auto it = d->mTransforms.constFind(key);
+        if (it != d->mTransforms.constEnd()) {
+            return it.value();
+        }
+    }
+
+    // Transforms are shared between threads: disable the lcms cache, which
+    // is not thread safe.
+    cmsUInt32Number flags = cmsFLAGS_BLACKPOINTCOMPENSATION | cmsFLAGS_NOCACHE;
+    if (DisplayTransform::canUseLut(cmsFormat)) {
+        // The lookup table of DisplayTransform is sampled from the exact
+        // transform, so that it does not interpolate interpolated values
+        flags |= cmsFLAGS_NOOPTIMIZE;
+    } else if (GwenviewConfig::precalculateColorTransform()) {
+        // Precalculate the whole transform as a device link with a finer
+        // grid, cmsDoTransform() then only has to interpolate.
+        flags |= cmsFLAGS_HIGHRESPRECALC;
+    }
+    cmsHTRANSFORM handle = cmsCreateTransform(profile->handle(), cmsFormat, monitor->handle(), cmsFormat, intent, flags);
+    if (!handle) {
+        qCWarning(GWENVIEW_LIB_LOG) << "Could not create color transform for format" << cmsFormat;
+        return {};
+    }
+    const Transform transform = std::make_shared<const DisplayTransform>(handle, cmsFormat);
+    if (!cacheable) {
+        return transform;
+    }
+
+    QMutexLocker locker(&d->mMutex);
+    if (d->mTransforms.size() >= MAX_CACHED_TRANSFORMS) {
+        d->mTransforms.clear();
+    }
+    d->mTransforms.insert(key, transform);
+    return transform;
+}
+
+} // namespace Cms
+} // namespace Gwenview
@@ -0,0 +1,71 @@
+// SPDX-FileCopyrightText: 2026 Gwenview Developers
+// SPDX-License-Identifier: GPL-2.0-or-later
+
+#ifndef CMSTRANSFORMCACHE_H
+#define CMSTRANSFORMCACHE_H
+
+#include <lib/gwenviewlib_export.h>
+
+// STL
+#include <memory>
+
+// Local
+#include <lib/cms/cmsdisplaytransform.h>
+#include <lib/cms/cmsprofile.h>
+
+namespace Gwenview
+{
+
+namespace Cms
+{
+
+struct TransformCachePrivate;
+/**
+ * Process-wide cache of the lcms transforms used to display images.
+ *
+ * Creating a transform is expensive, so transforms are kept for each
+ * combination of source profile, monitor profile, rendering intent and pixel
+ * format, and shared between all views. The returned transforms are created
+ * without the lcms cache so they can be used from several threads at once.
+ *
+ * The monitor profile is cached as well, call resetMonitorProfile() when it
+ * may have changed.
+ */
+class GWENVIEWLIB_EXPORT TransformCache
+{
+public:
+    /**
+     * A shared transform, deleted when the last user drops it.
+     */
+    using Transform = std::shared_ptr<const DisplayTransform>;
+
+    static TransformCache *instance();
+    ~TransformCache();
+
+    /**
+     * Returns a transform from @p profile to the monitor profile, for pixels
+     * in lcms format @p cmsFormat. Returns a null transform if lcms could not
+     * create it.
+     */
+    Transform displayTransform(const Profile::Ptr &profile, cmsUInt32Number cmsFormat, cmsUInt32Number intent);
+
+    /**
+     * Returns the profile of the monitor, as returned by
+     * Profile::getMonitorProfile() the first time this was called.
+     */
+    Profile::Ptr monitorProfile();
+
+    /**
+     * Forget the monitor profile and all transforms created with it.
+     */
+    void resetMonitorProfile();
+
+private:
+    TransformCache();
+    TransformCachePrivate *const d;
+};
+
+} // namespace Cms
+} // namespace Gwenview
+
+#endif /* CMSTRANSFORMCACHE_H */
@@ -28,11 +28,13 @@ Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.
 
 // Local
 #include "document.h"
+#include "mappedfile.h"
 
 namespace Gwenview
 {
 struct AbstractDocumentImplPrivate {
     Document *mDocument = nullptr;
+    MappedFile::Ptr mMappedFile;
 };
 
 AbstractDocumentImpl::AbstractDocumentImpl(Document *document)
@@ -51,6 +53,16 @@ Document *AbstractDocumentImpl::document() const
     return d->mDocument;
 }
 
+void AbstractDocumentImpl::setMappedFile(const MappedFile::Ptr &file)
+{
+    d->mMappedFile = file;
+}
+
+MappedFile::Ptr AbstractDocumentImpl::mappedFile() const
+{
+    return d->mMappedFile;
+}
+
 void AbstractDocumentImpl::switchToImpl(AbstractDocumentImpl *impl)
 {
     d->mDocument->switchToImpl(impl);
@@ -86,6 +98,16 @@ void AbstractDocumentImpl::setDocumentDownSampledImage(const QImage &image, int
     d->mDocument->setDownSampledImage(image, invertedZoom);
 }
 
+void AbstractDocumentImpl::setDocumentPartialImage(const QImage &image, int rowCount)
+{
+    d->mDocument->setPartialImage(image, rowCount);
+}
+
+void AbstractDocumentImpl::setDocumentRegionDecoder(const RegionDecoder::Ptr &decoder)
+{
+    d->mDocument->setRegionDecoder(decoder);
+}
+
 void AbstractDocumentImpl::setDocumentErrorString(const QString &string)
 {
     d->mDocument->setErrorString(string);
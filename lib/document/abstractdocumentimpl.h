@@ -25,6 +25,9 @@ Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.
 #include <QByteArray>
 #include <QObject>
 
+// STL
+#include <memory>
+
 // KF
 
 // Local
@@ -44,6 +47,7 @@ namespace Gwenview
 class Document;
 class DocumentJob;
 class AbstractDocumentEditor;
+class MappedFile;
 
 struct AbstractDocumentImplPrivate;
 class AbstractDocumentImpl : public QObject
@@ -94,8 +98,32 @@ public:
     {
     }
 
+    /**
+     * Returns how much bytes the impl uses on top of the document images and
+     * raw data, for example to cache decoded frames
+     */
+    virtual qint64 extraMemoryUsage() const
+    {
+        return 0;
+    }
+
+    /**
+     * Called when Document::decodePriority() changes, so that decoding work
+     * which has not started yet can be rescheduled
+     */
+    virtual void updateDecodePriority()
+    {
+    }
+
     Document *document() const;
 
+    /**
+     * Keeps @p file mapped as long as the impl is alive. Must be called if
+     * the impl holds on to data from file.
+     */
+    void setMappedFile(const std::shared_ptr<const MappedFile> &file);
+    std::shared_ptr<const MappedFile> mappedFile() const;
+
     virtual QSvgRenderer *svgRenderer() const
     {
         return nullptr;
@@ -115,6 +143,8 @@ protected:
     void setDocumentFormat(const QByteArray &format);
     void setDocumentExiv2Image(std::unique_ptr<Exiv2::Image>);
     void setDocumentDownSampledImage(const QImage &, int invertedZoom);
+    void setDocumentPartialImage(const QImage &, int rowCount);
+    void setDocumentRegionDecoder(const RegionDecoder::Ptr &decoder);
     void setDocumentCmsProfile(const Cms::Profile::Ptr &profile);
     void setDocumentErrorString(const QString &);
     void switchToImpl(AbstractDocumentImpl *impl);
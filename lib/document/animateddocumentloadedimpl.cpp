@@ -21,44 +21,285 @@ Foundation, Inc., 51 Franklin Street, Fifth Floor, Cambridge, MA 02110-1301, USA
 // Self
 #include "animateddocumentloadedimpl.h"
 
+// STL
+#include <atomic>
+#include <memory>
+
 // Qt
 #include <QBuffer>
+#include <QFuture>
 #include <QImage>
-#include <QMovie>
+#include <QImageReader>
+#include <QList>
+#include <QMutex>
+#include <QMutexLocker>
+#include <QQueue>
+#include <QTimer>
 
 // KF
 
 // Local
+#include "decodescheduler.h"
 #include "gwenview_lib_debug.h"
+#include "mappedfile.h"
 
 namespace Gwenview
 {
+#undef ENABLE_LOG
+#undef LOG
+// #define ENABLE_LOG
+#ifdef ENABLE_LOG
+#define LOG(x) qCDebug(GWENVIEW_LIB_LOG) << x
+#else
+#define LOG(x) ;
+#endif
+
+// How many frames are decoded ahead of the one being shown
+const int MAX_QUEUED_FRAMES = 8;
+
+// Animations whose frames fit in this many bytes are decoded once, their
+// frames are then reused for every loop. Larger ones are decoded again at
+// each loop.
+const qint64 MAX_FRAME_CACHE_SIZE = 128 * 1024 * 1024;
+
+// How long to wait before trying again if the next frame is not decoded yet,
+// in milliseconds
+const int FRAME_NOT_READY_INTERVAL = 10;
+
+struct AnimationFrame {
+    QImage mImage;
+    // How long to show the frame, in milliseconds
+    int mDelay = 0;
+};
+
+/**
+ * The frames of the animation, shared with the decoding tasks like
+ * LoadingContext in LoadingDocumentImpl. Tasks fill the queue of frames to
+ * show, the GUI thread takes frames from it.
+ */
+struct AnimationContext {
+    enum FrameStatus {
+        FrameReady,
+        FrameNotReady,
+        AnimationFinished,
+    };
+
+    QByteArray mData;
+    // Set if mData points to its mapping, so that it stays valid while the
+    // decoding task runs
+    MappedFile::Ptr mMappedFile;
+    QByteArray mFormat;
+    std::atomic<bool> mCancelled{false};
+
+    // Only used by the decoding task, there is never more than one of them
+    QBuffer mBuffer;
+    std::unique_ptr<QImageReader> mReader;
+
+    // Protects the members below
+    QMutex mMutex;
+    int mLoopCount = -1;
+    QQueue<AnimationFrame> mQueue;
+    // All the frames of the animation, as long as they fit in
+    // MAX_FRAME_CACHE_SIZE
+    QList<AnimationFrame> mCache;
+    qint64 mCacheSize = 0;
+    // Set once mCache contains all the frames. The frames are then taken from
+    // it, at mCacheIndex, rather than from mQueue.
+    bool mCacheComplete = false;
+    int mCacheIndex = 0;
+    // Set if the frames do not fit in MAX_FRAME_CACHE_SIZE
+    bool mCacheOverBudget = false;
+    // How many times the animation has been played entirely, by the decoding
+    // task or from the cache
+    int mPlayCount = 0;
+    int mFrameCountInPlay = 0;
+    bool mFinished = false;
+
+    void startReading()
+    {
+        mBuffer.close();
+        mBuffer.setBuffer(&mData);
+        mBuffer.open(QIODevice::ReadOnly);
+        mReader = std::make_unique<QImageReader>(&mBuffer, mFormat);
+        const int loopCount = mReader->loopCount();
+        QMutexLocker locker(&mMutex);
+        mLoopCount = loopCount;
+    }
+
+    bool needsFrames()
+    {
+        QMutexLocker locker(&mMutex);
+        return !mCacheComplete && !mFinished && mQueue.size() < MAX_QUEUED_FRAMES;
+    }
+
+    /**
+     * Decodes frames until the queue is full
+     */
+    void decodeFrames()
+    {
+        while (!mCancelled && needsFrames()) {
+            if (!mReader) {
+                if (mMappedFile && !mMappedFile->isUnchanged()) {
+                    qCWarning(GWENVIEW_LIB_LOG) << "Animation file changed, stopping";
+                    QMutexLocker locker(&mMutex);
+                    mFinished = true;
+                    return;
+                }
+                startReading();
+            }
+            AnimationFrame frame;
+            if (!mReader->read(&frame.mImage)) {
+                // QMovie also relies on read() failing at the end of the
+                // animation
+                endPlay();
+                continue;
+            }
+            frame.mDelay = mReader->nextImageDelay();
+            if (frame.mImage.colorCount() > 0) {
+                // Indexed frames, common in GIF files, would otherwise be
+                // converted for every tile RasterImageItem prepares
+                frame.mImage.convertTo(frame.mImage.hasAlphaChannel() ? QImage::Format_ARGB32 : QImage::Format_RGB32);
+            }
+
+            QMutexLocker locker(&mMutex);
+            mQueue.enqueue(frame);
+            ++mFrameCountInPlay;
+            if (mPlayCount == 0 && !mCacheOverBudget) {
+                mCacheSize += frame.mImage.sizeInBytes();
+                if (mCacheSize <= MAX_FRAME_CACHE_SIZE) {
+                    mCache << frame;
+                } else {
+                    LOG("Frames do not fit in the cache, decoding them at each loop");
+                    mCacheOverBudget = true;
+                    mCache.clear();
+                }
+            }
+        }
+    }
+
+    /**
+     * Called when all the frames of the animation have been decoded. The
+     * next call to decodeFrames() starts over if the animation loops.
+     */
+    void endPlay()
+    {
+        const QString errorString = mReader->errorString();
+        mReader.reset();
+        QMutexLocker locker(&mMutex);
+        if (mFrameCountInPlay == 0) {
+            qCWarning(GWENVIEW_LIB_LOG) << "Could not decode animation frames:" << errorString;
+            mFinished = true;
+            return;
+        }
+        ++mPlayCount;
+        mFrameCountInPlay = 0;
+        if (!mCacheOverBudget) {
+            LOG("Cached" << mCache.size() << "frames," << mCacheSize << "bytes");
+            mCacheComplete = true;
+        } else if (mLoopCount >= 0 && mPlayCount > mLoopCount) {
+            mFinished = true;
+        }
+    }
+
+    FrameStatus takeFrame(AnimationFrame *frame)
+    {
+        QMutexLocker locker(&mMutex);
+        if (!mQueue.isEmpty()) {
+            *frame = mQueue.dequeue();
+            return FrameReady;
+        }
+        if (mCacheComplete) {
+            if (mCacheIndex == mCache.size()) {
+                mCacheIndex = 0;
+                ++mPlayCount;
+            }
+            if (mCacheIndex == 0 && mLoopCount >= 0 && mPlayCount > mLoopCount) {
+                return AnimationFinished;
+            }
+            *frame = mCache.at(mCacheIndex++);
+            return FrameReady;
+        }
+        return mFinished ? AnimationFinished : FrameNotReady;
+    }
+
+    /**
+     * Plays the animation again once it is finished
+     */
+    void rewind()
+    {
+        QMutexLocker locker(&mMutex);
+        if (mCacheComplete) {
+            // The queue only holds the end of the first play
+            mQueue.clear();
+            mCacheIndex = 0;
+            mPlayCount = 0;
+        } else if (mFinished) {
+            mPlayCount = 0;
+            mFinished = false;
+        }
+    }
+
+    qint64 cacheSize()
+    {
+        QMutexLocker locker(&mMutex);
+        if (!mCacheOverBudget) {
+            // Queued frames are in the cache as well
+            return mCacheSize;
+        }
+        qint64 size = 0;
+        for (const AnimationFrame &frame : std::as_const(mQueue)) {
+            size += frame.mImage.sizeInBytes();
+        }
+        return size;
+    }
+};
+
 struct AnimatedDocumentLoadedImplPrivate {
-    QByteArray mRawData;
-    QBuffer mMovieBuffer;
-    QMovie mMovie;
+    AnimatedDocumentLoadedImpl *q;
+    std::shared_ptr<AnimationContext> mContext;
+    QTimer mFrameTimer;
+    QFuture<void> mDecodeFuture;
+    DecodeScheduler::TaskId mDecodeTaskId = 0;
+
+    void scheduleDecoding()
+    {
+        if (mDecodeFuture.isRunning() || !mContext->needsFrames()) {
+            return;
+        }
+        mDecodeFuture = DecodeScheduler::instance()->run(
+            q->document()->decodePriority(),
+            [context = mContext]() {
+                context->decodeFrames();
+            },
+            &mDecodeTaskId);
+    }
 };
 
 AnimatedDocumentLoadedImpl::AnimatedDocumentLoadedImpl(Document *document, const QByteArray &rawData)
     : AbstractDocumentImpl(document)
     , d(new AnimatedDocumentLoadedImplPrivate)
 {
-    d->mRawData = rawData;
-
-    connect(&d->mMovie, &QMovie::frameChanged, this, &AnimatedDocumentLoadedImpl::slotFrameChanged);
+    d->q = this;
+    d->mContext = std::make_shared<AnimationContext>();
+    d->mContext->mData = rawData;
+    d->mContext->mFormat = document->format();
 
-    d->mMovieBuffer.setBuffer(&d->mRawData);
-    d->mMovieBuffer.open(QIODevice::ReadOnly);
-    d->mMovie.setDevice(&d->mMovieBuffer);
+    d->mFrameTimer.setSingleShot(true);
+    connect(&d->mFrameTimer, &QTimer::timeout, this, &AnimatedDocumentLoadedImpl::showNextFrame);
 }
 
 AnimatedDocumentLoadedImpl::~AnimatedDocumentLoadedImpl()
 {
+    // Like LoadingDocumentImpl, do not wait for the decoding task
+    d->mContext->mCancelled = true;
+    DecodeScheduler::instance()->cancel(d->mDecodeTaskId);
     delete d;
 }
 
 void AnimatedDocumentLoadedImpl::init()
 {
+    // Set by LoadingDocumentImpl once constructed
+    d->mContext->mMappedFile = mappedFile();
     Q_EMIT isAnimatedUpdated();
     if (!document()->image().isNull()) {
         // We may reach this point without an image if the first frame got
@@ -67,6 +308,8 @@ void AnimatedDocumentLoadedImpl::init()
         Q_EMIT imageRectUpdated(document()->image().rect());
         Q_EMIT loaded();
     }
+    // Have the first frames ready when the animation starts
+    d->scheduleDecoding();
 }
 
 Document::LoadingState AnimatedDocumentLoadedImpl::loadingState() const
@@ -76,14 +319,36 @@ Document::LoadingState AnimatedDocumentLoadedImpl::loadingState() const
 
 QByteArray AnimatedDocumentLoadedImpl::rawData() const
 {
-    return d->mRawData;
+    return d->mContext->mData;
+}
+
+qint64 AnimatedDocumentLoadedImpl::extraMemoryUsage() const
+{
+    return d->mContext->cacheSize();
 }
 
-void AnimatedDocumentLoadedImpl::slotFrameChanged(int /*frameNumber*/)
+void AnimatedDocumentLoadedImpl::updateDecodePriority()
 {
-    QImage image = d->mMovie.currentImage();
-    setDocumentImage(image);
-    Q_EMIT imageRectUpdated(image.rect());
+    DecodeScheduler::instance()->setPriority(d->mDecodeTaskId, document()->decodePriority());
+}
+
+void AnimatedDocumentLoadedImpl::showNextFrame()
+{
+    AnimationFrame frame;
+    switch (d->mContext->takeFrame(&frame)) {
+    case AnimationContext::FrameReady:
+        setDocumentImage(frame.mImage);
+        Q_EMIT imageRectUpdated(frame.mImage.rect());
+        d->mFrameTimer.start(qMax(0, frame.mDelay));
+        break;
+    case AnimationContext::FrameNotReady:
+        LOG("Next frame is not ready");
+        d->mFrameTimer.start(FRAME_NOT_READY_INTERVAL);
+        break;
+    case AnimationContext::AnimationFinished:
+        break;
+    }
+    d->scheduleDecoding();
 }
 
 bool AnimatedDocumentLoadedImpl::isAnimated() const
@@ -93,18 +358,17 @@ bool AnimatedDocumentLoadedImpl::isAnimated() const
 
 void AnimatedDocumentLoadedImpl::startAnimation()
 {
-    d->mMovie.start();
-    if (d->mMovie.state() == QMovie::NotRunning) {
-        // This is true with qt-copy as of 2008.08.23
-        // qCDebug(GWENVIEW_LIB_LOG) << "QMovie didn't start. This can happen in some cases when starting for the second time.";
-        // qCDebug(GWENVIEW_LIB_LOG) << "Trying to start again, it usually fixes the bug.";
-        d->mMovie.start();
+    if (d->mFrameTimer.isActive()) {
+        return;
     }
+    d->mContext->rewind();
+    d->scheduleDecoding();
+    d->mFrameTimer.start(0);
 }
 
 void AnimatedDocumentLoadedImpl::stopAnimation()
 {
-    d->mMovie.stop();
+    d->mFrameTimer.stop();
 }
 
 } // namespace
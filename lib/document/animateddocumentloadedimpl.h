@@ -44,9 +44,11 @@ public:
     bool isAnimated() const override;
     void startAnimation() override;
     void stopAnimation() override;
+    qint64 extraMemoryUsage() const override;
+    void updateDecodePriority() override;
 
 private Q_SLOTS:
-    void slotFrameChanged(int frameNumber);
+    void showNextFrame();
 
 private:
     AnimatedDocumentLoadedImplPrivate *const d;
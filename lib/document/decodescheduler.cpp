@@ -0,0 +1,174 @@
+// SPDX-FileCopyrightText: 2026 Gwenview Developers
+// SPDX-License-Identifier: GPL-2.0-or-later
+
+// Self
+#include "decodescheduler.h"
+
+// STL
+#include <array>
+#include <utility>
+
+// Qt
+#include <QList>
+#include <QMutex>
+#include <QMutexLocker>
+#include <QThread>
+#include <QThreadPool>
+
+// Local
+#include "gwenview_lib_debug.h"
+
+namespace Gwenview
+{
+#undef ENABLE_LOG
+#undef LOG
+// #define ENABLE_LOG
+#ifdef ENABLE_LOG
+#define LOG(x) qCDebug(GWENVIEW_LIB_LOG) << x
+#else
+#define LOG(x) ;
+#endif
+
+struct DecodeTask {
+    DecodeScheduler::TaskId mId;
+    std::function<void()> mFunction;
+};
+
+struct DecodeSchedulerPrivate {
+    DecodeScheduler *q = nullptr;
+    QThreadPool mPool;
+
+    // Protects the members below, which are used by the pool threads when
+    // they are done with a task
+    QMutex mMutex;
+    DecodeScheduler::TaskId mNextId = 1;
+    std::array<QList<DecodeTask>, DecodeScheduler::PriorityCount> mQueues;
+    std::array<int, DecodeScheduler::PriorityCount> mRunningCounts{};
+    int mTotalRunningCount = 0;
+
+    /**
+     * Starts as many queued tasks as the caps allow, most urgent first.
+     * mMutex must be locked.
+     */
+    void dispatch()
+    {
+        const int maxThreadCount = mPool.maxThreadCount();
+        for (int priority = 0; priority < DecodeScheduler::PriorityCount; ++priority) {
+            QList<DecodeTask> &queue = mQueues[priority];
+            const int maxRunningCount = q->maxRunningCount(DecodeScheduler::Priority(priority));
+            // Keep a thread for the visible document
+            const int maxTotalCount = priority == DecodeScheduler::VisiblePriority ? maxThreadCount : maxThreadCount - 1;
+            while (!queue.isEmpty() && mRunningCounts[priority] < maxRunningCount && mTotalRunningCount < maxTotalCount) {
+                DecodeTask task = queue.takeFirst();
+                LOG("starting task" << task.mId << "priority" << priority);
+                ++mRunningCounts[priority];
+                ++mTotalRunningCount;
+                mPool.start([this, priority, function = std::move(task.mFunction)]() {
+                    function();
+                    QMutexLocker locker(&mMutex);
+                    --mRunningCounts[priority];
+                    --mTotalRunningCount;
+                    dispatch();
+                });
+            }
+        }
+    }
+
+    /**
+     * Returns the queue and index of task @p id, or a null queue if the task
+     * is not queued. mMutex must be locked.
+     */
+    QList<DecodeTask> *findTask(DecodeScheduler::TaskId id, qsizetype *index)
+    {
+        for (QList<DecodeTask> &queue : mQueues) {
+            for (qsizetype idx = 0; idx < queue.size(); ++idx) {
+                if (queue.at(idx).mId == id) {
+                    *index = idx;
+                    return &queue;
+                }
+            }
+        }
+        return nullptr;
+    }
+};
+
+DecodeScheduler::DecodeScheduler()
+    : d(new DecodeSchedulerPrivate)
+{
+    d->q = this;
+    // At least two threads, so that preloading never holds the visible
+    // document back
+    d->mPool.setMaxThreadCount(qMax(2, QThread::idealThreadCount()));
+}
+
+DecodeScheduler::~DecodeScheduler()
+{
+    std::array<QList<DecodeTask>, PriorityCount> queues;
+    {
+        QMutexLocker locker(&d->mMutex);
+        std::swap(queues, d->mQueues);
+    }
+    d->mPool.waitForDone();
+}
+
+DecodeScheduler *DecodeScheduler::instance()
+{
+    static DecodeScheduler scheduler;
+    return &scheduler;
+}
+
+int DecodeScheduler::maxRunningCount(Priority priority) const
+{
+    const int maxThreadCount = d->mPool.maxThreadCount();
+    switch (priority) {
+    case VisiblePriority:
+        return maxThreadCount;
+    case ComparePriority:
+        return maxThreadCount - 1;
+    case PreloadPriority:
+        return qMax(1, maxThreadCount / 2);
+    case BackgroundPriority:
+        return 1;
+    }
+    return 1;
+}
+
+DecodeScheduler::TaskId DecodeScheduler::enqueue(Priority priority, std::function<void()> function)
+{
+    QMutexLocker locker(&d->mMutex);
+    const TaskId id = d->mNextId++;
+    LOG("queuing task" << id << "priority" << priority);
+    d->mQueues[priority].append({id, std::move(function)});
+    d->dispatch();
+    return id;
+}
+
+void DecodeScheduler::setPriority(TaskId id, Priority priority)
+{
+    QMutexLocker locker(&d->mMutex);
+    qsizetype index;
+    QList<DecodeTask> *queue = d->findTask(id, &index);
+    if (!queue || queue == &d->mQueues[priority]) {
+        return;
+    }
+    LOG("moving task" << id << "to priority" << priority);
+    d->mQueues[priority].append(queue->takeAt(index));
+    d->dispatch();
+}
+
+void DecodeScheduler::cancel(TaskId id)
+{
+    QMutexLocker locker(&d->mMutex);
+    qsizetype index;
+    QList<DecodeTask> *queue = d->findTask(id, &index);
+    if (!queue) {
+        return;
+    }
+    LOG("canceling task" << id);
+    const DecodeTask task = queue->takeAt(index);
+    // Destroying the task cancels its future, which may run code
+    // reentering the scheduler
+    locker.unlock();
+}
+
+} // namespace
@@ -0,0 +1,111 @@
+// SPDX-FileCopyrightText: 2026 Gwenview Developers
+// SPDX-License-Identifier: GPL-2.0-or-later
+
+#ifndef DECODESCHEDULER_H
+#define DECODESCHEDULER_H
+
+#include <lib/gwenviewlib_export.h>
+
+// STL
+#include <functional>
+#include <memory>
+#include <type_traits>
+
+// Qt
+#include <QFuture>
+#include <QPromise>
+
+namespace Gwenview
+{
+struct DecodeSchedulerPrivate;
+
+/**
+ * Runs document decoding tasks on a dedicated thread pool, so that they do
+ * not compete with whatever else uses the global pool.
+ *
+ * Tasks are queued by priority: queued tasks of a lower priority are
+ * overtaken by any task of a higher priority, and each priority has a cap on
+ * how many of its tasks can run at the same time. One thread is always kept
+ * for the visible document. Running tasks are never interrupted, they are
+ * expected to give up by themselves when they are not needed anymore.
+ */
+class GWENVIEWLIB_EXPORT DecodeScheduler
+{
+public:
+    enum Priority {
+        /// The document the user is looking at
+        VisiblePriority,
+        /// The other documents shown in compare mode
+        ComparePriority,
+        /// Documents the user is likely to look at next
+        PreloadPriority,
+        /// Everything else
+        BackgroundPriority,
+    };
+    static const int PriorityCount = BackgroundPriority + 1;
+
+    /**
+     * Identifies a queued task, to change its priority or cancel it. 0 is
+     * never used.
+     */
+    using TaskId = quint64;
+
+    static DecodeScheduler *instance();
+    ~DecodeScheduler();
+
+    /**
+     * Queues @p function with @p priority and returns a future for its
+     * result. If @p id is not null, it is set to the id of the task.
+     *
+     * The future is canceled if the task is canceled before it starts.
+     */
+    template<typename Function>
+    auto run(Priority priority, Function function, TaskId *id = nullptr) -> QFuture<std::invoke_result_t<Function>>
+    {
+        using Result = std::invoke_result_t<Function>;
+        auto promise = std::make_shared<QPromise<Result>>();
+        QFuture<Result> future = promise->future();
+        // Like QtConcurrent::run(), report the task as running while it is
+        // queued
+        promise->start();
+        const TaskId taskId = enqueue(priority, [promise, function = std::move(function)]() mutable {
+            if constexpr (std::is_void_v<Result>) {
+                function();
+            } else {
+                promise->addResult(function());
+            }
+            promise->finish();
+        });
+        if (id) {
+            *id = taskId;
+        }
+        return future;
+    }
+
+    /**
+     * Moves task @p id to @p priority. Does nothing if the task already
+     * started.
+     */
+    void setPriority(TaskId id, Priority priority);
+
+    /**
+     * Removes task @p id from the queue. Does nothing if the task already
+     * started.
+     */
+    void cancel(TaskId id);
+
+    /**
+     * How many tasks of @p priority can run at the same time
+     */
+    int maxRunningCount(Priority priority) const;
+
+private:
+    DecodeScheduler();
+    TaskId enqueue(Priority priority, std::function<void()> function);
+
+    std::unique_ptr<DecodeSchedulerPrivate> d;
+};
+
+} // namespace
+
+#endif /* DECODESCHEDULER_H */
@@ -20,6 +20,9 @@ Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
 #include "document.h"
 #include "document_p.h"
 
+// STL
+#include <algorithm>
+
 // Qt
 #include <QApplication>
 #include <QImage>
@@ -40,6 +43,7 @@ Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
 #include "imagemetainfomodel.h"
 #include "loadingdocumentimpl.h"
 #include "loadingjob.h"
+#include "mappedfile.h"
 #include "savejob.h"
 
 namespace Gwenview
@@ -123,6 +127,17 @@ void DocumentPrivate::scheduleImageDownSampling(int invertedZoom)
     q->enqueueJob(new DownSamplingJob(invertedZoom));
 }
 
+void DocumentPrivate::applyDecodePriority(DecodeScheduler::Priority priority)
+{
+    if (mDecodePriority == priority) {
+        return;
+    }
+    mDecodePriority = priority;
+    if (mImpl) {
+        mImpl->updateDecodePriority();
+    }
+}
+
 void DocumentPrivate::downSampleImage(int invertedZoom)
 {
     mDownSampledImageMap[invertedZoom] = mImage.scaled(mImage.size() / invertedZoom, Qt::KeepAspectRatio, Qt::FastTransformation);
@@ -155,6 +170,7 @@ Document::Document(const QUrl &url)
     d->mImpl = nullptr;
     d->mUrl = url;
     d->mKeepRawData = false;
+    d->mDecodePriority = DecodeScheduler::VisiblePriority;
 }
 
 Document::~Document()
@@ -172,6 +188,9 @@ void Document::reload()
     d->mSize = QSize();
     d->mImage = QImage();
     d->mDownSampledImageMap.clear();
+    d->mPartialImage = QImage();
+    d->mPartialImageRowCount = 0;
+    d->mRegionDecoder.reset();
     d->mExiv2Image.reset();
     d->mKind = MimeTypeUtils::KIND_UNKNOWN;
     d->mFormat = QByteArray();
@@ -228,6 +247,21 @@ const QImage &Document::downSampledImageForZoom(qreal zoom) const
     return d->mDownSampledImageMap[invertedZoom];
 }
 
+const QImage &Document::partialImage() const
+{
+    return d->mPartialImage;
+}
+
+int Document::partialImageRowCount() const
+{
+    return d->mPartialImageRowCount;
+}
+
+RegionDecoder::Ptr Document::regionDecoder() const
+{
+    return d->mRegionDecoder;
+}
+
 Document::LoadingState Document::loadingState() const
 {
     return d->mImpl->loadingState();
@@ -254,6 +288,10 @@ void Document::setImageInternal(const QImage &image)
 {
     d->mImage = image;
     d->mDownSampledImageMap.clear();
+    d->mPartialImage = QImage();
+    d->mPartialImageRowCount = 0;
+    // Views can now use the image itself
+    d->mRegionDecoder.reset();
 
     // If we didn't get the image size before decoding the full image, set it
     // now
@@ -267,7 +305,17 @@ QUrl Document::url() const
 
 QByteArray Document::rawData() const
 {
-    return d->mImpl->rawData();
+    QByteArray data = d->mImpl->rawData();
+    const MappedFile::Ptr mappedFile = d->mImpl->mappedFile();
+    if (mappedFile && mappedFile->contains(data)) {
+        if (!mappedFile->isUnchanged()) {
+            qCWarning(GWENVIEW_LIB_LOG) << d->mUrl << "changed since it was loaded, not copying its data";
+            return {};
+        }
+        // The caller may keep the data after the impl and its mapping are gone
+        data.detach();
+    }
+    return data;
 }
 
 bool Document::keepRawData() const
@@ -280,6 +328,36 @@ void Document::setKeepRawData(bool value)
     d->mKeepRawData = value;
 }
 
+DecodeScheduler::Priority Document::decodePriority() const
+{
+    return d->mDecodePriority;
+}
+
+void Document::setDecodePriority(const QObject *holder, DecodeScheduler::Priority priority)
+{
+    if (!d->mDecodePriorities.contains(holder)) {
+        connect(holder, &QObject::destroyed, this, [this, holder]() {
+            releaseDecodePriority(holder);
+        });
+    }
+    d->mDecodePriorities.insert(holder, priority);
+    d->applyDecodePriority(*std::min_element(d->mDecodePriorities.cbegin(), d->mDecodePriorities.cend()));
+}
+
+void Document::releaseDecodePriority(const QObject *holder)
+{
+    if (!d->mDecodePriorities.remove(holder)) {
+        return;
+    }
+    disconnect(holder, &QObject::destroyed, this, nullptr);
+    if (d->mDecodePriorities.isEmpty()) {
+        // Nobody needs it anytime soon
+        d->applyDecodePriority(DecodeScheduler::BackgroundPriority);
+    } else {
+        d->applyDecodePriority(*std::min_element(d->mDecodePriorities.cbegin(), d->mDecodePriorities.cend()));
+    }
+}
+
 void Document::waitUntilLoaded()
 {
     startLoadingFullImage();
@@ -359,11 +437,25 @@ bool Document::hasAlphaChannel() const
     }
 }
 
-int Document::memoryUsage() const
+qint64 Document::memoryUsage() const
 {
-    // FIXME: Take undo stack into account
-    int usage = d->mImage.sizeInBytes();
-    usage += rawData().length();
+    qint64 usage = d->mImage.sizeInBytes() + d->mPartialImage.sizeInBytes();
+    for (const QImage &image : std::as_const(d->mDownSampledImageMap)) {
+        // Small images are not down sampled, the map then shares mImage
+        if (image.cacheKey() != d->mImage.cacheKey()) {
+            usage += image.sizeInBytes();
+        }
+    }
+    // Mapped data lives in the page cache, not in our memory
+    const QByteArray data = d->mImpl->rawData();
+    const MappedFile::Ptr mappedFile = d->mImpl->mappedFile();
+    if (!mappedFile || !mappedFile->contains(data)) {
+        usage += data.length();
+    }
+    // Image operations keep a copy of the image to be able to undo their
+    // changes, assume each command on the stack holds one
+    usage += qint64(d->mUndoStack.count()) * d->mImage.sizeInBytes();
+    usage += d->mImpl->extraMemoryUsage();
     return usage;
 }
 
@@ -401,6 +493,18 @@ void Document::setDownSampledImage(const QImage &image, int invertedZoom)
     Q_EMIT downSampledImageReady();
 }
 
+void Document::setPartialImage(const QImage &image, int rowCount)
+{
+    d->mPartialImage = image;
+    d->mPartialImageRowCount = rowCount;
+    Q_EMIT partialImageUpdated();
+}
+
+void Document::setRegionDecoder(const RegionDecoder::Ptr &decoder)
+{
+    d->mRegionDecoder = decoder;
+}
+
 QString Document::errorString() const
 {
     return d->mErrorString;
@@ -32,6 +32,8 @@ Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
 
 // Local
 #include <lib/cms/cmsprofile.h>
+#include <lib/document/decodescheduler.h>
+#include <lib/document/regiondecoder.h>
 #include <lib/mimetypeutils.h>
 
 class QImage;
@@ -122,6 +124,22 @@ public:
 
     const QImage &downSampledImageForZoom(qreal zoom) const;
 
+    /**
+     * While a large image is being decoded, returns the image being filled.
+     * Only its first partialImageRowCount() rows are decoded, the other ones
+     * must not be read. Returns a null image once image() is available.
+     */
+    const QImage &partialImage() const;
+
+    int partialImageRowCount() const;
+
+    /**
+     * For images too large to be decoded at once, returns a decoder for the
+     * parts of the image which are shown. Returns nullptr if the image can be
+     * decoded at once, or once image() is available.
+     */
+    RegionDecoder::Ptr regionDecoder() const;
+
     /**
      * Returns an implementation of AbstractDocumentEditor if this document can
      * be edited.
@@ -159,9 +177,30 @@ public:
     bool keepRawData() const;
 
     /**
-     * Returns how much bytes the document is using
+     * Defines how urgently @p holder needs the document to be decoded,
+     * compared to other documents. The document is decoded with the most
+     * urgent priority of its holders.
+     *
+     * Documents which never had a holder are decoded with
+     * DecodeScheduler::VisiblePriority, documents whose holders all released
+     * them with DecodeScheduler::BackgroundPriority.
      */
-    int memoryUsage() const;
+    void setDecodePriority(const QObject *holder, DecodeScheduler::Priority);
+
+    /**
+     * Forgets the priority defined by @p holder. This is done automatically
+     * when @p holder is destroyed.
+     */
+    void releaseDecodePriority(const QObject *holder);
+
+    DecodeScheduler::Priority decodePriority() const;
+
+    /**
+     * Returns how much bytes the document is using: full and down sampled
+     * images, raw data, an estimate of the undo stack and caches such as the
+     * decoded frames of animations
+     */
+    qint64 memoryUsage() const;
 
     /**
      * Returns the compressed version of the document, if it is still
@@ -210,6 +249,10 @@ public:
 Q_SIGNALS:
     void downSampledImageReady();
     void imageRectUpdated(const QRect &);
+    /**
+     * Emitted when more rows of partialImage() have been decoded
+     */
+    void partialImageUpdated();
     void kindDetermined(const QUrl &);
     void metaInfoLoaded(const QUrl &);
     void loaded(const QUrl &);
@@ -240,6 +283,8 @@ private:
     void setSize(const QSize &);
     void setExiv2Image(std::unique_ptr<Exiv2::Image>);
     void setDownSampledImage(const QImage &, int invertedZoom);
+    void setPartialImage(const QImage &, int rowCount);
+    void setRegionDecoder(const RegionDecoder::Ptr &);
     void switchToImpl(AbstractDocumentImpl *impl);
     void setErrorString(const QString &);
     void setCmsProfile(const Cms::Profile::Ptr &);
@@ -31,6 +31,7 @@ Foundation, Inc., 51 Franklin Street, Fifth Floor, Cambridge, MA 02110-1301, USA
 // KF
 
 // Qt
+#include <QHash>
 #include <QImage>
 #include <QPointer>
 #include <QQueue>
@@ -50,6 +51,9 @@ struct DocumentPrivate {
     AbstractDocumentImpl *mImpl;
     QUrl mUrl;
     bool mKeepRawData;
+    DecodeScheduler::Priority mDecodePriority;
+    // The priorities wanted by the objects holding the document
+    QHash<const QObject *, DecodeScheduler::Priority> mDecodePriorities;
     QPointer<DocumentJob> mCurrentJob;
     DocumentJobQueue mJobQueue;
 
@@ -60,6 +64,9 @@ struct DocumentPrivate {
     QSize mSize;
     QImage mImage;
     QMap<int, QImage> mDownSampledImageMap;
+    QImage mPartialImage;
+    int mPartialImageRowCount = 0;
+    RegionDecoder::Ptr mRegionDecoder;
     std::unique_ptr<Exiv2::Image> mExiv2Image;
     MimeTypeUtils::Kind mKind;
     QByteArray mFormat;
@@ -72,6 +79,7 @@ struct DocumentPrivate {
     void scheduleImageLoading(int invertedZoom);
     void scheduleImageDownSampling(int invertedZoom);
     void downSampleImage(int invertedZoom);
+    void applyDecodePriority(DecodeScheduler::Priority priority);
 };
 
 class DownSamplingJob : public DocumentJob
@@ -23,6 +23,7 @@ Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
 #include <QByteArray>
 #include <QDateTime>
 #include <QMap>
+#include <QTimer>
 #include <QUndoGroup>
 #include <QUrl>
 
@@ -30,6 +31,8 @@ Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
 
 // Local
 #include "gwenview_lib_debug.h"
+#include "gwenviewconfig.h"
+#include <lib/memoryutils.h>
 #include <gvdebug.h>
 
 namespace Gwenview
@@ -45,7 +48,9 @@ namespace Gwenview
 
 inline int getMaxUnreferencedImages()
 {
-    int defaultValue = 3;
+    // By default the number of unreferenced images is only limited by the
+    // memory budget
+    int defaultValue = -1;
     QByteArray ba = qgetenv("GV_MAX_UNREFERENCED_IMAGES");
     if (ba.isEmpty()) {
         return defaultValue;
@@ -76,13 +81,37 @@ struct DocumentInfo {
 using DocumentMap = QMap<QUrl, DocumentInfo *>;
 
 struct DocumentFactoryPrivate {
+    DocumentFactory *q = nullptr;
     DocumentMap mDocumentMap;
     QUndoGroup mUndoGroup;
+    bool mGarbageCollectScheduled = false;
+
+    qint64 memoryUsage() const
+    {
+        qint64 usage = 0;
+        for (const DocumentInfo *info : mDocumentMap) {
+            usage += info->mDocument->memoryUsage();
+        }
+        return usage;
+    }
+
+    qint64 memoryBudget() const
+    {
+        qint64 budget = qint64(MemoryUtils::getTotalMemory()) / 100 * GwenviewConfig::percentageOfMemoryForDocumentCache();
+        // Give memory back to the system when it is running low
+        if (MemoryUtils::getFreeMemory() < MemoryUtils::getTotalMemory() / 10) {
+            LOG("Low memory, shrinking budget");
+            budget /= 4;
+        }
+        return budget;
+    }
 
     /**
-     * Removes items in a map if they are no longer referenced elsewhere
+     * Removes the least recently accessed documents which are no longer
+     * referenced elsewhere, until there are at most MAX_UNREFERENCED_IMAGES
+     * of them and the cache uses at most maxMemoryUsage bytes.
      */
-    void garbageCollect(DocumentMap &map)
+    void garbageCollect(DocumentMap &map, qint64 maxMemoryUsage)
     {
         // Build a map of all unreferenced images. We use a MultiMap because in
         // rare cases documents may get accessed at the same millisecond.
@@ -90,31 +119,67 @@ struct DocumentFactoryPrivate {
         using UnreferencedImages = QMultiMap<QDateTime, QUrl>;
         UnreferencedImages unreferencedImages;
 
+        qint64 usage = 0;
         DocumentMap::Iterator it = map.begin(), end = map.end();
         for (; it != end; ++it) {
             DocumentInfo *info = it.value();
+            usage += info->mDocument->memoryUsage();
             if (info->mDocument->ref == 1 && !info->mDocument->isModified()) {
                 unreferencedImages.insert(info->mLastAccess, it.key());
             }
         }
 
+        auto mustCollect = [&]() {
+            if (unreferencedImages.isEmpty()) {
+                return false;
+            }
+            if (MAX_UNREFERENCED_IMAGES >= 0 && unreferencedImages.count() > MAX_UNREFERENCED_IMAGES) {
+                return true;
+            }
+            return usage > maxMemoryUsage;
+        };
+
         // Remove oldest unreferenced images. Since the map is sorted by key,
         // the oldest one is always unreferencedImages.begin().
-        for (UnreferencedImages::Iterator unreferencedIt = unreferencedImages.begin(); unreferencedImages.count() > MAX_UNREFERENCED_IMAGES;
+        for (UnreferencedImages::Iterator unreferencedIt = unreferencedImages.begin(); mustCollect();
              unreferencedIt = unreferencedImages.erase(unreferencedIt)) {
             const QUrl url = unreferencedIt.value();
-            LOG("Collecting" << url);
             it = map.find(url);
             Q_ASSERT(it != map.end());
+            const qint64 documentUsage = it.value()->mDocument->memoryUsage();
+            LOG("Collecting" << url << "usage=" << documentUsage);
+            usage -= documentUsage;
             delete it.value();
             map.erase(it);
         }
 
 #ifdef ENABLE_LOG
+        LOG("usage=" << usage << "budget=" << maxMemoryUsage);
         logDocumentMap(map);
 #endif
     }
 
+    void garbageCollect(DocumentMap &map)
+    {
+        garbageCollect(map, memoryBudget());
+    }
+
+    /**
+     * Documents grow while they load: collect once the current event has
+     * been processed, since the sender of the signal may be collected.
+     */
+    void scheduleGarbageCollect()
+    {
+        if (mGarbageCollectScheduled) {
+            return;
+        }
+        mGarbageCollectScheduled = true;
+        QTimer::singleShot(0, q, [this]() {
+            mGarbageCollectScheduled = false;
+            garbageCollect(mDocumentMap);
+        });
+    }
+
     void logDocumentMap(const DocumentMap &map)
     {
         LOG("map:");
@@ -130,6 +195,7 @@ struct DocumentFactoryPrivate {
 DocumentFactory::DocumentFactory()
     : d(new DocumentFactoryPrivate)
 {
+    d->q = this;
 }
 
 DocumentFactory::~DocumentFactory()
@@ -187,6 +253,9 @@ Document::Ptr DocumentFactory::load(const QUrl &url)
     connect(doc, &Document::downSampledImageReady, [this, url]() {
         Q_EMIT readyForDirListerStart(url);
     });
+    connect(doc, &Document::downSampledImageReady, this, [this]() {
+        d->scheduleGarbageCollect();
+    });
 
     doc->reload();
 
@@ -214,6 +283,21 @@ bool DocumentFactory::hasUrl(const QUrl &url) const
     return d->mDocumentMap.contains(url);
 }
 
+qint64 DocumentFactory::memoryUsage() const
+{
+    return d->memoryUsage();
+}
+
+qint64 DocumentFactory::memoryBudget() const
+{
+    return d->memoryBudget();
+}
+
+void DocumentFactory::shrinkCache(qint64 maxMemoryUsage)
+{
+    d->garbageCollect(d->mDocumentMap, maxMemoryUsage);
+}
+
 void DocumentFactory::clearCache()
 {
     qDeleteAll(d->mDocumentMap);
@@ -223,6 +307,7 @@ void DocumentFactory::clearCache()
 
 void DocumentFactory::slotLoaded(const QUrl &url)
 {
+    d->scheduleGarbageCollect();
     if (d->mModifiedDocumentList.contains(url)) {
         d->mModifiedDocumentList.removeAll(url);
         Q_EMIT modifiedDocumentListChanged();
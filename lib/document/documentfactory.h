@@ -38,7 +38,9 @@ struct DocumentFactoryPrivate;
  *
  * It keeps a cache of recently accessed documents to avoid reloading them.
  * To do so it keeps a last-access timestamp, which is updated to the
- * current time every time DocumentFactory::load() is called.
+ * current time every time DocumentFactory::load() is called. When the
+ * documents use more memory than memoryBudget(), the least recently accessed
+ * documents which are not referenced elsewhere are removed from the cache.
  */
 class GWENVIEWLIB_EXPORT DocumentFactory : public QObject
 {
@@ -64,6 +66,24 @@ public:
 
     bool hasUrl(const QUrl &) const;
 
+    /**
+     * Returns how much bytes the cached documents are using
+     */
+    qint64 memoryUsage() const;
+
+    /**
+     * Returns how much bytes the cached documents may use. This is a
+     * percentage of the total memory, lowered when the system is short of free
+     * memory.
+     */
+    qint64 memoryBudget() const;
+
+    /**
+     * Removes unreferenced documents from the cache, least recently accessed
+     * first, until the cached documents use at most @p maxMemoryUsage bytes.
+     */
+    void shrinkCache(qint64 maxMemoryUsage);
+
     void clearCache();
 
     QUndoGroup *undoGroup();
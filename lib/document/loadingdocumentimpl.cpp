@@ -22,7 +22,9 @@ Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.
 #include "loadingdocumentimpl.h"
 
 // STL
+#include <atomic>
 #include <memory>
+#include <utility>
 
 // Exiv2
 #include <exiv2/exiv2.hpp>
@@ -30,16 +32,17 @@ Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.
 // Qt
 #include <QBuffer>
 #include <QByteArray>
-#include <QColorSpace>
 #include <QFile>
 #include <QFuture>
 #include <QFutureWatcher>
 #include <QImage>
 #include <QImageReader>
 #include <QMimeDatabase>
+#include <QMutex>
+#include <QMutexLocker>
 #include <QPointer>
+#include <QTimer>
 #include <QUrl>
-#include <QtConcurrentRun>
 
 // KF
 #include <KIO/TransferJob>
@@ -53,15 +56,22 @@ Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.
 // Local
 #include "animateddocumentloadedimpl.h"
 #include "cms/cmsprofile.h"
+#include "decodescheduler.h"
 #include "document.h"
+#include "documentfactory.h"
 #include "documentloadedimpl.h"
 #include "emptydocumentimpl.h"
 #include "exiv2imageloader.h"
 #include "gvdebug.h"
 #include "gwenview_lib_debug.h"
 #include "gwenviewconfig.h"
+#include "imageutils.h"
 #include "jpegcontent.h"
 #include "jpegdocumentloadedimpl.h"
+#include "mappedfile.h"
+#include "progressivedecoder.h"
+#include "regiondecoder.h"
+#include "streambuffer.h"
 #include "svgdocumentloadedimpl.h"
 #include "urlutils.h"
 #include "videodocumentloadedimpl.h"
@@ -79,123 +89,158 @@ namespace Gwenview
 
 const int HEADER_SIZE = 256;
 
-struct LoadingDocumentImplPrivate {
-    LoadingDocumentImpl *q;
-    QPointer<KIO::TransferJob> mTransferJob;
-    QFuture<bool> mMetaInfoFuture;
-    QFutureWatcher<bool> mMetaInfoFutureWatcher;
-    QFuture<void> mImageDataFuture;
-    QFutureWatcher<void> mImageDataFutureWatcher;
-
-    // If != 0, this means we need to load an image at zoom =
-    // 1/mImageDataInvertedZoom
-    int mImageDataInvertedZoom;
-
-    bool mMetaInfoLoaded;
-    bool mAnimated;
-    bool mDownSampledImageLoaded;
-    QByteArray mFormatHint;
-    QByteArray mData;
-    QByteArray mFormat;
-    QSize mImageSize;
-    std::unique_ptr<Exiv2::Image> mExiv2Image;
-    std::unique_ptr<JpegContent> mJpegContent;
-    QImage mImage;
-    Cms::Profile::Ptr mCmsProfile;
-    QMimeType mMimeType;
-
-    /**
-     * Determine kind of document and switch to an implementation if it is not
-     * necessary to download more data.
-     * @return true if switched to another implementation.
-     */
-    bool determineKind()
-    {
-        const QUrl &url = q->document()->url();
-        QMimeDatabase db;
-        if (KProtocolInfo::determineMimetypeFromExtension(url.scheme())) {
-            mMimeType = db.mimeTypeForFileNameAndData(url.fileName(), mData);
-        } else {
-            mMimeType = db.mimeTypeForData(mData);
-        }
+// Smaller files are read in memory: it is cheap, and it does not keep a file
+// descriptor open for as long as the document is cached
+const qint64 MIN_MAPPED_FILE_SIZE = 1024 * 1024;
 
-        MimeTypeUtils::Kind kind = MimeTypeUtils::mimeTypeKind(mMimeType.name());
-        LOG("mimeType:" << mMimeType.name());
-        LOG("kind:" << kind);
-        q->setDocumentKind(kind);
+// Images with fewer pixels decode fast enough to be shown in one go
+const qint64 MIN_PROGRESSIVE_PIXEL_COUNT = 16 * 1024 * 1024;
 
-        switch (kind) {
-        case MimeTypeUtils::KIND_RASTER_IMAGE:
-        case MimeTypeUtils::KIND_SVG_IMAGE:
-            return false;
+// Images with more pixels are not decoded at once if their decoder can decode
+// the visible parts only, see RegionDecoder
+const qint64 MIN_REGION_PIXEL_COUNT = 64 * 1024 * 1024;
 
-        case MimeTypeUtils::KIND_VIDEO:
-            q->switchToImpl(new VideoDocumentLoadedImpl(q->document()));
-            return true;
+// How often rows decoded by ProgressiveDecoder are shown, in milliseconds
+const int PARTIAL_IMAGE_INTERVAL = 100;
 
-        default:
-            q->setDocumentErrorString(
-                i18nc("@info",
-                      "Gwenview cannot display documents of type %1. Install the kimageformats package to gain support for a wider range of media types.",
-                      mMimeType.name()));
-            Q_EMIT q->loadingFailed();
-            q->switchToImpl(new EmptyDocumentImpl(q->document()));
-            return true;
-        }
+/**
+ * A read-only buffer whose reads fail once loading has been cancelled, so
+ * that decoders give up early rather than going through the whole image.
+ */
+class CancellableBuffer : public QBuffer
+{
+public:
+    CancellableBuffer(QByteArray *data, const std::atomic<bool> *cancelled)
+        : mCancelled(cancelled)
+    {
+        setBuffer(data);
+        open(QIODevice::ReadOnly);
     }
 
-    void startLoading()
+protected:
+    qint64 readData(char *data, qint64 maxSize) override
     {
-        Q_ASSERT(!mMetaInfoLoaded);
-
-        switch (q->document()->kind()) {
-        case MimeTypeUtils::KIND_RASTER_IMAGE:
-            // The hint is used to:
-            // - Speed up loadMetaInfo(): QImageReader will try to decode the
-            //   image using plugins matching this format first.
-            // - Avoid breakage: Because of a bug in Qt TGA image plugin, some
-            //   PNG were incorrectly identified as PCX! See:
-            //   https://bugs.kde.org/show_bug.cgi?id=289819
-            //
-            mFormatHint = mMimeType.preferredSuffix().toLocal8Bit().toLower();
-            mMetaInfoFuture = QtConcurrent::run(&LoadingDocumentImplPrivate::loadMetaInfo, this);
-            mMetaInfoFutureWatcher.setFuture(mMetaInfoFuture);
-            break;
-
-        case MimeTypeUtils::KIND_SVG_IMAGE:
-            q->switchToImpl(new SvgDocumentLoadedImpl(q->document(), mData));
-            break;
+        if (*mCancelled) {
+            return -1;
+        }
+        return QBuffer::readData(data, maxSize);
+    }
 
-        case MimeTypeUtils::KIND_VIDEO:
-            break;
+private:
+    const std::atomic<bool> *const mCancelled;
+};
 
-        default:
-            qCWarning(GWENVIEW_LIB_LOG) << "We should not reach this point!";
-            break;
+/**
+ * Returns how many bytes of the JPEG or PNG @p data come before the pixel
+ * data, or -1 if @p data does not reach the pixel data yet. Returns the size
+ * of @p data if it is not JPEG or PNG data.
+ */
+static qsizetype metaInfoSize(const QByteArray &data)
+{
+    const auto *bytes = reinterpret_cast<const uchar *>(data.constData());
+    const qsizetype size = data.size();
+    if (data.startsWith("\xff\xd8")) {
+        // Markers and their segments, up to and including the start of scan
+        qsizetype pos = 2;
+        while (pos + 4 <= size) {
+            if (bytes[pos] != 0xff) {
+                return size;
+            }
+            const uchar marker = bytes[pos + 1];
+            if (marker == 0xff) {
+                // Fill byte
+                ++pos;
+                continue;
+            }
+            if (marker == 0x01 || (marker >= 0xd0 && marker <= 0xd8)) {
+                // No segment
+                pos += 2;
+                continue;
+            }
+            pos += 2 + ((bytes[pos + 2] << 8) | bytes[pos + 3]);
+            if (marker == 0xda) {
+                return pos <= size ? pos : -1;
+            }
         }
+        return -1;
     }
-
-    void startImageDataLoading()
-    {
-        LOG("");
-        Q_ASSERT(mMetaInfoLoaded);
-        Q_ASSERT(mImageDataInvertedZoom != 0);
-        Q_ASSERT(!mImageDataFuture.isRunning());
-        mImageDataFuture = QtConcurrent::run(&LoadingDocumentImplPrivate::loadImageData, this);
-        mImageDataFutureWatcher.setFuture(mImageDataFuture);
+    if (data.startsWith("\x89PNG\r\n\x1a\n")) {
+        // Chunks, up to the first image data chunk
+        qsizetype pos = 8;
+        while (pos + 8 <= size) {
+            if (data.mid(pos + 4, 4) == "IDAT") {
+                return pos;
+            }
+            pos += 12 + ((qsizetype(bytes[pos]) << 24) | (bytes[pos + 1] << 16) | (bytes[pos + 2] << 8) | bytes[pos + 3]);
+        }
+        return -1;
     }
+    return size;
+}
+
+/**
+ * The loading state used by the decoding threads. They share it with the
+ * LoadingDocumentImpl, which can then be destroyed without waiting for them:
+ * they notice the cancellation, and their results are dropped.
+ */
+struct LoadingContext {
+    QUrl mUrl;
+    // Keeps mData valid if it points to a file mapping
+    MappedFile::Ptr mMappedFile;
+    std::atomic<bool> mCancelled{false};
+
+    // Zoom of the image decoded by loadImageData(): 1/mInvertedZoom
+    int mInvertedZoom = 0;
+
+    bool mAnimated = false;
+    // True if views should use a RegionDecoder rather than the whole image
+    bool mRegionDecodable = false;
+    QByteArray mFormatHint;
+    QByteArray mData;
+    QByteArray mFormat;
+    QSize mImageSize;
+    std::unique_ptr<Exiv2::Image> mExiv2Image;
+    std::unique_ptr<JpegContent> mJpegContent;
+    QImage mImage;
+    // Set if the image had to be decoded to get its profile, which happens
+    // for the formats Cms::Profile::loadFromImageData() does not know, like
+    // JPEG XL, PSD or OpenEXR, and for raw formats Exiv2 finds no profile
+    // in. loadImageData() reuses it. It counts in the memory usage of the
+    // document, and is dropped if it does not fit in the DocumentFactory
+    // budget while no image is wanted.
+    QImage mMetaInfoImage;
+    // The size of mMetaInfoImage, which can be read from any thread
+    std::atomic<qint64> mMetaInfoImageBytes{0};
+    Cms::Profile::Ptr mCmsProfile;
+
+    // Set while the data is still being transferred, mData is empty until
+    // finishStream() is called
+    StreamBuffer::Ptr mStream;
+
+    // The image being decoded by ProgressiveDecoder, and how many of its rows
+    // are ready
+    QMutex mPartialImageMutex;
+    QImage mPartialImage;
+    int mPartialImageRowCount = 0;
 
     bool loadMetaInfo()
     {
+        if (mCancelled) {
+            return false;
+        }
         LOG("mFormatHint" << mFormatHint);
-        QBuffer buffer;
-        buffer.setBuffer(&mData);
-        buffer.open(QIODevice::ReadOnly);
+        if (mStream) {
+            return loadStreamedMetaInfo();
+        }
+        CancellableBuffer buffer(&mData, &mCancelled);
 
         Exiv2ImageLoader loader;
         if (loader.load(mData)) {
             mExiv2Image = loader.popImage();
         }
+        if (mCancelled) {
+            return false;
+        }
 
         QImageReader reader;
 
@@ -216,7 +261,7 @@ struct LoadingDocumentImplPrivate {
                 // That's slower but it works even for images containing
                 // small (160x120px) or none embedded preview.
                 if (!KDcrawIface::KDcraw::loadHalfPreview(previewData, buffer)) {
-                    qCWarning(GWENVIEW_LIB_LOG) << "unable to get half preview for " << q->document()->url().fileName();
+                    qCWarning(GWENVIEW_LIB_LOG) << "unable to get half preview for " << mUrl.fileName();
                     return false;
                 }
             }
@@ -270,44 +315,192 @@ struct LoadingDocumentImplPrivate {
 
         if (mJpegContent.get()) {
             if (!mJpegContent->loadFromData(mData, mExiv2Image.get()) && !mJpegContent->loadFromData(mData)) {
-                qCWarning(GWENVIEW_LIB_LOG) << "Unable to use preview of " << q->document()->url().fileName();
+                qCWarning(GWENVIEW_LIB_LOG) << "Unable to use preview of " << mUrl.fileName();
                 return false;
             }
             // Use the size from JpegContent, as its correctly transposed if the
             // image has been rotated
             mImageSize = mJpegContent->size();
-
-            mCmsProfile = Cms::Profile::loadFromExiv2Image(mExiv2Image.get());
         }
 
         LOG("mImageSize" << mImageSize);
 
+        // Region coordinates do not account for the orientation, keep these
+        // images decoded at once
+        mRegionDecodable = qint64(mImageSize.width()) * mImageSize.height() >= MIN_REGION_PIXEL_COUNT && RegionDecoder::canDecodeRegions(mData, reader)
+            && reader.transformation() == QImageIOHandler::TransformationNone;
+        LOG("mRegionDecodable" << mRegionDecodable);
+
+        if (mExiv2Image.get()) {
+            // Covers JPEG, TIFF and most raw formats
+            mCmsProfile = Cms::Profile::loadFromExiv2Image(mExiv2Image.get());
+        }
+
         if (!mCmsProfile) {
             mCmsProfile = Cms::Profile::loadFromImageData(mData, mFormat);
         }
 
-        if (!mCmsProfile && reader.canRead()) {
-            const QImage qtimage = reader.read();
-            if (!qtimage.isNull()) {
-                mCmsProfile = Cms::Profile::loadFromICC(qtimage.colorSpace().iccProfile());
+        if (!mCmsProfile && !Cms::Profile::canLoadFromImageData(mFormat) && !mRegionDecodable && !mCancelled && reader.canRead()) {
+            // Only the decoder knows where to find the profile. Keep the
+            // decoded image, so that loadImageData() does not decode it again.
+            LOG("Decoding the image to get its profile");
+            if (GwenviewConfig::applyExifOrientation()) {
+                reader.setAutoTransform(true);
+            }
+            if (reader.read(&mMetaInfoImage)) {
+                mCmsProfile = Cms::Profile::loadFromICC(mMetaInfoImage.colorSpace().iccProfile());
+                // Unlike reader.size(), this is transposed if the image has
+                // been rotated
+                mImageSize = mMetaInfoImage.size();
+                mMetaInfoImageBytes = mMetaInfoImage.sizeInBytes();
+                detectAnimation(reader);
             }
         }
 
         return true;
     }
 
+    /**
+     * Like loadMetaInfo(), but only waits for the data which comes before the
+     * pixel data
+     */
+    bool loadStreamedMetaInfo()
+    {
+        QByteArray data = mStream->waitForData([](const QByteArray &received) {
+            return metaInfoSize(received) != -1;
+        });
+        if (data.isNull() || mCancelled) {
+            return false;
+        }
+        const qsizetype size = metaInfoSize(data);
+        data.truncate(size == -1 ? data.size() : size);
+
+        // Exiv2 reads PNG files up to the end chunk: make it look like the
+        // metadata is all there is. Metadata stored after the pixel data is
+        // not found.
+        const bool png = data.startsWith("\x89PNG");
+        Exiv2ImageLoader loader;
+        if (loader.load(png ? data + QByteArrayLiteral("\0\0\0\0IEND\xae\x42\x60\x82") : data)) {
+            mExiv2Image = loader.popImage();
+        }
+        if (mCancelled) {
+            return false;
+        }
+
+        StreamReader device(mStream);
+        QImageReader reader(&device, mFormatHint);
+        if (!reader.canRead()) {
+            qCWarning(GWENVIEW_LIB_LOG) << "QImageReader::read() using format hint" << mFormatHint << "failed:" << reader.errorString();
+            return false;
+        }
+        mFormat = reader.format();
+        if (mFormat == "jpg") {
+            mFormat = "jpeg";
+        }
+        mImageSize = reader.size();
+        if (GwenviewConfig::applyExifOrientation() && (reader.transformation() & QImageIOHandler::TransformationRotate90)) {
+            // JpegContent, which needs the whole data, is not there to
+            // transpose the size
+            mImageSize.transpose();
+        }
+        LOG("mFormat" << mFormat << "mImageSize" << mImageSize);
+
+        if (mExiv2Image.get()) {
+            mCmsProfile = Cms::Profile::loadFromExiv2Image(mExiv2Image.get());
+        }
+        if (!mCmsProfile) {
+            mCmsProfile = Cms::Profile::loadFromImageData(data, mFormat);
+        }
+        return !mCancelled;
+    }
+
+    /**
+     * Waits for the transfer to be done, then makes the data available in
+     * mData like for a non streamed document
+     */
+    bool finishStream()
+    {
+        mData = mStream->waitForAllData();
+        mStream.reset();
+        if (mData.isNull() || mCancelled) {
+            return false;
+        }
+        if (mFormat == "jpeg") {
+            mJpegContent = std::make_unique<JpegContent>();
+            if (!mJpegContent->loadFromData(mData)) {
+                qCWarning(GWENVIEW_LIB_LOG) << "Unable to load JPEG content of" << mUrl.fileName();
+                mJpegContent.reset();
+            }
+        }
+        return true;
+    }
+
     void loadImageData()
     {
-        QBuffer buffer;
-        buffer.setBuffer(&mData);
-        buffer.open(QIODevice::ReadOnly);
+        if (mCancelled) {
+            return;
+        }
+        QImage metaInfoImage = std::exchange(mMetaInfoImage, QImage());
+        mMetaInfoImageBytes = 0;
+        if (!metaInfoImage.isNull()) {
+            LOG("Using the image decoded by loadMetaInfo()");
+            if (mInvertedZoom == 1) {
+                mImage = std::move(metaInfoImage);
+            } else {
+                // Cheaper than decoding the image again
+                mImage = metaInfoImage.scaled(metaInfoImage.size() / mInvertedZoom, Qt::IgnoreAspectRatio, Qt::SmoothTransformation);
+                metaInfoImage = QImage();
+            }
+        } else if (!decodeImageData()) {
+            return;
+        }
+        {
+            // ProgressiveDecoder shares mImage with the partial image. Drop
+            // it so that converting mImage in place does not detach it.
+            QMutexLocker locker(&mPartialImageMutex);
+            mPartialImage = QImage();
+        }
+        // The GUI thread may still hold a copy of the partial image, but
+        // ProgressiveDecoder already decoded it in its display format and
+        // color space then. Either way, this does not allocate a second full
+        // size image for the usual formats.
+        LOG("Converting from" << mImage.format() << mImage.colorSpace().description() << "for display");
+        ImageUtils::convertForDisplay(mImage);
+    }
+
+    bool decodeImageData()
+    {
+        if (mStream) {
+            // Show the rows as they arrive rather than after the transfer
+            bool decoded = false;
+            if (canDecodeProgressively()) {
+                StreamReader device(mStream);
+                decoded = decodeProgressively(&device);
+            }
+            if (!finishStream()) {
+                return false;
+            }
+            if (decoded) {
+                return !mCancelled;
+            }
+        } else if (canDecodeProgressively() && qint64(mImageSize.width()) * mImageSize.height() >= MIN_PROGRESSIVE_PIXEL_COUNT) {
+            CancellableBuffer buffer(&mData, &mCancelled);
+            if (decodeProgressively(&buffer)) {
+                return !mCancelled;
+            }
+        }
+        if (mCancelled) {
+            return false;
+        }
+
+        CancellableBuffer buffer(&mData, &mCancelled);
         QImageReader reader(&buffer, mFormat);
 
-        LOG("mImageDataInvertedZoom=" << mImageDataInvertedZoom);
-        if (mImageSize.isValid() && mImageDataInvertedZoom != 1 && reader.supportsOption(QImageIOHandler::ScaledSize)) {
+        LOG("mInvertedZoom=" << mInvertedZoom);
+        if (mImageSize.isValid() && mInvertedZoom != 1 && reader.supportsOption(QImageIOHandler::ScaledSize)) {
             // Do not use mImageSize here: QImageReader needs a non-transposed
             // image size
-            QSize size = reader.size() / mImageDataInvertedZoom;
+            QSize size = reader.size() / mInvertedZoom;
             if (!size.isEmpty()) {
                 LOG("Setting scaled size to" << size);
                 reader.setScaledSize(size);
@@ -323,20 +516,61 @@ struct LoadingDocumentImplPrivate {
         bool ok = reader.read(&mImage);
         if (!ok) {
             LOG("QImageReader::read() failed");
-            return;
+            return false;
         }
-        // Color space conversion logic
-        if (!mImage.isNull() && mImage.colorSpace().isValid()) {
-            // Convert to sRGB if not already sRGB
-            if (mImage.colorSpace() != QColorSpace::SRgb) {
-                LOG("Converting color space from" << mImage.colorSpace().description() << "to sRGB");
-                QImage convertedImage = mImage.convertedToColorSpace(QColorSpace::SRgb);
-                if (!convertedImage.isNull()) {
-                    mImage = std::move(convertedImage);
-                    LOG("Color space conversion completed");
-                }
+        if (mCancelled) {
+            return false;
+        }
+        detectAnimation(reader);
+        return true;
+    }
+
+    bool canDecodeProgressively() const
+    {
+        return mInvertedZoom == 1 && ProgressiveDecoder::canDecode(mFormat);
+    }
+
+    /**
+     * Decodes @p device with ProgressiveDecoder, which makes the rows
+     * available in mPartialImage as they are decoded. Returns false if the
+     * image must be decoded with QImageReader, or if loading was cancelled.
+     */
+    bool decodeProgressively(QIODevice *device)
+    {
+        if (GwenviewConfig::applyExifOrientation()) {
+            // Rows would be shown before being rotated
+            QImageReader reader(device, mFormat);
+            if (reader.transformation() != QImageIOHandler::TransformationNone) {
+                return false;
             }
+            device->seek(0);
+        }
+
+        LOG("Decoding progressively");
+        const bool ok = ProgressiveDecoder::decode(device, mFormat, &mImage, [this](const QImage &image, int rowCount) {
+            if (mCancelled) {
+                return false;
+            }
+            QMutexLocker locker(&mPartialImageMutex);
+            mPartialImage = image;
+            mPartialImageRowCount = rowCount;
+            return true;
+        });
+        if (!ok) {
+            LOG("ProgressiveDecoder::decode() failed or was cancelled");
+            mImage = QImage();
+            QMutexLocker locker(&mPartialImageMutex);
+            mPartialImage = QImage();
+            mPartialImageRowCount = 0;
         }
+        return ok;
+    }
+
+    /**
+     * Must be called after the first frame has been read from @p reader
+     */
+    void detectAnimation(QImageReader &reader)
+    {
         if (reader.supportsAnimation() && reader.nextImageDelay() > 0 // Assume delay == 0 <=> only one frame
         ) {
             /*
@@ -356,25 +590,216 @@ struct LoadingDocumentImplPrivate {
                 LOG("Really an animated image (more than one frame)");
                 mAnimated = true;
             } else {
-                qCWarning(GWENVIEW_LIB_LOG) << q->document()->url() << "is not really an animated image (only one frame)";
+                qCWarning(GWENVIEW_LIB_LOG) << mUrl << "is not really an animated image (only one frame)";
             }
         }
     }
 };
 
+struct LoadingDocumentImplPrivate {
+    LoadingDocumentImpl *q;
+    QPointer<KIO::TransferJob> mTransferJob;
+    QFuture<bool> mMetaInfoFuture;
+    QFutureWatcher<bool> mMetaInfoFutureWatcher;
+    QFuture<void> mImageDataFuture;
+    QFutureWatcher<void> mImageDataFutureWatcher;
+    DecodeScheduler::TaskId mMetaInfoTaskId = 0;
+    DecodeScheduler::TaskId mImageDataTaskId = 0;
+    std::shared_ptr<LoadingContext> mContext;
+
+    // If != 0, this means we need to load an image at zoom =
+    // 1/mImageDataInvertedZoom
+    int mImageDataInvertedZoom;
+
+    bool mMetaInfoLoaded;
+    bool mDownSampledImageLoaded;
+    QMimeType mMimeType;
+
+    QTimer mPartialImageTimer;
+    int mPartialImageRowCount = 0;
+
+    // Receives the transferred data once decoding started, see
+    // startStreaming()
+    StreamBuffer::Ptr mStream;
+    // Copy of the streamed data until it contains the meta information
+    QByteArray mStreamedHead;
+    bool mStreamedLoadingStarted = false;
+
+    /**
+     * Determine kind of document and switch to an implementation if it is not
+     * necessary to download more data.
+     * @return true if switched to another implementation.
+     */
+    bool determineKind()
+    {
+        const QUrl &url = q->document()->url();
+        QMimeDatabase db;
+        if (KProtocolInfo::determineMimetypeFromExtension(url.scheme())) {
+            mMimeType = db.mimeTypeForFileNameAndData(url.fileName(), mContext->mData);
+        } else {
+            mMimeType = db.mimeTypeForData(mContext->mData);
+        }
+
+        MimeTypeUtils::Kind kind = MimeTypeUtils::mimeTypeKind(mMimeType.name());
+        LOG("mimeType:" << mMimeType.name());
+        LOG("kind:" << kind);
+        q->setDocumentKind(kind);
+
+        switch (kind) {
+        case MimeTypeUtils::KIND_RASTER_IMAGE:
+        case MimeTypeUtils::KIND_SVG_IMAGE:
+            return false;
+
+        case MimeTypeUtils::KIND_VIDEO:
+            q->switchToImpl(new VideoDocumentLoadedImpl(q->document()));
+            return true;
+
+        default:
+            q->setDocumentErrorString(
+                i18nc("@info",
+                      "Gwenview cannot display documents of type %1. Install the kimageformats package to gain support for a wider range of media types.",
+                      mMimeType.name()));
+            Q_EMIT q->loadingFailed();
+            q->switchToImpl(new EmptyDocumentImpl(q->document()));
+            return true;
+        }
+    }
+
+    void startLoading()
+    {
+        Q_ASSERT(!mMetaInfoLoaded);
+
+        switch (q->document()->kind()) {
+        case MimeTypeUtils::KIND_RASTER_IMAGE:
+            // The hint is used to:
+            // - Speed up loadMetaInfo(): QImageReader will try to decode the
+            //   image using plugins matching this format first.
+            // - Avoid breakage: Because of a bug in Qt TGA image plugin, some
+            //   PNG were incorrectly identified as PCX! See:
+            //   https://bugs.kde.org/show_bug.cgi?id=289819
+            //
+            mContext->mFormatHint = mMimeType.preferredSuffix().toLocal8Bit().toLower();
+            mMetaInfoFuture = DecodeScheduler::instance()->run(
+                q->document()->decodePriority(),
+                [context = mContext]() {
+                    return context->loadMetaInfo();
+                },
+                &mMetaInfoTaskId);
+            mMetaInfoFutureWatcher.setFuture(mMetaInfoFuture);
+            break;
+
+        case MimeTypeUtils::KIND_SVG_IMAGE:
+            switchToLoadedImpl(new SvgDocumentLoadedImpl(q->document(), mContext->mData));
+            break;
+
+        case MimeTypeUtils::KIND_VIDEO:
+            break;
+
+        default:
+            qCWarning(GWENVIEW_LIB_LOG) << "We should not reach this point!";
+            break;
+        }
+    }
+
+    /**
+     * Starts loading JPEG and PNG documents while they are being
+     * transferred: their meta information comes before the pixel data, which
+     * ProgressiveDecoder can decode as it arrives. Other formats are loaded
+     * once the transfer is done.
+     */
+    void startStreaming()
+    {
+        if (q->document()->kind() != MimeTypeUtils::KIND_RASTER_IMAGE
+            || !(mMimeType.inherits(QStringLiteral("image/jpeg")) || mMimeType.inherits(QStringLiteral("image/png")))) {
+            return;
+        }
+        LOG("Streaming" << mMimeType.name());
+        mStream = std::make_shared<StreamBuffer>();
+        mStreamedHead = mContext->mData;
+        mStream->append(std::exchange(mContext->mData, QByteArray()));
+        mContext->mStream = mStream;
+        startStreamedLoadingIfReady();
+    }
+
+    /**
+     * Starts loading once the meta information has arrived, so that
+     * loadStreamedMetaInfo() does not hold a decoding thread while it waits
+     * for the network
+     */
+    void startStreamedLoadingIfReady()
+    {
+        if (mStreamedLoadingStarted || (!mStream->isFinished() && metaInfoSize(mStreamedHead) == -1)) {
+            return;
+        }
+        mStreamedLoadingStarted = true;
+        mStreamedHead = QByteArray();
+        startLoading();
+    }
+
+    /**
+     * Switches to @p impl, which may hold on to the loaded data
+     */
+    void switchToLoadedImpl(AbstractDocumentImpl *impl)
+    {
+        impl->setMappedFile(q->mappedFile());
+        q->switchToImpl(impl);
+    }
+
+    void startImageDataLoading()
+    {
+        LOG("");
+        Q_ASSERT(mMetaInfoLoaded);
+        Q_ASSERT(mImageDataInvertedZoom != 0);
+        Q_ASSERT(!mImageDataFuture.isRunning());
+        mContext->mInvertedZoom = mImageDataInvertedZoom;
+        mImageDataFuture = DecodeScheduler::instance()->run(
+            q->document()->decodePriority(),
+            [context = mContext]() {
+                context->loadImageData();
+            },
+            &mImageDataTaskId);
+        mImageDataFutureWatcher.setFuture(mImageDataFuture);
+        if (mImageDataInvertedZoom == 1) {
+            mPartialImageTimer.start();
+        }
+    }
+
+    void publishPartialImage()
+    {
+        QImage image;
+        int rowCount;
+        {
+            QMutexLocker locker(&mContext->mPartialImageMutex);
+            image = mContext->mPartialImage;
+            rowCount = mContext->mPartialImageRowCount;
+        }
+        if (image.isNull() || rowCount <= mPartialImageRowCount) {
+            return;
+        }
+        mPartialImageRowCount = rowCount;
+        q->setDocumentPartialImage(image, rowCount);
+    }
+};
+
 LoadingDocumentImpl::LoadingDocumentImpl(Document *document)
     : AbstractDocumentImpl(document)
     , d(new LoadingDocumentImplPrivate)
 {
     d->q = this;
+    d->mContext = std::make_shared<LoadingContext>();
+    d->mContext->mUrl = document->url();
     d->mMetaInfoLoaded = false;
-    d->mAnimated = false;
     d->mDownSampledImageLoaded = false;
     d->mImageDataInvertedZoom = 0;
 
     connect(&d->mMetaInfoFutureWatcher, &QFutureWatcherBase::finished, this, &LoadingDocumentImpl::slotMetaInfoLoaded);
 
     connect(&d->mImageDataFutureWatcher, &QFutureWatcherBase::finished, this, &LoadingDocumentImpl::slotImageLoaded);
+
+    d->mPartialImageTimer.setInterval(PARTIAL_IMAGE_INTERVAL);
+    connect(&d->mPartialImageTimer, &QTimer::timeout, this, [this]() {
+        d->publishPartialImage();
+    });
 }
 
 LoadingDocumentImpl::~LoadingDocumentImpl()
@@ -384,8 +809,14 @@ LoadingDocumentImpl::~LoadingDocumentImpl()
     d->mMetaInfoFutureWatcher.disconnect();
     d->mImageDataFutureWatcher.disconnect();
 
-    d->mMetaInfoFutureWatcher.waitForFinished();
-    d->mImageDataFutureWatcher.waitForFinished();
+    // Do not wait for running decodes: they share the context, see it is
+    // cancelled and stop as soon as they can. Their results are dropped.
+    d->mContext->mCancelled = true;
+    if (d->mStream) {
+        d->mStream->abort();
+    }
+    DecodeScheduler::instance()->cancel(d->mMetaInfoTaskId);
+    DecodeScheduler::instance()->cancel(d->mImageDataTaskId);
 
     if (d->mTransferJob) {
         d->mTransferJob->kill();
@@ -406,11 +837,19 @@ void LoadingDocumentImpl::init()
             switchToImpl(new EmptyDocumentImpl(document()));
             return;
         }
-        d->mData = file.read(HEADER_SIZE);
+        d->mContext->mData = file.read(HEADER_SIZE);
         if (d->determineKind()) {
             return;
         }
-        d->mData += file.readAll();
+        // Let decoders read a mapping of the file rather than a copy of it
+        const MappedFile::Ptr mappedFile = file.size() >= MIN_MAPPED_FILE_SIZE ? MappedFile::create(file.fileName()) : nullptr;
+        if (mappedFile) {
+            setMappedFile(mappedFile);
+            d->mContext->mMappedFile = mappedFile;
+            d->mContext->mData = mappedFile->data();
+        } else {
+            d->mContext->mData += file.readAll();
+        }
         d->startLoading();
     } else {
         // Transfer file via KIO
@@ -431,8 +870,13 @@ void LoadingDocumentImpl::loadImage(int invertedZoom)
         LOG("Ignoring request: we are loading a full image");
         return;
     }
-    d->mImageDataFutureWatcher.waitForFinished();
     d->mImageDataInvertedZoom = invertedZoom;
+    if (d->mImageDataFuture.isRunning()) {
+        // Do not block until the current decode is done, slotImageLoaded()
+        // starts the next one
+        LOG("Deferring request for invertedZoom=" << invertedZoom);
+        return;
+    }
 
     if (d->mMetaInfoLoaded) {
         // Do not test on mMetaInfoFuture.isRunning() here: it might not have
@@ -443,18 +887,39 @@ void LoadingDocumentImpl::loadImage(int invertedZoom)
 
 void LoadingDocumentImpl::slotDataReceived(KIO::Job *job, const QByteArray &chunk)
 {
-    d->mData.append(chunk);
-    if (document()->kind() == MimeTypeUtils::KIND_UNKNOWN && d->mData.length() >= HEADER_SIZE) {
+    if (d->mStream) {
+        d->mStream->append(chunk);
+        if (!d->mStreamedLoadingStarted) {
+            d->mStreamedHead.append(chunk);
+            d->startStreamedLoadingIfReady();
+        }
+        return;
+    }
+    d->mContext->mData.append(chunk);
+    if (document()->kind() == MimeTypeUtils::KIND_UNKNOWN && d->mContext->mData.length() >= HEADER_SIZE) {
         if (d->determineKind()) {
             job->kill();
             return;
         }
+        d->startStreaming();
     }
 }
 
 void LoadingDocumentImpl::slotTransferFinished(KJob *job)
 {
+    if (d->mStream && !job->error()) {
+        d->mStream->finish();
+        d->startStreamedLoadingIfReady();
+        return;
+    }
     if (job->error()) {
+        if (d->mStream) {
+            // Decoders waiting for the missing data fail, there is no need to
+            // report it twice
+            d->mMetaInfoFutureWatcher.disconnect();
+            d->mImageDataFutureWatcher.disconnect();
+            d->mStream->abort();
+        }
         setDocumentErrorString(job->errorString());
         Q_EMIT loadingFailed();
         switchToImpl(new EmptyDocumentImpl(document()));
@@ -474,6 +939,13 @@ bool LoadingDocumentImpl::isEditable() const
     return d->mDownSampledImageLoaded;
 }
 
+void LoadingDocumentImpl::updateDecodePriority()
+{
+    const DecodeScheduler::Priority priority = document()->decodePriority();
+    DecodeScheduler::instance()->setPriority(d->mMetaInfoTaskId, priority);
+    DecodeScheduler::instance()->setPriority(d->mImageDataTaskId, priority);
+}
+
 Document::LoadingState LoadingDocumentImpl::loadingState() const
 {
     if (!document()->image().isNull()) {
@@ -487,6 +959,11 @@ Document::LoadingState LoadingDocumentImpl::loadingState() const
     }
 }
 
+qint64 LoadingDocumentImpl::extraMemoryUsage() const
+{
+    return d->mContext->mMetaInfoImageBytes;
+}
+
 void LoadingDocumentImpl::slotMetaInfoLoaded()
 {
     LOG("");
@@ -498,14 +975,29 @@ void LoadingDocumentImpl::slotMetaInfoLoaded()
         return;
     }
 
-    setDocumentFormat(d->mFormat);
-    setDocumentImageSize(d->mImageSize);
-    setDocumentExiv2Image(std::move(d->mExiv2Image));
-    setDocumentCmsProfile(d->mCmsProfile);
+    LoadingContext *context = d->mContext.get();
+    setDocumentFormat(context->mFormat);
+    setDocumentImageSize(context->mImageSize);
+    setDocumentExiv2Image(std::move(context->mExiv2Image));
+    setDocumentCmsProfile(context->mCmsProfile);
+    if (context->mRegionDecodable) {
+        setDocumentRegionDecoder(std::make_shared<RegionDecoder>(context->mData, context->mFormat, context->mMappedFile));
+    }
 
     d->mMetaInfoLoaded = true;
     Q_EMIT metaInfoLoaded();
 
+    if (d->mImageDataInvertedZoom == 0 && !context->mMetaInfoImage.isNull()) {
+        // No image is wanted yet. Keep the decoded one for when it is, unless
+        // the document cache is already over its budget.
+        const DocumentFactory *factory = DocumentFactory::instance();
+        if (factory->memoryUsage() > factory->memoryBudget()) {
+            LOG("Dropping the image decoded by loadMetaInfo()");
+            context->mMetaInfoImage = QImage();
+            context->mMetaInfoImageBytes = 0;
+        }
+    }
+
     // Start image loading if necessary
     // We test if mImageDataFuture is not already running because code connected to
     // metaInfoLoaded() signal could have called loadImage()
@@ -517,42 +1009,58 @@ void LoadingDocumentImpl::slotMetaInfoLoaded()
 void LoadingDocumentImpl::slotImageLoaded()
 {
     LOG("");
-    if (d->mImage.isNull()) {
+    d->mPartialImageTimer.stop();
+    LoadingContext *context = d->mContext.get();
+    {
+        // The document gets the complete image, do not keep the partial one
+        // around
+        QMutexLocker locker(&context->mPartialImageMutex);
+        context->mPartialImage = QImage();
+    }
+    if (context->mImage.isNull()) {
+        if (d->mPartialImageRowCount > 0) {
+            setDocumentPartialImage(QImage(), 0);
+        }
         setDocumentErrorString(i18nc("@info", "Loading image failed."));
         Q_EMIT loadingFailed();
         switchToImpl(new EmptyDocumentImpl(document()));
         return;
     }
 
-    if (d->mAnimated) {
-        if (d->mImage.size() == d->mImageSize) {
+    if (context->mAnimated) {
+        if (context->mImage.size() == context->mImageSize) {
             // We already decoded the first frame at the right size, let's show
             // it
-            setDocumentImage(d->mImage);
+            setDocumentImage(context->mImage);
         }
 
-        switchToImpl(new AnimatedDocumentLoadedImpl(document(), d->mData));
+        d->switchToLoadedImpl(new AnimatedDocumentLoadedImpl(document(), context->mData));
 
         return;
     }
 
-    if (d->mImageDataInvertedZoom != 1 && d->mImage.size() != d->mImageSize) {
+    if (context->mInvertedZoom != 1 && context->mImage.size() != context->mImageSize) {
         LOG("Loaded a down sampled image");
         d->mDownSampledImageLoaded = true;
         // We loaded a down sampled image
-        setDocumentDownSampledImage(d->mImage, d->mImageDataInvertedZoom);
+        setDocumentDownSampledImage(context->mImage, context->mInvertedZoom);
+        if (d->mImageDataInvertedZoom != context->mInvertedZoom) {
+            // loadImage() was called for another zoom while we were decoding
+            d->startImageDataLoading();
+        }
         return;
     }
 
     LOG("Loaded a full image");
-    setDocumentImage(d->mImage);
-    DocumentLoadedImpl *impl;
-    if (d->mJpegContent.get()) {
-        impl = new JpegDocumentLoadedImpl(document(), d->mJpegContent.release());
+    setDocumentImage(context->mImage);
+    if (context->mJpegContent.get()) {
+        d->switchToLoadedImpl(new JpegDocumentLoadedImpl(document(), context->mJpegContent.release()));
+    } else if (document()->keepRawData()) {
+        d->switchToLoadedImpl(new DocumentLoadedImpl(document(), context->mData));
     } else {
-        impl = new DocumentLoadedImpl(document(), d->mData);
+        // The mapping can go, the impl does not keep the data
+        switchToImpl(new DocumentLoadedImpl(document(), context->mData));
     }
-    switchToImpl(impl);
 }
 
 } // namespace
@@ -47,6 +47,8 @@ public:
     void init() override;
     Document::LoadingState loadingState() const override;
     bool isEditable() const override;
+    void updateDecodePriority() override;
+    qint64 extraMemoryUsage() const override;
 
     void loadImage(int invertedZoom);
 
@@ -0,0 +1,60 @@
+// SPDX-FileCopyrightText: 2026 Gwenview Developers
+// SPDX-License-Identifier: GPL-2.0-or-later
+
+// Self
+#include "mappedfile.h"
+
+// Qt
+#include <QFileInfo>
+
+// Local
+#include "gwenview_lib_debug.h"
+
+namespace Gwenview
+{
+/** Files modified less than this many secs ago are not mapped */
+static const int MIN_FILE_AGE = 10;
+
+MappedFile::Ptr MappedFile::create(const QString &path)
+{
+    std::shared_ptr<MappedFile> file(new MappedFile);
+    file->mFile.setFileName(path);
+    if (!file->mFile.open(QIODevice::ReadOnly)) {
+        return nullptr;
+    }
+    file->mSize = file->mFile.size();
+    if (file->mSize == 0) {
+        return nullptr;
+    }
+    file->mModificationTime = file->mFile.fileTime(QFileDevice::FileModificationTime);
+    if (file->mModificationTime.secsTo(QDateTime::currentDateTime()) < MIN_FILE_AGE) {
+        // It may still be written to, or truncated
+        return nullptr;
+    }
+    const uchar *data = file->mFile.map(0, file->mSize, QFileDevice::MapPrivateOption);
+    if (!data) {
+        // Process mapping limit exceeded, filesystem does not support it...
+        qCDebug(GWENVIEW_LIB_LOG) << "Could not mmap" << path << file->mFile.errorString();
+        return nullptr;
+    }
+    file->mData = reinterpret_cast<const char *>(data);
+    return file;
+}
+
+QByteArray MappedFile::data() const
+{
+    return QByteArray::fromRawData(mData, mSize);
+}
+
+bool MappedFile::contains(const QByteArray &data) const
+{
+    return !data.isEmpty() && data.constData() >= mData && data.constData() < mData + mSize;
+}
+
+bool MappedFile::isUnchanged() const
+{
+    const QFileInfo info(mFile.fileName());
+    return info.size() == mSize && info.lastModified() == mModificationTime;
+}
+
+} // namespace
@@ -0,0 +1,68 @@
+// SPDX-FileCopyrightText: 2026 Gwenview Developers
+// SPDX-License-Identifier: GPL-2.0-or-later
+
+#ifndef MAPPEDFILE_H
+#define MAPPEDFILE_H
+
+// Qt
+#include <QByteArray>
+#include <QDateTime>
+#include <QFile>
+
+// STL
+#include <memory>
+
+namespace Gwenview
+{
+/**
+ * A read-only memory mapping of a file. The file is kept open as long as the
+ * mapping is alive.
+ *
+ * The mapping follows the file: if another process truncates it, reading
+ * the pages past the new end raises SIGBUS. To make this unlikely, files
+ * which have just been modified, and may thus still be being written, are
+ * not mapped. Users which go back to the data after a while, like region
+ * or animation decoders, call isUnchanged() first and give up if the file
+ * changed. This leaves a window while data is being read.
+ */
+class MappedFile
+{
+public:
+    using Ptr = std::shared_ptr<const MappedFile>;
+
+    /**
+     * Maps the file at @p path. Returns nullptr if it could not be mapped or
+     * has been modified too recently, it must then be read.
+     */
+    static Ptr create(const QString &path);
+
+    /**
+     * Returns the content of the file, without copying it. The returned
+     * array, and any copy of it, must not outlive the MappedFile.
+     */
+    QByteArray data() const;
+
+    /**
+     * Returns true if @p data points to the mapped memory
+     */
+    bool contains(const QByteArray &data) const;
+
+    /**
+     * Returns true if the size and modification time of the file are still
+     * the ones it had when it was mapped
+     */
+    bool isUnchanged() const;
+
+private:
+    MappedFile() = default;
+    Q_DISABLE_COPY(MappedFile)
+
+    QFile mFile;
+    const char *mData = nullptr;
+    qint64 mSize = 0;
+    QDateTime mModificationTime;
+};
+
+} // namespace
+
+#endif /* MAPPEDFILE_H */
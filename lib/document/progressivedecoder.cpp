@@ -0,0 +1,325 @@
+// SPDX-FileCopyrightText: 2026 Gwenview Developers
+// SPDX-License-Identifier: GPL-2.0-or-later
+
+// Self
+#include "progressivedecoder.h"
+
+// STL
+#include <memory>
+
+// Qt
+#include <QColorSpace>
+#include <QColorTransform>
+#include <QIODevice>
+#include <QImage>
+
+// libpng
+#include <png.h>
+
+// Local
+#include "gwenview_lib_debug.h"
+#include <iodevicejpegsourcemanager.h>
+#include <jpegerrormanager.h>
+
+extern "C" {
+#include <cms/iccjpeg.h>
+}
+
+namespace Gwenview
+{
+#undef ENABLE_LOG
+#undef LOG
+// #define ENABLE_LOG
+#ifdef ENABLE_LOG
+#define LOG(x) qCDebug(GWENVIEW_LIB_LOG) << x
+#else
+#define LOG(x) ;
+#endif
+
+namespace ProgressiveDecoder
+{
+// Do not report every single row, the callback may lock a mutex
+static const int REPORT_ROW_COUNT = 32;
+
+/**
+ * Sets the color space of @p image, which has not been decoded yet. If its
+ * rows can be converted to sRGB as they are decoded, sets sRGB instead and
+ * returns the transform to apply to them, so that the decoded image does not
+ * have to be converted as a whole afterwards.
+ */
+static QColorTransform setupColorSpace(QImage &image, const QColorSpace &colorSpace)
+{
+    if (!colorSpace.isValid() || colorSpace == QColorSpace::SRgb || image.format() == QImage::Format_Grayscale8) {
+        image.setColorSpace(colorSpace);
+        return {};
+    }
+    image.setColorSpace(QColorSpace::SRgb);
+    return colorSpace.transformationToColorSpace(QColorSpace::SRgb);
+}
+
+/**
+ * Applies @p transform to rows [@p firstRow, @p lastRow[ of @p image, whose
+ * pixels are at @p bits
+ */
+static void convertRows(const QImage &image, uchar *bits, int firstRow, int lastRow, const QColorTransform &transform)
+{
+    if (transform.isIdentity() || firstRow >= lastRow) {
+        return;
+    }
+    // Works on the pixels of image, without detaching it
+    const qsizetype bytesPerLine = image.bytesPerLine();
+    QImage stripe(bits + firstRow * bytesPerLine, image.width(), lastRow - firstRow, bytesPerLine, image.format());
+    stripe.applyColorTransform(transform);
+}
+
+/**
+ * The objects a decoder changes after calling setjmp(). They must not be
+ * locals of the decoder: after a longjmp(), locals changed since setjmp()
+ * have undefined values, and the destructors of locals declared after
+ * setjmp() are skipped.
+ */
+struct DecoderState {
+    QImage mImage;
+    QByteArray mRowBuffer;
+    QColorTransform mTransform;
+};
+
+//- JPEG -----------------------------------------------------------------------
+static bool decodeJpeg(QIODevice *device, QImage *image, const ProgressCallback &progress)
+{
+    struct jpeg_decompress_struct cinfo;
+    JPEGErrorManager errorManager;
+    cinfo.err = &errorManager;
+    jpeg_create_decompress(&cinfo);
+
+    const auto state = std::make_unique<DecoderState>();
+    QImage &result = state->mImage;
+    if (setjmp(errorManager.jmp_buffer)) {
+        jpeg_destroy_decompress(&cinfo);
+        return false;
+    }
+
+    IODeviceJpegSourceManager::setup(&cinfo, device);
+    setup_read_icc_profile(&cinfo);
+    jpeg_read_header(&cinfo, true);
+
+    const bool grayscale = cinfo.jpeg_color_space == JCS_GRAYSCALE;
+    if (!grayscale && cinfo.jpeg_color_space != JCS_YCbCr && cinfo.jpeg_color_space != JCS_RGB) {
+        LOG("Unsupported color space" << cinfo.jpeg_color_space);
+        jpeg_destroy_decompress(&cinfo);
+        return false;
+    }
+    cinfo.out_color_space = grayscale ? JCS_GRAYSCALE : JCS_RGB;
+    jpeg_start_decompress(&cinfo);
+
+    result = QImage(cinfo.output_width, cinfo.output_height, grayscale ? QImage::Format_Grayscale8 : QImage::Format_RGB32);
+    if (result.isNull()) {
+        qCWarning(GWENVIEW_LIB_LOG) << "Could not allocate image of size" << cinfo.output_width << "x" << cinfo.output_height;
+        jpeg_destroy_decompress(&cinfo);
+        return false;
+    }
+
+    JOCTET *iccData = nullptr;
+    unsigned int iccLength = 0;
+    const QColorTransform &transform = state->mTransform;
+    if (read_icc_profile(&cinfo, &iccData, &iccLength)) {
+        state->mTransform = setupColorSpace(result, QColorSpace::fromIccProfile(QByteArray(reinterpret_cast<const char *>(iccData), iccLength)));
+        free(iccData);
+    }
+
+    // Rows are written through this pointer: the image is shared with the
+    // progress callback, writing to it through QImage would detach it
+    uchar *bits = result.bits();
+    const qsizetype bytesPerLine = result.bytesPerLine();
+    *image = result;
+    if (!progress(*image, 0)) {
+        jpeg_abort_decompress(&cinfo);
+        jpeg_destroy_decompress(&cinfo);
+        return false;
+    }
+
+    QByteArray &rowBuffer = state->mRowBuffer;
+    if (!grayscale) {
+        rowBuffer.resize(cinfo.output_width * 3);
+    }
+    while (cinfo.output_scanline < cinfo.output_height) {
+        const int row = cinfo.output_scanline;
+        uchar *line = bits + row * bytesPerLine;
+        JSAMPROW sampleRow = grayscale ? line : reinterpret_cast<JSAMPROW>(rowBuffer.data());
+        if (jpeg_read_scanlines(&cinfo, &sampleRow, 1) != 1) {
+            break;
+        }
+        if (!grayscale) {
+            const auto *rgb = reinterpret_cast<const uchar *>(rowBuffer.constData());
+            auto *pixel = reinterpret_cast<QRgb *>(line);
+            for (JDIMENSION x = 0; x < cinfo.output_width; ++x, rgb += 3) {
+                pixel[x] = qRgb(rgb[0], rgb[1], rgb[2]);
+            }
+        }
+        if ((row + 1) % REPORT_ROW_COUNT == 0) {
+            convertRows(result, bits, row + 1 - REPORT_ROW_COUNT, row + 1, transform);
+            if (!progress(*image, row + 1)) {
+                LOG("Stopped at row" << row + 1);
+                jpeg_abort_decompress(&cinfo);
+                jpeg_destroy_decompress(&cinfo);
+                return false;
+            }
+        }
+    }
+
+    const bool complete = cinfo.output_scanline == cinfo.output_height;
+    if (complete) {
+        jpeg_finish_decompress(&cinfo);
+    }
+    jpeg_destroy_decompress(&cinfo);
+    if (complete) {
+        const int height = image->height();
+        convertRows(result, bits, height - height % REPORT_ROW_COUNT, height, transform);
+        return progress(*image, height);
+    }
+    return false;
+}
+
+//- PNG ------------------------------------------------------------------------
+static void readPngData(png_structp png, png_bytep data, png_size_t length)
+{
+    auto device = static_cast<QIODevice *>(png_get_io_ptr(png));
+    if (device->read(reinterpret_cast<char *>(data), length) != qint64(length)) {
+        png_error(png, "Read error");
+    }
+}
+
+static bool decodePng(QIODevice *device, QImage *image, const ProgressCallback &progress)
+{
+    png_structp png = png_create_read_struct(PNG_LIBPNG_VER_STRING, nullptr, nullptr, nullptr);
+    if (!png) {
+        return false;
+    }
+    png_infop info = png_create_info_struct(png);
+    if (!info) {
+        png_destroy_read_struct(&png, nullptr, nullptr);
+        return false;
+    }
+
+    const auto state = std::make_unique<DecoderState>();
+    QImage &result = state->mImage;
+    if (setjmp(png_jmpbuf(png))) {
+        png_destroy_read_struct(&png, &info, nullptr);
+        return false;
+    }
+
+    png_set_read_fn(png, device, readPngData);
+    png_read_info(png, info);
+
+    const png_uint_32 width = png_get_image_width(png, info);
+    const png_uint_32 height = png_get_image_height(png, info);
+    const int bitDepth = png_get_bit_depth(png, info);
+    const int colorType = png_get_color_type(png, info);
+    if (png_get_interlace_type(png, info) != PNG_INTERLACE_NONE || bitDepth > 8) {
+        LOG("Interlaced or 16 bits PNG");
+        png_destroy_read_struct(&png, &info, nullptr);
+        return false;
+    }
+    if (!png_get_valid(png, info, PNG_INFO_iCCP) && !png_get_valid(png, info, PNG_INFO_sRGB)
+        && (png_get_valid(png, info, PNG_INFO_gAMA) || png_get_valid(png, info, PNG_INFO_cHRM))) {
+        // QImageReader turns these into a color space, we do not
+        LOG("PNG with gamma or chromaticities");
+        png_destroy_read_struct(&png, &info, nullptr);
+        return false;
+    }
+
+    const bool hasAlpha = (colorType & PNG_COLOR_MASK_ALPHA) || png_get_valid(png, info, PNG_INFO_tRNS);
+    const bool grayscale = !(colorType & PNG_COLOR_MASK_COLOR) && !hasAlpha;
+    if (colorType == PNG_COLOR_TYPE_PALETTE) {
+        png_set_palette_to_rgb(png);
+    }
+    if (png_get_valid(png, info, PNG_INFO_tRNS)) {
+        png_set_tRNS_to_alpha(png);
+    }
+    if (!(colorType & PNG_COLOR_MASK_COLOR)) {
+        if (bitDepth < 8) {
+            png_set_expand_gray_1_2_4_to_8(png);
+        }
+        if (!grayscale) {
+            png_set_gray_to_rgb(png);
+        }
+    }
+    if (!grayscale) {
+        // Produce the memory layout of QImage::Format_(A)RGB32
+#if Q_BYTE_ORDER == Q_LITTLE_ENDIAN
+        png_set_bgr(png);
+        if (!hasAlpha) {
+            png_set_filler(png, 0xff, PNG_FILLER_AFTER);
+        }
+#else
+        if (hasAlpha) {
+            png_set_swap_alpha(png);
+        } else {
+            png_set_filler(png, 0xff, PNG_FILLER_BEFORE);
+        }
+#endif
+    }
+    png_read_update_info(png, info);
+
+    const QImage::Format format = grayscale ? QImage::Format_Grayscale8 : hasAlpha ? QImage::Format_ARGB32 : QImage::Format_RGB32;
+    result = QImage(width, height, format);
+    if (result.isNull()) {
+        qCWarning(GWENVIEW_LIB_LOG) << "Could not allocate image of size" << width << "x" << height;
+        png_destroy_read_struct(&png, &info, nullptr);
+        return false;
+    }
+
+    png_charp iccName;
+    int iccCompression;
+    png_bytep iccData;
+    png_uint_32 iccLength;
+    const QColorTransform &transform = state->mTransform;
+    if (png_get_iCCP(png, info, &iccName, &iccCompression, &iccData, &iccLength)) {
+        state->mTransform = setupColorSpace(result, QColorSpace::fromIccProfile(QByteArray(reinterpret_cast<const char *>(iccData), iccLength)));
+    } else if (png_get_valid(png, info, PNG_INFO_sRGB)) {
+        result.setColorSpace(QColorSpace::SRgb);
+    }
+
+    // See decodeJpeg()
+    uchar *bits = result.bits();
+    const qsizetype bytesPerLine = result.bytesPerLine();
+    *image = result;
+    if (!progress(*image, 0)) {
+        png_destroy_read_struct(&png, &info, nullptr);
+        return false;
+    }
+
+    for (png_uint_32 row = 0; row < height; ++row) {
+        png_read_row(png, bits + row * bytesPerLine, nullptr);
+        if ((row + 1) % REPORT_ROW_COUNT == 0) {
+            convertRows(result, bits, row + 1 - REPORT_ROW_COUNT, row + 1, transform);
+            if (!progress(*image, row + 1)) {
+                LOG("Stopped at row" << row + 1);
+                png_destroy_read_struct(&png, &info, nullptr);
+                return false;
+            }
+        }
+    }
+    png_destroy_read_struct(&png, &info, nullptr);
+    convertRows(result, bits, int(height - height % REPORT_ROW_COUNT), int(height), transform);
+    return progress(*image, image->height());
+}
+
+bool canDecode(const QByteArray &format)
+{
+    return format == "jpeg" || format == "png";
+}
+
+bool decode(QIODevice *device, const QByteArray &format, QImage *image, const ProgressCallback &progress)
+{
+    if (format == "jpeg") {
+        return decodeJpeg(device, image, progress);
+    } else if (format == "png") {
+        return decodePng(device, image, progress);
+    }
+    return false;
+}
+
+} // namespace
+
+} // namespace
@@ -0,0 +1,55 @@
+// SPDX-FileCopyrightText: 2026 Gwenview Developers
+// SPDX-License-Identifier: GPL-2.0-or-later
+
+#ifndef PROGRESSIVEDECODER_H
+#define PROGRESSIVEDECODER_H
+
+// STL
+#include <functional>
+
+// Qt
+#include <QByteArray>
+
+class QIODevice;
+class QImage;
+
+namespace Gwenview
+{
+/**
+ * Decodes JPEG and PNG images from top to bottom and tells about the rows as
+ * soon as they are decoded, so that large images can be shown while they
+ * load.
+ *
+ * Images with an ICC profile are converted to sRGB as they are decoded, except
+ * for grayscale ones.
+ *
+ * Only the common cases are handled: CMYK JPEG files, interlaced PNG files
+ * and PNG files with more than 8 bits per channel must be decoded with
+ * QImageReader.
+ */
+namespace ProgressiveDecoder
+{
+/**
+ * Called with the image being decoded, whose first @p rowCount rows are
+ * decoded and will not change anymore. Other rows must not be read.
+ *
+ * Returns false to stop decoding.
+ */
+using ProgressCallback = std::function<bool(const QImage &image, int rowCount)>;
+
+bool canDecode(const QByteArray &format);
+
+/**
+ * Decodes @p device into @p image. @p progress is first called once the
+ * image has been allocated, then every time new rows have been decoded.
+ *
+ * Returns false if decoding failed, was stopped by @p progress, or if the
+ * image must be decoded with QImageReader.
+ */
+bool decode(QIODevice *device, const QByteArray &format, QImage *image, const ProgressCallback &progress);
+
+} // namespace
+
+} // namespace
+
+#endif /* PROGRESSIVEDECODER_H */
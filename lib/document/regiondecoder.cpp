@@ -0,0 +1,188 @@
+// SPDX-FileCopyrightText: 2026 Gwenview Developers
+// SPDX-License-Identifier: GPL-2.0-or-later
+
+// Self
+#include "regiondecoder.h"
+
+// Qt
+#include <QBuffer>
+#include <QColorSpace>
+#include <QImage>
+#include <QImageReader>
+#include <QMutexLocker>
+#include <QPromise>
+#include <QRect>
+
+// STL
+#include <optional>
+
+// Local
+#include "gwenview_lib_debug.h"
+#include "mappedfile.h"
+
+namespace Gwenview
+{
+#undef ENABLE_LOG
+#undef LOG
+// #define ENABLE_LOG
+#ifdef ENABLE_LOG
+#define LOG(x) qCDebug(GWENVIEW_LIB_LOG) << x
+#else
+#define LOG(x) ;
+#endif
+
+// Maximum amount of memory used by decoded bands, in kilobytes
+static const int MaxBandCacheCost = 64 * 1024;
+
+/**
+ * Returns true if @p data is a JPEG image whose frame is baseline or
+ * extended sequential. Progressive frames must be decoded entirely before
+ * any row is complete.
+ */
+static bool isSequentialJpeg(const QByteArray &data)
+{
+    const auto *bytes = reinterpret_cast<const uchar *>(data.constData());
+    const qsizetype size = data.size();
+    if (!data.startsWith("\xff\xd8")) {
+        return false;
+    }
+    qsizetype pos = 2;
+    while (pos + 4 <= size) {
+        if (bytes[pos] != 0xff) {
+            return false;
+        }
+        const uchar marker = bytes[pos + 1];
+        if (marker == 0xff) {
+            // Fill byte
+            ++pos;
+            continue;
+        }
+        if (marker == 0x01 || (marker >= 0xd0 && marker <= 0xd8)) {
+            // No segment
+            pos += 2;
+            continue;
+        }
+        if (marker >= 0xc0 && marker <= 0xcf && marker != 0xc4 && marker != 0xc8 && marker != 0xcc) {
+            // Start of frame
+            return marker == 0xc0 || marker == 0xc1;
+        }
+        pos += 2 + ((bytes[pos + 2] << 8) | bytes[pos + 3]);
+    }
+    return false;
+}
+
+RegionDecoder::RegionDecoder(const QByteArray &data, const QByteArray &format, const std::shared_ptr<const MappedFile> &mappedFile)
+    : mData(data)
+    , mFormat(format)
+    , mMappedFile(mappedFile)
+    , mBands(MaxBandCacheCost)
+{
+    QBuffer buffer(&mData);
+    buffer.open(QIODevice::ReadOnly);
+    QImageReader reader(&buffer, mFormat);
+    mSize = reader.size();
+}
+
+bool RegionDecoder::canDecodeRegions(const QByteArray &data, const QImageReader &reader)
+{
+    const QByteArray format = reader.format();
+    return (format == "jpeg" || format == "jpg") && isSequentialJpeg(data) && reader.supportsOption(QImageIOHandler::ClipRect);
+}
+
+QSize RegionDecoder::size() const
+{
+    return mSize;
+}
+
+QImage RegionDecoder::decode(const QRect &rect, const QSize &scaledSize) const
+{
+    // Regions in the same row share their band. Bands are not upscaled, the
+    // regions cut from them are.
+    const qreal scale = qMin(qreal(1), qreal(scaledSize.height()) / rect.height());
+    const QRect bandRect{0, rect.y(), mSize.width(), rect.height()};
+    const QSize bandSize{qMax(1, qRound(bandRect.width() * scale)), qMax(1, qRound(bandRect.height() * scale))};
+    const BandKey key{bandRect.y(), bandRect.height(), bandSize.height()};
+
+    QImage band;
+    QFuture<QImage> decoding;
+    std::optional<QPromise<QImage>> promise;
+    {
+        QMutexLocker locker(&mBandsMutex);
+        if (const QImage *cached = mBands.object(key)) {
+            band = *cached;
+        } else if (const auto it = mDecodingBands.constFind(key); it != mDecodingBands.constEnd()) {
+            decoding = it.value();
+        } else {
+            promise.emplace();
+            promise->start();
+            mDecodingBands.insert(key, promise->future());
+        }
+    }
+    if (promise) {
+        band = decodeRect(bandRect, bandSize);
+        {
+            QMutexLocker locker(&mBandsMutex);
+            if (!band.isNull()) {
+                mBands.insert(key, new QImage(band), qMax(qsizetype(1), band.sizeInBytes() / 1024));
+            }
+            mDecodingBands.remove(key);
+        }
+        if (!band.isNull()) {
+            promise->addResult(band);
+        }
+        promise->finish();
+    } else if (band.isNull()) {
+        // Another thread is decoding the band
+        decoding.waitForFinished();
+        if (decoding.resultCount() > 0) {
+            band = decoding.result();
+        }
+    }
+    if (band.isNull()) {
+        return {};
+    }
+
+    const qreal bandScale = qreal(band.width()) / mSize.width();
+    const QRect cutRect = QRectF(rect.x() * bandScale, 0, rect.width() * bandScale, band.height()).toAlignedRect().intersected(band.rect());
+    QImage image = band.copy(cutRect);
+    if (image.size() != scaledSize) {
+        image = image.scaled(scaledSize, Qt::IgnoreAspectRatio, Qt::SmoothTransformation);
+    }
+    return image;
+}
+
+QImage RegionDecoder::decodeRect(const QRect &rect, const QSize &scaledSize) const
+{
+    if (mMappedFile && !mMappedFile->isUnchanged()) {
+        qCWarning(GWENVIEW_LIB_LOG) << "Image file changed, not decoding region" << rect;
+        return {};
+    }
+    // A shallow copy, QBuffer wants a non const array
+    QByteArray data = mData;
+    QBuffer buffer(&data);
+    buffer.open(QIODevice::ReadOnly);
+    QImageReader reader(&buffer, mFormat);
+    reader.setClipRect(rect);
+    if (scaledSize != rect.size() && reader.supportsOption(QImageIOHandler::ScaledSize)) {
+        // Applies to the clipped area, and lets decoders like the JPEG one
+        // skip details which would be scaled away
+        reader.setScaledSize(scaledSize);
+    }
+
+    QImage image;
+    if (!reader.read(&image)) {
+        qCWarning(GWENVIEW_LIB_LOG) << "Could not decode region" << rect << ":" << reader.errorString();
+        return {};
+    }
+    LOG("Decoded" << rect << "as" << image.size());
+    if (image.size() != scaledSize) {
+        image = image.scaled(scaledSize, Qt::IgnoreAspectRatio, Qt::SmoothTransformation);
+    }
+    // Like LoadingDocumentImpl does for whole images
+    if (image.colorSpace().isValid() && image.colorSpace() != QColorSpace::SRgb) {
+        image.convertToColorSpace(QColorSpace::SRgb);
+    }
+    return image;
+}
+
+} // namespace
@@ -0,0 +1,99 @@
+// SPDX-FileCopyrightText: 2026 Gwenview Developers
+// SPDX-License-Identifier: GPL-2.0-or-later
+
+#ifndef REGIONDECODER_H
+#define REGIONDECODER_H
+
+#include <lib/gwenviewlib_export.h>
+
+// STL
+#include <memory>
+
+// Qt
+#include <QByteArray>
+#include <QCache>
+#include <QFuture>
+#include <QHash>
+#include <QHashFunctions>
+#include <QImage>
+#include <QMutex>
+#include <QSize>
+
+class QImageReader;
+class QRect;
+
+namespace Gwenview
+{
+class MappedFile;
+
+/**
+ * Decodes parts of an image, for formats whose decoder can do so without
+ * decoding the whole image. This makes it possible to show images which are
+ * too large to be kept decoded in memory.
+ *
+ * Only baseline JPEG images are decoded by regions: their decoder can skip
+ * the rows below a region, but still goes through every row above it and
+ * through whole rows. decode() therefore decodes horizontal bands of the
+ * image once and cuts the requested regions from them.
+ *
+ * decode() can be called from any thread.
+ */
+class GWENVIEWLIB_EXPORT RegionDecoder
+{
+public:
+    using Ptr = std::shared_ptr<const RegionDecoder>;
+
+    /**
+     * @p mappedFile must be set if @p data points to its mapping, so that it
+     * stays valid
+     */
+    RegionDecoder(const QByteArray &data, const QByteArray &format, const std::shared_ptr<const MappedFile> &mappedFile = nullptr);
+
+    /**
+     * Returns true if @p data, read by @p reader, is a baseline JPEG image and
+     * the decoder of @p reader supports QImageIOHandler::ClipRect, rather than
+     * QImageReader emulating it by decoding the whole image
+     */
+    static bool canDecodeRegions(const QByteArray &data, const QImageReader &reader);
+
+    QSize size() const;
+
+    /**
+     * Decodes @p rect of the image, scaled to @p scaledSize. Returns a null
+     * image if decoding failed.
+     */
+    QImage decode(const QRect &rect, const QSize &scaledSize) const;
+
+private:
+    struct BandKey {
+        int top;
+        int height;
+        int scaledHeight;
+        bool operator==(const BandKey &other) const
+        {
+            return top == other.top && height == other.height && scaledHeight == other.scaledHeight;
+        }
+        friend size_t qHash(const BandKey &key, size_t seed = 0)
+        {
+            return qHashMulti(seed, key.top, key.height, key.scaledHeight);
+        }
+    };
+
+    QImage decodeRect(const QRect &rect, const QSize &scaledSize) const;
+
+    QByteArray mData;
+    QByteArray mFormat;
+    std::shared_ptr<const MappedFile> mMappedFile;
+    QSize mSize;
+
+    // Protects mBands and mDecodingBands
+    mutable QMutex mBandsMutex;
+    mutable QCache<BandKey, QImage> mBands;
+    // The bands being decoded, so that a band is only decoded once while
+    // different bands are decoded in parallel
+    mutable QHash<BandKey, QFuture<QImage>> mDecodingBands;
+};
+
+} // namespace
+
+#endif /* REGIONDECODER_H */
@@ -0,0 +1,110 @@
+// SPDX-FileCopyrightText: 2026 Gwenview Developers
+// SPDX-License-Identifier: GPL-2.0-or-later
+
+// Self
+#include "streambuffer.h"
+
+// Qt
+#include <QMutexLocker>
+
+// STL
+#include <cstring>
+
+namespace Gwenview
+{
+void StreamBuffer::append(const QByteArray &data)
+{
+    QMutexLocker locker(&mMutex);
+    mData.append(data);
+    mCondition.wakeAll();
+}
+
+void StreamBuffer::finish()
+{
+    QMutexLocker locker(&mMutex);
+    mFinished = true;
+    mCondition.wakeAll();
+}
+
+void StreamBuffer::abort()
+{
+    QMutexLocker locker(&mMutex);
+    mAborted = true;
+    mCondition.wakeAll();
+}
+
+QByteArray StreamBuffer::waitForAllData()
+{
+    QMutexLocker locker(&mMutex);
+    while (!mFinished && !mAborted) {
+        mCondition.wait(&mMutex);
+    }
+    return mAborted ? QByteArray() : mData;
+}
+
+QByteArray StreamBuffer::waitForData(const std::function<bool(const QByteArray &)> &isEnough)
+{
+    QMutexLocker locker(&mMutex);
+    while (!mFinished && !mAborted && !isEnough(mData)) {
+        mCondition.wait(&mMutex);
+    }
+    return mAborted ? QByteArray() : mData;
+}
+
+qint64 StreamBuffer::read(qint64 pos, char *data, qint64 maxSize)
+{
+    QMutexLocker locker(&mMutex);
+    while (!mFinished && !mAborted && mData.size() <= pos) {
+        mCondition.wait(&mMutex);
+    }
+    if (mAborted) {
+        return -1;
+    }
+    const qint64 count = qBound(qint64(0), mData.size() - pos, maxSize);
+    if (count > 0) {
+        memcpy(data, mData.constData() + pos, count);
+    }
+    return count;
+}
+
+bool StreamBuffer::isFinished() const
+{
+    QMutexLocker locker(&mMutex);
+    return mFinished;
+}
+
+qint64 StreamBuffer::size() const
+{
+    QMutexLocker locker(&mMutex);
+    return mData.size();
+}
+
+StreamReader::StreamReader(const StreamBuffer::Ptr &buffer)
+    : mBuffer(buffer)
+{
+    // readData() relies on pos() being the position of the next read
+    open(QIODevice::ReadOnly | QIODevice::Unbuffered);
+}
+
+bool StreamReader::atEnd() const
+{
+    // More data may come, even if we read everything received so far
+    return mBuffer->isFinished() && QIODevice::atEnd();
+}
+
+qint64 StreamReader::size() const
+{
+    return mBuffer->size();
+}
+
+qint64 StreamReader::readData(char *data, qint64 maxSize)
+{
+    return mBuffer->read(pos(), data, maxSize);
+}
+
+qint64 StreamReader::writeData(const char * /*data*/, qint64 /*maxSize*/)
+{
+    return -1;
+}
+
+} // namespace
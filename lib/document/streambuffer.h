@@ -0,0 +1,94 @@
+// SPDX-FileCopyrightText: 2026 Gwenview Developers
+// SPDX-License-Identifier: GPL-2.0-or-later
+
+#ifndef STREAMBUFFER_H
+#define STREAMBUFFER_H
+
+// Qt
+#include <QByteArray>
+#include <QIODevice>
+#include <QMutex>
+#include <QWaitCondition>
+
+// STL
+#include <functional>
+#include <memory>
+
+namespace Gwenview
+{
+/**
+ * Data which is still arriving, for example from a KIO transfer. One thread
+ * appends to it while others read it through a StreamReader.
+ */
+class StreamBuffer
+{
+public:
+    using Ptr = std::shared_ptr<StreamBuffer>;
+
+    void append(const QByteArray &data);
+
+    /**
+     * No more data will be appended
+     */
+    void finish();
+
+    /**
+     * The data will never be complete, or it is not needed anymore: pending
+     * and further reads fail.
+     */
+    void abort();
+
+    /**
+     * Blocks until the data is complete and returns it. Returns a null array
+     * if the stream has been aborted.
+     */
+    QByteArray waitForAllData();
+
+    /**
+     * Blocks until @p isEnough returns true for the data received so far, or
+     * until the data is complete, and returns the data. Returns a null array
+     * if the stream has been aborted.
+     */
+    QByteArray waitForData(const std::function<bool(const QByteArray &)> &isEnough);
+
+    /**
+     * Blocks until data past @p pos is available, then copies up to
+     * @p maxSize bytes of it to @p data. Returns the number of bytes copied,
+     * 0 at the end of complete data and -1 if the stream has been aborted.
+     */
+    qint64 read(qint64 pos, char *data, qint64 maxSize);
+
+    bool isFinished() const;
+    qint64 size() const;
+
+private:
+    mutable QMutex mMutex;
+    QWaitCondition mCondition;
+    QByteArray mData;
+    bool mFinished = false;
+    bool mAborted = false;
+};
+
+/**
+ * A read-only device over a StreamBuffer, whose reads block until the data
+ * they need has arrived
+ */
+class StreamReader : public QIODevice
+{
+public:
+    explicit StreamReader(const StreamBuffer::Ptr &buffer);
+
+    bool atEnd() const override;
+    qint64 size() const override;
+
+protected:
+    qint64 readData(char *data, qint64 maxSize) override;
+    qint64 writeData(const char *data, qint64 maxSize) override;
+
+private:
+    StreamBuffer::Ptr mBuffer;
+};
+
+} // namespace
+
+#endif /* STREAMBUFFER_H */
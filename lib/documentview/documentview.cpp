@@ -240,6 +240,14 @@ struct DocumentViewPrivate {
         mBirdEyeView->setZValue(1);
     }
 
+    void updateDecodePriority()
+    {
+        if (!mDocument) {
+            return;
+        }
+        mDocument->setDecodePriority(q, !mCompareMode || mCurrent ? DecodeScheduler::VisiblePriority : DecodeScheduler::ComparePriority);
+    }
+
     void updateCaption()
     {
         if (!mCurrent) {
@@ -559,6 +567,9 @@ void DocumentView::openUrl(const QUrl &url, const DocumentView::Setup &setup)
             return;
         }
         disconnect(d->mDocument.data(), nullptr, this, nullptr);
+        // Decoding it is not urgent anymore, unless another view or the
+        // preloader holds it
+        d->mDocument->releaseDecodePriority(this);
     }
 
     // because some loading will be going on right now, also display the indicator after a small delay
@@ -567,6 +578,7 @@ void DocumentView::openUrl(const QUrl &url, const DocumentView::Setup &setup)
 
     d->mSetup = setup;
     d->mDocument = DocumentFactory::instance()->load(url);
+    d->updateDecodePriority();
     connect(d->mDocument.data(), &Document::busyChanged, this, &DocumentView::slotBusyChanged);
     connect(d->mDocument.data(), &Document::modified, this, [this]() {
         d->updateZoomSnapValues();
@@ -983,6 +995,7 @@ qreal DocumentView::minimumZoom() const
 void DocumentView::setCompareMode(bool compare)
 {
     d->mCompareMode = compare;
+    d->updateDecodePriority();
     if (compare) {
         d->mHud->show();
         d->mHud->setZValue(1);
@@ -994,6 +1007,7 @@ void DocumentView::setCompareMode(bool compare)
 void DocumentView::setCurrent(bool value)
 {
     d->mCurrent = value;
+    d->updateDecodePriority();
     if (value) {
         d->mAdapter->widget()->setFocus();
         d->updateCaption();
@@ -21,13 +21,19 @@ Foundation, Inc., 51 Franklin Street, Fifth Floor, Cambridge, MA 02110-1301, USA
 #include "rasterimageitem.h"
 
 #include <cmath>
+#include <cstring>
 
+#include <QElapsedTimer>
+#include <QFuture>
 #include <QGraphicsScene>
 #include <QGraphicsView>
 #include <QPainter>
+#include <QThreadPool>
+#include <QtConcurrentRun>
 
 #include "gvdebug.h"
 #include "lib/cms/cmsprofile.h"
+#include "lib/imageutils.h"
 #include "rasterimageview.h"
 
 using namespace Gwenview;
@@ -36,28 +42,156 @@ using namespace Gwenview;
 static const qreal Third = 1.0 / 3.0;
 static const qreal Sixth = 1.0 / 6.0;
 
+// Size of the side of a tile, in device pixels.
+static const int TileSize = 256;
+
+// Size of the longest side of the down sampled copy used at low zoom levels
+// when the image is decoded by regions, the actual copy is 2 to 4 times larger.
+static const int OverviewSize = 1024;
+
+// Maximum amount of memory used by prepared tiles, in kilobytes. This is
+// enough to hold a few screens worth of tiles on a 4K display.
+static const int MaxTileCacheCost = 128 * 1024;
+
+// Maximum number of tiles decoded from the document data at the same time.
+// Region decodes are slow and memory hungry, and the tiles of a row are cut
+// from the same band anyway.
+static const int MaxRegionDecodeCount = 2;
+
+// Tiles are prepared in their own pool, so that a burst of requests after
+// zooming does not delay the loading of documents.
+Q_GLOBAL_STATIC(QThreadPool, sTilePool)
+
+struct RasterImageItem::TileJob {
+    QImage source;
+    // Set if the source is not available as an image and must be decoded
+    RegionDecoder::Ptr regionDecoder;
+    // Zoom to apply to source to get the tile, which is not the view zoom if
+    // source is one of the scaled down copies of the image
+    qreal sourceZoom;
+    QRect tileRect;
+    Qt::TransformationMode transformationMode;
+    QImage::Format format;
+    DisplayTransform displayTransform;
+};
+
+static qint64 zoomKey(qreal zoom)
+{
+    return qRound64(zoom * 1000000.0);
+}
+
+/**
+ * Returns an image showing the first @p rowCount rows of @p image, without
+ * copying them. The returned image keeps @p image alive.
+ */
+static QImage topRows(const QImage &image, int rowCount)
+{
+    auto owner = new QImage(image);
+    QImage rows(
+        owner->constBits(),
+        owner->width(),
+        rowCount,
+        owner->bytesPerLine(),
+        owner->format(),
+        [](void *info) {
+            delete static_cast<QImage *>(info);
+        },
+        owner);
+    rows.setColorSpace(owner->colorSpace());
+    return rows;
+}
+
+QImage RasterImageItem::renderTile(const TileJob &job)
+{
+    // Find the area of the source image covered by the tile. Grow it by a few
+    // pixels so that smooth scaling does not produce visible seams between
+    // tiles.
+    const QRectF exactSourceRect{job.tileRect.x() / job.sourceZoom,
+                                 job.tileRect.y() / job.sourceZoom,
+                                 job.tileRect.width() / job.sourceZoom,
+                                 job.tileRect.height() / job.sourceZoom};
+    const QRect sourceImageRect = job.regionDecoder ? QRect{QPoint{0, 0}, job.regionDecoder->size()} : job.source.rect();
+    const QRect sourceRect = exactSourceRect.toAlignedRect().marginsAdded(QMargins(2, 2, 2, 2)).intersected(sourceImageRect);
+    if (sourceRect.isEmpty()) {
+        return {};
+    }
+
+    const QSize scaledSize{qRound(sourceRect.width() * job.sourceZoom), qRound(sourceRect.height() * job.sourceZoom)};
+    QImage image;
+    if (job.regionDecoder) {
+        image = job.regionDecoder->decode(sourceRect, scaledSize);
+        if (image.isNull()) {
+            return {};
+        }
+    } else {
+        image = job.source.copy(sourceRect).scaled(scaledSize, Qt::IgnoreAspectRatio, job.transformationMode);
+    }
+
+    // Cut the tile out of the scaled area
+    const QPoint offset{qRound(job.tileRect.x() - sourceRect.x() * job.sourceZoom), qRound(job.tileRect.y() - sourceRect.y() * job.sourceZoom)};
+    image = image.copy(QRect{offset, job.tileRect.size()});
+
+    // We may load an image in indexed color or premultiplied alpha, or scaling may produce premultiplied alpha.
+    // These are not supported by the color correction engine, so convert to a standard format.
+    if (image.format() != job.format) {
+        image.convertTo(job.format);
+    }
+
+    if (job.displayTransform) {
+        job.displayTransform->apply(image);
+    }
+    return image;
+}
+
 RasterImageItem::RasterImageItem(Gwenview::RasterImageView *parent)
     : QGraphicsItem(parent)
     , mParentView(parent)
+    , mTiles(MaxTileCacheCost)
+    , mTileRequestState(std::make_shared<TileRequestState>())
 {
 }
 
 RasterImageItem::~RasterImageItem()
 {
-    if (mDisplayTransform) {
-        cmsDeleteTransform(mDisplayTransform);
-    }
+    // Make sure queued tile requests do not waste time on us
+    ++mTileRequestState->generation;
 }
 
 void RasterImageItem::setRenderingIntent(RenderingIntent::Enum intent)
 {
+    if (mRenderingIntent == intent) {
+        return;
+    }
     mRenderingIntent = intent;
-    update();
+    resetDisplayTransform();
+}
+
+void RasterImageItem::resetDisplayTransform()
+{
+    mApplyDisplayTransform = true;
+    updateDisplayTransform(mTileFormat);
+    updatePreviewImage();
+    invalidateTiles();
 }
 
 void Gwenview::RasterImageItem::updateCache()
 {
     auto document = mParentView->document();
+    if (document->image().isNull() && !document->partialImage().isNull()) {
+        updatePartialCache();
+        return;
+    }
+    mPartialImage = QImage();
+    mPartialThird = {};
+    mPartialSixth = {};
+    mPartialPreview = {};
+
+    if (document->image().isNull() && document->regionDecoder()) {
+        updateRegionCache();
+        return;
+    }
+    mRegionDecoder.reset();
+    mOverviewImage = QImage();
 
     // Save a shallow copy of the image to make sure that it will not get
     // destroyed by another thread.
@@ -69,16 +203,164 @@ void Gwenview::RasterImageItem::updateCache()
     // very slow for large images.
     mThirdScaledImage = mOriginalImage.scaled(document->size() * Third, Qt::IgnoreAspectRatio, Qt::SmoothTransformation);
     mSixthScaledImage = mOriginalImage.scaled(document->size() * Sixth, Qt::IgnoreAspectRatio, Qt::SmoothTransformation);
+
+    // Smooth scaling produces premultiplied alpha. Convert the copies once
+    // rather than every tile cut from them.
+    const QImage::Format tileFormat = ImageUtils::displayFormat(mOriginalImage);
+    mThirdScaledImage.convertTo(tileFormat);
+    mSixthScaledImage.convertTo(tileFormat);
+
+    if (document->isAnimated() && tileFormat == mTileFormat && document->cmsProfile() == mDisplayTransformProfile) {
+        // Another frame of the same animation, only the pixels changed
+        invalidateTiles();
+        return;
+    }
+    // The document, and thus its color profile, may have changed as well
+    mTileFormat = tileFormat;
+    resetDisplayTransform();
+}
+
+void RasterImageItem::updateRegionCache()
+{
+    auto document = mParentView->document();
+    const QSize size = document->size();
+    const qreal zoom = qreal(OverviewSize) / qMax(size.width(), size.height());
+    if (!document->prepareDownSampledImageForZoom(zoom)) {
+        // RasterImageView calls us again once it is ready
+        return;
+    }
+    const QImage overview = document->downSampledImageForZoom(zoom);
+    if (overview.isNull()) {
+        return;
+    }
+
+    mRegionDecoder = document->regionDecoder();
+    mOverviewImage = overview;
+    mOverviewZoom = qreal(overview.width()) / size.width();
+    mOriginalImage = QImage();
+    mThirdScaledImage = QImage();
+    mSixthScaledImage = QImage();
+
+    mTileFormat = ImageUtils::displayFormat(mOverviewImage);
+    resetDisplayTransform();
+}
+
+void RasterImageItem::updatePartialCache()
+{
+    auto document = mParentView->document();
+    const QImage &image = document->partialImage();
+    const int rowCount = qMin(document->partialImageRowCount(), image.height());
+    if (image.isNull() || rowCount <= 0) {
+        return;
+    }
+
+    const bool newImage = image.cacheKey() != mPartialImage.cacheKey();
+    if (newImage) {
+        // The canvases are written to through their bits, so that the shallow
+        // copies handed to the tile workers never detach them
+        mPartialImage = image;
+        mPartialImageRowCount = 0;
+        for (PartialScaledImage *scaled : {&mPartialThird, &mPartialSixth}) {
+            const qreal factor = scaled == &mPartialThird ? Third : Sixth;
+            scaled->canvas = QImage(image.size() * factor, image.format());
+            scaled->canvas.setColorSpace(image.colorSpace());
+            scaled->bits = scaled->canvas.bits();
+            scaled->rowCount = 0;
+        }
+    } else if (rowCount <= mPartialImageRowCount) {
+        return;
+    }
+
+    const int oldRowCount = mPartialImageRowCount;
+    mPartialImageRowCount = rowCount;
+    fillPartialScaledImage(mPartialThird, Third, rowCount);
+    fillPartialScaledImage(mPartialSixth, Sixth, rowCount);
+
+    mOriginalImage = topRows(mPartialImage, rowCount);
+    mThirdScaledImage = topRows(mPartialThird.canvas, mPartialThird.rowCount);
+    mSixthScaledImage = topRows(mPartialSixth.canvas, mPartialSixth.rowCount);
+
+    if (newImage) {
+        mTileFormat = ImageUtils::displayFormat(mOriginalImage);
+        resetDisplayTransform();
+    } else {
+        fillPartialPreviewImage();
+        invalidateTilesFromRow(oldRowCount);
+    }
+}
+
+void RasterImageItem::fillPartialScaledImage(PartialScaledImage &scaled, qreal factor, int sourceRowCount)
+{
+    const int canvasHeight = scaled.canvas.height();
+    const int lastRow = sourceRowCount == mPartialImage.height() ? canvasHeight : qMin(canvasHeight, int(sourceRowCount * factor));
+    if (lastRow <= scaled.rowCount) {
+        return;
+    }
+    const int sourceTop = int(scaled.rowCount / factor);
+    const int sourceBottom = qMin(sourceRowCount, int(std::ceil(lastRow / factor)));
+    const QImage band = mPartialImage.copy(0, sourceTop, mPartialImage.width(), sourceBottom - sourceTop)
+                            .scaled(scaled.canvas.width(), lastRow - scaled.rowCount, Qt::IgnoreAspectRatio, Qt::SmoothTransformation)
+                            .convertedTo(scaled.canvas.format());
+    const qsizetype bytesPerLine = scaled.canvas.bytesPerLine();
+    for (int row = 0; row < band.height(); ++row) {
+        memcpy(scaled.bits + (scaled.rowCount + row) * bytesPerLine, band.constScanLine(row), qMin(bytesPerLine, band.bytesPerLine()));
+    }
+    scaled.rowCount = lastRow;
+}
+
+void RasterImageItem::invalidateTiles()
+{
+    mTiles.clear();
+    mPendingTiles.clear();
+    ++mTileRequestState->generation;
+    update();
+}
+
+void RasterImageItem::invalidateTilesFromRow(int row)
+{
+    // Tiles are prepared from a slightly larger area of the image, see
+    // renderTile()
+    const qreal firstInvalidRow = qMax(0, row - 2);
+    const auto isInvalid = [firstInvalidRow](const RasterImageTileKey &key) {
+        return (key.y + 1) * TileSize > firstInvalidRow * key.zoom / 1000000.0;
+    };
+    const QList<RasterImageTileKey> keys = mTiles.keys();
+    for (const RasterImageTileKey &key : keys) {
+        if (isInvalid(key)) {
+            mTiles.remove(key);
+        }
+    }
+    // Tiles being prepared from fewer rows are requested again, the others
+    // are still good
+    mPendingTiles.removeIf([&isInvalid](QHash<RasterImageTileKey, quint64>::iterator it) {
+        return isInvalid(it.key());
+    });
+    update();
+}
+
+QRect RasterImageItem::sourceImageRect() const
+{
+    if (mRegionDecoder) {
+        return QRect{QPoint{0, 0}, mRegionDecoder->size()};
+    }
+    return mOriginalImage.rect();
 }
 
 void RasterImageItem::paint(QPainter *painter, const QStyleOptionGraphicsItem * /*option*/, QWidget * /*widget*/)
 {
-    if (mOriginalImage.isNull() || mThirdScaledImage.isNull() || mSixthScaledImage.isNull()) {
+    if (mRegionDecoder ? mOverviewImage.isNull() : (mOriginalImage.isNull() || mThirdScaledImage.isNull() || mSixthScaledImage.isNull())) {
         return;
     }
 
+    QElapsedTimer timer;
+    timer.start();
+
     const auto dpr = mParentView->devicePixelRatio();
     const auto zoom = mParentView->zoom();
+    const qint64 currentZoomKey = zoomKey(zoom);
+
+    // Let workers skip requests made for a previous zoom level
+    mTileRequestState->zoom = currentZoomKey;
 
     // This assumes we always have at least a single view of the graphics scene,
     // which should be true when painting a graphics item.
@@ -95,111 +377,254 @@ void RasterImageItem::paint(QPainter *painter, const QStyleOptionGraphicsItem *
 
     // Constrain the visible area rect by the image's rect so we don't try to
     // copy pixels that are outside the image.
-    imageRect = imageRect.intersected(mOriginalImage.rect());
+    const QRect sourceRect = sourceImageRect();
+    imageRect = imageRect.intersected(sourceRect);
+    if (imageRect.isEmpty()) {
+        return;
+    }
 
-    QImage image;
-    qreal targetZoom = zoom;
-
-    // Copy the visible area from the document's image into a new image. This
-    // allows us to modify the resulting image without affecting the original
-    // image data. If we are zoomed out far enough, we instead use one of the
-    // cached scaled copies to avoid having to copy a lot of data.
-    if (zoom > Third) {
-        image = mOriginalImage.copy(imageRect);
-    } else if (zoom > Sixth) {
-        auto sourceRect = QRect{imageRect.topLeft() * Third, imageRect.size() * Third};
-        targetZoom = zoom / Third;
-        image = mThirdScaledImage.copy(sourceRect);
-    } else {
-        auto sourceRect = QRect{imageRect.topLeft() * Sixth, imageRect.size() * Sixth};
-        targetZoom = zoom / Sixth;
-        image = mSixthScaledImage.copy(sourceRect);
+    // Work in the coordinates of the image scaled to the current zoom, in
+    // device pixels. This is the space the tile grid is defined in.
+    const QRect scaledImageRect{0, 0, int(std::ceil(sourceRect.width() * zoom)), int(std::ceil(sourceRect.height() * zoom))};
+    const QRect visibleRect = QRectF{imageRect.topLeft() * zoom, imageRect.size() * zoom}.toAlignedRect().intersected(scaledImageRect);
+    if (visibleRect.isEmpty()) {
+        return;
     }
 
-    const bool isIndexedColor = image.colorCount() > 0;
+    // Animated images change every frame, tiles would never get reused and
+    // showing the preview in the meantime would make the animation flicker.
+    const bool renderSynchronously = mParentView->document() && mParentView->document()->isAnimated();
+
+    const int firstColumn = visibleRect.left() / TileSize;
+    const int lastColumn = visibleRect.right() / TileSize;
+    const int firstRow = visibleRect.top() / TileSize;
+    const int lastRow = visibleRect.bottom() / TileSize;
+
+    for (int row = firstRow; row <= lastRow; ++row) {
+        for (int column = firstColumn; column <= lastColumn; ++column) {
+            const RasterImageTileKey key{currentZoomKey, column, row};
+            const QRect tileRect = QRect{column * TileSize, row * TileSize, TileSize, TileSize}.intersected(scaledImageRect);
+            const QRectF destinationRect{QPointF(tileRect.topLeft()) / dpr, QSizeF(tileRect.size()) / dpr};
+
+            const QImage *tile = mTiles.object(key);
+            if (!tile && renderSynchronously) {
+                const QImage image = renderTile(createTileJob(tileRect, zoom));
+                if (!image.isNull()) {
+                    mTiles.insert(key, new QImage(image), qMax(qsizetype(1), image.sizeInBytes() / 1024));
+                    tile = mTiles.object(key);
+                }
+            }
+
+            if (tile) {
+                painter->drawImage(destinationRect, *tile);
+            } else {
+                drawFallback(painter, destinationRect, tileRect, zoom);
+                requestTile(key, tileRect, zoom);
+                ++mPaintStatistics.missingTileCount;
+            }
+        }
+    }
+    mPaintStatistics.tileCount += (lastRow - firstRow + 1) * (lastColumn - firstColumn + 1);
+
+    if (mRegionDecoder && zoom > mOverviewZoom) {
+        // Decoding tiles takes a while, prepare the ones around the visible
+        // area so that they are ready when scrolling
+        const int lastGridColumn = (scaledImageRect.width() - 1) / TileSize;
+        const int lastGridRow = (scaledImageRect.height() - 1) / TileSize;
+        for (int row = qMax(0, firstRow - 1); row <= qMin(lastGridRow, lastRow + 1); ++row) {
+            for (int column = qMax(0, firstColumn - 1); column <= qMin(lastGridColumn, lastColumn + 1); ++column) {
+                const RasterImageTileKey key{currentZoomKey, column, row};
+                if (!mTiles.contains(key)) {
+                    requestTile(key, QRect{column * TileSize, row * TileSize, TileSize, TileSize}.intersected(scaledImageRect), zoom);
+                }
+            }
+        }
+    }
 
-    QImage::Format outputImageFormat = image.format();
-    if (isIndexedColor) {
-        outputImageFormat = image.hasAlphaChannel() ? QImage::Format_ARGB32 : QImage::Format_RGB32;
-    } else {
-        switch (outputImageFormat) {
-        case QImage::Format_ARGB32_Premultiplied:
-            outputImageFormat = QImage::Format_ARGB32;
-            break;
-        case QImage::Format_RGBA8888_Premultiplied:
-            outputImageFormat = QImage::Format_RGBA8888;
-            break;
-        case QImage::Format_RGBA64_Premultiplied:
-            outputImageFormat = QImage::Format_RGBA64;
-            break;
-        // TODO convert formats not supported by LittleCMS?
-        default:;
+    ++mPaintStatistics.paintCount;
+    mPaintStatistics.elapsedNsecs += timer.nsecsElapsed();
+}
+
+RasterImageItem::PaintStatistics RasterImageItem::paintStatistics() const
+{
+    return mPaintStatistics;
+}
+
+QRectF RasterImageItem::boundingRect() const
+{
+    return QRectF{QPointF{0, 0}, mParentView->documentSize() * mParentView->zoom()};
+}
+
+RasterImageItem::TileJob RasterImageItem::createTileJob(const QRect &tileRect, qreal zoom) const
+{
+    TileJob job;
+    job.tileRect = tileRect;
+    job.format = mTileFormat;
+    job.displayTransform = mApplyDisplayTransform ? mDisplayTransform : DisplayTransform();
+
+    // If we are zoomed out far enough, use one of the cached scaled copies to
+    // avoid having to copy a lot of data.
+    if (mRegionDecoder) {
+        if (zoom > mOverviewZoom) {
+            job.regionDecoder = mRegionDecoder;
+            job.sourceZoom = zoom;
+        } else {
+            job.source = mOverviewImage;
+            job.sourceZoom = zoom / mOverviewZoom;
         }
+    } else if (zoom > Third) {
+        job.source = mOriginalImage;
+        job.sourceZoom = zoom;
+    } else if (zoom > Sixth) {
+        job.source = mThirdScaledImage;
+        job.sourceZoom = zoom / Third;
+    } else {
+        job.source = mSixthScaledImage;
+        job.sourceZoom = zoom / Sixth;
     }
 
     // We want nearest neighbour at high zoom since that provides the most
     // accurate representation of pixels, but at low zoom or when zooming out it
     // will not look very nice, so use smoothing instead. Switch at an arbitrary
     // threshold of 400% zoom
-    const auto transformationMode = zoom < 4.0 ? Qt::SmoothTransformation : Qt::FastTransformation;
-
-    // Scale the visible image to the requested zoom.
-    image = image.scaled(image.size() * targetZoom, Qt::IgnoreAspectRatio, transformationMode);
+    job.transformationMode = zoom < 4.0 ? Qt::SmoothTransformation : Qt::FastTransformation;
+    return job;
+}
 
-    // We may load an image in indexed color or premultiplied alpha, or scaling may produce premultiplied alpha.
-    // These are not supported by the color correction engine, so convert to a standard format.
-    if (image.format() != outputImageFormat) {
-        image.convertTo(outputImageFormat);
+void RasterImageItem::requestTile(const RasterImageTileKey &key, const QRect &tileRect, qreal zoom)
+{
+    if (mPendingTiles.contains(key)) {
+        return;
     }
+    TileJob job = createTileJob(tileRect, zoom);
+    const bool regionDecode = bool(job.regionDecoder);
+    if (regionDecode) {
+        if (mRegionDecodeCount >= MaxRegionDecodeCount) {
+            // Requested again by the repaint following a finished decode
+            mRegionDecodeDeferred = true;
+            return;
+        }
+        ++mRegionDecodeCount;
+    }
+    const quint64 request = ++mLastTileRequest;
+    mPendingTiles.insert(key, request);
+
+    const int generation = mTileRequestState->generation;
+    QtConcurrent::run(sTilePool(), [job = std::move(job), state = mTileRequestState, key, generation]() {
+        if (state->generation != generation || state->zoom != key.zoom) {
+            // The image changed or the user zoomed since the request was made
+            return QImage();
+        }
+        return renderTile(job);
+    }).then(mParentView, [this, key, generation, request, tileRect, regionDecode](const QImage &image) {
+        if (regionDecode) {
+            --mRegionDecodeCount;
+            if (mRegionDecodeDeferred) {
+                mRegionDecodeDeferred = false;
+                update();
+            }
+        }
+        if (mTileRequestState->generation != generation) {
+            return;
+        }
+        const auto it = mPendingTiles.constFind(key);
+        if (it == mPendingTiles.constEnd() || it.value() != request) {
+            // The tile has been invalidated since the request was made
+            return;
+        }
+        mPendingTiles.erase(it);
+        if (image.isNull()) {
+            return;
+        }
+        mTiles.insert(key, new QImage(image), qMax(qsizetype(1), image.sizeInBytes() / 1024));
+        if (key.zoom == zoomKey(mParentView->zoom())) {
+            const qreal dpr = mParentView->devicePixelRatio();
+            update(QRectF{QPointF(tileRect.topLeft()) / dpr, QSizeF(tileRect.size()) / dpr});
+        }
+    });
+}
 
-    // Perform color correction on the visible image.
-    applyDisplayTransform(image);
-
-    const auto destinationRect = QRectF{QPointF{std::ceil(imageRect.left() * (zoom / dpr)), std::ceil(imageRect.top() * (zoom / dpr))},
-                                        QSizeF{image.size().width() / dpr, image.size().height() / dpr}};
+void RasterImageItem::drawFallback(QPainter *painter, const QRectF &destinationRect, const QRect &tileRect, qreal zoom) const
+{
+    if (mPreviewImage.isNull()) {
+        return;
+    }
+    const qreal previewZoom = zoom / mPreviewZoom;
+    const QRectF sourceRect{tileRect.x() / previewZoom, tileRect.y() / previewZoom, tileRect.width() / previewZoom, tileRect.height() / previewZoom};
+    painter->save();
+    painter->setRenderHint(QPainter::SmoothPixmapTransform);
+    painter->drawImage(destinationRect, mPreviewImage, sourceRect);
+    painter->restore();
+}
 
-    painter->drawImage(destinationRect, image);
+void RasterImageItem::updatePreviewImage()
+{
+    mPreviewImage = QImage();
+    if (mTileFormat == QImage::Format_Invalid) {
+        return;
+    }
+    if (mParentView->document() && mParentView->document()->isAnimated()) {
+        // Tiles of animated documents are rendered when painting, see paint()
+        return;
+    }
+    mPreviewZoom = mRegionDecoder ? mOverviewZoom : Sixth;
+    if (!mPartialImage.isNull()) {
+        // Filled as rows get decoded
+        mPartialPreview.canvas = QImage(mPartialSixth.canvas.size(), mTileFormat);
+        mPartialPreview.bits = mPartialPreview.canvas.bits();
+        mPartialPreview.rowCount = 0;
+        fillPartialPreviewImage();
+        return;
+    }
+    const QImage &source = mRegionDecoder ? mOverviewImage : mSixthScaledImage;
+    if (source.isNull()) {
+        return;
+    }
+    mPreviewImage = source.convertedTo(mTileFormat);
+    applyDisplayTransform(mPreviewImage);
 }
 
-QRectF RasterImageItem::boundingRect() const
+void RasterImageItem::fillPartialPreviewImage()
 {
-    return QRectF{QPointF{0, 0}, mParentView->documentSize() * mParentView->zoom()};
+    // Only convert and color correct the rows scaled since the last call
+    const int lastRow = mPartialSixth.rowCount;
+    if (mPartialPreview.canvas.isNull() || lastRow <= mPartialPreview.rowCount) {
+        return;
+    }
+    QImage rows = mPartialSixth.canvas.copy(0, mPartialPreview.rowCount, mPartialSixth.canvas.width(), lastRow - mPartialPreview.rowCount);
+    rows.convertTo(mTileFormat);
+    applyDisplayTransform(rows);
+    const qsizetype bytesPerLine = mPartialPreview.canvas.bytesPerLine();
+    for (int row = 0; row < rows.height(); ++row) {
+        memcpy(mPartialPreview.bits + (mPartialPreview.rowCount + row) * bytesPerLine, rows.constScanLine(row), qMin(bytesPerLine, rows.bytesPerLine()));
+    }
+    mPartialPreview.rowCount = lastRow;
+    mPreviewImage = topRows(mPartialPreview.canvas, lastRow);
 }
 
 void RasterImageItem::applyDisplayTransform(QImage &image)
 {
-    if (mApplyDisplayTransform) {
-        updateDisplayTransform(image.format());
-        if (mDisplayTransform) {
-            quint8 *bytes = image.bits();
-            cmsDoTransform(mDisplayTransform, bytes, bytes, image.width() * image.height());
-        }
+    if (mApplyDisplayTransform && mDisplayTransform) {
+        mDisplayTransform->apply(image);
     }
 }
 
 void RasterImageItem::updateDisplayTransform(QImage::Format format)
 {
-    if (format == QImage::Format_Invalid) {
+    if (format == QImage::Format_Invalid || !mParentView->document()) {
         return;
     }
 
     mApplyDisplayTransform = false;
-    if (mDisplayTransform) {
-        cmsDeleteTransform(mDisplayTransform);
-    }
-    mDisplayTransform = nullptr;
+    mDisplayTransform.reset();
+    mDisplayTransformProfile = mParentView->document()->cmsProfile();
 
-    Cms::Profile::Ptr profile = mParentView->document()->cmsProfile();
+    Cms::Profile::Ptr profile = mDisplayTransformProfile;
     if (!profile) {
         // The assumption that something unmarked is *probably* sRGB is better than failing to apply any transform when one
         // has a wide-gamut screen.
         profile = Cms::Profile::getSRgbProfile();
     }
-    Cms::Profile::Ptr monitorProfile = Cms::Profile::getMonitorProfile();
-    if (!monitorProfile) {
-        qCWarning(GWENVIEW_LIB_LOG) << "Could not get monitor color profile";
-        return;
-    }
 
     cmsUInt32Number cmsFormat = 0;
     switch (format) {
@@ -232,7 +657,6 @@ void RasterImageItem::updateDisplayTransform(QImage::Format format)
         return;
     }
 
-    mDisplayTransform =
-        cmsCreateTransform(profile->handle(), cmsFormat, monitorProfile->handle(), cmsFormat, mRenderingIntent, cmsFLAGS_BLACKPOINTCOMPENSATION);
-    mApplyDisplayTransform = true;
+    mDisplayTransform = Cms::TransformCache::instance()->displayTransform(profile, cmsFormat, mRenderingIntent);
+    mApplyDisplayTransform = bool(mDisplayTransform);
 }
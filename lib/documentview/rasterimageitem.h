@@ -21,14 +21,47 @@ Foundation, Inc., 51 Franklin Street, Fifth Floor, Cambridge, MA 02110-1301, USA
 #ifndef RASTERIMAGEITEM_H
 #define RASTERIMAGEITEM_H
 
+#include <QCache>
 #include <QGraphicsItem>
+#include <QHash>
+#include <QHashFunctions>
+#include <QImage>
 
+#include <atomic>
+#include <memory>
+
+#include <lib/gwenviewlib_export.h>
+
+#include "lib/cms/cmstransformcache.h"
+#include "lib/document/regiondecoder.h"
 #include "lib/renderingintent.h"
 
 namespace Gwenview
 {
 class RasterImageView;
 
+/**
+ * Identifies a tile of the image, as displayed at a given zoom level.
+ *
+ * x and y are the column and row of the tile in the grid covering the image
+ * scaled to the zoom level, zoom is the zoom level in millionths.
+ */
+struct RasterImageTileKey {
+    qint64 zoom;
+    int x;
+    int y;
+};
+
+inline bool operator==(const RasterImageTileKey &a, const RasterImageTileKey &b)
+{
+    return a.zoom == b.zoom && a.x == b.x && a.y == b.y;
+}
+
+inline size_t qHash(const RasterImageTileKey &key, size_t seed = 0)
+{
+    return qHashMulti(seed, key.zoom, key.x, key.y);
+}
+
 /**
  * A QGraphicsItem subclass responsible for rendering the main raster image.
  *
@@ -40,10 +73,32 @@ class RasterImageView;
  * For performance, two extra images are cached, one at a third of the image
  * size and one at a sixth. These are used at low zoom levels, to avoid having
  * to copy large amounts of image data that later gets discarded.
+ *
+ * The visible image is split into tiles of a fixed size in device pixels. Each
+ * tile is scaled and color corrected once, by a pool of worker threads, and
+ * kept in a cache keyed by zoom level and tile position, so that painting only
+ * needs to blit tiles which are already prepared. While a tile is not ready
+ * yet, a scaled up part of a color corrected preview of the image is drawn in
+ * its place.
+ *
+ * Images too large to be decoded at once are not available as a QImage. Their
+ * tiles are decoded from the document data using the document RegionDecoder,
+ * and a down sampled copy of the image replaces the scaled ones.
  */
-class RasterImageItem : public QGraphicsItem
+class GWENVIEWLIB_EXPORT RasterImageItem : public QGraphicsItem
 {
 public:
+    /**
+     * What paint() did since the item was created
+     */
+    struct PaintStatistics {
+        quint64 paintCount = 0;
+        quint64 tileCount = 0;
+        // Tiles which were not ready, the preview was drawn instead
+        quint64 missingTileCount = 0;
+        qint64 elapsedNsecs = 0;
+    };
+
     RasterImageItem(RasterImageView *parent);
     ~RasterImageItem() override;
 
@@ -57,6 +112,19 @@ public:
      */
     void updateCache();
 
+    /**
+     * Update the cached images with the rows of the document partial image
+     * which have been decoded since the last call. Only the decoded rows are
+     * painted.
+     */
+    void updatePartialCache();
+
+    /**
+     * Recreate the color correction transform, for example because the
+     * monitor profile changed. This drops all prepared tiles.
+     */
+    void resetDisplayTransform();
+
     /**
      * Reimplemented from QGraphicsItem::paint
      */
@@ -67,18 +135,102 @@ public:
      */
     QRectF boundingRect() const override;
 
+    PaintStatistics paintStatistics() const;
+
 private:
+    using DisplayTransform = Cms::TransformCache::Transform;
+
+    /**
+     * Everything a worker needs to prepare one tile. It only holds shallow
+     * copies, so that the item can keep changing while the tile is prepared.
+     */
+    struct TileJob;
+
+    /**
+     * State shared with the tile workers, so that they can skip requests
+     * which have become useless before starting to work on them.
+     */
+    struct TileRequestState {
+        std::atomic<int> generation{0};
+        std::atomic<qint64> zoom{0};
+    };
+
     void applyDisplayTransform(QImage &image);
     void updateDisplayTransform(QImage::Format format);
+    void updateRegionCache();
+    void updatePreviewImage();
+    void invalidateTiles();
+
+    /**
+     * The area of the image which can be painted
+     */
+    QRect sourceImageRect() const;
+    void invalidateTilesFromRow(int row);
+
+    /**
+     * A scaled down copy of the partial image, filled as rows get decoded
+     */
+    struct PartialScaledImage {
+        QImage canvas;
+        uchar *bits = nullptr;
+        int rowCount = 0;
+    };
+    void fillPartialScaledImage(PartialScaledImage &scaled, qreal factor, int sourceRowCount);
+    void fillPartialPreviewImage();
+
+    TileJob createTileJob(const QRect &tileRect, qreal zoom) const;
+    static QImage renderTile(const TileJob &job);
+    void requestTile(const RasterImageTileKey &key, const QRect &tileRect, qreal zoom);
+    void drawFallback(QPainter *painter, const QRectF &destinationRect, const QRect &tileRect, qreal zoom) const;
 
     RasterImageView *mParentView;
     bool mApplyDisplayTransform = true;
-    cmsHTRANSFORM mDisplayTransform = nullptr;
+    DisplayTransform mDisplayTransform;
+    // The document profile mDisplayTransform was created for
+    Cms::Profile::Ptr mDisplayTransformProfile;
     cmsUInt32Number mRenderingIntent = INTENT_PERCEPTUAL;
 
     QImage mOriginalImage;
     QImage mThirdScaledImage;
     QImage mSixthScaledImage;
+
+    // While the document is being decoded, the partial image and how many of
+    // its rows have been decoded. mOriginalImage and the scaled images then
+    // only show the decoded rows.
+    QImage mPartialImage;
+    int mPartialImageRowCount = 0;
+    PartialScaledImage mPartialThird;
+    PartialScaledImage mPartialSixth;
+    // Color corrected version of mPartialSixth, backing mPreviewImage
+    PartialScaledImage mPartialPreview;
+
+    // Set if the document is shown through its region decoder, then
+    // mOriginalImage and the scaled images are null. mOverviewImage is the
+    // image scaled by mOverviewZoom.
+    RegionDecoder::Ptr mRegionDecoder;
+    QImage mOverviewImage;
+    qreal mOverviewZoom = 0;
+
+    // The format tiles are converted to before applying color correction
+    QImage::Format mTileFormat = QImage::Format_Invalid;
+    // Color corrected version of mSixthScaledImage, drawn in place of tiles
+    // which are not ready yet
+    QImage mPreviewImage;
+    // Zoom of mPreviewImage, relative to the image
+    qreal mPreviewZoom = 0;
+
+    QCache<RasterImageTileKey, QImage> mTiles;
+    // The tiles being prepared, and the request preparing each of them. Only
+    // the result of that request is kept.
+    QHash<RasterImageTileKey, quint64> mPendingTiles;
+    quint64 mLastTileRequest = 0;
+    // How many of the pending tiles are decoded from the document data, and
+    // whether tiles were not requested because too many were
+    int mRegionDecodeCount = 0;
+    bool mRegionDecodeDeferred = false;
+    std::shared_ptr<TileRequestState> mTileRequestState;
+
+    PaintStatistics mPaintStatistics;
 };
 
 }
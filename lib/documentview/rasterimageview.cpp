@@ -26,6 +26,7 @@ Foundation, Inc., 51 Franklin Street, Fifth Floor, Cambridge, MA 02110-1301, USA
 #include "gwenview_lib_debug.h"
 #include "rasterimageitem.h"
 #include <lib/cms/cmsprofile.h>
+#include <lib/cms/cmstransformcache.h>
 #include <lib/documentview/abstractrasterimageviewtool.h>
 #include <lib/gvdebug.h>
 #include <lib/paintutils.h>
@@ -84,6 +85,10 @@ struct RasterImageViewPrivate {
 
     QPointer<AbstractRasterImageViewTool> mTool;
 
+    // True if the view has been set up to show the rows of a document which
+    // is still being decoded
+    bool mShowingPartialImage = false;
+
     void startAnimationIfNecessary()
     {
         if (q->document() && q->isVisible()) {
@@ -125,6 +130,8 @@ void RasterImageView::setRenderingIntent(const RenderingIntent::Enum &renderingI
 
 void RasterImageView::resetMonitorICC()
 {
+    Cms::TransformCache::instance()->resetMonitorProfile();
+    d->mImageItem->resetDisplayTransform();
     update();
 }
 
@@ -137,9 +144,17 @@ void RasterImageView::loadFromDocument()
 
     connect(doc.data(), &Document::metaInfoLoaded, this, &RasterImageView::slotDocumentMetaInfoLoaded);
     connect(doc.data(), &Document::isAnimatedUpdated, this, &RasterImageView::slotDocumentIsAnimatedUpdated);
+    connect(doc.data(), &Document::partialImageUpdated, this, &RasterImageView::slotDocumentPartialImageUpdated);
+    d->mShowingPartialImage = false;
     connect(doc.data(), &Document::imageRectUpdated, this, [this]() {
         d->mImageItem->updateCache();
     });
+    connect(doc.data(), &Document::downSampledImageReady, this, [this]() {
+        if (document()->regionDecoder()) {
+            // The item waits for a down sampled image to show the regions
+            d->mImageItem->updateCache();
+        }
+    });
 
     const Document::LoadingState state = doc->loadingState();
     if (state == Document::MetaInfoLoaded || state == Document::Loaded) {
@@ -149,6 +164,12 @@ void RasterImageView::loadFromDocument()
 
 void RasterImageView::slotDocumentMetaInfoLoaded()
 {
+    if (document()->regionDecoder()) {
+        // Too large to be decoded at once, RasterImageItem decodes what is
+        // shown
+        QMetaObject::invokeMethod(this, &RasterImageView::finishSetDocument, Qt::QueuedConnection);
+        return;
+    }
     if (document()->size().isValid() && document()->image().format() != QImage::Format_Invalid) {
         QMetaObject::invokeMethod(this, &RasterImageView::finishSetDocument, Qt::QueuedConnection);
     } else {
@@ -159,6 +180,22 @@ void RasterImageView::slotDocumentMetaInfoLoaded()
     }
 }
 
+void RasterImageView::slotDocumentPartialImageUpdated()
+{
+    if (document()->partialImage().isNull()) {
+        return;
+    }
+    if (d->mShowingPartialImage) {
+        d->mImageItem->updatePartialCache();
+        return;
+    }
+    // Do not wait for the image to be loaded to show it. The view is set up
+    // now, the loaded image only has to replace the partial one.
+    d->mShowingPartialImage = true;
+    disconnect(document().data(), &Document::loaded, this, &RasterImageView::finishSetDocument);
+    finishSetDocument();
+}
+
 void RasterImageView::finishSetDocument()
 {
     GV_RETURN_IF_FAIL(document()->size().isValid());
@@ -70,6 +70,7 @@ protected:
 private Q_SLOTS:
     void slotDocumentMetaInfoLoaded();
     void slotDocumentIsAnimatedUpdated();
+    void slotDocumentPartialImageUpdated();
     void finishSetDocument();
 
 private:
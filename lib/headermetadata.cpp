@@ -0,0 +1,463 @@
+// SPDX-FileCopyrightText: 2026 Gwenview Developers
+// SPDX-License-Identifier: GPL-2.0-or-later
+
+// Self
+#include "headermetadata.h"
+
+// Qt
+#include <QBuffer>
+#include <QFile>
+#include <QMap>
+#include <QRegularExpression>
+#include <QtEndian>
+
+// Local
+#include "gwenview_lib_debug.h"
+
+namespace Gwenview
+{
+#undef ENABLE_LOG
+#undef LOG
+// #define ENABLE_LOG
+#ifdef ENABLE_LOG
+#define LOG(x) qCDebug(GWENVIEW_LIB_LOG) << x
+#else
+#define LOG(x) ;
+#endif
+
+// Larger segments and chunks are ignored, they are not worth reading
+static const qint64 MAX_SEGMENT_SIZE = 16 * 1024 * 1024;
+
+// Protects against corrupted files
+static const int MAX_IFD_ENTRY_COUNT = 1000;
+
+static QByteArray readAt(QIODevice *device, qint64 pos, qint64 size)
+{
+    if (pos < 0 || size < 0 || size > MAX_SEGMENT_SIZE || !device->seek(pos)) {
+        return {};
+    }
+    const QByteArray data = device->read(size);
+    return data.size() == size ? data : QByteArray();
+}
+
+static QDateTime parseExifDateTime(const QByteArray &value)
+{
+    // Exif strings are NUL terminated
+    const QByteArray string = value.left(value.indexOf('\0')).trimmed();
+    return QDateTime::fromString(QString::fromLatin1(string), QStringLiteral("yyyy:MM:dd hh:mm:ss"));
+}
+
+static Orientation orientationFromValue(uint value)
+{
+    return value >= NORMAL && value <= ROT_270 ? Orientation(value) : NOT_AVAILABLE;
+}
+
+/**
+ * zlib data, as found in PNG chunks
+ */
+static QByteArray inflate(const QByteArray &data)
+{
+    // qUncompress() wants the uncompressed size first. It is only a hint: the
+    // buffer grows if it is too small.
+    QByteArray input(4, '\0');
+    qToBigEndian<quint32>(quint32(qMin(data.size() * 4, MAX_SEGMENT_SIZE)), input.data());
+    input += data;
+    return qUncompress(input);
+}
+
+//- TIFF -----------------------------------------------------------------------
+namespace
+{
+enum TiffTag {
+    ImageWidthTag = 0x0100,
+    ImageLengthTag = 0x0101,
+    OrientationTag = 0x0112,
+    DateTimeTag = 0x0132,
+    RatingTag = 0x4746,
+    ExifIfdTag = 0x8769,
+    InterColorProfileTag = 0x8773,
+    DateTimeOriginalTag = 0x9003,
+    DateTimeDigitizedTag = 0x9004,
+};
+
+struct TiffEntry {
+    quint16 tag;
+    quint16 type;
+    quint32 count;
+    // The value if it fits in 4 bytes, its offset otherwise
+    QByteArray value;
+};
+
+/**
+ * Reads the IFDs of TIFF data starting at mBase in mDevice, without reading
+ * anything else
+ */
+class TiffReader
+{
+public:
+    TiffReader(QIODevice *device, qint64 base)
+        : mDevice(device)
+        , mBase(base)
+    {
+    }
+
+    /**
+     * Reads the header, returns the offset of the first IFD or 0
+     */
+    quint32 readHeader()
+    {
+        const QByteArray header = readAt(mDevice, mBase, 8);
+        if (header.startsWith("II")) {
+            mLittleEndian = true;
+        } else if (header.startsWith("MM")) {
+            mLittleEndian = false;
+        } else {
+            return 0;
+        }
+        // BigTIFF files use 43 and a different layout
+        if (uint16(header.constData() + 2) != 42) {
+            return 0;
+        }
+        return uint32(header.constData() + 4);
+    }
+
+    QList<TiffEntry> readIfd(quint32 offset)
+    {
+        const QByteArray countData = readAt(mDevice, mBase + offset, 2);
+        if (countData.isEmpty()) {
+            return {};
+        }
+        const int count = uint16(countData.constData());
+        if (count > MAX_IFD_ENTRY_COUNT) {
+            return {};
+        }
+        const QByteArray entryData = readAt(mDevice, mBase + offset + 2, count * 12);
+        if (entryData.isEmpty()) {
+            return {};
+        }
+        QList<TiffEntry> entries;
+        entries.reserve(count);
+        for (int idx = 0; idx < count; ++idx) {
+            const char *entry = entryData.constData() + idx * 12;
+            entries << TiffEntry{uint16(entry), uint16(entry + 2), uint32(entry + 4), QByteArray(entry + 8, 4)};
+        }
+        return entries;
+    }
+
+    /**
+     * The value of a SHORT or LONG entry
+     */
+    uint uintValue(const TiffEntry &entry) const
+    {
+        switch (entry.type) {
+        case 3:
+            return uint16(entry.value.constData());
+        case 4:
+            return uint32(entry.value.constData());
+        default:
+            return 0;
+        }
+    }
+
+    /**
+     * The value of an ASCII, BYTE or UNDEFINED entry
+     */
+    QByteArray byteValue(const TiffEntry &entry)
+    {
+        if (entry.type != 1 && entry.type != 2 && entry.type != 7) {
+            return {};
+        }
+        if (entry.count <= 4) {
+            return entry.value.left(entry.count);
+        }
+        return readAt(mDevice, mBase + uint32(entry.value.constData()), entry.count);
+    }
+
+private:
+    quint16 uint16(const char *data) const
+    {
+        return mLittleEndian ? qFromLittleEndian<quint16>(data) : qFromBigEndian<quint16>(data);
+    }
+
+    quint32 uint32(const char *data) const
+    {
+        return mLittleEndian ? qFromLittleEndian<quint32>(data) : qFromBigEndian<quint32>(data);
+    }
+
+    QIODevice *mDevice;
+    qint64 mBase;
+    bool mLittleEndian = true;
+};
+
+} // namespace
+
+/**
+ * Reads TIFF data starting at @p base in @p device. The size is only read if
+ * @p readSize is true: the first IFD describes the image in TIFF files, but
+ * not in the Exif data of other formats.
+ */
+static bool loadTiff(QIODevice *device, qint64 base, bool readSize, HeaderMetaData *metaData)
+{
+    TiffReader reader(device, base);
+    const quint32 ifdOffset = reader.readHeader();
+    if (ifdOffset == 0) {
+        return false;
+    }
+
+    // Ordered like the tags to try
+    QDateTime dateTimeOriginal, dateTimeDigitized, dateTime;
+    quint32 exifIfdOffset = 0;
+    for (const TiffEntry &entry : reader.readIfd(ifdOffset)) {
+        switch (entry.tag) {
+        case ImageWidthTag:
+            if (readSize) {
+                metaData->size.setWidth(reader.uintValue(entry));
+            }
+            break;
+        case ImageLengthTag:
+            if (readSize) {
+                metaData->size.setHeight(reader.uintValue(entry));
+            }
+            break;
+        case OrientationTag:
+            metaData->orientation = orientationFromValue(reader.uintValue(entry));
+            break;
+        case DateTimeTag:
+            dateTime = parseExifDateTime(reader.byteValue(entry));
+            break;
+        case RatingTag:
+            metaData->rating = qBound(0, int(reader.uintValue(entry)), 5);
+            break;
+        case DateTimeOriginalTag:
+            dateTimeOriginal = parseExifDateTime(reader.byteValue(entry));
+            break;
+        case ExifIfdTag:
+            exifIfdOffset = reader.uintValue(entry);
+            break;
+        case InterColorProfileTag:
+            metaData->iccProfile = reader.byteValue(entry);
+            break;
+        }
+    }
+
+    if (exifIfdOffset != 0) {
+        for (const TiffEntry &entry : reader.readIfd(exifIfdOffset)) {
+            if (entry.tag == DateTimeOriginalTag) {
+                dateTimeOriginal = parseExifDateTime(reader.byteValue(entry));
+            } else if (entry.tag == DateTimeDigitizedTag) {
+                dateTimeDigitized = parseExifDateTime(reader.byteValue(entry));
+            }
+        }
+    }
+
+    for (const QDateTime &candidate : {dateTimeOriginal, dateTimeDigitized, dateTime}) {
+        if (candidate.isValid()) {
+            metaData->dateTime = candidate;
+            break;
+        }
+    }
+    return true;
+}
+
+static void loadExif(const QByteArray &exif, HeaderMetaData *metaData)
+{
+    QByteArray data = exif;
+    QBuffer buffer(&data);
+    buffer.open(QIODevice::ReadOnly);
+    loadTiff(&buffer, 0, false /* readSize */, metaData);
+}
+
+//- XMP ------------------------------------------------------------------------
+static QByteArray xmpProperty(const QByteArray &xmp, const char *name)
+{
+    // Properties are either attributes or elements
+    const QRegularExpression regex(QStringLiteral("%1(?:=\"|>)([^\"<]*)").arg(QRegularExpression::escape(QLatin1String(name))));
+    const QRegularExpressionMatch match = regex.match(QString::fromUtf8(xmp));
+    return match.hasMatch() ? match.captured(1).trimmed().toUtf8() : QByteArray();
+}
+
+/**
+ * Fills what Exif data did not tell
+ */
+static void loadXmp(const QByteArray &xmp, HeaderMetaData *metaData)
+{
+    if (metaData->orientation == NOT_AVAILABLE) {
+        metaData->orientation = orientationFromValue(xmpProperty(xmp, "tiff:Orientation").toUInt());
+    }
+    if (metaData->rating == -1) {
+        bool ok;
+        // -1 means rejected
+        const int rating = xmpProperty(xmp, "xmp:Rating").toInt(&ok);
+        if (ok) {
+            metaData->rating = qBound(0, rating, 5);
+        }
+    }
+    if (!metaData->dateTime.isValid()) {
+        for (const char *name : {"exif:DateTimeOriginal", "xmp:CreateDate", "xmp:ModifyDate"}) {
+            // Keep the local time, like Exif dates
+            const QByteArray value = xmpProperty(xmp, name).left(19);
+            const QDateTime dateTime = QDateTime::fromString(QString::fromLatin1(value), Qt::ISODate);
+            if (dateTime.isValid()) {
+                metaData->dateTime = dateTime;
+                break;
+            }
+        }
+    }
+}
+
+//- JPEG -----------------------------------------------------------------------
+static bool loadJpeg(QIODevice *device, HeaderMetaData *metaData)
+{
+    static const QByteArray exifSignature("Exif\0\0", 6);
+    static const QByteArray xmpSignature("http://ns.adobe.com/xap/1.0/\0", 29);
+    static const QByteArray iccSignature("ICC_PROFILE\0", 12);
+
+    QByteArray xmp;
+    // ICC profiles are split in numbered chunks
+    QMap<int, QByteArray> iccChunks;
+    int iccChunkCount = 0;
+
+    qint64 pos = 2;
+    while (true) {
+        const QByteArray header = readAt(device, pos, 4);
+        if (header.isEmpty() || uchar(header.at(0)) != 0xff) {
+            break;
+        }
+        const uchar marker = header.at(1);
+        if (marker == 0xff) {
+            // Fill byte
+            ++pos;
+            continue;
+        }
+        if (marker == 0x01 || (marker >= 0xd0 && marker <= 0xd8)) {
+            // No segment
+            pos += 2;
+            continue;
+        }
+        if (marker == 0xda || marker == 0xd9) {
+            // Start of scan or end of image: no more metadata
+            break;
+        }
+        const qint64 length = qFromBigEndian<quint16>(header.constData() + 2);
+        const qint64 dataPos = pos + 4;
+        const qint64 dataSize = length - 2;
+
+        if (marker == 0xe1) {
+            const QByteArray data = readAt(device, dataPos, dataSize);
+            if (data.startsWith(exifSignature)) {
+                loadExif(data.mid(exifSignature.size()), metaData);
+            } else if (data.startsWith(xmpSignature)) {
+                xmp = data.mid(xmpSignature.size());
+            }
+        } else if (marker == 0xe2) {
+            const QByteArray data = readAt(device, dataPos, dataSize);
+            if (data.startsWith(iccSignature) && data.size() > iccSignature.size() + 2) {
+                iccChunks[uchar(data.at(iccSignature.size()))] = data.mid(iccSignature.size() + 2);
+                iccChunkCount = uchar(data.at(iccSignature.size() + 1));
+            }
+        } else if (marker >= 0xc0 && marker <= 0xcf && marker != 0xc4 && marker != 0xc8 && marker != 0xcc) {
+            // Start of frame: precision, height and width
+            const QByteArray data = readAt(device, dataPos, 5);
+            if (!data.isEmpty()) {
+                metaData->size = QSize(qFromBigEndian<quint16>(data.constData() + 3), qFromBigEndian<quint16>(data.constData() + 1));
+            }
+        }
+        pos += 2 + length;
+    }
+
+    if (iccChunkCount > 0 && iccChunks.size() == iccChunkCount) {
+        for (const QByteArray &chunk : std::as_const(iccChunks)) {
+            metaData->iccProfile += chunk;
+        }
+    }
+    if (!xmp.isEmpty()) {
+        loadXmp(xmp, metaData);
+    }
+    return true;
+}
+
+//- PNG ------------------------------------------------------------------------
+static bool loadPng(QIODevice *device, HeaderMetaData *metaData)
+{
+    QByteArray xmp;
+    qint64 pos = 8;
+    while (true) {
+        const QByteArray header = readAt(device, pos, 8);
+        if (header.isEmpty()) {
+            break;
+        }
+        const qint64 length = qFromBigEndian<quint32>(header.constData());
+        const QByteArray type = header.mid(4);
+        if (type == "IDAT" || type == "IEND") {
+            // Metadata stored after the image data is not worth going through
+            // the image data
+            break;
+        }
+        const qint64 dataPos = pos + 8;
+
+        if (type == "IHDR") {
+            const QByteArray data = readAt(device, dataPos, 8);
+            if (!data.isEmpty()) {
+                metaData->size = QSize(qFromBigEndian<quint32>(data.constData()), qFromBigEndian<quint32>(data.constData() + 4));
+            }
+        } else if (type == "eXIf") {
+            loadExif(readAt(device, dataPos, length), metaData);
+        } else if (type == "iCCP") {
+            // Profile name, compression method, compressed profile
+            const QByteArray data = readAt(device, dataPos, length);
+            const qsizetype nameEnd = data.indexOf('\0');
+            if (nameEnd != -1) {
+                metaData->iccProfile = inflate(data.mid(nameEnd + 2));
+            }
+        } else if (type == "iTXt") {
+            // Keyword, compression flag and method, language tag, translated
+            // keyword, text
+            const QByteArray data = readAt(device, dataPos, length);
+            if (data.startsWith(QByteArrayLiteral("XML:com.adobe.xmp\0")) && data.size() > 19) {
+                const bool compressed = data.at(18) != 0;
+                const qsizetype languageEnd = data.indexOf('\0', 20);
+                const qsizetype keywordEnd = languageEnd == -1 ? -1 : data.indexOf('\0', languageEnd + 1);
+                if (keywordEnd != -1) {
+                    const QByteArray text = data.mid(keywordEnd + 1);
+                    xmp = compressed ? inflate(text) : text;
+                }
+            }
+        }
+        pos += 12 + length;
+    }
+
+    if (!xmp.isEmpty()) {
+        loadXmp(xmp, metaData);
+    }
+    return true;
+}
+
+bool HeaderMetaData::load(QIODevice *device, HeaderMetaData *metaData)
+{
+    *metaData = HeaderMetaData();
+    const QByteArray signature = readAt(device, 0, 8);
+    if (signature.startsWith("\xff\xd8")) {
+        return loadJpeg(device, metaData);
+    }
+    if (signature == "\x89PNG\r\n\x1a\n") {
+        return loadPng(device, metaData);
+    }
+    if (signature.startsWith(QByteArrayView("II*\0", 4)) || signature.startsWith(QByteArrayView("MM\0*", 4))) {
+        return loadTiff(device, 0, true /* readSize */, metaData);
+    }
+    LOG("Unsupported format");
+    return false;
+}
+
+bool HeaderMetaData::load(const QString &path, HeaderMetaData *metaData)
+{
+    QFile file(path);
+    if (!file.open(QIODevice::ReadOnly)) {
+        qCWarning(GWENVIEW_LIB_LOG) << "Could not open" << path;
+        *metaData = HeaderMetaData();
+        return false;
+    }
+    return load(&file, metaData);
+}
+
+} // namespace
@@ -0,0 +1,55 @@
+// SPDX-FileCopyrightText: 2026 Gwenview Developers
+// SPDX-License-Identifier: GPL-2.0-or-later
+
+#ifndef HEADERMETADATA_H
+#define HEADERMETADATA_H
+
+#include <lib/gwenviewlib_export.h>
+
+// Qt
+#include <QByteArray>
+#include <QDateTime>
+#include <QSize>
+
+// Local
+#include <lib/orientation.h>
+
+class QIODevice;
+class QString;
+
+namespace Gwenview
+{
+/**
+ * The meta information needed when going through many files, read from the
+ * file structure without creating an Exiv2::Image, which parses all the
+ * metadata and may go through the whole file.
+ *
+ * Only the parts which can hold this information are read: the APP1 and APP2
+ * segments of JPEG files, the first IFD and the Exif IFD of TIFF files and of
+ * raw formats based on TIFF, and the chunks coming before the image data in
+ * PNG files. XMP data is used for what Exif data does not tell.
+ */
+struct GWENVIEWLIB_EXPORT HeaderMetaData {
+    Orientation orientation = NOT_AVAILABLE;
+    /// When the picture was taken, or last modified if that is unknown
+    QDateTime dateTime;
+    /// The size of the image as stored, before applying the orientation. For
+    /// raw formats, this may be the size of a preview.
+    QSize size;
+    QByteArray iccProfile;
+    /// From 0 to 5, -1 if unknown
+    int rating = -1;
+
+    /**
+     * Reads the meta information of the image in @p device, which must be
+     * open and seekable, into @p metaData. Returns false if the format of the
+     * image is not one of the supported ones, the caller then has to find the
+     * information some other way.
+     */
+    static bool load(QIODevice *device, HeaderMetaData *metaData);
+    static bool load(const QString &path, HeaderMetaData *metaData);
+};
+
+} // namespace
+
+#endif /* HEADERMETADATA_H */
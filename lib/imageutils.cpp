@@ -21,6 +21,7 @@ Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.
 #include "imageutils.h"
 
 // Qt
+#include <QColorSpace>
 #include <QTransform>
 
 namespace Gwenview
@@ -69,5 +70,40 @@ QTransform transformMatrix(Orientation orientation)
     return matrix;
 }
 
+QImage::Format displayFormat(const QImage &image)
+{
+    if (image.colorCount() > 0) {
+        return image.hasAlphaChannel() ? QImage::Format_ARGB32 : QImage::Format_RGB32;
+    }
+    switch (image.format()) {
+    case QImage::Format_ARGB32_Premultiplied:
+        return QImage::Format_ARGB32;
+    case QImage::Format_RGBA8888_Premultiplied:
+        return QImage::Format_RGBA8888;
+    case QImage::Format_RGBA64_Premultiplied:
+        return QImage::Format_RGBA64;
+    // TODO convert formats not supported by LittleCMS?
+    default:
+        return image.format();
+    }
+}
+
+void convertForDisplay(QImage &image)
+{
+    if (image.isNull()) {
+        return;
+    }
+    // Unpremultiplying keeps the pixel size, QImage does it in place
+    const QImage::Format format = displayFormat(image);
+    if (image.format() != format) {
+        image.convertTo(format);
+    }
+    // Applies the transform to the pixels of image, rather than to a copy
+    // like convertedToColorSpace() does
+    if (image.colorSpace().isValid() && image.colorSpace() != QColorSpace::SRgb) {
+        image.convertToColorSpace(QColorSpace::SRgb);
+    }
+}
+
 } // namespace
 } // namespace
@@ -24,6 +24,9 @@ Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.
 #include <lib/gwenviewlib_export.h>
 #include <lib/orientation.h>
 
+// Qt
+#include <QImage>
+
 class QTransform;
 
 namespace Gwenview
@@ -32,6 +35,19 @@ namespace ImageUtils
 {
 GWENVIEWLIB_EXPORT QTransform transformMatrix(Orientation);
 
+/**
+ * The format @p image is shown in: no color table and no premultiplied
+ * alpha, which the color correction engine does not support.
+ */
+GWENVIEWLIB_EXPORT QImage::Format displayFormat(const QImage &image);
+
+/**
+ * Converts @p image to displayFormat() and to sRGB. Conversions which keep
+ * the pixel size are done in place, so that unless @p image is shared, no
+ * other full size copy is allocated.
+ */
+GWENVIEWLIB_EXPORT void convertForDisplay(QImage &image);
+
 } // namespace
 } // namespace
 
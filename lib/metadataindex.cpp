@@ -0,0 +1,489 @@
+// SPDX-FileCopyrightText: 2026 Gwenview Developers
+// SPDX-License-Identifier: GPL-2.0-or-later
+
+// Self
+#include "metadataindex.h"
+
+// Qt
+#include <QCoreApplication>
+#include <QCryptographicHash>
+#include <QDataStream>
+#include <QDateTime>
+#include <QDir>
+#include <QDirIterator>
+#include <QFile>
+#include <QFileInfo>
+#include <QHash>
+#include <QMultiMap>
+#include <QSaveFile>
+#include <QSet>
+#include <QStandardPaths>
+#include <QThreadPool>
+#include <QTimer>
+#include <QtConcurrentRun>
+
+// Local
+#include "gwenview_lib_debug.h"
+#include <lib/headermetadata.h>
+#include <lib/timeutils.h>
+#include <lib/urlutils.h>
+
+namespace Gwenview
+{
+#undef ENABLE_LOG
+#undef LOG
+// #define ENABLE_LOG
+#ifdef ENABLE_LOG
+#define LOG(x) qCDebug(GWENVIEW_LIB_LOG) << x
+#else
+#define LOG(x) ;
+#endif
+
+static const quint32 INDEX_MAGIC = 0x47564d49; // "GVMI"
+static const quint32 INDEX_VERSION = 1;
+
+/** How many items a background task indexes */
+static const int BATCH_SIZE = 64;
+
+/** How many msec to wait after a change before writing the index */
+static const int SAVE_DELAY = 5000;
+
+/** How many folders are kept in memory */
+static const int MAX_LOADED_FOLDERS = 16;
+
+/** How many days an index file is kept after the folder was last opened */
+static const int MAX_INDEX_AGE = 90;
+
+/** How much disk space the index files may use, in bytes */
+static const qint64 MAX_INDEX_DISK_SIZE = 64 * 1024 * 1024;
+
+struct IndexedEntry {
+    qint64 mModificationTime = 0;
+    KIO::filesize_t mFileSize = 0;
+    MetaDataIndex::Entry mEntry;
+};
+
+struct IndexedFolder {
+    QHash<QString, IndexedEntry> mEntries;
+    bool mDirty = false;
+    /// When the folder was last used, see MetaDataIndexPrivate::mUseCount
+    quint64 mLastUse = 0;
+    /// False until the index file has been read
+    bool mLoaded = false;
+};
+
+static QDataStream &operator<<(QDataStream &stream, const IndexedEntry &indexed)
+{
+    const MetaDataIndex::Entry &entry = indexed.mEntry;
+    return stream << indexed.mModificationTime << quint64(indexed.mFileSize) << entry.dateTime << entry.size << qint32(entry.orientation)
+                  << qint32(entry.rating) << qint32(entry.kind);
+}
+
+static QDataStream &operator>>(QDataStream &stream, IndexedEntry &indexed)
+{
+    MetaDataIndex::Entry &entry = indexed.mEntry;
+    quint64 fileSize;
+    qint32 orientation, rating, kind;
+    stream >> indexed.mModificationTime >> fileSize >> entry.dateTime >> entry.size >> orientation >> rating >> kind;
+    indexed.mFileSize = fileSize;
+    entry.orientation = Orientation(orientation);
+    entry.rating = rating;
+    entry.kind = MimeTypeUtils::Kind(kind);
+    return stream;
+}
+
+/**
+ * Removes the index files of @p dir which have not been used for
+ * MAX_INDEX_AGE days, then the least recently used ones until they fit in
+ * MAX_INDEX_DISK_SIZE
+ */
+static void pruneIndexFiles(const QString &dir)
+{
+    const QDateTime expiry = QDateTime::currentDateTime().addDays(-MAX_INDEX_AGE);
+    // last modification => path
+    QMultiMap<QDateTime, QString> files;
+    qint64 totalSize = 0;
+    QDirIterator it(dir, {QStringLiteral("*.index")}, QDir::Files);
+    while (it.hasNext()) {
+        const QFileInfo info = it.nextFileInfo();
+        if (info.lastModified() < expiry) {
+            QFile::remove(info.filePath());
+            continue;
+        }
+        files.insert(info.lastModified(), info.filePath());
+        totalSize += info.size();
+    }
+    for (auto fileIt = files.constBegin(); totalSize > MAX_INDEX_DISK_SIZE && fileIt != files.constEnd(); ++fileIt) {
+        totalSize -= QFileInfo(fileIt.value()).size();
+        QFile::remove(fileIt.value());
+    }
+    LOG("Index files use" << totalSize << "bytes");
+}
+
+/**
+ * Returns the path of the folder and the name of @p item, or false if it is
+ * not indexed
+ */
+static bool splitPath(const KFileItem &item, QString *folder, QString *name)
+{
+    const QUrl url = item.targetUrl();
+    if (item.isNull() || !UrlUtils::urlIsFastLocalFile(url)) {
+        return false;
+    }
+    const QFileInfo info(url.toLocalFile());
+    *folder = info.path();
+    *name = info.fileName();
+    return true;
+}
+
+/**
+ * Reads the index file of @p folder, returns no entries if there is none or it
+ * cannot be used
+ */
+static QHash<QString, IndexedEntry> readIndexFile(const QString &indexPath, const QString &folder)
+{
+    QFile file(indexPath);
+    if (!file.open(QIODevice::ReadOnly)) {
+        return {};
+    }
+    QDataStream stream(&file);
+    quint32 magic, version;
+    QString storedPath;
+    stream >> magic >> version;
+    if (magic != INDEX_MAGIC || version != INDEX_VERSION) {
+        qCWarning(GWENVIEW_LIB_LOG) << "Ignoring metadata index" << file.fileName() << "of an unknown version";
+        return {};
+    }
+    stream.setVersion(QDataStream::Qt_6_0);
+    stream >> storedPath;
+    if (storedPath != folder) {
+        // Another folder with the same hash, it is replaced when saving
+        return {};
+    }
+    QHash<QString, IndexedEntry> entries;
+    stream >> entries;
+    if (stream.status() != QDataStream::Ok) {
+        qCWarning(GWENVIEW_LIB_LOG) << "Could not read metadata index" << file.fileName();
+        return {};
+    }
+    LOG("Loaded" << entries.size() << "entries for" << folder);
+    // Index files expire when their folder is not opened anymore
+    file.setFileTime(QDateTime::currentDateTime(), QFileDevice::FileModificationTime);
+    return entries;
+}
+
+static void writeIndexFile(const QString &indexPath, const QString &folder, const QHash<QString, IndexedEntry> &entries)
+{
+    QSaveFile file(indexPath);
+    if (!file.open(QIODevice::WriteOnly)) {
+        qCWarning(GWENVIEW_LIB_LOG) << "Could not write metadata index" << file.fileName() << ":" << file.errorString();
+        return;
+    }
+    QDataStream stream(&file);
+    stream << INDEX_MAGIC << INDEX_VERSION;
+    stream.setVersion(QDataStream::Qt_6_0);
+    stream << folder << entries;
+    if (!file.commit()) {
+        qCWarning(GWENVIEW_LIB_LOG) << "Could not write metadata index" << file.fileName() << ":" << file.errorString();
+    }
+}
+
+struct MetaDataIndexPrivate {
+    MetaDataIndex *q;
+    QString mDir;
+    QHash<QString, IndexedFolder> mFolders;
+    /// The folders being loaded, with the items to update once they are
+    QHash<QString, KFileItemList> mLoadingFolders;
+    QSet<QUrl> mPendingUrls;
+    /// Extracts the meta information
+    QThreadPool mPool;
+    /// Reads and writes the index files, in order
+    QThreadPool mIoPool;
+    QTimer mSaveTimer;
+    quint64 mUseCount = 0;
+
+    QString indexPath(const QString &folder) const
+    {
+        const QByteArray hash = QCryptographicHash::hash(QFile::encodeName(folder), QCryptographicHash::Md5).toHex();
+        return mDir + QLatin1Char('/') + QString::fromLatin1(hash) + QStringLiteral(".index");
+    }
+
+    bool isLoaded(const QString &path) const
+    {
+        const auto it = mFolders.constFind(path);
+        return it != mFolders.constEnd() && it->mLoaded;
+    }
+
+    /**
+     * Returns the folder @p path, creating it empty if needed. It may not be
+     * loaded yet.
+     */
+    IndexedFolder &folder(const QString &path)
+    {
+        auto it = mFolders.find(path);
+        if (it == mFolders.end()) {
+            it = mFolders.insert(path, IndexedFolder());
+            startLoading(path);
+            trimFolders(path);
+        }
+        it->mLastUse = ++mUseCount;
+        return it.value();
+    }
+
+    void startLoading(const QString &path)
+    {
+        if (isLoaded(path) || mLoadingFolders.contains(path)) {
+            return;
+        }
+        mLoadingFolders.insert(path, {});
+        QtConcurrent::run(&mIoPool, readIndexFile, indexPath(path), path).then(q, [this, path](QHash<QString, IndexedEntry> entries) {
+            finishLoading(path, std::move(entries));
+        });
+    }
+
+    void finishLoading(const QString &path, QHash<QString, IndexedEntry> entries)
+    {
+        const KFileItemList waitingItems = mLoadingFolders.take(path);
+        IndexedFolder &loaded = mFolders[path];
+        loaded.mLastUse = ++mUseCount;
+        // Entries inserted while the folder was loading are more recent
+        for (auto it = loaded.mEntries.constBegin(), end = loaded.mEntries.constEnd(); it != end; ++it) {
+            entries.insert(it.key(), it.value());
+        }
+        loaded.mEntries = std::move(entries);
+        loaded.mLoaded = true;
+        if (loaded.mDirty && !mSaveTimer.isActive()) {
+            mSaveTimer.start();
+        }
+
+        QList<QUrl> urls;
+        urls.reserve(loaded.mEntries.size());
+        for (auto it = loaded.mEntries.constBegin(), end = loaded.mEntries.constEnd(); it != end; ++it) {
+            urls << QUrl::fromLocalFile(path + QLatin1Char('/') + it.key());
+        }
+        trimFolders(path);
+        if (!urls.isEmpty()) {
+            Q_EMIT q->updated(urls);
+        }
+        if (!waitingItems.isEmpty()) {
+            q->update(waitingItems);
+        }
+    }
+
+    /**
+     * Unloads the least recently used folders other than @p current until
+     * there are at most MAX_LOADED_FOLDERS. Folders which are not loaded yet
+     * are kept, since their index file has not been merged.
+     */
+    void trimFolders(const QString &current)
+    {
+        while (mFolders.size() > MAX_LOADED_FOLDERS) {
+            auto leastRecent = mFolders.end();
+            for (auto it = mFolders.begin(), end = mFolders.end(); it != end; ++it) {
+                if (it->mLoaded && it.key() != current && (leastRecent == end || it->mLastUse < leastRecent->mLastUse)) {
+                    leastRecent = it;
+                }
+            }
+            if (leastRecent == mFolders.end()) {
+                return;
+            }
+            if (leastRecent->mDirty) {
+                scheduleSave(leastRecent.key(), leastRecent.value());
+            }
+            LOG("Unloading" << leastRecent.key());
+            mFolders.erase(leastRecent);
+        }
+    }
+
+    void scheduleSave(const QString &path, IndexedFolder &folder)
+    {
+        folder.mDirty = false;
+        QtConcurrent::run(&mIoPool, writeIndexFile, indexPath(path), path, folder.mEntries);
+    }
+
+    void startBatch(const KFileItemList &items)
+    {
+        QtConcurrent::run(&mPool, [items]() {
+            QList<MetaDataIndex::Entry> entries;
+            entries.reserve(items.size());
+            for (const KFileItem &item : items) {
+                entries << MetaDataIndex::extract(item);
+            }
+            return entries;
+        }).then(q, [this, items](const QList<MetaDataIndex::Entry> &entries) {
+            QList<QUrl> urls;
+            urls.reserve(items.size());
+            for (int idx = 0; idx < items.size(); ++idx) {
+                const KFileItem &item = items.at(idx);
+                mPendingUrls.remove(item.url());
+                q->insert(item, entries.at(idx));
+                urls << item.url();
+            }
+            Q_EMIT q->updated(urls);
+        });
+    }
+};
+
+MetaDataIndex::MetaDataIndex(const QString &dir, QObject *parent)
+    : QObject(parent)
+    , d(new MetaDataIndexPrivate)
+{
+    d->q = this;
+    d->mDir = dir;
+    QDir().mkpath(dir);
+    // Leave the other cores to thumbnail generation and decoding
+    d->mPool.setMaxThreadCount(2);
+    d->mIoPool.setMaxThreadCount(1);
+    d->mSaveTimer.setSingleShot(true);
+    d->mSaveTimer.setInterval(SAVE_DELAY);
+    connect(&d->mSaveTimer, &QTimer::timeout, this, &MetaDataIndex::save);
+    d->mIoPool.start([dir]() {
+        pruneIndexFiles(dir);
+    });
+}
+
+MetaDataIndex::~MetaDataIndex()
+{
+    d->mPool.clear();
+    d->mPool.waitForDone();
+    // Let the pending writes finish before the last ones
+    d->mIoPool.waitForDone();
+    d->mSaveTimer.stop();
+    for (auto it = d->mFolders.begin(), end = d->mFolders.end(); it != end; ++it) {
+        if (!it->mDirty) {
+            continue;
+        }
+        const QString indexPath = d->indexPath(it.key());
+        QHash<QString, IndexedEntry> entries = it->mEntries;
+        if (!it->mLoaded) {
+            entries = readIndexFile(indexPath, it.key());
+            entries.insert(it->mEntries);
+        }
+        writeIndexFile(indexPath, it.key(), entries);
+    }
+    delete d;
+}
+
+MetaDataIndex *MetaDataIndex::instance()
+{
+    // Destroyed, and thus saved, with the application
+    static MetaDataIndex *index =
+        new MetaDataIndex(QStandardPaths::writableLocation(QStandardPaths::GenericCacheLocation) + QStringLiteral("/gwenview/metadata"), qApp);
+    return index;
+}
+
+MetaDataIndex::Entry MetaDataIndex::extract(const KFileItem &item)
+{
+    Entry entry;
+    entry.kind = MimeTypeUtils::fileItemKind(item);
+    if (entry.kind != MimeTypeUtils::KIND_RASTER_IMAGE) {
+        entry.dateTime = item.time(KFileItem::ModificationTime);
+        return entry;
+    }
+
+    HeaderMetaData metaData;
+    if (HeaderMetaData::load(item.targetUrl().toLocalFile(), &metaData)) {
+        entry.dateTime = metaData.dateTime.isValid() ? metaData.dateTime : item.time(KFileItem::ModificationTime);
+        entry.size = metaData.size;
+        entry.orientation = metaData.orientation;
+        entry.rating = metaData.rating;
+    } else {
+        // Let Exiv2 find the date of the other formats
+        entry.dateTime = TimeUtils::dateTimeForFileItem(item, TimeUtils::SkipCache);
+    }
+    return entry;
+}
+
+bool MetaDataIndex::find(const KFileItem &item, Entry *entry)
+{
+    QString folderPath, name;
+    if (!splitPath(item, &folderPath, &name)) {
+        return false;
+    }
+    const auto folderIt = d->mFolders.find(folderPath);
+    if (folderIt == d->mFolders.end() || !folderIt->mLoaded) {
+        d->startLoading(folderPath);
+    }
+    if (folderIt == d->mFolders.end()) {
+        return false;
+    }
+    folderIt->mLastUse = ++d->mUseCount;
+    const IndexedFolder &folder = folderIt.value();
+    const auto it = folder.mEntries.constFind(name);
+    if (it == folder.mEntries.constEnd() || it->mModificationTime != item.time(KFileItem::ModificationTime).toMSecsSinceEpoch()
+        || it->mFileSize != item.size()) {
+        return false;
+    }
+    *entry = it->mEntry;
+    return true;
+}
+
+void MetaDataIndex::insert(const KFileItem &item, const Entry &entry)
+{
+    QString folderPath, name;
+    if (!splitPath(item, &folderPath, &name)) {
+        return;
+    }
+    IndexedFolder &folder = d->folder(folderPath);
+    folder.mEntries.insert(name, {item.time(KFileItem::ModificationTime).toMSecsSinceEpoch(), item.size(), entry});
+    folder.mDirty = true;
+    if (!d->mSaveTimer.isActive()) {
+        d->mSaveTimer.start();
+    }
+}
+
+void MetaDataIndex::load(const QUrl &folderUrl)
+{
+    if (UrlUtils::urlIsFastLocalFile(folderUrl)) {
+        d->startLoading(QDir::cleanPath(folderUrl.toLocalFile()));
+    }
+}
+
+void MetaDataIndex::update(const KFileItemList &items)
+{
+    KFileItemList batch;
+    Entry entry;
+    for (const KFileItem &item : items) {
+        QString folderPath, name;
+        if (item.isDir() || !splitPath(item, &folderPath, &name)) {
+            continue;
+        }
+        if (!d->isLoaded(folderPath)) {
+            // Only index what the index file does not know about
+            d->startLoading(folderPath);
+            d->mLoadingFolders[folderPath] << item;
+            continue;
+        }
+        if (d->mPendingUrls.contains(item.url()) || find(item, &entry)) {
+            continue;
+        }
+        // KFileItem determines its mime type lazily, which must not happen
+        // from the worker threads
+        MimeTypeUtils::fileItemKind(item);
+        d->mPendingUrls.insert(item.url());
+        batch << item;
+        if (batch.size() == BATCH_SIZE) {
+            d->startBatch(batch);
+            batch.clear();
+        }
+    }
+    if (!batch.isEmpty()) {
+        d->startBatch(batch);
+    }
+}
+
+void MetaDataIndex::save()
+{
+    d->mSaveTimer.stop();
+    for (auto it = d->mFolders.begin(), end = d->mFolders.end(); it != end; ++it) {
+        // Folders which are not loaded yet are saved once they are, to
+        // keep the entries of their index file
+        if (it->mDirty && it->mLoaded) {
+            d->scheduleSave(it.key(), it.value());
+        }
+    }
+}
+
+} // namespace
+
+#include "moc_metadataindex.cpp"
@@ -0,0 +1,111 @@
+// SPDX-FileCopyrightText: 2026 Gwenview Developers
+// SPDX-License-Identifier: GPL-2.0-or-later
+
+#ifndef METADATAINDEX_H
+#define METADATAINDEX_H
+
+#include <lib/gwenviewlib_export.h>
+
+// Qt
+#include <QDateTime>
+#include <QList>
+#include <QObject>
+#include <QSize>
+#include <QUrl>
+
+// KF
+#include <KFileItem>
+
+// Local
+#include <lib/mimetypeutils.h>
+#include <lib/orientation.h>
+
+namespace Gwenview
+{
+struct MetaDataIndexPrivate;
+
+/**
+ * Remembers across sessions the meta information sorting and filtering need,
+ * so that they do not have to read the files again every time a folder is
+ * opened.
+ *
+ * There is one index file per folder. Entries are keyed by file name, and are
+ * only used if the modification time and size of the file did not change.
+ * Only fast local files are indexed.
+ *
+ * Except for extract(), methods must be called from the thread the index
+ * lives in.
+ */
+class GWENVIEWLIB_EXPORT MetaDataIndex : public QObject
+{
+    Q_OBJECT
+public:
+    struct Entry {
+        /// When the picture was taken, or the modification time of the file
+        /// if that is unknown
+        QDateTime dateTime;
+        /// The size of the image as stored, before applying the orientation
+        QSize size;
+        Orientation orientation = NOT_AVAILABLE;
+        /// From 0 to 5, -1 if unknown
+        int rating = -1;
+        MimeTypeUtils::Kind kind = MimeTypeUtils::KIND_UNKNOWN;
+    };
+
+    /**
+     * Creates an index stored in @p dir, which is created if needed
+     */
+    explicit MetaDataIndex(const QString &dir, QObject *parent = nullptr);
+    ~MetaDataIndex() override;
+
+    /**
+     * The index of the application, stored in the cache folder
+     */
+    static MetaDataIndex *instance();
+
+    /**
+     * Reads the meta information of @p item from the file. Can be called
+     * from any thread.
+     */
+    static Entry extract(const KFileItem &item);
+
+    /**
+     * Starts reading the index of the folder @p folderUrl in the background
+     * if it is not loaded yet. updated() is emitted for its entries once it
+     * is.
+     */
+    void load(const QUrl &folderUrl);
+
+    /**
+     * Returns true and sets @p entry if @p item is indexed and did not change
+     * since then. Only looks at what is in memory: if the folder of @p item
+     * is not loaded yet, it starts loading it and returns false.
+     */
+    bool find(const KFileItem &item, Entry *entry);
+
+    void insert(const KFileItem &item, const Entry &entry);
+
+    /**
+     * Indexes the items of @p items which are not indexed yet or changed, in
+     * the background. updated() is emitted as they get indexed. Items whose
+     * folder is not loaded yet are looked at once it is.
+     */
+    void update(const KFileItemList &items);
+
+    /**
+     * Writes the folders which changed to disk, in the background. This is
+     * done after a delay when entries are inserted, and synchronously when
+     * the index is destroyed.
+     */
+    void save();
+
+Q_SIGNALS:
+    void updated(const QList<QUrl> &urls);
+
+private:
+    MetaDataIndexPrivate *const d;
+};
+
+} // namespace
+
+#endif /* METADATAINDEX_H */
@@ -20,9 +20,14 @@ Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
 #include "sorteddirmodel.h"
 
 // Qt
+#include <QSet>
 #include <QTimer>
 #include <QUrl>
 
+// STL
+#include <algorithm>
+#include <utility>
+
 // KF
 #include <KDirLister>
 #ifdef GWENVIEW_SEMANTICINFO_BACKEND_NONE
@@ -30,6 +35,7 @@ Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
 #endif
 // Local
 #include <lib/archiveutils.h>
+#include <lib/metadataindex.h>
 #include <lib/timeutils.h>
 #ifndef GWENVIEW_SEMANTICINFO_BACKEND_NONE
 #include "abstractsemanticinfobackend.h"
@@ -65,6 +71,100 @@ struct SortedDirModelPrivate {
     QList<AbstractSortedDirModelFilter *> mFilters;
     QTimer mDelayedApplyFiltersTimer;
     MimeTypeUtils::Kinds mKindFilter;
+    /// Urls whose dates got indexed since the last mIndexedUrlsTimer timeout
+    QSet<QUrl> mIndexedUrls;
+    QTimer mIndexedUrlsTimer;
+
+    /**
+     * Returns true if sorting or filtering uses the dates of the items
+     */
+    bool needsDates(const SortedDirModel *q) const
+    {
+        if (q->sortColumn() == KDirModel::ModifiedTime) {
+            return true;
+        }
+        return std::any_of(mFilters.cbegin(), mFilters.cend(), [](const AbstractSortedDirModelFilter *filter) {
+            return filter->needsDates();
+        });
+    }
+
+    /**
+     * Has the meta information of the listed items indexed when sorting or
+     * filtering needs it, so that they find it without reading the files
+     */
+    void connectDirLister(SortedDirModel *q)
+    {
+        KDirLister *dirLister = mSourceModel->dirLister();
+        // Read the index of the folder while it is being listed, so that the
+        // sorting does not wait for it
+        QObject::connect(dirLister, &KDirLister::started, q, [this, q](const QUrl &url) {
+            if (needsDates(q)) {
+                MetaDataIndex::instance()->load(url);
+            }
+        });
+        QObject::connect(dirLister, &KDirLister::newItems, q, [this, q](const KFileItemList &items) {
+            if (needsDates(q)) {
+                MetaDataIndex::instance()->update(items);
+            }
+        });
+        QObject::connect(dirLister, &KDirLister::refreshItems, q, [this, q](const QList<QPair<KFileItem, KFileItem>> &items) {
+            if (!needsDates(q)) {
+                return;
+            }
+            KFileItemList newItems;
+            newItems.reserve(items.size());
+            for (const auto &pair : items) {
+                newItems << pair.second;
+            }
+            MetaDataIndex::instance()->update(newItems);
+        });
+    }
+
+    /**
+     * Has the listed items indexed if sorting or filtering started to need
+     * their dates
+     */
+    void indexListedItems(const SortedDirModel *q)
+    {
+        if (needsDates(q)) {
+            MetaDataIndex::instance()->update(mSourceModel->dirLister()->items());
+        }
+    }
+
+    void notifyIndexed(const QList<QUrl> &urls, const SortedDirModel *q)
+    {
+        if (!needsDates(q)) {
+            return;
+        }
+        for (const QUrl &url : urls) {
+            mIndexedUrls.insert(url);
+        }
+        if (!mIndexedUrlsTimer.isActive()) {
+            mIndexedUrlsTimer.start();
+        }
+    }
+
+    /**
+     * Tells that the dates of the listed items among mIndexedUrls are known.
+     * The proxy then moves or filters these rows only, without sorting the
+     * whole folder again.
+     */
+    void applyIndexedDates(const SortedDirModel *q)
+    {
+        const QSet<QUrl> urls = std::exchange(mIndexedUrls, {});
+        if (!needsDates(q)) {
+            return;
+        }
+        for (const QUrl &url : urls) {
+            const QModelIndex index = mSourceModel->indexForUrl(url);
+            if (!index.isValid()) {
+                continue;
+            }
+            // With no roles, the proxy does not know which column changed
+            // and moves the row to its new place, whatever the sort column is
+            Q_EMIT mSourceModel->dataChanged(index, index.siblingAtColumn(KDirModel::ColumnCount - 1));
+        }
+    }
 };
 
 SortedDirModel::SortedDirModel(QObject *parent)
@@ -83,6 +183,21 @@ SortedDirModel::SortedDirModel(QObject *parent)
     d->mDelayedApplyFiltersTimer.setInterval(0);
     d->mDelayedApplyFiltersTimer.setSingleShot(true);
     connect(&d->mDelayedApplyFiltersTimer, &QTimer::timeout, this, &SortedDirModel::doApplyFilters);
+
+    // Sorting and filtering use the dates known so far, rows move as the
+    // other dates get indexed. Dates arrive by batches, so wait a little to
+    // move the rows of several batches at once. The rows are only moved if
+    // the sorting is dynamic.
+    setDynamicSortFilter(true);
+    d->mIndexedUrlsTimer.setInterval(300);
+    d->mIndexedUrlsTimer.setSingleShot(true);
+    connect(&d->mIndexedUrlsTimer, &QTimer::timeout, this, [this]() {
+        d->applyIndexedDates(this);
+    });
+    connect(MetaDataIndex::instance(), &MetaDataIndex::updated, this, [this](const QList<QUrl> &urls) {
+        d->notifyIndexed(urls, this);
+    });
+    d->connectDirLister(this);
 }
 
 SortedDirModel::~SortedDirModel()
@@ -263,9 +378,16 @@ void SortedDirModel::applyFilters()
 
 void SortedDirModel::doApplyFilters()
 {
+    d->indexListedItems(this);
     QSortFilterProxyModel::invalidateFilter();
 }
 
+void SortedDirModel::sort(int column, Qt::SortOrder order)
+{
+    KDirSortFilterProxyModel::sort(column, order);
+    d->indexListedItems(this);
+}
+
 bool SortedDirModel::lessThan(const QModelIndex &left, const QModelIndex &right) const
 {
     const KFileItem leftItem = itemForSourceIndex(left);
@@ -282,8 +404,8 @@ bool SortedDirModel::lessThan(const QModelIndex &left, const QModelIndex &right)
     // a secondary criterion is needed, delegate sorting to the parent class.
     if (!leftIsDirOrArchive) {
         if (sortColumn() == KDirModel::ModifiedTime) {
-            const QDateTime leftDate = TimeUtils::dateTimeForFileItem(leftItem);
-            const QDateTime rightDate = TimeUtils::dateTimeForFileItem(rightItem);
+            const QDateTime leftDate = TimeUtils::cachedDateTimeForFileItem(leftItem);
+            const QDateTime rightDate = TimeUtils::cachedDateTimeForFileItem(rightItem);
 
             if (leftDate != rightDate) {
                 return leftDate < rightDate;
@@ -323,6 +445,7 @@ bool SortedDirModel::hasDocuments() const
 void SortedDirModel::setDirLister(KDirLister *dirLister)
 {
     d->mSourceModel->setDirLister(dirLister);
+    d->connectDirLister(this);
 }
 
 } // namespace
@@ -63,6 +63,15 @@ public:
      */
     virtual bool acceptsIndex(const QModelIndex &index) const = 0;
 
+    /**
+     * Returns true if acceptsIndex() looks at the dates of the items. Their
+     * meta information is then indexed, see MetaDataIndex.
+     */
+    virtual bool needsDates() const
+    {
+        return false;
+    }
+
 private:
     QPointer<SortedDirModel> mModel;
 };
@@ -115,6 +124,8 @@ public:
 
     bool hasDocuments() const;
 
+    void sort(int column, Qt::SortOrder order = Qt::AscendingOrder) override;
+
 public Q_SLOTS:
     void applyFilters();
 
@@ -0,0 +1,120 @@
+// SPDX-FileCopyrightText: 2026 Gwenview Developers
+// SPDX-License-Identifier: GPL-2.0-or-later
+
+// Self
+#include "pngtextreader.h"
+
+// Qt
+#include <QByteArray>
+#include <QFile>
+#include <QtEndian>
+
+namespace Gwenview
+{
+namespace PngTextReader
+{
+static const char PNG_SIGNATURE[] = "\x89PNG\r\n\x1a\n";
+static const int PNG_SIGNATURE_LENGTH = 8;
+
+// Thumbnail texts are short, anything bigger is skipped rather than read
+static const quint32 MAX_TEXT_CHUNK_LENGTH = 64 * 1024;
+
+static QByteArray inflate(const QByteArray &data)
+{
+    // qUncompress() wants the zlib stream to be prefixed with the size of the
+    // uncompressed data. It is only used as a hint for the buffer size.
+    QByteArray buffer(4, '\0');
+    qToBigEndian<quint32>(data.size() * 4, buffer.data());
+    buffer += data;
+    return qUncompress(buffer);
+}
+
+static void parseTextChunk(const QByteArray &type, const QByteArray &data, QHash<QString, QString> *texts)
+{
+    const int keyEnd = data.indexOf('\0');
+    if (keyEnd <= 0) {
+        return;
+    }
+    const QString key = QString::fromLatin1(data.constData(), keyEnd);
+    int pos = keyEnd + 1;
+
+    if (type == "tEXt") {
+        texts->insert(key, QString::fromLatin1(data.mid(pos)));
+    } else if (type == "zTXt") {
+        // Compression method byte, 0 is the only one defined
+        if (pos >= data.size() || data.at(pos) != 0) {
+            return;
+        }
+        texts->insert(key, QString::fromLatin1(inflate(data.mid(pos + 1))));
+    } else if (type == "iTXt") {
+        // Compression flag and method bytes, then language tag and translated
+        // keyword
+        if (pos + 2 > data.size()) {
+            return;
+        }
+        const bool compressed = data.at(pos) != 0;
+        if (compressed && data.at(pos + 1) != 0) {
+            return;
+        }
+        pos += 2;
+        for (int field = 0; field < 2; ++field) {
+            pos = data.indexOf('\0', pos);
+            if (pos < 0) {
+                return;
+            }
+            ++pos;
+        }
+        const QByteArray text = data.mid(pos);
+        texts->insert(key, QString::fromUtf8(compressed ? inflate(text) : text));
+    }
+}
+
+bool read(QIODevice *device, QHash<QString, QString> *texts)
+{
+    if (device->read(PNG_SIGNATURE_LENGTH) != QByteArray(PNG_SIGNATURE, PNG_SIGNATURE_LENGTH)) {
+        return false;
+    }
+
+    while (true) {
+        // Each chunk is made of its length, its type, its data and a CRC
+        const QByteArray header = device->read(8);
+        if (header.size() != 8) {
+            return false;
+        }
+        const quint32 length = qFromBigEndian<quint32>(header.constData());
+        const QByteArray type = header.mid(4);
+        if (type == "IDAT" || type == "IEND") {
+            return true;
+        }
+        if (length > 0x7fffffff) {
+            return false;
+        }
+
+        const bool isText = type == "tEXt" || type == "zTXt" || type == "iTXt";
+        if (isText && length <= MAX_TEXT_CHUNK_LENGTH) {
+            const QByteArray data = device->read(length);
+            if (data.size() != qint64(length)) {
+                return false;
+            }
+            parseTextChunk(type, data, texts);
+            if (device->skip(4) != 4) {
+                return false;
+            }
+        } else if (device->skip(qint64(length) + 4) != qint64(length) + 4) {
+            return false;
+        }
+    }
+}
+
+bool read(const QString &path, QHash<QString, QString> *texts)
+{
+    QFile file(path);
+    if (!file.open(QIODevice::ReadOnly)) {
+        return false;
+    }
+    return read(&file, texts);
+}
+
+} // namespace
+
+} // namespace
@@ -0,0 +1,37 @@
+// SPDX-FileCopyrightText: 2026 Gwenview Developers
+// SPDX-License-Identifier: GPL-2.0-or-later
+
+#ifndef PNGTEXTREADER_H
+#define PNGTEXTREADER_H
+
+#include <lib/gwenviewlib_export.h>
+
+// Qt
+#include <QHash>
+#include <QString>
+
+class QIODevice;
+
+namespace Gwenview
+{
+/**
+ * Reads the text chunks (tEXt, zTXt and uncompressed iTXt) of a PNG file
+ * without decoding the image. Only the chunks located before the image data
+ * are read, which is where thumbnail writers put them.
+ */
+namespace PngTextReader
+{
+/**
+ * Fills @p texts with the texts of @p device, which must be open and
+ * positioned at the start of the PNG signature. Returns false if the data is
+ * not a valid PNG file.
+ */
+GWENVIEWLIB_EXPORT bool read(QIODevice *device, QHash<QString, QString> *texts);
+
+GWENVIEWLIB_EXPORT bool read(const QString &path, QHash<QString, QString> *texts);
+
+} // namespace
+
+} // namespace
+
+#endif /* PNGTEXTREADER_H */
@@ -25,6 +25,7 @@ Foundation, Inc., 51 Franklin Street, Fifth Floor, Cambridge, MA 02110-1301, USA
 #include "gwenview_lib_debug.h"
 #include "gwenviewconfig.h"
 #include "jpegcontent.h"
+#include "thumbnailstore.h"
 
 // KDCRAW
 #ifdef KDCRAW_FOUND
@@ -36,7 +37,16 @@ Foundation, Inc., 51 Franklin Street, Fifth Floor, Cambridge, MA 02110-1301, USA
 // Qt
 #include <QBuffer>
 #include <QCoreApplication>
+#include <QFile>
 #include <QImageReader>
+#include <QThread>
+#include <QThreadPool>
+#include <QtConcurrentRun>
+
+// STL
+#include <algorithm>
+#include <atomic>
+#include <utility>
 
 namespace Gwenview
 {
@@ -49,6 +59,11 @@ namespace Gwenview
 #define LOG(x) ;
 #endif
 
+// Results arriving within this interval are reported together
+static const int RESULT_BATCH_INTERVAL = 20;
+
+Q_GLOBAL_STATIC(QThreadPool, sGeneratorPool)
+
 //------------------------------------------------------------------------
 //
 // ThumbnailContext
@@ -178,153 +193,225 @@ bool ThumbnailContext::load(const QString &pixPath, int pixelSize)
 // ThumbnailGenerator
 //
 //------------------------------------------------------------------------
-ThumbnailGenerator::ThumbnailGenerator()
-    : mCancel(false)
+struct ThumbnailGenerator::Job {
+    explicit Job(const ThumbnailRequest &request)
+        : mRequest(request)
+    {
+    }
+
+    const ThumbnailRequest mRequest;
+    std::atomic<bool> mCancelled{false};
+};
+
+struct ThumbnailGenerator::JobOutput {
+    // True if the job was cancelled before it started
+    bool mSkipped = false;
+    bool mNeedCaching = false;
+    QImage mImage;
+    QSize mOriginalSize;
+};
+
+static void setThumbnailTextKeys(QImage &image, const ThumbnailRequest &request, const QSize &originalSize)
 {
-    connect(
-        qApp,
-        &QCoreApplication::aboutToQuit,
-        this,
-        [=]() {
-            cancel();
-            wait();
-        },
-        Qt::DirectConnection);
-    start();
+    image.setText(QStringLiteral("Thumb::URI"), request.mOriginalUri);
+    image.setText(QStringLiteral("Thumb::MTime"), QString::number(request.mOriginalTime));
+    image.setText(QStringLiteral("Thumb::Size"), QString::number(request.mOriginalFileSize));
+    image.setText(QStringLiteral("Thumb::Mimetype"), request.mOriginalMimeType);
+    image.setText(QStringLiteral("Thumb::Image::Width"), QString::number(originalSize.width()));
+    image.setText(QStringLiteral("Thumb::Image::Height"), QString::number(originalSize.height()));
+    image.setText(QStringLiteral("Software"), QStringLiteral("Gwenview"));
 }
 
-void ThumbnailGenerator::load(const QString &originalUri,
-                              time_t originalTime,
-                              KIO::filesize_t originalFileSize,
-                              const QString &originalMimeType,
-                              const QString &pixPath,
-                              const QString &thumbnailPath,
-                              ThumbnailGroup::Enum group)
+static QImage loadCachedThumbnail(const QString &path)
 {
-    QMutexLocker lock(&mMutex);
-    Q_ASSERT(mPixPath.isNull());
-
-    mOriginalUri = originalUri;
-    mOriginalTime = originalTime;
-    mOriginalFileSize = originalFileSize;
-    mOriginalMimeType = originalMimeType;
-    mPixPath = pixPath;
-    mThumbnailPath = thumbnailPath;
-    mThumbnailGroup = group;
-    mCond.wakeOne();
+    if (const ThumbnailStore::Ptr store = ThumbnailStore::instance()) {
+        ThumbnailStore::Entry entry;
+        if (store->find(path, &entry)) {
+            return store->load(entry);
+        }
+    }
+    return QImage(path);
 }
 
-QString ThumbnailGenerator::originalUri() const
+ThumbnailGenerator::ThumbnailGenerator(QObject *parent)
+    : QObject(parent)
 {
-    return mOriginalUri;
+    mFlushTimer.setSingleShot(true);
+    mFlushTimer.setInterval(RESULT_BATCH_INTERVAL);
+    connect(&mFlushTimer, &QTimer::timeout, this, &ThumbnailGenerator::flushResults);
+
+    connect(qApp, &QCoreApplication::aboutToQuit, this, [this]() {
+        cancel();
+        sGeneratorPool->waitForDone();
+    });
 }
 
-bool ThumbnailGenerator::isStopped()
+ThumbnailGenerator::~ThumbnailGenerator()
 {
-    QMutexLocker lock(&mMutex);
-    return mStopped;
+    cancel();
 }
 
-time_t ThumbnailGenerator::originalTime() const
+int ThumbnailGenerator::maxThreadCount()
 {
-    return mOriginalTime;
+    const int idealCount = QThread::idealThreadCount();
+    const int maxCount = GwenviewConfig::maxThumbnailGeneratorThreads();
+    return maxCount > 0 ? qMin(idealCount, maxCount) : idealCount;
 }
 
-KIO::filesize_t ThumbnailGenerator::originalFileSize() const
+void ThumbnailGenerator::load(const ThumbnailRequest &request)
 {
-    return mOriginalFileSize;
+    const JobPtr job = mJobs.value(request.mThumbnailPath);
+    if (job) {
+        LOG("Already generating" << request.mThumbnailPath);
+        job->mCancelled = false;
+        if (request.mTemporaryPixPath) {
+            QFile::remove(request.mPixPath);
+        }
+        return;
+    }
+
+    const auto newJob = std::make_shared<Job>(request);
+    mJobs.insert(request.mThumbnailPath, newJob);
+    startJob(newJob);
 }
 
-QString ThumbnailGenerator::originalMimeType() const
+void ThumbnailGenerator::cancel()
 {
-    return mOriginalMimeType;
+    for (const JobPtr &job : std::as_const(mJobs)) {
+        job->mCancelled = true;
+    }
+    mResults.clear();
 }
 
-bool ThumbnailGenerator::testCancel()
+void ThumbnailGenerator::cancel(const KFileItemList &items)
 {
-    QMutexLocker lock(&mMutex);
-    return mCancel;
+    for (const JobPtr &job : std::as_const(mJobs)) {
+        if (items.contains(job->mRequest.mItem)) {
+            job->mCancelled = true;
+        }
+    }
+    mResults.erase(std::remove_if(mResults.begin(),
+                                  mResults.end(),
+                                  [&items](const ThumbnailResult &result) {
+                                      return items.contains(result.mRequest.mItem);
+                                  }),
+                   mResults.end());
 }
 
-void ThumbnailGenerator::cancel()
+int ThumbnailGenerator::activeCount() const
 {
-    QMutexLocker lock(&mMutex);
-    mCancel = true;
-    mCond.wakeOne();
+    return std::count_if(mJobs.cbegin(), mJobs.cend(), [](const JobPtr &job) {
+        return !job->mCancelled;
+    });
 }
 
-void ThumbnailGenerator::run()
+bool ThumbnailGenerator::isFull() const
 {
-    while (!testCancel()) {
-        QString pixPath;
-        int pixelSize;
-        {
-            QMutexLocker lock(&mMutex);
-            // empty mPixPath means nothing to do
-            if (mPixPath.isNull()) {
-                mCond.wait(&mMutex);
-            }
+    return activeCount() >= maxThreadCount();
+}
+
+ThumbnailGenerator::JobOutput ThumbnailGenerator::generate(const Job &job)
+{
+    JobOutput output;
+    if (job.mCancelled) {
+        output.mSkipped = true;
+        return output;
+    }
+
+    const ThumbnailRequest &request = job.mRequest;
+    if (request.mSource == ThumbnailRequest::FromCache || request.mSource == ThumbnailRequest::FromStore) {
+        LOG("Loading cached thumbnail" << request.mThumbnailPath);
+        output.mImage = request.mSource == ThumbnailRequest::FromStore ? loadCachedThumbnail(request.mThumbnailPath) : QImage(request.mThumbnailPath);
+        if (!output.mImage.isNull()) {
+            output.mOriginalSize = request.mCachedOriginalSize;
+            return output;
         }
-        if (testCancel()) {
-            break;
+        qCWarning(GWENVIEW_LIB_LOG) << "Could not load cached thumbnail" << request.mThumbnailPath;
+        if (request.mPixPath.isEmpty()) {
+            return output;
         }
-        {
-            QMutexLocker lock(&mMutex);
-            pixPath = mPixPath;
-            pixelSize = ThumbnailGroup::pixelSize(mThumbnailGroup);
+    } else if (request.mSource == ThumbnailRequest::FromLargerThumbnail) {
+        LOG("Deriving thumbnail from" << request.mLargerThumbnailPath);
+        const QImage largeImage = request.mLargerThumbnail.isNull() ? loadCachedThumbnail(request.mLargerThumbnailPath) : request.mLargerThumbnail;
+        if (job.mCancelled) {
+            output.mSkipped = true;
+            return output;
         }
-
-        Q_ASSERT(!pixPath.isNull());
-        LOG("Loading" << pixPath);
-        ThumbnailContext context;
-        bool ok = context.load(pixPath, pixelSize);
-
-        {
-            QMutexLocker lock(&mMutex);
-            if (ok) {
-                mImage = context.mImage;
-                mOriginalWidth = context.mOriginalWidth;
-                mOriginalHeight = context.mOriginalHeight;
-                if (context.mNeedCaching && mThumbnailGroup <= ThumbnailGroup::XXLarge) {
-                    cacheThumbnail();
-                }
-            } else {
-                // avoid emitting the thumb from the previous successful run
-                mImage = QImage();
-                qCWarning(GWENVIEW_LIB_LOG) << "Could not generate thumbnail for file" << mOriginalUri;
+        if (!largeImage.isNull()) {
+            const int size = ThumbnailGroup::pixelSize(request.mThumbnailGroup);
+            output.mImage = largeImage.scaled(size, size, Qt::KeepAspectRatio, Qt::SmoothTransformation);
+            const QStringList textKeys = largeImage.textKeys();
+            for (const QString &key : textKeys) {
+                output.mImage.setText(key, largeImage.text(key));
             }
-            mPixPath.clear(); // done, ready for next
-        }
-        if (testCancel()) {
-            break;
+            output.mOriginalSize = request.mCachedOriginalSize;
+            output.mNeedCaching = true;
+            return output;
         }
-        {
-            QSize size(mOriginalWidth, mOriginalHeight);
-            LOG("emitting done signal, size=" << size);
-            QMutexLocker lock(&mMutex);
-            Q_EMIT done(mImage, size);
-            LOG("Done");
+        qCWarning(GWENVIEW_LIB_LOG) << "Could not load cached thumbnail" << request.mLargerThumbnailPath;
+        if (request.mPixPath.isEmpty()) {
+            return output;
         }
     }
 
-    LOG("Ending thread");
+    LOG("Loading" << request.mPixPath);
+    ThumbnailContext context;
+    if (!context.load(request.mPixPath, ThumbnailGroup::pixelSize(request.mThumbnailGroup))) {
+        qCWarning(GWENVIEW_LIB_LOG) << "Could not generate thumbnail for file" << request.mOriginalUri;
+        return output;
+    }
+
+    output.mImage = context.mImage;
+    output.mOriginalSize = QSize(context.mOriginalWidth, context.mOriginalHeight);
+    if (context.mNeedCaching && request.mThumbnailGroup <= ThumbnailGroup::XXLarge) {
+        setThumbnailTextKeys(output.mImage, request, output.mOriginalSize);
+        output.mNeedCaching = true;
+    }
+    return output;
+}
+
+void ThumbnailGenerator::startJob(const JobPtr &job)
+{
+    QThreadPool *pool = sGeneratorPool;
+    pool->setMaxThreadCount(maxThreadCount());
+    QtConcurrent::run(pool, [job]() {
+        return generate(*job);
+    }).then(this, [this, job](JobOutput output) {
+        finishJob(job, output);
+    });
+}
+
+void ThumbnailGenerator::finishJob(const JobPtr &job, const JobOutput &output)
+{
+    const ThumbnailRequest &request = job->mRequest;
+    if (output.mSkipped && !job->mCancelled) {
+        // The job has been requested again after it got cancelled
+        startJob(job);
+        return;
+    }
+
+    mJobs.remove(request.mThumbnailPath);
+    if (request.mTemporaryPixPath) {
+        LOG("Delete temp file" << request.mPixPath);
+        QFile::remove(request.mPixPath);
+    }
 
-    QMutexLocker lock(&mMutex);
-    mStopped = true;
-    deleteLater();
+    if (output.mNeedCaching) {
+        Q_EMIT thumbnailReadyToBeCached(request.mThumbnailPath, output.mImage);
+    }
+    if (!job->mCancelled) {
+        mResults << ThumbnailResult{request, output.mImage, output.mOriginalSize};
+    }
+    if (!mFlushTimer.isActive()) {
+        mFlushTimer.start();
+    }
 }
 
-void ThumbnailGenerator::cacheThumbnail()
+void ThumbnailGenerator::flushResults()
 {
-    mImage.setText(QStringLiteral("Thumb::URI"), mOriginalUri);
-    mImage.setText(QStringLiteral("Thumb::MTime"), QString::number(mOriginalTime));
-    mImage.setText(QStringLiteral("Thumb::Size"), QString::number(mOriginalFileSize));
-    mImage.setText(QStringLiteral("Thumb::Mimetype"), mOriginalMimeType);
-    mImage.setText(QStringLiteral("Thumb::Image::Width"), QString::number(mOriginalWidth));
-    mImage.setText(QStringLiteral("Thumb::Image::Height"), QString::number(mOriginalHeight));
-    mImage.setText(QStringLiteral("Software"), QStringLiteral("Gwenview"));
-
-    Q_EMIT thumbnailReadyToBeCached(mThumbnailPath, mImage);
+    const QList<ThumbnailResult> results = std::exchange(mResults, {});
+    LOG("Reporting" << results.count() << "thumbnails");
+    Q_EMIT thumbnailsReady(results);
 }
 
 } // namespace
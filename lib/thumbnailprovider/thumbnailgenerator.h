@@ -28,10 +28,14 @@ Foundation, Inc., 51 Franklin Street, Fifth Floor, Cambridge, MA 02110-1301, USA
 #include <KFileItem>
 
 // Qt
+#include <QHash>
 #include <QImage>
-#include <QMutex>
-#include <QThread>
-#include <QWaitCondition>
+#include <QList>
+#include <QObject>
+#include <QTimer>
+
+// STL
+#include <memory>
 
 namespace Gwenview
 {
@@ -44,55 +48,114 @@ struct ThumbnailContext {
     bool load(const QString &pixPath, int pixelSize);
 };
 
-class ThumbnailGenerator : public QThread
+struct ThumbnailRequest {
+    enum Source {
+        // Generate the thumbnail from mPixPath
+        FromOriginal,
+        // Decode the thumbnail cached in mThumbnailPath, which is known to be
+        // up to date. Falls back to mPixPath if it can't be decoded.
+        FromCache,
+        // Like FromCache, for a thumbnail of the packed store
+        FromStore,
+        // Scale down the up to date thumbnail cached in mLargerThumbnailPath,
+        // or mLargerThumbnail if it has not been written yet. Falls back to
+        // mPixPath if it can't be decoded.
+        FromLargerThumbnail,
+    };
+
+    Source mSource = FromOriginal;
+    KFileItem mItem;
+    QString mOriginalUri;
+    time_t mOriginalTime = 0;
+    KIO::filesize_t mOriginalFileSize = 0;
+    QString mOriginalMimeType;
+    QString mPixPath;
+    // True if mPixPath is a temporary copy of a remote file, which must be
+    // removed once the thumbnail has been generated
+    bool mTemporaryPixPath = false;
+    QString mThumbnailPath;
+    ThumbnailGroup::Enum mThumbnailGroup = ThumbnailGroup::Normal;
+    // Size of the original image, as read from the cached thumbnail
+    QSize mCachedOriginalSize;
+    QString mLargerThumbnailPath;
+    QImage mLargerThumbnail;
+};
+
+struct ThumbnailResult {
+    ThumbnailRequest mRequest;
+    // Null if the thumbnail could not be generated
+    QImage mImage;
+    QSize mOriginalSize;
+};
+
+/**
+ * Generates thumbnails on a pool of worker threads. The number of workers
+ * defaults to the number of cores, capped by the MaxThumbnailGeneratorThreads
+ * config entry.
+ *
+ * Up to date cached thumbnails are decoded by the workers too, and scaled
+ * down when they come from a larger group, see ThumbnailRequest::Source.
+ *
+ * Requests are started in the order they are passed to load(). Results are
+ * reported in batches, to avoid updating the views for every thumbnail.
+ */
+class ThumbnailGenerator : public QObject
 {
     Q_OBJECT
 public:
-    ThumbnailGenerator();
-
-    // Because we override run(), like you're not really supposed to do, we
-    // can't trust isRunning()
-    bool isStopped();
-
-    void load(const QString &originalUri,
-              time_t originalTime,
-              KIO::filesize_t originalFileSize,
-              const QString &originalMimeType,
-              const QString &pixPath,
-              const QString &thumbnailPath,
-              ThumbnailGroup::Enum group);
-
+    explicit ThumbnailGenerator(QObject *parent = nullptr);
+    ~ThumbnailGenerator() override;
+
+    static int maxThreadCount();
+
+    /**
+     * Queues @p request. If a thumbnail is already being generated for the
+     * same thumbnail path, it is reused instead, even if it had been
+     * cancelled.
+     */
+    void load(const ThumbnailRequest &request);
+
+    /**
+     * Cancels all requests. Requests which have not started yet are dropped,
+     * thumbnails which are being generated are still cached but not reported.
+     */
     void cancel();
 
-    QString originalUri() const;
-    time_t originalTime() const;
-    KIO::filesize_t originalFileSize() const;
-    QString originalMimeType() const;
+    /**
+     * Cancels the requests for @p items
+     */
+    void cancel(const KFileItemList &items);
+
+    /**
+     * Returns the number of requests which have neither been reported nor
+     * cancelled
+     */
+    int activeCount() const;
 
-protected:
-    void run() override;
+    /**
+     * Returns true if there are at least as many active requests as workers.
+     * Callers should wait for results before queuing more requests, so that
+     * they can still change their mind about which one comes next.
+     */
+    bool isFull() const;
 
 Q_SIGNALS:
-    void done(const QImage &, const QSize &);
+    void thumbnailsReady(const QList<Gwenview::ThumbnailResult> &results);
     void thumbnailReadyToBeCached(const QString &thumbnailPath, const QImage &);
 
 private:
-    bool testCancel();
-    void cacheThumbnail();
-    QImage mImage;
-    QString mPixPath;
-    QString mThumbnailPath;
-    QString mOriginalUri;
-    time_t mOriginalTime;
-    KIO::filesize_t mOriginalFileSize;
-    QString mOriginalMimeType;
-    int mOriginalWidth;
-    int mOriginalHeight;
-    QMutex mMutex;
-    QWaitCondition mCond;
-    ThumbnailGroup::Enum mThumbnailGroup;
-    bool mCancel;
-    bool mStopped = false;
+    struct Job;
+    struct JobOutput;
+    using JobPtr = std::shared_ptr<Job>;
+
+    static JobOutput generate(const Job &job);
+    void startJob(const JobPtr &job);
+    void finishJob(const JobPtr &job, const JobOutput &output);
+    void flushResults();
+
+    QHash<QString, JobPtr> mJobs;
+    QList<ThumbnailResult> mResults;
+    QTimer mFlushTimer;
 };
 
 } // namespace
@@ -44,7 +44,9 @@
 // Local
 #include "gwenview_lib_debug.h"
 #include "mimetypeutils.h"
+#include "pngtextreader.h"
 #include "thumbnailgenerator.h"
+#include "thumbnailstore.h"
 #include "thumbnailwriter.h"
 #include "urlutils.h"
 
@@ -82,6 +84,21 @@ static QString generateThumbnailPath(const QString &uri, ThumbnailGroup::Enum gr
     return baseDir + QFile::encodeName(QString::fromLatin1(md5.result().toHex())) + QStringLiteral(".png");
 }
 
+static QHash<QString, QString> imageTexts(const QImage &image)
+{
+    QHash<QString, QString> texts;
+    const QStringList keys = image.textKeys();
+    for (const QString &key : keys) {
+        texts.insert(key, image.text(key));
+    }
+    return texts;
+}
+
+static bool isStoreEntryUpToDate(const ThumbnailStore::Entry &entry, time_t originalTime, KIO::filesize_t originalFileSize)
+{
+    return entry.mOriginalTime == originalTime && (entry.mOriginalFileSize == 0 || entry.mOriginalFileSize == originalFileSize);
+}
+
 //------------------------------------------------------------------------
 //
 // ThumbnailProvider static methods
@@ -104,6 +121,7 @@ QString ThumbnailProvider::thumbnailBaseDir()
 void ThumbnailProvider::setThumbnailBaseDir(const QString &dir)
 {
     sThumbnailBaseDir = dir;
+    ThumbnailStore::close();
 }
 
 QString ThumbnailProvider::thumbnailBaseDir(ThumbnailGroup::Enum group)
@@ -131,8 +149,13 @@ QString ThumbnailProvider::thumbnailBaseDir(ThumbnailGroup::Enum group)
 void ThumbnailProvider::deleteImageThumbnail(const QUrl &url)
 {
     QString uri = generateOriginalUri(url);
+    const ThumbnailStore::Ptr store = ThumbnailStore::instance();
     for (auto group : s_thumbnailGroups) {
-        QFile::remove(generateThumbnailPath(uri, group));
+        const QString path = generateThumbnailPath(uri, group);
+        QFile::remove(path);
+        if (store) {
+            store->remove(path);
+        }
     }
 }
 
@@ -140,6 +163,11 @@ static void moveThumbnailHelper(const QString &oldUri, const QString &newUri, Th
 {
     QString oldPath = generateThumbnailPath(oldUri, group);
     QString newPath = generateThumbnailPath(newUri, group);
+    if (const ThumbnailStore::Ptr store = ThumbnailStore::instance()) {
+        // Let the thumbnail be generated again for its new url
+        store->remove(oldPath);
+        store->remove(newPath);
+    }
     QImage thumb;
     if (!thumb.load(oldPath)) {
         return;
@@ -180,38 +208,32 @@ ThumbnailProvider::ThumbnailProvider()
     // Look for images and store the items in our todo list
     mCurrentItem = KFileItem();
     mThumbnailGroup = ThumbnailGroup::XXLarge;
-    createNewThumbnailGenerator();
+
+    mThumbnailGenerator = new ThumbnailGenerator(this);
+    connect(mThumbnailGenerator, &ThumbnailGenerator::thumbnailsReady, this, &ThumbnailProvider::handleGeneratedThumbnails);
+    connect(mThumbnailGenerator, &ThumbnailGenerator::thumbnailReadyToBeCached, sThumbnailWriter, &ThumbnailWriter::queueThumbnail);
+    connect(sThumbnailWriter, &ThumbnailWriter::thumbnailWritten, this, [this]() {
+        if (mCurrentItem.isNull() && !mItems.isEmpty()) {
+            determineNextIcon();
+        }
+    });
 }
 
 ThumbnailProvider::~ThumbnailProvider()
 {
     LOG(this);
     disconnect(mThumbnailGenerator, nullptr, this, nullptr);
-    disconnect(mThumbnailGenerator, nullptr, sThumbnailWriter, nullptr);
     abortSubjob();
     mThumbnailGenerator->cancel();
-    if (mPreviousThumbnailGenerator) {
-        disconnect(mPreviousThumbnailGenerator, nullptr, sThumbnailWriter, nullptr);
-    }
-    sThumbnailWriter->requestInterruption();
-    sThumbnailWriter->wait();
 }
 
 void ThumbnailProvider::stop()
 {
-    // Clear mItems and create a new ThumbnailGenerator if mThumbnailGenerator is running,
-    // but also make sure that at most two ThumbnailGenerators are running.
-    // startCreatingThumbnail() will take care that these two threads won't work on the same item.
+    // Thumbnails which are being generated will still be cached, but they
+    // won't be reported
     mItems.clear();
     abortSubjob();
-    if (!mThumbnailGenerator->isStopped() && !mPreviousThumbnailGenerator) {
-        mPreviousThumbnailGenerator = mThumbnailGenerator;
-        mPreviousThumbnailGenerator->cancel();
-        disconnect(mPreviousThumbnailGenerator, nullptr, this, nullptr);
-        connect(mPreviousThumbnailGenerator, SIGNAL(finished()), mPreviousThumbnailGenerator, SLOT(deleteLater()));
-        createNewThumbnailGenerator();
-        mCurrentItem = KFileItem();
-    }
+    mThumbnailGenerator->cancel();
 }
 
 const KFileItemList &ThumbnailProvider::pendingItems() const
@@ -245,7 +267,8 @@ void ThumbnailProvider::appendItems(const KFileItemList &items)
 
 void ThumbnailProvider::removeItems(const KFileItemList &itemList)
 {
-    if (mItems.isEmpty()) {
+    // Items may be in progress even if none is pending
+    if (mItems.isEmpty() && !isRunning()) {
         return;
     }
     for (const KFileItem &item : itemList) {
@@ -257,6 +280,7 @@ void ThumbnailProvider::removeItems(const KFileItemList &itemList)
             abortSubjob();
         }
     }
+    mThumbnailGenerator->cancel(itemList);
 
     // No more current item, carry on to the next remaining item
     if (mCurrentItem.isNull()) {
@@ -271,22 +295,10 @@ void ThumbnailProvider::removePendingItems()
 
 bool ThumbnailProvider::isRunning() const
 {
-    return !mCurrentItem.isNull();
+    return !mCurrentItem.isNull() || mThumbnailGenerator->activeCount() > 0;
 }
 
 //-Internal--------------------------------------------------------------
-void ThumbnailProvider::createNewThumbnailGenerator()
-{
-    mThumbnailGenerator = new ThumbnailGenerator;
-    connect(mThumbnailGenerator, SIGNAL(done(QImage, QSize)), SLOT(thumbnailReady(QImage, QSize)), Qt::QueuedConnection);
-
-    connect(mThumbnailGenerator,
-            SIGNAL(thumbnailReadyToBeCached(QString, QImage)),
-            sThumbnailWriter,
-            SLOT(queueThumbnail(QString, QImage)),
-            Qt::QueuedConnection);
-}
-
 void ThumbnailProvider::abortSubjob()
 {
     if (hasSubjobs()) {
@@ -305,9 +317,20 @@ void ThumbnailProvider::determineNextIcon()
 
     // No more items ?
     if (mItems.isEmpty()) {
-        LOG("No more items. Nothing to do");
         mCurrentItem = KFileItem();
-        Q_EMIT finished();
+        if (mThumbnailGenerator->activeCount() == 0) {
+            LOG("No more items. Nothing to do");
+            Q_EMIT finished();
+        }
+        return;
+    }
+
+    // Leave the items in mItems until a generator worker is available and
+    // the writer has caught up, so that they are still processed in the order
+    // of the latest appendItems()
+    if (mThumbnailGenerator->isFull() || sThumbnailWriter->isFull()) {
+        LOG("Waiting for generated thumbnails");
+        mCurrentItem = KFileItem();
         return;
     }
 
@@ -378,58 +401,77 @@ void ThumbnailProvider::slotResult(KJob *job)
     }
 }
 
-void ThumbnailProvider::thumbnailReady(const QImage &_img, const QSize &_size)
+void ThumbnailProvider::handleGeneratedThumbnails(const QList<ThumbnailResult> &results)
 {
-    QImage img = _img;
-    QSize size = _size;
-    if (!img.isNull()) {
-        emitThumbnailLoaded(img, size);
-    } else {
-        emitThumbnailLoadingFailed();
+    for (const ThumbnailResult &result : results) {
+        const ThumbnailRequest &request = result.mRequest;
+        LOG(request.mItem.url());
+        if (result.mImage.isNull()) {
+            Q_EMIT thumbnailLoadingFailed(request.mItem);
+        } else {
+            Q_EMIT thumbnailLoaded(request.mItem, QPixmap::fromImage(result.mImage), result.mOriginalSize, request.mOriginalFileSize);
+        }
     }
-    if (!mTempPath.isEmpty()) {
-        LOG("Delete temp file" << mTempPath);
-        QFile::remove(mTempPath);
-        mTempPath.clear();
+
+    // Workers are available again, carry on with the next items
+    if (mCurrentItem.isNull() && (!results.isEmpty() || !mItems.isEmpty())) {
+        determineNextIcon();
     }
-    determineNextIcon();
 }
 
-QImage ThumbnailProvider::loadThumbnailFromCache() const
+bool ThumbnailProvider::isThumbnailUpToDate(const QHash<QString, QString> &texts) const
 {
-    if (mThumbnailGroup > ThumbnailGroup::XXLarge) {
-        return {};
-    }
-
-    QImage image = sThumbnailWriter->value(mThumbnailPath);
-    if (!image.isNull()) {
-        return image;
-    }
+    const KIO::filesize_t fileSize = texts.value(QStringLiteral("Thumb::Size")).toULongLong();
+    return texts.value(QStringLiteral("Thumb::URI")) == mOriginalUri && texts.value(QStringLiteral("Thumb::MTime")).toLongLong() == mOriginalTime
+        && (fileSize == 0 || fileSize == mOriginalFileSize);
+}
 
-    if (!QFileInfo::exists(mThumbnailPath)) {
-        return {};
+QSize ThumbnailProvider::thumbnailOriginalSize(const QHash<QString, QString> &texts) const
+{
+    bool ok;
+    const int width = texts.value(QStringLiteral("Thumb::Image::Width")).toInt(&ok);
+    if (ok) {
+        const int height = texts.value(QStringLiteral("Thumb::Image::Height")).toInt(&ok);
+        if (ok) {
+            return QSize(width, height);
+        }
     }
+    // Don't try to determine the size from the original: it might be a
+    // video, which would cause high I/O usage with big files (bug #307007).
+    LOG("Thumbnail for" << mOriginalUri << "does not contain correct image size information");
+    return QSize();
+}
 
-    image = QImage(mThumbnailPath);
-    int largeThumbnailGroup = mThumbnailGroup;
-    while (image.isNull() && ++largeThumbnailGroup <= ThumbnailGroup::XXLarge) {
-        // If there is a large-sized thumbnail, generate the small-sized version from it
-        const QString largeThumbnailPath = generateThumbnailPath(mOriginalUri, static_cast<ThumbnailGroup::Enum>(largeThumbnailGroup));
-        const QImage largeImage(largeThumbnailPath);
-        if (!largeImage.isNull()) {
-            const int size = ThumbnailGroup::pixelSize(mThumbnailGroup);
-            image = largeImage.scaled(size, size, Qt::KeepAspectRatio, Qt::SmoothTransformation);
-            const QStringList textKeys = largeImage.textKeys();
-            for (const QString &key : textKeys) {
-                QString text = largeImage.text(key);
-                image.setText(key, text);
+QString ThumbnailProvider::findLargerThumbnail(QImage *pendingImage, QSize *originalSize) const
+{
+    const ThumbnailStore::Ptr store = ThumbnailStore::instance();
+    for (int group = mThumbnailGroup + 1; group <= ThumbnailGroup::XXLarge; ++group) {
+        const QString path = generateThumbnailPath(mOriginalUri, static_cast<ThumbnailGroup::Enum>(group));
+
+        const QImage pendingThumb = sThumbnailWriter->value(path);
+        if (!pendingThumb.isNull()) {
+            const QHash<QString, QString> texts = imageTexts(pendingThumb);
+            if (isThumbnailUpToDate(texts)) {
+                *pendingImage = pendingThumb;
+                *originalSize = thumbnailOriginalSize(texts);
+                return path;
             }
-            sThumbnailWriter->queueThumbnail(mThumbnailPath, image);
-            break;
+            continue;
+        }
+
+        ThumbnailStore::Entry entry;
+        if (store && store->find(path, &entry) && isStoreEntryUpToDate(entry, mOriginalTime, mOriginalFileSize)) {
+            *originalSize = entry.mOriginalSize;
+            return path;
         }
-    }
 
-    return image;
+        QHash<QString, QString> texts;
+        if (PngTextReader::read(path, &texts) && isThumbnailUpToDate(texts)) {
+            *originalSize = thumbnailOriginalSize(texts);
+            return path;
+        }
+    }
+    return {};
 }
 
 void ThumbnailProvider::checkThumbnail()
@@ -451,35 +493,48 @@ void ThumbnailProvider::checkThumbnail()
     mOriginalUri = generateOriginalUri(mCurrentUrl);
     mThumbnailPath = generateThumbnailPath(mOriginalUri, mThumbnailGroup);
 
+    // The packed store knows whether its thumbnail is up to date without
+    // decoding it. Thumbnails waiting to be written are more recent though.
+    const ThumbnailStore::Ptr store = ThumbnailStore::instance();
+    ThumbnailStore::Entry entry;
+    if (store && store->find(mThumbnailPath, &entry) && sThumbnailWriter->value(mThumbnailPath).isNull()) {
+        if (isStoreEntryUpToDate(entry, mOriginalTime, mOriginalFileSize)) {
+            startLoadingCachedThumbnail(entry.mOriginalSize, true);
+            return;
+        }
+        LOG("Stale thumbnail in store for" << mOriginalUri);
+    }
+
     LOG("Stat thumb" << mThumbnailPath);
 
-    QImage thumb = loadThumbnailFromCache();
-    KIO::filesize_t fileSize = thumb.text(QStringLiteral("Thumb::Size")).toULongLong();
-    if (!thumb.isNull()) {
-        if (thumb.text(QStringLiteral("Thumb::URI")) == mOriginalUri && thumb.text(QStringLiteral("Thumb::MTime")).toInt() == mOriginalTime
-            && (fileSize == 0 || fileSize == mOriginalFileSize)) {
-            int width = 0, height = 0;
-            QSize size;
-            bool ok;
-
-            width = thumb.text(QStringLiteral("Thumb::Image::Width")).toInt(&ok);
-            if (ok)
-                height = thumb.text(QStringLiteral("Thumb::Image::Height")).toInt(&ok);
-            if (ok) {
-                size = QSize(width, height);
-            } else {
-                LOG("Thumbnail for" << mOriginalUri << "does not contain correct image size information");
-                // Don't try to determine the size of a video, it probably won't work and
-                // will cause high I/O usage with big files (bug #307007).
-                if (MimeTypeUtils::urlKind(mCurrentUrl) == MimeTypeUtils::KIND_VIDEO) {
-                    emitThumbnailLoaded(thumb, QSize());
-                    determineNextIcon();
-                    return;
-                }
+    if (mThumbnailGroup <= ThumbnailGroup::XXLarge) {
+        const QImage pendingThumb = sThumbnailWriter->value(mThumbnailPath);
+        QHash<QString, QString> texts;
+        if (!pendingThumb.isNull()) {
+            // Not written yet, but already decoded
+            texts = imageTexts(pendingThumb);
+            if (isThumbnailUpToDate(texts)) {
+                emitThumbnailLoaded(pendingThumb, thumbnailOriginalSize(texts));
+                determineNextIcon();
+                return;
+            }
+        } else if (PngTextReader::read(mThumbnailPath, &texts)) {
+            // Check the text chunks only: the pixels of a stale thumbnail
+            // would be decoded for nothing
+            if (isThumbnailUpToDate(texts)) {
+                startLoadingCachedThumbnail(thumbnailOriginalSize(texts));
+                return;
+            }
+        } else {
+            // Missing or broken thumbnail. If there is a larger one, the
+            // generator can derive this one from it.
+            QImage pendingLargerThumb;
+            QSize originalSize;
+            const QString largerThumbnailPath = findLargerThumbnail(&pendingLargerThumb, &originalSize);
+            if (!largerThumbnailPath.isEmpty()) {
+                startDerivingThumbnail(largerThumbnailPath, pendingLargerThumb, originalSize);
+                return;
             }
-            emitThumbnailLoaded(thumb, size);
-            determineNextIcon();
-            return;
         }
     }
 
@@ -526,22 +581,58 @@ void ThumbnailProvider::checkThumbnail()
     }
 }
 
+ThumbnailRequest ThumbnailProvider::createRequest(const QString &pixPath)
+{
+    ThumbnailRequest request;
+    request.mItem = mCurrentItem;
+    request.mOriginalUri = mOriginalUri;
+    request.mOriginalTime = mOriginalTime;
+    request.mOriginalFileSize = mOriginalFileSize;
+    request.mOriginalMimeType = mCurrentItem.mimetype();
+    request.mPixPath = pixPath;
+    request.mTemporaryPixPath = !pixPath.isEmpty() && pixPath == mTempPath;
+    request.mThumbnailPath = mThumbnailPath;
+    request.mThumbnailGroup = mThumbnailGroup;
+    // The generator takes care of removing the temporary file
+    mTempPath.clear();
+    return request;
+}
+
 void ThumbnailProvider::startCreatingThumbnail(const QString &pixPath)
 {
     LOG("Creating thumbnail from" << pixPath);
-    // If mPreviousThumbnailGenerator is already working on our current item
-    // its thumbnail will be passed to sThumbnailWriter when ready. So we
-    // connect mPreviousThumbnailGenerator's signal "finished" to determineNextIcon
-    // which will load the thumbnail from sThumbnailWriter or from disk
-    // (because we re-add mCurrentItem to mItems).
-    if (mPreviousThumbnailGenerator && !mPreviousThumbnailGenerator->isStopped() && mOriginalUri == mPreviousThumbnailGenerator->originalUri()
-        && mOriginalTime == mPreviousThumbnailGenerator->originalTime() && mOriginalFileSize == mPreviousThumbnailGenerator->originalFileSize()
-        && mCurrentItem.mimetype() == mPreviousThumbnailGenerator->originalMimeType()) {
-        connect(mPreviousThumbnailGenerator, SIGNAL(finished()), SLOT(determineNextIcon()));
-        mItems.prepend(mCurrentItem);
-        return;
-    }
-    mThumbnailGenerator->load(mOriginalUri, mOriginalTime, mOriginalFileSize, mCurrentItem.mimetype(), pixPath, mThumbnailPath, mThumbnailGroup);
+    mThumbnailGenerator->load(createRequest(pixPath));
+    determineNextIcon();
+}
+
+ThumbnailRequest ThumbnailProvider::createCacheRequest(const QSize &originalSize)
+{
+    // Should the cached thumbnail turn out to be broken, generate it again
+    // if that does not require a download
+    const bool canRegenerate = mCurrentUrl.isLocalFile() && MimeTypeUtils::fileItemKind(mCurrentItem) == MimeTypeUtils::KIND_RASTER_IMAGE;
+    ThumbnailRequest request = createRequest(canRegenerate ? mCurrentUrl.toLocalFile() : QString());
+    request.mCachedOriginalSize = originalSize;
+    return request;
+}
+
+void ThumbnailProvider::startLoadingCachedThumbnail(const QSize &originalSize, bool fromStore)
+{
+    LOG("Loading cached thumbnail" << mThumbnailPath);
+    ThumbnailRequest request = createCacheRequest(originalSize);
+    request.mSource = fromStore ? ThumbnailRequest::FromStore : ThumbnailRequest::FromCache;
+    mThumbnailGenerator->load(request);
+    determineNextIcon();
+}
+
+void ThumbnailProvider::startDerivingThumbnail(const QString &largerThumbnailPath, const QImage &pendingLargerThumb, const QSize &originalSize)
+{
+    LOG("Deriving thumbnail from" << largerThumbnailPath);
+    ThumbnailRequest request = createCacheRequest(originalSize);
+    request.mSource = ThumbnailRequest::FromLargerThumbnail;
+    request.mLargerThumbnailPath = largerThumbnailPath;
+    request.mLargerThumbnail = pendingLargerThumb;
+    mThumbnailGenerator->load(request);
+    determineNextIcon();
 }
 
 void ThumbnailProvider::slotGotPreview(const KFileItem &item, const QPixmap &pixmap)
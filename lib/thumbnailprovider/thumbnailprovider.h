@@ -27,7 +27,9 @@
 #include <lib/gwenviewlib_export.h>
 
 // Qt
+#include <QHash>
 #include <QImage>
+#include <QList>
 #include <QPixmap>
 #include <QPointer>
 
@@ -42,6 +44,8 @@ namespace Gwenview
 {
 class ThumbnailGenerator;
 class ThumbnailWriter;
+struct ThumbnailRequest;
+struct ThumbnailResult;
 
 /**
  * A job that determines the thumbnails for the images in the current directory
@@ -133,7 +137,6 @@ private Q_SLOTS:
     void determineNextIcon();
     void slotGotPreview(const KFileItem &, const QPixmap &);
     void checkThumbnail();
-    void thumbnailReady(const QImage &, const QSize &);
     void emitThumbnailLoadingFailed();
 
 private:
@@ -169,17 +172,28 @@ private:
     ThumbnailGroup::Enum mThumbnailGroup;
 
     ThumbnailGenerator *mThumbnailGenerator;
-    QPointer<ThumbnailGenerator> mPreviousThumbnailGenerator;
 
     QStringList mPreviewPlugins;
 
-    void createNewThumbnailGenerator();
     void abortSubjob();
+    ThumbnailRequest createRequest(const QString &pixPath);
     void startCreatingThumbnail(const QString &path);
+    ThumbnailRequest createCacheRequest(const QSize &originalSize);
+    void startLoadingCachedThumbnail(const QSize &originalSize, bool fromStore = false);
+    void startDerivingThumbnail(const QString &largerThumbnailPath, const QImage &pendingLargerThumb, const QSize &originalSize);
+    void handleGeneratedThumbnails(const QList<ThumbnailResult> &results);
 
     void emitThumbnailLoaded(const QImage &img, const QSize &size);
 
-    QImage loadThumbnailFromCache() const;
+    bool isThumbnailUpToDate(const QHash<QString, QString> &texts) const;
+    QSize thumbnailOriginalSize(const QHash<QString, QString> &texts) const;
+    /**
+     * Returns the path of an up to date thumbnail for the current item, from
+     * a larger group than mThumbnailGroup, or an empty string if there is
+     * none. If that thumbnail has not been written yet, @p pendingImage is
+     * set to it.
+     */
+    QString findLargerThumbnail(QImage *pendingImage, QSize *originalSize) const;
 };
 
 } // namespace
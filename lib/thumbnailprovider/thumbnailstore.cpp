@@ -0,0 +1,668 @@
+// SPDX-FileCopyrightText: 2026 Gwenview Developers
+// SPDX-License-Identifier: GPL-2.0-or-later
+
+// Self
+#include "thumbnailstore.h"
+
+// Qt
+#include <QCryptographicHash>
+#include <QDir>
+#include <QFile>
+#include <QAtomicInteger>
+#include <QLockFile>
+#include <QMutex>
+#include <QSaveFile>
+#include <QThread>
+
+// STL
+#include <atomic>
+#include <cstring>
+#include <memory>
+
+// Local
+#include "gwenview_lib_debug.h"
+#include "gwenviewconfig.h"
+#include "thumbnailprovider.h"
+
+namespace Gwenview
+{
+#undef ENABLE_LOG
+#undef LOG
+// #define ENABLE_LOG
+#ifdef ENABLE_LOG
+#define LOG(x) qCDebug(GWENVIEW_LIB_LOG) << x
+#else
+#define LOG(x) ;
+#endif
+
+// The files are only read on the machine which wrote them, so they use the
+// native byte order. Several Gwenview instances may use them at the same time.
+static const char INDEX_MAGIC[8] = {'G', 'V', 'T', 'H', 'I', 'D', 'X', '1'};
+static const char BLOB_MAGIC[8] = {'G', 'V', 'T', 'H', 'B', 'L', 'B', '2'};
+static const quint32 INDEX_VERSION = 2;
+static const quint32 INITIAL_CAPACITY = 4096;
+static const qreal MAX_LOAD_FACTOR = 0.7;
+
+/** How many msec to wait for another instance to be done changing the store */
+static const int LOCK_TIMEOUT = 5000;
+
+/** How many times find() reads an entry another instance keeps changing */
+static const int MAX_READ_ATTEMPTS = 100;
+
+/**
+ * The blob is compacted when more than half of it, and at least that many
+ * bytes, is used by replaced or removed thumbnails
+ */
+static const quint64 MIN_COMPACTION_DEAD_BYTES = 16 * 1024 * 1024;
+
+/** The store is emptied when its blob would grow bigger than this */
+static const quint64 MAX_BLOB_SIZE = 512 * 1024 * 1024;
+
+struct IndexHeader {
+    char mMagic[8];
+    quint32 mVersion;
+    quint32 mCapacity;
+    // Number of slots which are not empty, including removed entries
+    quint32 mUsedSlots;
+    // Odd while an instance changes the index. Readers do not take the lock
+    // file: they retry when it changed while they were reading.
+    quint32 mGeneration;
+    // Changes when the blob is rewritten, BlobHeader holds the same value
+    quint32 mBlobGeneration;
+    quint32 mPadding;
+    // Bytes of the blob used by replaced or removed thumbnails
+    quint64 mDeadBytes;
+    char mReserved[24];
+};
+static_assert(sizeof(IndexHeader) == 64);
+
+struct BlobHeader {
+    char mMagic[8];
+    quint32 mGeneration;
+    char mReserved[4];
+};
+static_assert(sizeof(BlobHeader) == 16);
+
+enum SlotState : quint32 {
+    EmptySlot = 0,
+    UsedSlot,
+    RemovedSlot,
+};
+
+struct IndexEntry {
+    quint8 mKey[16];
+    qint64 mOriginalTime;
+    quint64 mOriginalFileSize;
+    quint64 mOffset;
+    quint32 mLength;
+    qint32 mOriginalWidth;
+    qint32 mOriginalHeight;
+    quint32 mState;
+    char mReserved[8];
+};
+static_assert(sizeof(IndexEntry) == 64);
+
+static QByteArray keyForPath(const QString &thumbnailPath)
+{
+    return QCryptographicHash::hash(QFile::encodeName(thumbnailPath), QCryptographicHash::Md5);
+}
+
+static qint64 indexFileSize(quint32 capacity)
+{
+    return sizeof(IndexHeader) + qint64(capacity) * sizeof(IndexEntry);
+}
+
+static QAtomicInteger<quint32> *generationCounter(IndexHeader *header)
+{
+    static_assert(sizeof(QAtomicInteger<quint32>) == sizeof(quint32));
+    return reinterpret_cast<QAtomicInteger<quint32> *>(&header->mGeneration);
+}
+
+/**
+ * Keeps the other Gwenview instances from changing the store files while it
+ * exists
+ */
+class StoreLocker
+{
+public:
+    explicit StoreLocker(QLockFile *lockFile)
+        : mLockFile(lockFile)
+        , mLocked(lockFile->tryLock(LOCK_TIMEOUT))
+    {
+        if (!mLocked) {
+            qCWarning(GWENVIEW_LIB_LOG) << "Could not lock thumbnail store, error" << lockFile->error();
+        }
+    }
+
+    ~StoreLocker()
+    {
+        if (mLocked) {
+            mLockFile->unlock();
+        }
+    }
+
+    bool isLocked() const
+    {
+        return mLocked;
+    }
+
+private:
+    QLockFile *const mLockFile;
+    const bool mLocked;
+};
+
+struct ThumbnailStorePrivate {
+    mutable QMutex mMutex;
+    std::unique_ptr<QLockFile> mLockFile;
+    QFile mIndexFile;
+    uchar *mIndexMap = nullptr;
+    // The capacity the index had when it was mapped. Another instance may
+    // have grown the index since then, header() then tells about entries
+    // which are out of the mapping.
+    quint32 mMappedCapacity = 0;
+    QFile mBlobFile;
+    // The generation of the blob which is open, see IndexHeader
+    quint32 mBlobGeneration = 0;
+
+    IndexHeader *header() const
+    {
+        return reinterpret_cast<IndexHeader *>(mIndexMap);
+    }
+
+    IndexEntry *entries() const
+    {
+        return reinterpret_cast<IndexEntry *>(mIndexMap + sizeof(IndexHeader));
+    }
+
+    bool isValid() const
+    {
+        return mIndexMap && mBlobFile.isOpen();
+    }
+
+    static QByteArray createIndex(quint32 capacity)
+    {
+        QByteArray index(indexFileSize(capacity), '\0');
+        auto header = reinterpret_cast<IndexHeader *>(index.data());
+        memcpy(header->mMagic, INDEX_MAGIC, sizeof(INDEX_MAGIC));
+        header->mVersion = INDEX_VERSION;
+        header->mCapacity = capacity;
+        return index;
+    }
+
+    static BlobHeader createBlobHeader(quint32 generation)
+    {
+        BlobHeader header = {};
+        memcpy(header.mMagic, BLOB_MAGIC, sizeof(BLOB_MAGIC));
+        header.mGeneration = generation;
+        return header;
+    }
+
+    /**
+     * Opens the blob file again, it may have been replaced by another
+     * instance. Returns false if it is not a valid blob.
+     */
+    bool openBlob()
+    {
+        mBlobFile.close();
+        if (!mBlobFile.open(QIODevice::ReadWrite)) {
+            return false;
+        }
+        BlobHeader header;
+        if (mBlobFile.read(reinterpret_cast<char *>(&header), sizeof(header)) != sizeof(header) || memcmp(header.mMagic, BLOB_MAGIC, sizeof(BLOB_MAGIC)) != 0) {
+            return false;
+        }
+        mBlobGeneration = header.mGeneration;
+        return true;
+    }
+
+    /**
+     * Makes sure the open blob is the one the index refers to. Must be called
+     * with the store locked.
+     */
+    bool ensureBlob()
+    {
+        if (header()->mBlobGeneration == mBlobGeneration && mBlobFile.isOpen()) {
+            return true;
+        }
+        LOG("Thumbnail blob was rewritten, opening it again");
+        return openBlob() && header()->mBlobGeneration == mBlobGeneration;
+    }
+
+    /**
+     * Changes of the index must be made between beginChange() and
+     * endChange(), with the store locked. The generation may already be odd
+     * if an instance crashed while changing the index: the next change makes
+     * it even again.
+     */
+    void beginChange()
+    {
+        QAtomicInteger<quint32> *counter = generationCounter(header());
+        counter->storeRelaxed(counter->loadRelaxed() | 1);
+        std::atomic_thread_fence(std::memory_order_release);
+    }
+
+    void endChange()
+    {
+        QAtomicInteger<quint32> *counter = generationCounter(header());
+        counter->storeRelease((counter->loadRelaxed() | 1) + 1);
+    }
+
+    bool mapIndex()
+    {
+        const qint64 size = mIndexFile.size();
+        if (size < qint64(sizeof(IndexHeader))) {
+            return false;
+        }
+        mIndexMap = mIndexFile.map(0, size);
+        if (!mIndexMap) {
+            return false;
+        }
+        const IndexHeader *hdr = header();
+        const quint32 capacity = hdr->mCapacity;
+        if (memcmp(hdr->mMagic, INDEX_MAGIC, sizeof(INDEX_MAGIC)) != 0 || hdr->mVersion != INDEX_VERSION || capacity == 0 || (capacity & (capacity - 1)) != 0
+            || indexFileSize(capacity) != size) {
+            mIndexFile.unmap(mIndexMap);
+            mIndexMap = nullptr;
+            return false;
+        }
+        mMappedCapacity = capacity;
+        return true;
+    }
+
+    void unmapIndex()
+    {
+        if (mIndexMap) {
+            mIndexFile.unmap(mIndexMap);
+            mIndexMap = nullptr;
+        }
+    }
+
+    /**
+     * Maps the index again if another instance resized it. Returns false if
+     * the index cannot be used right now, for example because another
+     * instance is in the middle of rewriting it.
+     */
+    bool ensureMapped()
+    {
+        if (mIndexMap && header()->mCapacity == mMappedCapacity) {
+            return true;
+        }
+        LOG("Thumbnail index changed size, mapping it again");
+        unmapIndex();
+        return mapIndex();
+    }
+
+    bool writeIndex(const QByteArray &index)
+    {
+        unmapIndex();
+        if (!mIndexFile.resize(index.size()) || !mIndexFile.seek(0) || mIndexFile.write(index) != index.size() || !mIndexFile.flush()) {
+            qCWarning(GWENVIEW_LIB_LOG) << "Could not write thumbnail index" << mIndexFile.errorString();
+            return false;
+        }
+        return mapIndex();
+    }
+
+    bool open(const QString &dir)
+    {
+        QDir().mkpath(dir);
+        mLockFile = std::make_unique<QLockFile>(dir + QStringLiteral("thumbnails.lock"));
+        const StoreLocker locker(mLockFile.get());
+        if (!locker.isLocked()) {
+            return false;
+        }
+        mIndexFile.setFileName(dir + QStringLiteral("thumbnails.index"));
+        mBlobFile.setFileName(dir + QStringLiteral("thumbnails.blob"));
+        if (!mIndexFile.open(QIODevice::ReadWrite)) {
+            qCWarning(GWENVIEW_LIB_LOG) << "Could not open thumbnail store in" << dir;
+            return false;
+        }
+        // A blob of another generation is left by an interrupted compaction
+        if (openBlob() && mapIndex() && header()->mBlobGeneration == mBlobGeneration) {
+            return true;
+        }
+        unmapIndex();
+
+        // Missing or corrupted, start from scratch
+        LOG("Creating thumbnail store in" << dir);
+        if (!mBlobFile.isOpen() && !mBlobFile.open(QIODevice::ReadWrite)) {
+            qCWarning(GWENVIEW_LIB_LOG) << "Could not open thumbnail store in" << dir;
+            return false;
+        }
+        const BlobHeader blobHeader = createBlobHeader(0);
+        mBlobGeneration = 0;
+        if (!mBlobFile.resize(0) || !mBlobFile.seek(0)
+            || mBlobFile.write(reinterpret_cast<const char *>(&blobHeader), sizeof(blobHeader)) != sizeof(blobHeader)) {
+            mBlobFile.close();
+            return false;
+        }
+        return writeIndex(createIndex(INITIAL_CAPACITY));
+    }
+
+    void close()
+    {
+        unmapIndex();
+        mIndexFile.close();
+        mBlobFile.close();
+    }
+
+    /**
+     * Returns the slot holding @p key, or -1. If @p forInsertion is true,
+     * returns the slot where @p key should be inserted if it is not there.
+     */
+    static qint64 findSlot(const IndexEntry *table, quint32 capacity, const QByteArray &key, bool forInsertion)
+    {
+        quint32 hash;
+        memcpy(&hash, key.constData(), sizeof(hash));
+        qint64 firstRemovedSlot = -1;
+        for (quint32 probe = 0; probe < capacity; ++probe) {
+            const quint32 slot = (hash + probe) & (capacity - 1);
+            const IndexEntry &entry = table[slot];
+            if (entry.mState == EmptySlot) {
+                if (!forInsertion) {
+                    return -1;
+                }
+                return firstRemovedSlot >= 0 ? firstRemovedSlot : slot;
+            }
+            if (entry.mState == RemovedSlot) {
+                if (firstRemovedSlot < 0) {
+                    firstRemovedSlot = slot;
+                }
+                continue;
+            }
+            if (memcmp(entry.mKey, key.constData(), sizeof(entry.mKey)) == 0) {
+                return slot;
+            }
+        }
+        return forInsertion ? firstRemovedSlot : -1;
+    }
+
+    /**
+     * Rehashes the index. Must be called with the store locked, between
+     * beginChange() and endChange().
+     */
+    bool grow()
+    {
+        const quint32 capacity = mMappedCapacity;
+        const IndexEntry *oldTable = entries();
+        // Double the capacity, unless removed entries take most of the used
+        // slots: dropping them is then enough
+        quint32 liveEntries = 0;
+        for (quint32 slot = 0; slot < capacity; ++slot) {
+            liveEntries += oldTable[slot].mState == UsedSlot;
+        }
+        const quint32 newCapacity = liveEntries > capacity * MAX_LOAD_FACTOR / 2 ? capacity * 2 : capacity;
+        LOG("Rehashing thumbnail index, capacity=" << newCapacity);
+
+        QByteArray index = createIndex(newCapacity);
+        auto newHeader = reinterpret_cast<IndexHeader *>(index.data());
+        auto newTable = reinterpret_cast<IndexEntry *>(index.data() + sizeof(IndexHeader));
+        for (quint32 slot = 0; slot < capacity; ++slot) {
+            const IndexEntry &entry = oldTable[slot];
+            if (entry.mState != UsedSlot) {
+                continue;
+            }
+            const QByteArray key = QByteArray::fromRawData(reinterpret_cast<const char *>(entry.mKey), sizeof(entry.mKey));
+            newTable[findSlot(newTable, newCapacity, key, true)] = entry;
+            ++newHeader->mUsedSlots;
+        }
+        newHeader->mGeneration = header()->mGeneration;
+        newHeader->mBlobGeneration = header()->mBlobGeneration;
+        newHeader->mDeadBytes = header()->mDeadBytes;
+        return writeIndex(index);
+    }
+
+    /**
+     * Writes the live thumbnails to a new blob, without the replaced or
+     * removed ones, and points the index to it. The capacity of the index
+     * does not change, so that the mappings of the other instances remain
+     * valid. Must be called with the store locked.
+     *
+     * If @p keepEntries is false, the store is emptied instead.
+     */
+    bool rewriteBlob(bool keepEntries)
+    {
+        LOG("Rewriting thumbnail blob, keepEntries=" << keepEntries);
+        const quint32 newGeneration = header()->mBlobGeneration + 1;
+        QSaveFile newBlob(mBlobFile.fileName());
+        const BlobHeader blobHeader = createBlobHeader(newGeneration);
+        if (!newBlob.open(QIODevice::WriteOnly)
+            || newBlob.write(reinterpret_cast<const char *>(&blobHeader), sizeof(blobHeader)) != sizeof(blobHeader)) {
+            qCWarning(GWENVIEW_LIB_LOG) << "Could not rewrite thumbnail blob" << newBlob.errorString();
+            return false;
+        }
+
+        QByteArray index = keepEntries ? QByteArray(reinterpret_cast<const char *>(mIndexMap), indexFileSize(mMappedCapacity)) : createIndex(mMappedCapacity);
+        auto newHeader = reinterpret_cast<IndexHeader *>(index.data());
+        auto newTable = reinterpret_cast<IndexEntry *>(index.data() + sizeof(IndexHeader));
+        for (quint32 slot = 0; keepEntries && slot < mMappedCapacity; ++slot) {
+            IndexEntry &entry = newTable[slot];
+            if (entry.mState != UsedSlot) {
+                continue;
+            }
+            const QByteArray data = readBlob(entry.mOffset, entry.mLength);
+            if (data.isEmpty()) {
+                entry.mState = RemovedSlot;
+                continue;
+            }
+            entry.mOffset = newBlob.pos();
+            if (newBlob.write(data) != data.size()) {
+                qCWarning(GWENVIEW_LIB_LOG) << "Could not rewrite thumbnail blob" << newBlob.errorString();
+                return false;
+            }
+        }
+        newHeader->mBlobGeneration = newGeneration;
+        newHeader->mDeadBytes = 0;
+        if (!newBlob.commit()) {
+            qCWarning(GWENVIEW_LIB_LOG) << "Could not rewrite thumbnail blob" << newBlob.errorString();
+            return false;
+        }
+        // Until the index is written, the blob does not match it: the other
+        // instances wait, and open() starts from scratch if we stop here
+        if (!openBlob()) {
+            return false;
+        }
+        beginChange();
+        newHeader->mGeneration = header()->mGeneration;
+        const bool ok = writeIndex(index);
+        if (mIndexMap) {
+            endChange();
+        }
+        return ok;
+    }
+
+    /**
+     * Reads the @p length bytes at @p offset in the blob, only those: the
+     * blob can be much bigger than what is worth mapping
+     */
+    QByteArray readBlob(quint64 offset, quint32 length)
+    {
+        if (offset < sizeof(BlobHeader) || offset + length > quint64(mBlobFile.size()) || !mBlobFile.seek(offset)) {
+            return {};
+        }
+        QByteArray data = mBlobFile.read(length);
+        if (data.size() != qsizetype(length)) {
+            return {};
+        }
+        return data;
+    }
+};
+
+static QMutex sInstanceMutex;
+static ThumbnailStore::Ptr sInstance;
+static bool sInstanceFailed = false;
+
+ThumbnailStore::Ptr ThumbnailStore::instance()
+{
+    if (!GwenviewConfig::usePackedThumbnailStore()) {
+        return {};
+    }
+    QMutexLocker locker(&sInstanceMutex);
+    if (!sInstance && !sInstanceFailed) {
+        Ptr store(new ThumbnailStore(ThumbnailProvider::thumbnailBaseDir() + QStringLiteral("x-gwenview/")), [](ThumbnailStore *store) {
+            delete store;
+        });
+        if (store->d->isValid()) {
+            sInstance = store;
+        } else {
+            sInstanceFailed = true;
+        }
+    }
+    return sInstance;
+}
+
+void ThumbnailStore::close()
+{
+    QMutexLocker locker(&sInstanceMutex);
+    // Deleted once the threads still using it are done
+    sInstance.reset();
+    sInstanceFailed = false;
+}
+
+ThumbnailStore::ThumbnailStore(const QString &dir)
+    : d(new ThumbnailStorePrivate)
+{
+    d->open(dir);
+}
+
+ThumbnailStore::~ThumbnailStore()
+{
+    d->close();
+    delete d;
+}
+
+bool ThumbnailStore::find(const QString &thumbnailPath, Entry *entry) const
+{
+    const QByteArray key = keyForPath(thumbnailPath);
+    QMutexLocker locker(&d->mMutex);
+    for (int attempt = 0; attempt < MAX_READ_ATTEMPTS; ++attempt) {
+        if (!d->ensureMapped()) {
+            return false;
+        }
+        QAtomicInteger<quint32> *counter = generationCounter(d->header());
+        const quint32 generation = counter->loadAcquire();
+        if (generation & 1) {
+            // Another instance is changing the index
+            QThread::yieldCurrentThread();
+            continue;
+        }
+        const quint32 blobGeneration = d->header()->mBlobGeneration;
+        const qint64 slot = ThumbnailStorePrivate::findSlot(d->entries(), d->mMappedCapacity, key, false);
+        IndexEntry indexEntry;
+        if (slot >= 0) {
+            memcpy(&indexEntry, &d->entries()[slot], sizeof(indexEntry));
+        }
+        std::atomic_thread_fence(std::memory_order_acquire);
+        if (counter->loadRelaxed() != generation) {
+            continue;
+        }
+        if (slot < 0) {
+            return false;
+        }
+        if (blobGeneration != d->mBlobGeneration && !(d->openBlob() && blobGeneration == d->mBlobGeneration)) {
+            // The blob is being rewritten
+            continue;
+        }
+        entry->mOriginalTime = indexEntry.mOriginalTime;
+        entry->mOriginalFileSize = indexEntry.mOriginalFileSize;
+        entry->mOriginalSize = QSize(indexEntry.mOriginalWidth, indexEntry.mOriginalHeight);
+        entry->mOffset = indexEntry.mOffset;
+        entry->mLength = indexEntry.mLength;
+        entry->mBlobGeneration = blobGeneration;
+        return true;
+    }
+    return false;
+}
+
+QImage ThumbnailStore::load(const Entry &entry) const
+{
+    QByteArray data;
+    {
+        QMutexLocker locker(&d->mMutex);
+        if (entry.mBlobGeneration != d->mBlobGeneration) {
+            // The blob has been rewritten since find()
+            return {};
+        }
+        data = d->readBlob(entry.mOffset, entry.mLength);
+    }
+    if (data.isEmpty()) {
+        qCWarning(GWENVIEW_LIB_LOG) << "Thumbnail store entry is out of the blob";
+        return {};
+    }
+    return QImage::fromData(data, "png");
+}
+
+void ThumbnailStore::insert(const QString &thumbnailPath, const QImage &image, const QByteArray &data)
+{
+    const QByteArray key = keyForPath(thumbnailPath);
+    bool ok;
+    IndexEntry entry = {};
+    memcpy(entry.mKey, key.constData(), sizeof(entry.mKey));
+    entry.mOriginalTime = image.text(QStringLiteral("Thumb::MTime")).toLongLong();
+    entry.mOriginalFileSize = image.text(QStringLiteral("Thumb::Size")).toULongLong();
+    entry.mOriginalWidth = image.text(QStringLiteral("Thumb::Image::Width")).toInt(&ok);
+    if (!ok) {
+        entry.mOriginalWidth = -1;
+    }
+    entry.mOriginalHeight = image.text(QStringLiteral("Thumb::Image::Height")).toInt(&ok);
+    if (!ok) {
+        entry.mOriginalHeight = -1;
+    }
+    entry.mLength = data.size();
+    entry.mState = UsedSlot;
+
+    QMutexLocker locker(&d->mMutex);
+    const StoreLocker storeLocker(d->mLockFile.get());
+    if (!storeLocker.isLocked() || !d->ensureMapped() || !d->ensureBlob()) {
+        return;
+    }
+    const quint64 deadBytes = d->header()->mDeadBytes;
+    if (deadBytes > MIN_COMPACTION_DEAD_BYTES && deadBytes > quint64(d->mBlobFile.size()) / 2) {
+        d->rewriteBlob(true);
+    }
+    if (quint64(d->mBlobFile.size()) + data.size() > MAX_BLOB_SIZE && !d->rewriteBlob(false)) {
+        return;
+    }
+    const qint64 offset = d->mBlobFile.size();
+    if (!d->mBlobFile.isOpen() || !d->mBlobFile.seek(offset) || d->mBlobFile.write(data) != data.size() || !d->mBlobFile.flush()) {
+        qCWarning(GWENVIEW_LIB_LOG) << "Could not write to thumbnail blob" << d->mBlobFile.errorString();
+        return;
+    }
+    entry.mOffset = offset;
+
+    d->beginChange();
+    if (d->header()->mUsedSlots + 1 > d->mMappedCapacity * MAX_LOAD_FACTOR && !d->grow()) {
+        if (d->mIndexMap) {
+            d->endChange();
+        }
+        return;
+    }
+    IndexEntry *table = d->entries();
+    const qint64 slot = ThumbnailStorePrivate::findSlot(table, d->mMappedCapacity, key, true);
+    Q_ASSERT(slot >= 0);
+    if (table[slot].mState == EmptySlot) {
+        ++d->header()->mUsedSlots;
+    } else if (table[slot].mState == UsedSlot) {
+        d->header()->mDeadBytes += table[slot].mLength;
+    }
+    table[slot] = entry;
+    d->endChange();
+}
+
+void ThumbnailStore::remove(const QString &thumbnailPath)
+{
+    const QByteArray key = keyForPath(thumbnailPath);
+    QMutexLocker locker(&d->mMutex);
+    const StoreLocker storeLocker(d->mLockFile.get());
+    if (!storeLocker.isLocked() || !d->ensureMapped()) {
+        return;
+    }
+    const qint64 slot = ThumbnailStorePrivate::findSlot(d->entries(), d->mMappedCapacity, key, false);
+    if (slot >= 0) {
+        d->beginChange();
+        d->entries()[slot].mState = RemovedSlot;
+        d->header()->mDeadBytes += d->entries()[slot].mLength;
+        d->endChange();
+    }
+}
+
+} // namespace
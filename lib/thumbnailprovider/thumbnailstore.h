@@ -0,0 +1,88 @@
+// SPDX-FileCopyrightText: 2026 Gwenview Developers
+// SPDX-License-Identifier: GPL-2.0-or-later
+
+#ifndef THUMBNAILSTORE_H
+#define THUMBNAILSTORE_H
+
+// STL
+#include <memory>
+
+// Qt
+#include <QImage>
+#include <QSize>
+#include <QString>
+
+namespace Gwenview
+{
+struct ThumbnailStorePrivate;
+
+/**
+ * A Gwenview-private thumbnail cache, packed in two files: a memory-mapped
+ * index and a blob file holding the PNG data of the thumbnails.
+ *
+ * Thumbnails are keyed by the path they would have in the freedesktop
+ * thumbnail cache, which remains the fallback when the store does not know
+ * about a thumbnail. The index keeps the modification time, file size and
+ * dimensions of the original image, so staleness can be checked without
+ * decoding anything.
+ *
+ * All methods are thread-safe. The store can be shared by several Gwenview
+ * instances: changes are made under a lock file, and the index is mapped
+ * again when another instance resized it. Lookups do not take the lock file,
+ * they read the index again if another instance changed it meanwhile.
+ *
+ * Replaced and removed thumbnails are dropped from the blob once they take
+ * more than half of it, and the store is emptied when the blob reaches its
+ * size limit.
+ */
+class ThumbnailStore
+{
+public:
+    using Ptr = std::shared_ptr<ThumbnailStore>;
+
+    struct Entry {
+        qint64 mOriginalTime = 0;
+        quint64 mOriginalFileSize = 0;
+        QSize mOriginalSize;
+        quint64 mOffset = 0;
+        quint32 mLength = 0;
+        /// The version of the blob mOffset refers to, load() fails if the
+        /// blob has been rewritten since then
+        quint32 mBlobGeneration = 0;
+    };
+
+    /**
+     * Returns the store for the current thumbnail base dir, or nullptr if the
+     * UsePackedThumbnailStore option is off or the store could not be opened.
+     */
+    static Ptr instance();
+
+    /**
+     * Closes the store. It is opened again by the next instance() call.
+     * Threads still using the previous store keep it open until they drop
+     * it.
+     */
+    static void close();
+
+    bool find(const QString &thumbnailPath, Entry *entry) const;
+
+    QImage load(const Entry &entry) const;
+
+    /**
+     * Stores @p data, the PNG encoded version of @p image. The information
+     * stored in the index is read from the Thumb:: text keys of @p image.
+     */
+    void insert(const QString &thumbnailPath, const QImage &image, const QByteArray &data);
+
+    void remove(const QString &thumbnailPath);
+
+private:
+    explicit ThumbnailStore(const QString &dir);
+    ~ThumbnailStore();
+
+    ThumbnailStorePrivate *const d;
+};
+
+} // namespace
+
+#endif /* THUMBNAILSTORE_H */
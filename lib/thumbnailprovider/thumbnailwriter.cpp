@@ -24,10 +24,14 @@ Foundation, Inc., 51 Franklin Street, Fifth Floor, Cambridge, MA 02110-1301, USA
 // Local
 #include "gwenview_lib_debug.h"
 #include "gwenviewconfig.h"
+#include "thumbnailstore.h"
 
 // Qt
+#include <QBuffer>
 #include <QImage>
+#include <QImageWriter>
 #include <QTemporaryFile>
+#include <QThread>
 
 namespace Gwenview
 {
@@ -40,27 +44,69 @@ namespace Gwenview
 #define LOG(x) ;
 #endif
 
-static void storeThumbnailToDiskCache(const QString &path, const QImage &image)
+// Above this number of queued thumbnails, ThumbnailProvider stops generating
+// new ones until some have been stored
+static const int MAX_QUEUED_THUMBNAILS = 32;
+
+static void storeThumbnailToDiskCache(const QString &path, const QImage &image, int quality)
 {
     if (GwenviewConfig::lowResourceUsageMode()) {
         return;
     }
 
     LOG(path);
+    // The Thumb:: text keys of the image are written as PNG text chunks
+    QByteArray data;
+    QBuffer buffer(&data);
+    buffer.open(QIODevice::WriteOnly);
+    QImageWriter writer(&buffer, "png");
+    writer.setQuality(quality);
+    if (!writer.write(image)) {
+        qCWarning(GWENVIEW_LIB_LOG) << "Could not save thumbnail" << writer.errorString();
+        return;
+    }
+
+    if (const ThumbnailStore::Ptr store = ThumbnailStore::instance()) {
+        store->insert(path, image, data);
+        return;
+    }
+
     QTemporaryFile tmp(path + QStringLiteral(".gwenview.tmpXXXXXX.png"));
     if (!tmp.open()) {
         qCWarning(GWENVIEW_LIB_LOG) << "Could not create a temporary file.";
         return;
     }
-
-    if (!image.save(tmp.fileName(), "png")) {
-        qCWarning(GWENVIEW_LIB_LOG) << "Could not save thumbnail";
+    if (tmp.write(data) != data.size()) {
+        qCWarning(GWENVIEW_LIB_LOG) << "Could not save thumbnail" << tmp.errorString();
         return;
     }
+    tmp.close();
 
     QFile::rename(tmp.fileName(), path);
 }
 
+ThumbnailWriter::ThumbnailWriter()
+{
+    // Leave some cores to the thumbnail generators
+    mPool.setMaxThreadCount(qMax(1, QThread::idealThreadCount() / 2));
+}
+
+ThumbnailWriter::~ThumbnailWriter()
+{
+    // Drop thumbnails which have not started being written, they can be
+    // generated again
+    mPool.clear();
+    mPool.waitForDone();
+}
+
+int ThumbnailWriter::pngQualityForCompressionLevel(int level)
+{
+    // QImageWriter expects a quality, 0 producing the smallest files and 100
+    // the biggest ones. It is converted back to a zlib level with
+    // (100 - quality) * 9 / 91, so round up to get the same level back.
+    return 100 - (qBound(0, level, 9) * 91 + 8) / 9;
+}
+
 void ThumbnailWriter::queueThumbnail(const QString &path, const QImage &image)
 {
     if (GwenviewConfig::lowResourceUsageMode()) {
@@ -68,28 +114,38 @@ void ThumbnailWriter::queueThumbnail(const QString &path, const QImage &image)
     }
 
     LOG(path);
+    const int quality = pngQualityForCompressionLevel(GwenviewConfig::thumbnailCompressionLevel());
     QMutexLocker locker(&mMutex);
+    const bool alreadyQueued = mCache.contains(path);
     mCache.insert(path, image);
-    start();
+    if (!alreadyQueued) {
+        mPool.start([this, path, quality]() {
+            writeThumbnail(path, quality);
+        });
+    }
 }
 
-void ThumbnailWriter::run()
+void ThumbnailWriter::writeThumbnail(const QString &path, int quality)
 {
     QMutexLocker locker(&mMutex);
-    while (!mCache.isEmpty() && !isInterruptionRequested()) {
-        Cache::ConstIterator it = mCache.constBegin();
-        const QString path = it.key();
-        const QImage image = it.value();
-
-        // This part of the thread is the most time consuming but it does not
-        // depend on mCache so we can unlock here. This way other thumbnails
-        // can be added or queried
+    while (true) {
+        const QImage image = mCache.value(path);
+
+        // This part is the most time consuming but it does not depend on
+        // mCache so we can unlock here. This way other thumbnails can be added
+        // or queried
         locker.unlock();
-        storeThumbnailToDiskCache(path, image);
+        storeThumbnailToDiskCache(path, image, quality);
         locker.relock();
 
-        mCache.remove(path);
+        // Write again if a new version has been queued in the meantime
+        if (mCache.value(path).cacheKey() == image.cacheKey()) {
+            mCache.remove(path);
+            break;
+        }
     }
+    locker.unlock();
+    Q_EMIT thumbnailWritten();
 }
 
 QImage ThumbnailWriter::value(const QString &path) const
@@ -104,6 +160,12 @@ bool ThumbnailWriter::isEmpty() const
     return mCache.isEmpty();
 }
 
+bool ThumbnailWriter::isFull() const
+{
+    QMutexLocker locker(&mMutex);
+    return mCache.count() >= MAX_QUEUED_THUMBNAILS;
+}
+
 } // namespace
 
 #include "moc_thumbnailwriter.cpp"
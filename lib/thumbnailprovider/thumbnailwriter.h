@@ -22,40 +22,64 @@ Foundation, Inc., 51 Franklin Street, Fifth Floor, Cambridge, MA 02110-1301, USA
 #define THUMBNAILWRITER_H
 
 // Local
+#include <lib/gwenviewlib_export.h>
 
 // KF
 
 // Qt
 #include <QHash>
 #include <QMutex>
-#include <QThread>
+#include <QObject>
+#include <QThreadPool>
 
 class QImage;
 
 namespace Gwenview
 {
 /**
- * Store thumbnails to disk when done generating them
+ * Store thumbnails to disk when done generating them. Thumbnails are
+ * encoded in parallel on a small pool of threads.
  */
-class ThumbnailWriter : public QThread
+class GWENVIEWLIB_EXPORT ThumbnailWriter : public QObject
 {
     Q_OBJECT
 public:
+    ThumbnailWriter();
+    ~ThumbnailWriter() override;
+
     // Return thumbnail if it has still not been stored
     QImage value(const QString &) const;
 
     bool isEmpty() const;
 
+    /**
+     * Returns true if too many thumbnails are waiting to be stored. Producers
+     * should wait for thumbnailWritten() before generating more of them.
+     */
+    bool isFull() const;
+
+    /**
+     * Returns the QImageWriter quality which makes the PNG encoder use the
+     * zlib compression @p level, between 0 and 9.
+     */
+    static int pngQualityForCompressionLevel(int level);
+
 public Q_SLOTS:
     void queueThumbnail(const QString &, const QImage &);
 
-protected:
-    void run() override;
+Q_SIGNALS:
+    /**
+     * Emitted from a writer thread when a thumbnail has been stored
+     */
+    void thumbnailWritten();
 
 private:
+    void writeThumbnail(const QString &path, int quality);
+
     using Cache = QHash<QString, QImage>;
     Cache mCache;
     mutable QMutex mMutex;
+    QThreadPool mPool;
 };
 
 } // namespace
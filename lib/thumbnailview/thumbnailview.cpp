@@ -20,6 +20,7 @@ Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
 #include "thumbnailview.h"
 
 // STL
+#include <algorithm>
 #include <cmath>
 
 // Qt
@@ -28,15 +29,19 @@ Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
 #include <QDrag>
 #include <QDragEnterEvent>
 #include <QDropEvent>
+#include <QElapsedTimer>
 #include <QMimeData>
 #include <QPainter>
 #include <QPointer>
 #include <QQueue>
 #include <QScrollBar>
 #include <QScroller>
+#include <QThread>
+#include <QThreadPool>
 #include <QTimeLine>
 #include <QTimer>
 #include <QWindow>
+#include <QtConcurrentRun>
 
 // KF
 #include <KDirLister>
@@ -74,6 +79,37 @@ namespace Gwenview
 /** How many msec to wait before starting to smooth thumbnails */
 const int SMOOTH_DELAY = 500;
 
+/** How many msec to wait before generating thumbnails */
+const int GENERATION_DELAY = 500;
+
+/**
+ * How many msec to wait before generating thumbnails while scrolling fast:
+ * the area the view is heading to is known, there is no point in waiting
+ */
+const int SCROLL_GENERATION_DELAY = 100;
+
+/** Scrolls further apart than this many msec are not part of the same move */
+const int SCROLL_VELOCITY_TIMEOUT = 200;
+
+/** How many msec ahead to predict the visible area when scrolling */
+const int SCROLL_LOOKAHEAD = 500;
+
+/** From how many pixels per second scrolling is considered fast */
+const int FAST_SCROLL_SPEED = 1000;
+
+/** How many thumbnails a smoothing task scales */
+const int SMOOTH_BATCH_SIZE = 16;
+
+/**
+ * A thumbnail which has not been shown for this many msec counts as a new
+ * lookup in the cache statistics when it is shown again
+ */
+const int LOOKUP_INTERVAL = 1000;
+
+// Thumbnails are smoothed in their own pool, so that they do not wait for
+// thumbnail generation, nor delay it
+Q_GLOBAL_STATIC(QThreadPool, sSmoothPool)
+
 const int WHEEL_ZOOM_MULTIPLIER = 4;
 
 static KFileItem fileItemForIndex(const QModelIndex &index)
@@ -92,6 +128,37 @@ static QUrl urlForIndex(const QModelIndex &index)
     return item.isNull() ? QUrl() : item.url();
 }
 
+/**
+ * Scales @p pix, a QPixmap or a QImage, to fit @p size according to @p mode
+ */
+template<typename Pixmap>
+static Pixmap scaleThumbnail(const Pixmap &pix, const QSize &size, ThumbnailView::ThumbnailScaleMode mode, Qt::TransformationMode transformationMode)
+{
+    switch (mode) {
+    case ThumbnailView::ScaleToFit:
+        return pix.scaled(size.width(), size.height(), Qt::KeepAspectRatio, transformationMode);
+    case ThumbnailView::ScaleToSquare: {
+        int minSize = qMin(pix.width(), pix.height());
+        Pixmap pix2 = pix.copy((pix.width() - minSize) / 2, (pix.height() - minSize) / 2, minSize, minSize);
+        return pix2.scaled(size.width(), size.height(), Qt::KeepAspectRatio, transformationMode);
+    }
+    case ThumbnailView::ScaleToHeight:
+        return pix.scaledToHeight(size.height(), transformationMode);
+    case ThumbnailView::ScaleToWidth:
+        return pix.scaledToWidth(size.width(), transformationMode);
+    }
+    // Keep compiler happy
+    Q_ASSERT(0);
+    return {};
+}
+
+struct SmoothRequest {
+    QUrl url;
+    QImage image;
+    /// Cache key of the group pixmap image comes from
+    qint64 groupPixKey;
+};
+
 struct Thumbnail {
     Thumbnail(const QPersistentModelIndex &index_, const QDateTime &mtime)
         : mIndex(index_)
@@ -115,6 +182,7 @@ struct Thumbnail {
     void initAsIcon(const QPixmap &pix)
     {
         mGroupPix = pix;
+        mGroupImage = QImage();
         int largeGroupSize = ThumbnailGroup::pixelSize(ThumbnailGroup::Large);
         mFullSize = QSize(largeGroupSize, largeGroupSize);
     }
@@ -137,11 +205,40 @@ struct Thumbnail {
         return groupSize == qMax(mFullSize.width(), mFullSize.height());
     }
 
+    /**
+     * Memory used by the pixmaps, in bytes
+     */
+    qint64 cost() const
+    {
+        auto pixmapCost = [](const QPixmap &pix) {
+            return qint64(pix.width()) * pix.height() * pix.depth() / 8;
+        };
+        qint64 cost = pixmapCost(mGroupPix);
+        if (mAdjustedPix.cacheKey() != mGroupPix.cacheKey()) {
+            cost += pixmapCost(mAdjustedPix);
+        }
+        return cost;
+    }
+
+    /**
+     * mGroupPix as an image, which can be scaled outside of the GUI thread.
+     * It is converted once and kept with mGroupPix, whose memory it shares
+     * on most platforms.
+     */
+    const QImage &groupImage()
+    {
+        if (mGroupImage.isNull() && !mGroupPix.isNull()) {
+            mGroupImage = mGroupPix.toImage();
+        }
+        return mGroupImage;
+    }
+
     void prepareForRefresh(const QDateTime &mtime)
     {
         mModificationTime = mtime;
         mFileSize = 0;
         mGroupPix = QPixmap();
+        mGroupImage = QImage();
         mAdjustedPix = QPixmap();
         mFullSize = QSize();
         mRealFullSize = QSize();
@@ -153,6 +250,8 @@ struct Thumbnail {
     QDateTime mModificationTime;
     /// The pix loaded from .thumbnails/{large,normal}
     QPixmap mGroupPix;
+    /// See groupImage()
+    QImage mGroupImage;
     /// Scaled version of mGroupPix, adjusted to ThumbnailView::thumbnailSize
     QPixmap mAdjustedPix;
     /// Size of the full image
@@ -167,6 +266,11 @@ struct Thumbnail {
     bool mRough;
     /// Set to true if mGroupPix should be replaced with a real thumbnail
     bool mWaitingForThumbnail;
+    /// cost() as counted in ThumbnailViewPrivate::mCacheSize
+    qint64 mCost = 0;
+    /// When the thumbnail was last shown, see ThumbnailViewPrivate::mClock.
+    /// Negative if it has not been shown yet.
+    qint64 mLastUsed = -1;
 };
 
 using ThumbnailForUrl = QHash<QUrl, Thumbnail>;
@@ -235,6 +339,17 @@ struct ThumbnailViewPrivate {
 
     UrlQueue mSmoothThumbnailQueue;
     QTimer mSmoothThumbnailTimer;
+    /// Urls in mSmoothThumbnailQueue or being smoothed
+    QSet<QUrl> mSmoothingUrls;
+    /// Incremented when the thumbnail size changes, to ignore smoothed
+    /// thumbnails of the previous size
+    int mSmoothGeneration = 0;
+
+    QElapsedTimer mClock;
+    QTimer mTrimCacheTimer;
+    ThumbnailView::CacheStatistics mCacheStatistics;
+    /// Sum of the costs of the thumbnails in mThumbnailForUrl
+    qint64 mCacheSize = 0;
 
     QPixmap mWaitingThumbnail;
     QPointer<ThumbnailProvider> mThumbnailProvider;
@@ -248,6 +363,11 @@ struct ThumbnailViewPrivate {
     QScroller *mScroller;
     Touch *mTouch;
 
+    /// Scroll speed in pixels per second, estimated from the recent scrolls
+    QPointF mScrollVelocity;
+    /// When the view was last scrolled, see mClock
+    qint64 mLastScrollTime = 0;
+
     bool loading = false;
 
     void setupBusyAnimation()
@@ -260,14 +380,61 @@ struct ThumbnailViewPrivate {
         QObject::connect(mBusyAnimationTimeLine, &QTimeLine::frameChanged, q, &ThumbnailView::updateBusyIndexes);
     }
 
+    void updateScrollVelocity(int dx, int dy)
+    {
+        const qint64 now = mClock.elapsed();
+        const qint64 elapsed = now - mLastScrollTime;
+        mLastScrollTime = now;
+        if (elapsed > SCROLL_VELOCITY_TIMEOUT) {
+            // A new move: its speed is not known yet
+            mScrollVelocity = QPointF();
+            return;
+        }
+        // The content moves the opposite way of the visible area. Average with
+        // the previous estimate to smooth out the irregular timing of wheel
+        // and scroll bar events.
+        const QPointF velocity = QPointF(-dx, -dy) * 1000. / qMax(qint64(1), elapsed);
+        mScrollVelocity = (mScrollVelocity + velocity) / 2;
+    }
+
+    bool isScrollingFast() const
+    {
+        if (mScroller->state() == QScroller::Scrolling) {
+            return true;
+        }
+        return mClock.elapsed() - mLastScrollTime <= SCROLL_VELOCITY_TIMEOUT && mScrollVelocity.manhattanLength() >= FAST_SCROLL_SPEED;
+    }
+
+    /**
+     * Returns where the visible area is expected to be once scrolling stops,
+     * in viewport coordinates
+     */
+    QRect predictedVisibleRect() const
+    {
+        const QRect visibleRect = q->viewport()->rect();
+        QPointF offset;
+        if (mScroller->state() == QScroller::Scrolling) {
+            // Kinetic scrolling knows where it stops. Its positions are the
+            // scroll bar values.
+            offset = mScroller->finalPosition() - QPointF(q->horizontalScrollBar()->value(), q->verticalScrollBar()->value());
+        } else if (mClock.elapsed() - mLastScrollTime <= SCROLL_VELOCITY_TIMEOUT) {
+            // Do not predict further than a viewport away, the user may stop
+            // anytime
+            offset = mScrollVelocity * SCROLL_LOOKAHEAD / 1000.;
+            offset.setX(qBound(qreal(-visibleRect.width()), offset.x(), qreal(visibleRect.width())));
+            offset.setY(qBound(qreal(-visibleRect.height()), offset.y(), qreal(visibleRect.height())));
+        }
+        return visibleRect.translated(offset.toPoint());
+    }
+
     void scheduleThumbnailGeneration()
     {
         if (mThumbnailProvider) {
             mThumbnailProvider->removePendingItems();
         }
-        mSmoothThumbnailQueue.clear();
+        clearSmoothThumbnailQueue();
         if (!mScheduledThumbnailGenerationTimer.isActive()) {
-            mScheduledThumbnailGenerationTimer.start();
+            mScheduledThumbnailGenerationTimer.start(GENERATION_DELAY);
         }
     }
 
@@ -280,7 +447,11 @@ struct ThumbnailViewPrivate {
         QPixmap pix;
         QSize fullSize;
         mDocumentInfoProvider->thumbnailForDocument(url, group, &pix, &fullSize);
-        mThumbnailForUrl[url] = Thumbnail(QPersistentModelIndex(index), QDateTime::currentDateTime());
+        const ThumbnailForUrl::Iterator it = mThumbnailForUrl.find(url);
+        if (it != mThumbnailForUrl.end()) {
+            removeThumbnail(it);
+        }
+        mThumbnailForUrl.insert(url, Thumbnail(QPersistentModelIndex(index), QDateTime::currentDateTime()));
         q->setThumbnail(item, pix, fullSize, 0);
     }
 
@@ -305,6 +476,7 @@ struct ThumbnailViewPrivate {
             thumbnail->mAdjustedPix = scale(mGroupPix, Qt::FastTransformation);
             thumbnail->mRough = true;
         }
+        updateCost(*thumbnail);
     }
 
     void initDragPixmap(QDrag *drag, const QModelIndexList &indexes)
@@ -320,24 +492,152 @@ struct ThumbnailViewPrivate {
         drag->setHotSpot(dragPixmap.hotSpot);
     }
 
+    /**
+     * Updates mCacheSize after the pixmaps of @p thumbnail changed
+     */
+    void updateCost(Thumbnail &thumbnail)
+    {
+        const qint64 cost = thumbnail.cost();
+        mCacheSize += cost - thumbnail.mCost;
+        thumbnail.mCost = cost;
+    }
+
+    ThumbnailForUrl::Iterator removeThumbnail(ThumbnailForUrl::Iterator it)
+    {
+        mCacheSize -= it->mCost;
+        return mThumbnailForUrl.erase(it);
+    }
+
+    /**
+     * Drops thumbnails until they fit in the budget. Visible thumbnails are
+     * kept, the others are dropped by decreasing score, which grows with the
+     * time since they were last shown (one point per second) and with their
+     * distance to the visible area (one point per viewport diagonal).
+     * Dropped thumbnails are loaded again from the disk cache when they get
+     * close to the visible area.
+     */
+    void trimCache()
+    {
+        const qint64 budget = qint64(GwenviewConfig::thumbnailCacheSize()) * 1024 * 1024;
+        if (mCacheSize <= budget) {
+            return;
+        }
+        const QRect visibleRect = q->viewport()->rect();
+        const qreal diagonal = qMax(1, visibleRect.bottomRight().manhattanLength());
+        const qint64 now = mClock.elapsed();
+
+        // score => url
+        QMultiMap<qreal, QUrl> candidates;
+        for (ThumbnailForUrl::ConstIterator it = mThumbnailForUrl.constBegin(), end = mThumbnailForUrl.constEnd(); it != end; ++it) {
+            if (it->mCost == 0) {
+                continue;
+            }
+            const QRect itemRect = it->mIndex.isValid() ? q->visualRect(it->mIndex) : QRect();
+            if (itemRect.intersects(visibleRect)) {
+                continue;
+            }
+            const qreal distance = (itemRect.center() - visibleRect.center()).manhattanLength() / diagonal;
+            const qreal age = (now - it->mLastUsed) / 1000.;
+            candidates.insert(distance + age, it.key());
+        }
+
+        KFileItemList evictedItems;
+        for (auto it = candidates.constEnd(); mCacheSize > budget && it != candidates.constBegin();) {
+            --it;
+            const ThumbnailForUrl::Iterator thumbnailIt = mThumbnailForUrl.find(it.value());
+            const KFileItem item = fileItemForIndex(thumbnailIt->mIndex);
+            if (!item.isNull()) {
+                evictedItems << item;
+            }
+            removeThumbnail(thumbnailIt);
+            removeSmoothThumbnail(it.value());
+            ++mCacheStatistics.evictionCount;
+        }
+        if (mThumbnailProvider && !evictedItems.isEmpty()) {
+            mThumbnailProvider->removeItems(evictedItems);
+        }
+        LOG("Cache size" << mCacheSize << "evicted" << evictedItems.count());
+    }
+
     QPixmap scale(const QPixmap &pix, Qt::TransformationMode transformationMode)
     {
-        switch (mScaleMode) {
-        case ThumbnailView::ScaleToFit:
-            return pix.scaled(mThumbnailSize.width(), mThumbnailSize.height(), Qt::KeepAspectRatio, transformationMode);
-        case ThumbnailView::ScaleToSquare: {
-            int minSize = qMin(pix.width(), pix.height());
-            QPixmap pix2 = pix.copy((pix.width() - minSize) / 2, (pix.height() - minSize) / 2, minSize, minSize);
-            return pix2.scaled(mThumbnailSize.width(), mThumbnailSize.height(), Qt::KeepAspectRatio, transformationMode);
+        return scaleThumbnail(pix, mThumbnailSize, mScaleMode, transformationMode);
+    }
+
+    void enqueueSmoothThumbnail(const QUrl &url)
+    {
+        if (mSmoothingUrls.contains(url)) {
+            return;
         }
-        case ThumbnailView::ScaleToHeight:
-            return pix.scaledToHeight(mThumbnailSize.height(), transformationMode);
-        case ThumbnailView::ScaleToWidth:
-            return pix.scaledToWidth(mThumbnailSize.width(), transformationMode);
+        mSmoothingUrls.insert(url);
+        mSmoothThumbnailQueue.enqueue(url);
+        if (!mSmoothThumbnailTimer.isActive()) {
+            mSmoothThumbnailTimer.start(SMOOTH_DELAY);
         }
-        // Keep compiler happy
-        Q_ASSERT(0);
-        return {};
+    }
+
+    void removeSmoothThumbnail(const QUrl &url)
+    {
+        mSmoothThumbnailQueue.removeAll(url);
+        mSmoothingUrls.remove(url);
+    }
+
+    void clearSmoothThumbnailQueue()
+    {
+        for (const QUrl &url : std::as_const(mSmoothThumbnailQueue)) {
+            mSmoothingUrls.remove(url);
+        }
+        mSmoothThumbnailQueue.clear();
+    }
+
+    /**
+     * Scales the group pixmaps of @p urls on sSmoothPool and shows the
+     * results
+     */
+    void startSmoothBatch(const QList<QUrl> &urls)
+    {
+        QList<SmoothRequest> requests;
+        for (const QUrl &url : urls) {
+            const ThumbnailForUrl::Iterator it = mThumbnailForUrl.find(url);
+            if (it == mThumbnailForUrl.end() || it->mGroupPix.isNull()) {
+                mSmoothingUrls.remove(url);
+                continue;
+            }
+            requests << SmoothRequest{url, it->groupImage(), it->mGroupPix.cacheKey()};
+        }
+        if (requests.isEmpty()) {
+            return;
+        }
+
+        const QSize size = mThumbnailSize;
+        const ThumbnailView::ThumbnailScaleMode mode = mScaleMode;
+        const int generation = mSmoothGeneration;
+        // The setting may change at any time
+        sSmoothPool->setMaxThreadCount(GwenviewConfig::lowResourceUsageMode() ? 1 : QThread::idealThreadCount());
+        QtConcurrent::run(sSmoothPool(), [requests = std::move(requests), size, mode]() mutable {
+            for (SmoothRequest &request : requests) {
+                request.image = scaleThumbnail(request.image, size, mode, Qt::SmoothTransformation);
+            }
+            return requests;
+        }).then(q, [this, generation](const QList<SmoothRequest> &results) {
+            if (generation != mSmoothGeneration) {
+                // The thumbnail size changed since the request
+                return;
+            }
+            const qreal dpr = q->devicePixelRatioF();
+            for (const SmoothRequest &result : results) {
+                mSmoothingUrls.remove(result.url);
+                const ThumbnailForUrl::Iterator it = mThumbnailForUrl.find(result.url);
+                if (it == mThumbnailForUrl.end() || it->mGroupPix.cacheKey() != result.groupPixKey) {
+                    continue;
+                }
+                it->mAdjustedPix = QPixmap::fromImage(result.image);
+                it->mAdjustedPix.setDevicePixelRatio(dpr);
+                it->mRough = false;
+                updateCost(*it);
+                q->update(it->mIndex);
+            }
+        });
     }
 };
 
@@ -372,11 +672,17 @@ ThumbnailView::ThumbnailView(QWidget *parent)
     setHorizontalScrollMode(ScrollPerPixel);
 
     d->mScheduledThumbnailGenerationTimer.setSingleShot(true);
-    d->mScheduledThumbnailGenerationTimer.setInterval(500);
     connect(&d->mScheduledThumbnailGenerationTimer, &QTimer::timeout, this, &ThumbnailView::generateThumbnailsForItems);
 
     d->mSmoothThumbnailTimer.setSingleShot(true);
-    connect(&d->mSmoothThumbnailTimer, &QTimer::timeout, this, &ThumbnailView::smoothNextThumbnail);
+    connect(&d->mSmoothThumbnailTimer, &QTimer::timeout, this, &ThumbnailView::smoothThumbnails);
+
+    // Thumbnails arrive in bursts, trim once per burst
+    d->mClock.start();
+    d->mTrimCacheTimer.setSingleShot(true);
+    connect(&d->mTrimCacheTimer, &QTimer::timeout, this, [this]() {
+        d->trimCache();
+    });
 
     setContextMenuPolicy(Qt::CustomContextMenu);
     connect(this, &ThumbnailView::customContextMenuRequested, this, &ThumbnailView::showContextMenu);
@@ -484,14 +790,17 @@ void ThumbnailView::updateThumbnailSize()
     d->mWaitingThumbnail = pix;
     d->mWaitingThumbnail.setDevicePixelRatio(dpr);
 
-    // Stop smoothing
+    // Stop smoothing, ignore the thumbnails being smoothed
     d->mSmoothThumbnailTimer.stop();
     d->mSmoothThumbnailQueue.clear();
+    d->mSmoothingUrls.clear();
+    ++d->mSmoothGeneration;
 
     // Clear adjustedPixes
     ThumbnailForUrl::iterator it = d->mThumbnailForUrl.begin(), end = d->mThumbnailForUrl.end();
     for (; it != end; ++it) {
         it.value().mAdjustedPix = QPixmap();
+        d->updateCost(it.value());
     }
 
     Q_EMIT thumbnailSizeChanged(value / dpr);
@@ -577,8 +886,11 @@ void ThumbnailView::rowsAboutToBeRemoved(const QModelIndex &parent, int start, i
         }
 
         QUrl url = item.url();
-        d->mThumbnailForUrl.remove(url);
-        d->mSmoothThumbnailQueue.removeAll(url);
+        const ThumbnailForUrl::Iterator it = d->mThumbnailForUrl.find(url);
+        if (it != d->mThumbnailForUrl.end()) {
+            d->removeThumbnail(it);
+        }
+        d->removeSmoothThumbnail(url);
 
         itemList.append(item);
     }
@@ -590,7 +902,7 @@ void ThumbnailView::rowsAboutToBeRemoved(const QModelIndex &parent, int start, i
     // Removing rows might make new images visible, make sure their thumbnail
     // is generated
     if (!d->mScheduledThumbnailGenerationTimer.isActive()) {
-        d->mScheduledThumbnailGenerationTimer.start();
+        d->mScheduledThumbnailGenerationTimer.start(GENERATION_DELAY);
     }
 }
 
@@ -599,7 +911,7 @@ void ThumbnailView::rowsInserted(const QModelIndex &parent, int start, int end)
     QListView::rowsInserted(parent, start, end);
 
     if (!d->mScheduledThumbnailGenerationTimer.isActive()) {
-        d->mScheduledThumbnailGenerationTimer.start();
+        d->mScheduledThumbnailGenerationTimer.start(GENERATION_DELAY);
     }
 
     if (isVisible()) {
@@ -635,11 +947,12 @@ void ThumbnailView::dataChanged(const QModelIndex &topLeft, const QModelIndex &b
                 // modification time changes.
                 thumbnailsNeedRefresh = true;
                 it->prepareForRefresh(mtime);
+                d->updateCost(*it);
             }
         }
     }
     if (thumbnailsNeedRefresh && !d->mScheduledThumbnailGenerationTimer.isActive()) {
-        d->mScheduledThumbnailGenerationTimer.start();
+        d->mScheduledThumbnailGenerationTimer.start(GENERATION_DELAY);
     }
 }
 
@@ -663,14 +976,19 @@ void ThumbnailView::setThumbnail(const KFileItem &item, const QPixmap &pixmap, c
     }
     Thumbnail &thumbnail = it.value();
     thumbnail.mGroupPix = pixmap;
+    thumbnail.mGroupImage = QImage();
     thumbnail.mAdjustedPix = QPixmap();
     int largeGroupSize = ThumbnailGroup::pixelSize(ThumbnailGroup::XLarge);
     thumbnail.mFullSize = size.isValid() ? size : QSize(largeGroupSize, largeGroupSize);
     thumbnail.mRealFullSize = size;
     thumbnail.mWaitingForThumbnail = false;
     thumbnail.mFileSize = fileSize;
+    d->updateCost(thumbnail);
 
     update(thumbnail.mIndex);
+    if (!d->mTrimCacheTimer.isActive()) {
+        d->mTrimCacheTimer.start();
+    }
     if (d->mScaleMode != ScaleToFit) {
         scheduleDelayedItemsLayout();
     }
@@ -699,6 +1017,7 @@ void ThumbnailView::setBrokenThumbnail(const KFileItem &item)
         thumbnail.initAsIcon(QIcon::fromTheme(QStringLiteral("image-missing")).pixmap(48));
         thumbnail.mFullSize = thumbnail.mGroupPix.size();
     }
+    d->updateCost(thumbnail);
     update(thumbnail.mIndex);
 }
 
@@ -721,6 +1040,11 @@ QPixmap ThumbnailView::thumbnailForIndex(const QModelIndex &index, QSize *fullSi
         it = d->mThumbnailForUrl.insert(url, thumbnail);
     }
     Thumbnail &thumbnail = it.value();
+    // Repainting a thumbnail which stays visible is not a lookup: only count
+    // the times it shows up, which would need a disk load without the cache
+    const qint64 now = d->mClock.elapsed();
+    const bool isLookup = thumbnail.mLastUsed < 0 || now - thumbnail.mLastUsed > LOOKUP_INTERVAL;
+    thumbnail.mLastUsed = now;
 
     // If dir or archive, generate a thumbnail from fileitem pixmap
     MimeTypeUtils::Kind kind = MimeTypeUtils::fileItemKind(item);
@@ -745,25 +1069,29 @@ QPixmap ThumbnailView::thumbnailForIndex(const QModelIndex &index, QSize *fullSi
                 // mGroupPix)
                 thumbnail.mWaitingForThumbnail = true;
             }
+            d->updateCost(thumbnail);
         }
     }
 
     if (thumbnail.mGroupPix.isNull()) {
+        if (isLookup) {
+            ++d->mCacheStatistics.missCount;
+        }
         if (fullSize) {
             *fullSize = QSize();
         }
         return d->mWaitingThumbnail;
     }
+    if (isLookup) {
+        ++d->mCacheStatistics.hitCount;
+    }
 
     // Adjust thumbnail
     if (thumbnail.mAdjustedPix.isNull()) {
         d->roughAdjustThumbnail(&thumbnail);
     }
-    if (GwenviewConfig::lowResourceUsageMode() && thumbnail.mRough && !d->mSmoothThumbnailQueue.contains(url)) {
-        d->mSmoothThumbnailQueue.enqueue(url);
-        if (!d->mSmoothThumbnailTimer.isActive()) {
-            d->mSmoothThumbnailTimer.start(SMOOTH_DELAY);
-        }
+    if (thumbnail.mRough) {
+        d->enqueueSmoothThumbnail(url);
     }
     if (fullSize) {
         *fullSize = thumbnail.mRealFullSize;
@@ -964,7 +1292,17 @@ void ThumbnailView::selectionChanged(const QItemSelection &selected, const QItem
 void ThumbnailView::scrollContentsBy(int dx, int dy)
 {
     QListView::scrollContentsBy(dx, dy);
-    d->scheduleThumbnailGeneration();
+    d->updateScrollVelocity(dx, dy);
+
+    // Unlike scheduleThumbnailGeneration(), keep the pending thumbnails:
+    // generateThumbnailsForItems() reorders them for the predicted area, so
+    // that they keep loading while scrolling
+    d->clearSmoothThumbnailQueue();
+    const int delay = d->isScrollingFast() ? SCROLL_GENERATION_DELAY : GENERATION_DELAY;
+    QTimer &timer = d->mScheduledThumbnailGenerationTimer;
+    if (!timer.isActive() || timer.remainingTime() > delay) {
+        timer.start(delay);
+    }
 }
 
 void ThumbnailView::generateThumbnailsForItems()
@@ -972,11 +1310,20 @@ void ThumbnailView::generateThumbnailsForItems()
     if (!isVisible() || !model() || d->loading) {
         return;
     }
-    const QRect visibleRect = viewport()->rect();
+    // When scrolling, start with the area the view is heading to, and skip
+    // the items it is leaving
+    const QRect visibleRect = d->predictedVisibleRect();
     const int visibleSurface = visibleRect.width() * visibleRect.height();
     const QPoint origin = visibleRect.center();
-    // Keep thumbnails around that are at most two "screen heights" away.
-    const int discardDistance = visibleRect.bottomRight().manhattanLength() * 2;
+    // Where the view is heading, null when it is not scrolling
+    const QRect currentRect = viewport()->rect();
+    const QPoint heading = origin - currentRect.center();
+    // Items behind the view which may have been requested already
+    KFileItemList leftItems;
+    // Generate thumbnails for items which are at most two "screen heights"
+    // away. Thumbnails of items further away are kept until trimCache()
+    // needs room.
+    const int prefetchDistance = (visibleRect.width() + visibleRect.height()) * 2;
 
     // distance => item
     QMultiMap<int, KFileItem> itemMap;
@@ -1011,33 +1358,31 @@ void ThumbnailView::generateThumbnailsForItems()
         if (itemRect.intersected(visibleRect).isValid()) {
             // Item is visible, order thumbnails from left to right, top to bottom
             // Distance is computed so that it is between 0 and visibleSurface
-            distance = itemRect.top() * visibleRect.width() + itemRect.left();
+            distance = (itemRect.top() - visibleRect.top()) * visibleRect.width() + itemRect.left() - visibleRect.left();
             // Make sure directory thumbnails are generated after image thumbnails:
             // Distance is between visibleSurface and 2 * visibleSurface
             if (kind == MimeTypeUtils::KIND_DIR) {
                 distance = distance + visibleSurface;
             }
         } else {
+            if (!heading.isNull() && !itemRect.intersects(currentRect) && QPoint::dotProduct(itemRect.center() - currentRect.center(), heading) < 0) {
+                // The view is leaving this item
+                if (it != d->mThumbnailForUrl.constEnd() && it->mWaitingForThumbnail) {
+                    leftItems << item;
+                }
+                continue;
+            }
             // Calculate how far away the thumbnail is to determine if it could
             // become visible soon.
             qreal itemDistance = (itemRect.center() - origin).manhattanLength();
 
-            if (itemDistance < discardDistance) {
+            if (itemDistance < prefetchDistance) {
                 // Item is not visible but within an area that may potentially
                 // become visible soon, order thumbnails according to distance
                 // Start at 2 * visibleSurface to ensure invisible thumbnails are
                 // generated *after* visible thumbnails
                 distance = 2 * visibleSurface + itemDistance;
             } else {
-                // Discard thumbnails that are too far away to prevent large
-                // directories from consuming massive amounts of RAM.
-                if (it != d->mThumbnailForUrl.constEnd()) {
-                    // Thumbnail exists for this item, discard it.
-                    const QUrl url = item.url();
-                    d->mThumbnailForUrl.remove(url);
-                    d->mSmoothThumbnailQueue.removeAll(url);
-                    d->mThumbnailProvider->removeItems({item});
-                }
                 continue;
             }
         }
@@ -1058,9 +1403,18 @@ void ThumbnailView::generateThumbnailsForItems()
         }
     }
 
+    // Replace the pending items, which may have been requested for an area
+    // the view has left since, and stop working on the items it has left
+    if (d->mThumbnailProvider) {
+        d->mThumbnailProvider->removePendingItems();
+        if (!leftItems.isEmpty()) {
+            d->mThumbnailProvider->removeItems(leftItems);
+        }
+    }
     if (!itemMap.isEmpty()) {
         d->appendItemsToThumbnailProvider(itemMap.values());
     }
+    d->trimCache();
 }
 
 void ThumbnailView::updateThumbnail(const QUrl &url)
@@ -1112,31 +1466,23 @@ QPixmap ThumbnailView::busySequenceCurrentPixmap() const
     return d->mBusySequence.frameAt(d->mBusyAnimationTimeLine->currentFrame());
 }
 
-void ThumbnailView::smoothNextThumbnail()
+void ThumbnailView::smoothThumbnails()
 {
     if (d->mSmoothThumbnailQueue.isEmpty()) {
         return;
     }
 
-    if (d->mThumbnailProvider && d->mThumbnailProvider->isRunning()) {
-        // give mThumbnailProvider priority over smoothing
-        d->mSmoothThumbnailTimer.start(SMOOTH_DELAY);
-        return;
-    }
-
-    QUrl url = d->mSmoothThumbnailQueue.dequeue();
-    ThumbnailForUrl::Iterator it = d->mThumbnailForUrl.find(url);
-    GV_RETURN_IF_FAIL2(it != d->mThumbnailForUrl.end(), url << "not in mThumbnailForUrl.");
-
-    Thumbnail &thumbnail = it.value();
-    thumbnail.mAdjustedPix = d->scale(thumbnail.mGroupPix, Qt::SmoothTransformation);
-    thumbnail.mRough = false;
-
-    GV_RETURN_IF_FAIL2(thumbnail.mIndex.isValid(), "index for" << url << "is invalid.");
-    update(thumbnail.mIndex);
+    // Visible thumbnails first, then in the order they were painted
+    QList<QUrl> urls = d->mSmoothThumbnailQueue;
+    d->mSmoothThumbnailQueue.clear();
+    const QRect visibleRect = viewport()->rect();
+    std::stable_partition(urls.begin(), urls.end(), [this, &visibleRect](const QUrl &url) {
+        const ThumbnailForUrl::ConstIterator it = d->mThumbnailForUrl.constFind(url);
+        return it != d->mThumbnailForUrl.constEnd() && visualRect(it->mIndex).intersects(visibleRect);
+    });
 
-    if (!d->mSmoothThumbnailQueue.isEmpty()) {
-        d->mSmoothThumbnailTimer.start(0);
+    for (qsizetype pos = 0; pos < urls.size(); pos += SMOOTH_BATCH_SIZE) {
+        d->startSmoothBatch(urls.mid(pos, SMOOTH_BATCH_SIZE));
     }
 }
 
@@ -1152,7 +1498,7 @@ void ThumbnailView::reloadThumbnail(const QModelIndex &index)
     if (it == d->mThumbnailForUrl.end()) {
         return;
     }
-    d->mThumbnailForUrl.erase(it);
+    d->removeThumbnail(it);
     generateThumbnailsForItems();
 }
 
@@ -1161,6 +1507,13 @@ void ThumbnailView::setCreateThumbnailsForRemoteUrls(bool createRemoteThumbs)
     d->mCreateThumbnailsForRemoteUrls = createRemoteThumbs;
 }
 
+ThumbnailView::CacheStatistics ThumbnailView::cacheStatistics() const
+{
+    CacheStatistics statistics = d->mCacheStatistics;
+    statistics.size = d->mCacheSize;
+    return statistics;
+}
+
 } // namespace
 
 #include "thumbnailview.moc"
@@ -56,6 +56,21 @@ public:
         ScaleToWidth,
         ScaleToFit,
     };
+    /**
+     * Counters of the in-memory thumbnail cache
+     */
+    struct CacheStatistics {
+        /// Thumbnails which were in memory when they showed up. Repaints
+        /// of a thumbnail which stays visible are not counted.
+        qint64 hitCount = 0;
+        /// Thumbnails which had to be loaded when they showed up
+        qint64 missCount = 0;
+        /// Thumbnails dropped to stay within the budget
+        qint64 evictionCount = 0;
+        /// Memory used by the thumbnails, in bytes
+        qint64 size = 0;
+    };
+
     explicit ThumbnailView(QWidget *parent);
     ~ThumbnailView() override;
 
@@ -115,6 +130,8 @@ public:
 
     void setCreateThumbnailsForRemoteUrls(bool createRemoteThumbs);
 
+    CacheStatistics cacheStatistics() const;
+
 Q_SIGNALS:
     /**
      * It seems we can't use the 'activated()' signal for now because it does
@@ -207,7 +224,11 @@ private Q_SLOTS:
      */
     void updateBusyIndexes();
 
-    void smoothNextThumbnail();
+    /**
+     * Smoothes the thumbnails which have been scaled with a fast
+     * transformation, on a thread pool
+     */
+    void smoothThumbnails();
 
 private:
     friend struct ThumbnailViewPrivate;
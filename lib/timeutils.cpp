@@ -26,6 +26,7 @@ Foundation, Inc., 51 Franklin Street, Fifth Floor, Cambridge, MA 02110-1301, USA
 
 // Qt
 #include <QDateTime>
+#include <QHash>
 
 // KF
 #include <KFileItem>
@@ -36,6 +37,8 @@ Foundation, Inc., 51 Franklin Street, Fifth Floor, Cambridge, MA 02110-1301, USA
 // Local
 #include "gwenview_lib_debug.h"
 #include <lib/exiv2imageloader.h>
+#include <lib/headermetadata.h>
+#include <lib/metadataindex.h>
 #include <lib/urlutils.h>
 
 namespace Gwenview
@@ -61,15 +64,32 @@ static Exiv2::ExifData::const_iterator findDateTimeKey(const Exiv2::ExifData &ex
 struct CacheItem {
     QDateTime fileMTime;
     QDateTime realTime;
+    // Set if realTime is only the modification time, because
+    // cachedDateTimeForFileItem() found no indexed date
+    bool waitingForIndex = false;
 
-    void update(const KFileItem &fileItem)
+    void update(const KFileItem &fileItem, CachePolicy cachePolicy)
     {
         QDateTime time = fileItem.time(KFileItem::ModificationTime);
-        if (fileMTime == time) {
+        if (fileMTime == time && !waitingForIndex) {
             return;
         }
 
         fileMTime = time;
+        waitingForIndex = false;
+
+        if (cachePolicy == UseCache && UrlUtils::urlIsFastLocalFile(fileItem.targetUrl())) {
+            // Going through the index makes the date available to the next
+            // sessions
+            MetaDataIndex *index = MetaDataIndex::instance();
+            MetaDataIndex::Entry entry;
+            if (!index->find(fileItem, &entry)) {
+                entry = MetaDataIndex::extract(fileItem);
+                index->insert(fileItem, entry);
+            }
+            realTime = entry.dateTime;
+            return;
+        }
 
         if (!updateFromExif(fileItem.url())) {
             realTime = time;
@@ -82,6 +102,18 @@ struct CacheItem {
             return false;
         }
         const QString path = url.path();
+
+        // Going through the file headers is much faster than letting Exiv2
+        // parse all the metadata, which matters when sorting folders by date
+        HeaderMetaData metaData;
+        if (HeaderMetaData::load(path, &metaData)) {
+            if (!metaData.dateTime.isValid()) {
+                return false;
+            }
+            realTime = metaData.dateTime;
+            return true;
+        }
+
         Exiv2ImageLoader loader;
 
         if (!loader.load(path)) {
@@ -120,26 +152,88 @@ struct CacheItem {
 
 using Cache = QHash<QUrl, CacheItem>;
 
+static Cache &cache()
+{
+    static Cache cache;
+    // Forget the dates which were not indexed yet once they are
+    static const bool connected = [] {
+        MetaDataIndex *index = MetaDataIndex::instance();
+        QObject::connect(index, &MetaDataIndex::updated, index, [](const QList<QUrl> &urls) {
+            for (const QUrl &url : urls) {
+                const Cache::iterator it = cache.find(url);
+                if (it != cache.end() && it->waitingForIndex) {
+                    cache.erase(it);
+                }
+            }
+        });
+        return true;
+    }();
+    Q_UNUSED(connected);
+    return cache;
+}
+
+/**
+ * Like UrlUtils::urlIsFastLocalFile(), but only checks the file system once
+ * per folder: sorting asks for all the files of a folder at once
+ */
+static bool isFastLocalFile(const QUrl &url)
+{
+    if (!url.isLocalFile()) {
+        return false;
+    }
+    static QHash<QString, bool> fastFolders;
+    const QString folder = url.adjusted(QUrl::RemoveFilename).toLocalFile();
+    auto it = fastFolders.constFind(folder);
+    if (it == fastFolders.constEnd()) {
+        it = fastFolders.insert(folder, UrlUtils::urlIsFastLocalFile(url));
+    }
+    return it.value();
+}
+
 QDateTime dateTimeForFileItem(const KFileItem &fileItem, CachePolicy cachePolicy)
 {
     if (cachePolicy == SkipCache) {
         CacheItem item;
-        item.update(fileItem);
+        item.update(fileItem, SkipCache);
         return item.realTime;
     }
 
-    static Cache cache;
     const QUrl url = fileItem.targetUrl();
 
-    Cache::iterator it = cache.find(url);
-    if (it == cache.end()) {
-        it = cache.insert(url, CacheItem());
+    Cache::iterator it = cache().find(url);
+    if (it == cache().end()) {
+        it = cache().insert(url, CacheItem());
     }
 
-    it.value().update(fileItem);
+    it.value().update(fileItem, UseCache);
     return it.value().realTime;
 }
 
+QDateTime cachedDateTimeForFileItem(const KFileItem &fileItem)
+{
+    const QDateTime time = fileItem.time(KFileItem::ModificationTime);
+    const QUrl url = fileItem.targetUrl();
+
+    Cache::const_iterator it = cache().constFind(url);
+    if (it != cache().constEnd() && it.value().fileMTime == time) {
+        return it.value().realTime;
+    }
+
+    CacheItem &item = cache()[url];
+    item.fileMTime = time;
+    MetaDataIndex::Entry entry;
+    if (isFastLocalFile(url) && MetaDataIndex::instance()->find(fileItem, &entry)) {
+        item.realTime = entry.dateTime;
+        item.waitingForIndex = false;
+    } else {
+        // Not indexed yet: remember the modification time until
+        // MetaDataIndex::updated() reports the url, see cache()
+        item.realTime = time;
+        item.waitingForIndex = true;
+    }
+    return item.realTime;
+}
+
 } // namespace
 
 } // namespace
@@ -36,8 +36,19 @@ enum CachePolicy {
     UseCache,
 };
 
+/**
+ * Returns when the picture of @p fileItem was taken, or its modification time
+ * if that is unknown. Reads the file if its date is not known yet.
+ */
 QDateTime GWENVIEWLIB_EXPORT dateTimeForFileItem(const KFileItem &fileItem, Gwenview::TimeUtils::CachePolicy cachePolicy = UseCache);
 
+/**
+ * Like dateTimeForFileItem(), but never reads the file: returns the
+ * modification time of @p fileItem until MetaDataIndex has indexed it.
+ * Suitable for sorting and filtering, which need many dates at once.
+ */
+QDateTime GWENVIEWLIB_EXPORT cachedDateTimeForFileItem(const KFileItem &fileItem);
+
 } // namespace
 
 } // namespace
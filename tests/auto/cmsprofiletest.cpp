@@ -22,14 +22,22 @@ Foundation, Inc., 51 Franklin Street, Fifth Floor, Cambridge, MA 02110-1301, USA
 #include "cmsprofiletest.h"
 
 // Local
+#include <lib/cms/cmsdisplaytransform.h>
 #include <lib/cms/cmsprofile.h>
+#include <lib/cms/cmstransformcache.h>
 #include <lib/exiv2imageloader.h>
 #include <testutils.h>
 
 // KF
 
 // Qt
+#include <QColorSpace>
+#include <QImage>
 #include <QTest>
+#include <QtEndian>
+
+// lcms
+#include <lcms2.h>
 
 QTEST_MAIN(CmsProfileTest)
 
@@ -64,6 +72,140 @@ void CmsProfileTest::testLoadFromImageData_data()
 }
 #undef NEW_ROW
 
+static QByteArray uint32LE(quint32 value)
+{
+    QByteArray data(4, '\0');
+    qToLittleEndian(value, data.data());
+    return data;
+}
+
+static QByteArray uint32BE(quint32 value)
+{
+    QByteArray data(4, '\0');
+    qToBigEndian(value, data.data());
+    return data;
+}
+
+static QByteArray bmffBox(const char *type, const QByteArray &payload)
+{
+    return uint32BE(8 + payload.size()) + type + payload;
+}
+
+void CmsProfileTest::testLoadFromContainerData()
+{
+    QFETCH(QByteArray, data);
+    QFETCH(QByteArray, format);
+    Cms::Profile::Ptr ptr = Cms::Profile::loadFromImageData(data, format);
+    QVERIFY(ptr);
+}
+
+void CmsProfileTest::testLoadFromContainerData_data()
+{
+    QTest::addColumn<QByteArray>("data");
+    QTest::addColumn<QByteArray>("format");
+
+    // Only the container structure matters, build minimal files around an
+    // sRGB profile
+    const QByteArray icc = QColorSpace(QColorSpace::SRgb).iccProfile();
+    QVERIFY(!icc.isEmpty());
+
+    QByteArray tiff = "II";
+    tiff += QByteArray::fromHex("2a00") + uint32LE(8);
+    // IFD with one InterColorProfile entry of type UNDEFINED, and no next IFD
+    tiff += QByteArray::fromHex("0100") + QByteArray::fromHex("73870700") + uint32LE(icc.size()) + uint32LE(26) + uint32LE(0);
+    tiff += icc;
+    QTest::newRow("tiff") << tiff << QByteArray("tiff");
+
+    QByteArray webp = "WEBP";
+    webp += "VP8X" + uint32LE(10) + QByteArray::fromHex("20000000000000000000");
+    webp += "ICCP" + uint32LE(icc.size()) + icc;
+    if (icc.size() & 1) {
+        webp += '\0';
+    }
+    webp = "RIFF" + uint32LE(webp.size()) + webp;
+    QTest::newRow("webp") << webp << QByteArray("webp");
+
+    QByteArray avif = bmffBox("ftyp", "avif" + uint32BE(0) + "avifmif1");
+    const QByteArray nclx = bmffBox("colr", "nclx" + QByteArray::fromHex("0001000d000680"));
+    const QByteArray colr = bmffBox("colr", "prof" + icc);
+    const QByteArray ipco = bmffBox("ipco", nclx + colr);
+    avif += bmffBox("meta", uint32BE(0) + bmffBox("hdlr", QByteArray(25, '\0')) + bmffBox("iprp", ipco));
+    avif += bmffBox("mdat", QByteArray(16, '\0'));
+    QTest::newRow("avif") << avif << QByteArray("avif");
+}
+
+void CmsProfileTest::testTransformCache()
+{
+    Cms::TransformCache *cache = Cms::TransformCache::instance();
+    const Cms::Profile::Ptr profile = Cms::Profile::getSRgbProfile();
+
+    const Cms::TransformCache::Transform transform = cache->displayTransform(profile, TYPE_BGRA_8, INTENT_PERCEPTUAL);
+    QVERIFY(transform);
+
+    // Same parameters, same transform
+    QCOMPARE(cache->displayTransform(profile, TYPE_BGRA_8, INTENT_PERCEPTUAL).get(), transform.get());
+
+    // A different format or intent needs a different transform
+    QVERIFY(cache->displayTransform(profile, TYPE_RGBA_8, INTENT_PERCEPTUAL).get() != transform.get());
+    QVERIFY(cache->displayTransform(profile, TYPE_BGRA_8, INTENT_RELATIVE_COLORIMETRIC).get() != transform.get());
+
+    // Resetting the monitor profile drops all transforms
+    cache->resetMonitorProfile();
+    QVERIFY(cache->displayTransform(profile, TYPE_BGRA_8, INTENT_PERCEPTUAL).get() != transform.get());
+}
+
+void CmsProfileTest::testDisplayTransformLut()
+{
+    // Transform from sRGB to Adobe RGB, so that the transform is far from an
+    // identity
+    cmsCIExyY whitePoint;
+    cmsWhitePointFromTemp(&whitePoint, 6504);
+    const cmsCIExyYTRIPLE primaries = {{0.64, 0.33, 1.0}, {0.21, 0.71, 1.0}, {0.15, 0.06, 1.0}};
+    cmsToneCurve *gamma = cmsBuildGamma(nullptr, 2.2);
+    cmsToneCurve *curves[3] = {gamma, gamma, gamma};
+    cmsHPROFILE adobeRgb = cmsCreateRGBProfile(&whitePoint, &primaries, curves);
+    cmsFreeToneCurve(gamma);
+    cmsHPROFILE sRgb = cmsCreate_sRGBProfile();
+
+    auto createTransform = [&]() {
+        return cmsCreateTransform(sRgb, TYPE_BGRA_8, adobeRgb, TYPE_BGRA_8, INTENT_PERCEPTUAL, cmsFLAGS_NOCACHE);
+    };
+    Cms::DisplayTransform transform(createTransform(), TYPE_BGRA_8);
+    QVERIFY(transform.hasLut());
+    cmsHTRANSFORM reference = createTransform();
+    cmsCloseProfile(adobeRgb);
+    cmsCloseProfile(sRgb);
+
+    // Big enough to be split in bands
+    QImage image(600, 600, QImage::Format_ARGB32);
+    for (int y = 0; y < image.height(); ++y) {
+        for (int x = 0; x < image.width(); ++x) {
+            image.setPixel(x, y, qRgba(x * 255 / 599, y * 255 / 599, (x + y) * 255 / 1198, 200));
+        }
+    }
+    QImage expected = image.copy();
+    cmsDoTransformLineStride(reference, expected.bits(), expected.bits(), expected.width(), expected.height(), expected.bytesPerLine(), expected.bytesPerLine(), 0, 0);
+    cmsDeleteTransform(reference);
+
+    transform.apply(image);
+    const Cms::DisplayTransform::Statistics statistics = transform.statistics();
+    QCOMPARE(statistics.imageCount, quint64(1));
+    QCOMPARE(statistics.pixelCount, quint64(600 * 600));
+
+    int maxDelta = 0;
+    for (int y = 0; y < image.height(); ++y) {
+        for (int x = 0; x < image.width(); ++x) {
+            const QRgb actual = image.pixel(x, y);
+            const QRgb wanted = expected.pixel(x, y);
+            QCOMPARE(qAlpha(actual), 200);
+            maxDelta = qMax(maxDelta, qAbs(qRed(actual) - qRed(wanted)));
+            maxDelta = qMax(maxDelta, qAbs(qGreen(actual) - qGreen(wanted)));
+            maxDelta = qMax(maxDelta, qAbs(qBlue(actual) - qBlue(wanted)));
+        }
+    }
+    QVERIFY2(maxDelta <= 2, qPrintable(QStringLiteral("max delta: %1").arg(maxDelta)));
+}
+
 #if 0
 
 void CmsProfileTest::testLoadFromExiv2Image()
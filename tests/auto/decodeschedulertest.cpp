@@ -0,0 +1,148 @@
+// SPDX-FileCopyrightText: 2026 Gwenview Developers
+// SPDX-License-Identifier: GPL-2.0-or-later
+
+#include "decodeschedulertest.h"
+
+// Qt
+#include <QList>
+#include <QMutex>
+#include <QMutexLocker>
+#include <QSemaphore>
+#include <QStringList>
+#include <QTest>
+
+// Local
+#include "../lib/document/decodescheduler.h"
+
+QTEST_MAIN(DecodeSchedulerTest)
+
+using namespace Gwenview;
+
+/**
+ * Occupies all the scheduler threads until release() is called
+ */
+class ThreadBlocker
+{
+public:
+    ThreadBlocker()
+    {
+        DecodeScheduler *scheduler = DecodeScheduler::instance();
+        const int count = scheduler->maxRunningCount(DecodeScheduler::VisiblePriority);
+        for (int idx = 0; idx < count; ++idx) {
+            mFutures << scheduler->run(DecodeScheduler::VisiblePriority, [this]() {
+                mStarted.release();
+                mGate.acquire();
+            });
+        }
+        mStarted.acquire(count);
+    }
+
+    ~ThreadBlocker()
+    {
+        for (QFuture<void> &future : mFutures) {
+            if (!future.isFinished()) {
+                mGate.release();
+            }
+        }
+        for (QFuture<void> &future : mFutures) {
+            future.waitForFinished();
+        }
+    }
+
+    /**
+     * Frees one thread
+     */
+    void release()
+    {
+        mGate.release();
+    }
+
+private:
+    QSemaphore mStarted;
+    QSemaphore mGate;
+    QList<QFuture<void>> mFutures;
+};
+
+struct TaskLog {
+    QMutex mMutex;
+    QStringList mNames;
+
+    std::function<void()> task(const QString &name)
+    {
+        return [this, name]() {
+            QMutexLocker locker(&mMutex);
+            mNames << name;
+        };
+    }
+};
+
+void DecodeSchedulerTest::testPriorityOrder()
+{
+    DecodeScheduler *scheduler = DecodeScheduler::instance();
+    TaskLog log;
+    ThreadBlocker blocker;
+
+    QFuture<void> background = scheduler->run(DecodeScheduler::BackgroundPriority, log.task("background"));
+    QFuture<void> preload = scheduler->run(DecodeScheduler::PreloadPriority, log.task("preload"));
+    QFuture<void> visible = scheduler->run(DecodeScheduler::VisiblePriority, log.task("visible"));
+
+    // The last free thread is kept for the visible document
+    blocker.release();
+    visible.waitForFinished();
+    QTest::qWait(100);
+    QCOMPARE(log.mNames, QStringList() << "visible");
+
+    blocker.release();
+    preload.waitForFinished();
+    background.waitForFinished();
+    QCOMPARE(log.mNames, QStringList() << "visible" << "preload" << "background");
+}
+
+void DecodeSchedulerTest::testSetPriority()
+{
+    DecodeScheduler *scheduler = DecodeScheduler::instance();
+    TaskLog log;
+    ThreadBlocker blocker;
+
+    DecodeScheduler::TaskId id;
+    QFuture<void> first = scheduler->run(DecodeScheduler::PreloadPriority, log.task("first"));
+    QFuture<void> second = scheduler->run(DecodeScheduler::BackgroundPriority, log.task("second"), &id);
+    QVERIFY(id != 0);
+    scheduler->setPriority(id, DecodeScheduler::VisiblePriority);
+
+    blocker.release();
+    second.waitForFinished();
+    QTest::qWait(100);
+    QCOMPARE(log.mNames, QStringList() << "second");
+
+    blocker.release();
+    first.waitForFinished();
+    QCOMPARE(log.mNames, QStringList() << "second" << "first");
+}
+
+void DecodeSchedulerTest::testCancel()
+{
+    DecodeScheduler *scheduler = DecodeScheduler::instance();
+    TaskLog log;
+    QFuture<void> future;
+    {
+        ThreadBlocker blocker;
+        DecodeScheduler::TaskId id;
+        future = scheduler->run(DecodeScheduler::VisiblePriority, log.task("canceled"), &id);
+        QVERIFY(future.isRunning());
+        scheduler->cancel(id);
+        QVERIFY(future.isCanceled());
+        QVERIFY(future.isFinished());
+    }
+    QTest::qWait(100);
+    QVERIFY(log.mNames.isEmpty());
+
+    // Canceling a task which already ran does nothing
+    DecodeScheduler::TaskId id;
+    future = scheduler->run(DecodeScheduler::VisiblePriority, log.task("done"), &id);
+    future.waitForFinished();
+    scheduler->cancel(id);
+    QCOMPARE(log.mNames, QStringList() << "done");
+}
+
+#include "moc_decodeschedulertest.cpp"
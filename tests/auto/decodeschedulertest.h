@@ -0,0 +1,20 @@
+// SPDX-FileCopyrightText: 2026 Gwenview Developers
+// SPDX-License-Identifier: GPL-2.0-or-later
+
+#ifndef DECODESCHEDULERTEST_H
+#define DECODESCHEDULERTEST_H
+
+// Qt
+#include <QObject>
+
+class DecodeSchedulerTest : public QObject
+{
+    Q_OBJECT
+
+private Q_SLOTS:
+    void testPriorityOrder();
+    void testSetPriority();
+    void testCancel();
+};
+
+#endif /* DECODESCHEDULERTEST_H */
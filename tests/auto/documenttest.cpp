@@ -18,9 +18,15 @@ Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
 
 */
 // Qt
+#include <QColorSpace>
 #include <QConicalGradient>
+#include <QDateTime>
+#include <QFile>
 #include <QImage>
+#include <QLinearGradient>
 #include <QPainter>
+#include <QRandomGenerator>
+#include <QSet>
 #include <QTest>
 
 // KF
@@ -270,6 +276,31 @@ void DocumentTest::testLoadRemote()
     QCOMPARE(image.height(), 100);
 }
 
+void DocumentTest::testLoadRemoteJpeg()
+{
+    // Remote JPEG files are decoded while they are transferred, make sure
+    // the result is the same as for a local file
+    const QString fileName = QStringLiteral("orient6.jpg");
+    QUrl url = setUpRemoteTestDir(fileName);
+    if (!url.isValid()) {
+        QSKIP("Not running this test: failed to setup remote test dir.");
+    }
+    url = url.adjusted(QUrl::StripTrailingSlash);
+    url.setPath(url.path() + '/' + fileName);
+
+    Document::Ptr localDoc = DocumentFactory::instance()->load(urlForTestFile(fileName));
+    localDoc->waitUntilLoaded();
+    QCOMPARE(localDoc->loadingState(), Document::Loaded);
+
+    Document::Ptr doc = DocumentFactory::instance()->load(url);
+    doc->waitUntilLoaded();
+    QCOMPARE(doc->loadingState(), Document::Loaded);
+    QCOMPARE(doc->format(), QByteArray("jpeg"));
+    QCOMPARE(doc->size(), localDoc->size());
+    QCOMPARE(doc->image(), localDoc->image());
+    QVERIFY(doc->isEditable());
+}
+
 void DocumentTest::testLoadAnimated()
 {
     QUrl srcUrl = urlForTestFile("40frames.gif");
@@ -300,6 +331,30 @@ void DocumentTest::testLoadAnimated()
     QVERIFY2(spy.count() > count, "No imageRectUpdated() signal received after restarting");
 }
 
+void DocumentTest::testAnimationFramesReused()
+{
+    // 4 frames of 100 ms each, looping forever
+    QUrl srcUrl = urlForTestFile("4frames.gif");
+    Document::Ptr doc = DocumentFactory::instance()->load(srcUrl);
+    doc->waitUntilLoaded();
+    QVERIFY(doc->isAnimated());
+
+    QSet<qint64> cacheKeys;
+    int frameCount = 0;
+    connect(doc.data(), &Document::imageRectUpdated, this, [&]() {
+        cacheKeys << doc->image().cacheKey();
+        ++frameCount;
+    });
+    doc->startAnimation();
+    QTest::qWait(2000);
+    doc->stopAnimation();
+
+    // Frames are decoded once, then shown again at each loop
+    QVERIFY2(frameCount > 8, qPrintable(QString::number(frameCount)));
+    QCOMPARE(cacheKeys.size(), 4);
+    QVERIFY(doc->memoryUsage() >= 4 * doc->image().sizeInBytes());
+}
+
 void DocumentTest::testPrepareDownSampledAfterFailure()
 {
     QUrl url = urlForTestFile("empty.png");
@@ -345,6 +400,36 @@ void DocumentTest::testDeleteWhileLoading()
     QTest::qWait(2000);
 }
 
+/**
+ * Check that deleting a document while its image is being decoded neither
+ * blocks until the decode is done nor crashes when the decode finishes
+ */
+void DocumentTest::testDeleteWhileDecoding()
+{
+    QImage image(2048, 2048, QImage::Format_RGB32);
+    for (int y = 0; y < image.height(); ++y) {
+        for (int x = 0; x < image.width(); ++x) {
+            image.setPixel(x, y, QRandomGenerator::global()->generate() | 0xff000000);
+        }
+    }
+    const QUrl url = urlForTestOutputFile("decoding.png");
+    QVERIFY(image.save(url.toLocalFile(), "png"));
+
+    {
+        Document::Ptr doc = DocumentFactory::instance()->load(url);
+        QSignalSpy spy(doc.data(), SIGNAL(metaInfoLoaded(QUrl)));
+        QVERIFY(spy.wait());
+        doc->prepareDownSampledImageForZoom(0.25);
+        // Ask for the full image while the smaller one is being decoded
+        doc->startLoadingFullImage();
+    }
+    DocumentFactory::instance()->clearCache();
+    QVERIFY(!DocumentFactory::instance()->hasUrl(url));
+    // If the decode still used the deleted document we would crash while
+    // waiting
+    QTest::qWait(2000);
+}
+
 void DocumentTest::testLoadRotated()
 {
     QUrl url = urlForTestFile("orient6.jpg");
@@ -386,6 +471,169 @@ void DocumentTest::testMultipleLoads()
     QCOMPARE(doc1.data(), doc2.data());
 }
 
+void DocumentTest::testCacheMemoryUsage()
+{
+    const QUrl url = urlForTestFile("test.png");
+    {
+        Document::Ptr doc = DocumentFactory::instance()->load(url);
+        doc->waitUntilLoaded();
+        QVERIFY(doc->memoryUsage() >= doc->image().sizeInBytes());
+        QCOMPARE(DocumentFactory::instance()->memoryUsage(), doc->memoryUsage());
+
+        // Referenced documents are never collected
+        DocumentFactory::instance()->shrinkCache(0);
+        QVERIFY(DocumentFactory::instance()->hasUrl(url));
+    }
+
+    DocumentFactory::instance()->shrinkCache(0);
+    QVERIFY(!DocumentFactory::instance()->hasUrl(url));
+    QCOMPARE(DocumentFactory::instance()->memoryUsage(), qint64(0));
+}
+
+void DocumentTest::testDecodePriority()
+{
+    Document::Ptr doc = DocumentFactory::instance()->load(urlForTestFile("test.png"));
+    QCOMPARE(doc->decodePriority(), DecodeScheduler::VisiblePriority);
+
+    QObject view;
+    auto preloader = std::make_unique<QObject>();
+    doc->setDecodePriority(preloader.get(), DecodeScheduler::PreloadPriority);
+    QCOMPARE(doc->decodePriority(), DecodeScheduler::PreloadPriority);
+    doc->setDecodePriority(&view, DecodeScheduler::VisiblePriority);
+    QCOMPARE(doc->decodePriority(), DecodeScheduler::VisiblePriority);
+
+    // Still preloaded when the view moves to another document
+    doc->releaseDecodePriority(&view);
+    QCOMPARE(doc->decodePriority(), DecodeScheduler::PreloadPriority);
+
+    // Holders are released when destroyed
+    preloader.reset();
+    QCOMPARE(doc->decodePriority(), DecodeScheduler::BackgroundPriority);
+    doc->waitUntilLoaded();
+}
+
+void DocumentTest::testLoadMappedFile()
+{
+    // Noise does not compress, so the file is big enough to be mapped
+    QImage image(1024, 1024, QImage::Format_RGB32);
+    for (int y = 0; y < image.height(); ++y) {
+        for (int x = 0; x < image.width(); ++x) {
+            image.setPixel(x, y, QRandomGenerator::global()->generate() | 0xff000000);
+        }
+    }
+    const QUrl url = urlForTestOutputFile("mapped.png");
+    QVERIFY(image.save(url.toLocalFile(), "png"));
+    QFile file(url.toLocalFile());
+    QVERIFY(file.open(QIODevice::ReadWrite));
+    // Files which have just been modified are not mapped
+    QVERIFY(file.setFileTime(QDateTime::currentDateTime().addSecs(-60), QFileDevice::FileModificationTime));
+    const QByteArray fileData = file.readAll();
+    QVERIFY(fileData.size() > 1024 * 1024);
+
+    QByteArray rawData;
+    {
+        Document::Ptr doc = DocumentFactory::instance()->load(url);
+        doc->setKeepRawData(true);
+        doc->waitUntilLoaded();
+        QCOMPARE(doc->image(), image);
+        rawData = doc->rawData();
+        QCOMPARE(rawData, fileData);
+        // The file content is not held in memory
+        QVERIFY(doc->memoryUsage() < image.sizeInBytes() + fileData.size());
+    }
+
+    // The data must remain valid once the document is gone
+    DocumentFactory::instance()->shrinkCache(0);
+    QVERIFY(!DocumentFactory::instance()->hasUrl(url));
+    QCOMPARE(rawData, fileData);
+}
+
+void DocumentTest::testMappedFileChanged()
+{
+    QImage image(1024, 1024, QImage::Format_RGB32);
+    for (int y = 0; y < image.height(); ++y) {
+        for (int x = 0; x < image.width(); ++x) {
+            image.setPixel(x, y, QRandomGenerator::global()->generate() | 0xff000000);
+        }
+    }
+    const QUrl url = urlForTestOutputFile("truncated.png");
+    QVERIFY(image.save(url.toLocalFile(), "png"));
+    QFile file(url.toLocalFile());
+    QVERIFY(file.open(QIODevice::ReadWrite));
+    QVERIFY(file.setFileTime(QDateTime::currentDateTime().addSecs(-60), QFileDevice::FileModificationTime));
+
+    Document::Ptr doc = DocumentFactory::instance()->load(url);
+    doc->setKeepRawData(true);
+    doc->waitUntilLoaded();
+    QCOMPARE(doc->image(), image);
+
+    // Reading the mapping past the new end of the file would crash
+    QVERIFY(file.resize(1024));
+    QVERIFY(doc->rawData().isEmpty());
+}
+
+void DocumentTest::testLoadProgressively()
+{
+    // Big enough to be decoded progressively
+    QImage image(4096, 4096, QImage::Format_RGB32);
+    {
+        QPainter painter(&image);
+        QLinearGradient gradient(0, 0, image.width(), image.height());
+        gradient.setColorAt(0, Qt::red);
+        gradient.setColorAt(1, Qt::blue);
+        painter.fillRect(image.rect(), gradient);
+    }
+    const QUrl url = urlForTestOutputFile("progressive.png");
+    QVERIFY(image.save(url.toLocalFile(), "png"));
+
+    Document::Ptr doc = DocumentFactory::instance()->load(url);
+    QList<int> rowCounts;
+    QList<QSize> sizes;
+    connect(doc.data(), &Document::partialImageUpdated, this, [&]() {
+        if (!doc->partialImage().isNull()) {
+            rowCounts << doc->partialImageRowCount();
+            sizes << doc->partialImage().size();
+        }
+    });
+    doc->waitUntilLoaded();
+    QVERIFY(!rowCounts.isEmpty());
+    for (int idx = 0; idx < rowCounts.size(); ++idx) {
+        QCOMPARE(sizes.at(idx), image.size());
+        QVERIFY(rowCounts.at(idx) > (idx > 0 ? rowCounts.at(idx - 1) : 0));
+    }
+    QCOMPARE(doc->loadingState(), Document::Loaded);
+    QCOMPARE(doc->image(), image);
+    // The partial image is not kept once the image is loaded
+    QVERIFY(doc->partialImage().isNull());
+    QCOMPARE(doc->partialImageRowCount(), 0);
+}
+
+void DocumentTest::testLoadProgressivelyToSRgb()
+{
+    // The rows are converted to sRGB as they are decoded
+    QImage image(4096, 4096, QImage::Format_RGB32);
+    image.fill(QColor(200, 100, 50));
+    image.setColorSpace(QColorSpace::DisplayP3);
+    const QUrl url = urlForTestOutputFile("progressive-p3.png");
+    QVERIFY(image.save(url.toLocalFile(), "png"));
+
+    Document::Ptr doc = DocumentFactory::instance()->load(url);
+    doc->waitUntilLoaded();
+    QCOMPARE(doc->loadingState(), Document::Loaded);
+    const QImage loaded = doc->image();
+    QCOMPARE(loaded.size(), image.size());
+    QCOMPARE(loaded.format(), QImage::Format_RGB32);
+    QCOMPARE(loaded.colorSpace(), QColorSpace(QColorSpace::SRgb));
+
+    const QRgb expected = image.copy(0, 0, 1, 1).convertedToColorSpace(QColorSpace::SRgb).pixel(0, 0);
+    for (const QPoint &pos : {QPoint(0, 0), QPoint(4095, 4095)}) {
+        const QRgb actual = loaded.pixel(pos);
+        QVERIFY(qAbs(qRed(actual) - qRed(expected)) <= 1);
+        QVERIFY(qAbs(qGreen(actual) - qGreen(expected)) <= 1);
+        QVERIFY(qAbs(qBlue(actual) - qBlue(expected)) <= 1);
+    }
+}
+
 void DocumentTest::testSaveAs()
 {
     QUrl url = urlForTestFile("orient6.jpg");
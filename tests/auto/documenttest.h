@@ -110,11 +110,20 @@ private Q_SLOTS:
     void testLoadDownSampled_data();
     void testLoadDownSampledPng();
     void testLoadRemote();
+    void testLoadRemoteJpeg();
     void testLoadAnimated();
+    void testAnimationFramesReused();
     void testPrepareDownSampledAfterFailure();
     void testDeleteWhileLoading();
+    void testDeleteWhileDecoding();
     void testLoadRotated();
     void testMultipleLoads();
+    void testCacheMemoryUsage();
+    void testDecodePriority();
+    void testLoadMappedFile();
+    void testMappedFileChanged();
+    void testLoadProgressively();
+    void testLoadProgressivelyToSRgb();
     void testSaveAs();
     void testSaveRemote();
     void testLosslessSave();
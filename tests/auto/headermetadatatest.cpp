@@ -0,0 +1,141 @@
+// SPDX-FileCopyrightText: 2026 Gwenview Developers
+// SPDX-License-Identifier: GPL-2.0-or-later
+
+#include "headermetadatatest.h"
+
+// Qt
+#include <QBuffer>
+#include <QFile>
+#include <QTest>
+#include <QtEndian>
+
+// Local
+#include "../lib/headermetadata.h"
+#include "testutils.h"
+
+QTEST_MAIN(HeaderMetaDataTest)
+
+using namespace Gwenview;
+
+/**
+ * Little endian TIFF data with an orientation in IFD0 and a DateTimeOriginal
+ * in the Exif IFD
+ */
+static QByteArray createTiffData(quint16 orientation, const QByteArray &dateTimeOriginal)
+{
+    QByteArray data;
+    auto append16 = [&data](quint16 value) {
+        char buffer[2];
+        qToLittleEndian(value, buffer);
+        data.append(buffer, 2);
+    };
+    auto append32 = [&data](quint32 value) {
+        char buffer[4];
+        qToLittleEndian(value, buffer);
+        data.append(buffer, 4);
+    };
+
+    // Header, IFD0 at offset 8
+    data.append("II*\0", 4);
+    append32(8);
+
+    // IFD0: 2 entries, Exif IFD at 8 + 2 + 2 * 12 + 4 = 38
+    append16(2);
+    append16(0x0112);
+    append16(3);
+    append32(1);
+    append16(orientation);
+    append16(0);
+    append16(0x8769);
+    append16(4);
+    append32(1);
+    append32(38);
+    append32(0);
+
+    // Exif IFD: 1 entry, string at 38 + 2 + 12 + 4 = 56
+    append16(1);
+    append16(0x9003);
+    append16(2);
+    append32(dateTimeOriginal.size() + 1);
+    append32(56);
+    append32(0);
+    data.append(dateTimeOriginal);
+    data.append('\0');
+    return data;
+}
+
+void HeaderMetaDataTest::testJpegDate_data()
+{
+    QTest::addColumn<QString>("fileName");
+    QTest::addColumn<QDateTime>("expected");
+
+    QTest::newRow("datetimeoriginal") << "date/exif-datetimeoriginal.jpg" << QDateTime::fromString("2003-03-10T17:45:21", Qt::ISODate);
+    QTest::newRow("datetime-only") << "date/exif-datetime-only.jpg" << QDateTime::fromString("2003-03-25T02:02:21", Qt::ISODate);
+}
+
+void HeaderMetaDataTest::testJpegDate()
+{
+    QFETCH(QString, fileName);
+    QFETCH(QDateTime, expected);
+
+    HeaderMetaData metaData;
+    QVERIFY(HeaderMetaData::load(pathForTestFile(fileName), &metaData));
+    QCOMPARE(metaData.dateTime, expected);
+}
+
+void HeaderMetaDataTest::testJpegOrientation()
+{
+    HeaderMetaData metaData;
+    QVERIFY(HeaderMetaData::load(pathForTestFile("orient6.jpg"), &metaData));
+    QCOMPARE(metaData.orientation, ROT_90);
+    QVERIFY(metaData.size.isValid());
+}
+
+void HeaderMetaDataTest::testPng()
+{
+    HeaderMetaData metaData;
+    QVERIFY(HeaderMetaData::load(pathForTestFile("test.png"), &metaData));
+    QCOMPARE(metaData.size, QSize(150, 100));
+    QCOMPARE(metaData.orientation, NOT_AVAILABLE);
+    QVERIFY(!metaData.dateTime.isValid());
+}
+
+void HeaderMetaDataTest::testPngExif()
+{
+    QFile file(pathForTestFile("test.png"));
+    QVERIFY(file.open(QIODevice::ReadOnly));
+    QByteArray data = file.readAll();
+
+    // Insert an eXIf chunk after IHDR. The CRC is not checked.
+    const QByteArray exif = createTiffData(ROT_270, "2010:05:06 07:08:09");
+    QByteArray chunk(4, '\0');
+    qToBigEndian<quint32>(exif.size(), chunk.data());
+    chunk += "eXIf" + exif + QByteArray(4, '\0');
+    // Signature, then IHDR: length, type, 13 bytes of data, CRC
+    data.insert(8 + 4 + 4 + 13 + 4, chunk);
+
+    QBuffer buffer(&data);
+    QVERIFY(buffer.open(QIODevice::ReadOnly));
+    HeaderMetaData metaData;
+    QVERIFY(HeaderMetaData::load(&buffer, &metaData));
+    QCOMPARE(metaData.size, QSize(150, 100));
+    QCOMPARE(metaData.orientation, ROT_270);
+    QCOMPARE(metaData.dateTime, QDateTime::fromString("2010-05-06T07:08:09", Qt::ISODate));
+}
+
+void HeaderMetaDataTest::testTiff()
+{
+    QByteArray data = createTiffData(TRANSPOSE, "2001:02:03 04:05:06");
+    QBuffer buffer(&data);
+    QVERIFY(buffer.open(QIODevice::ReadOnly));
+    HeaderMetaData metaData;
+    QVERIFY(HeaderMetaData::load(&buffer, &metaData));
+    QCOMPARE(metaData.orientation, TRANSPOSE);
+    QCOMPARE(metaData.dateTime, QDateTime::fromString("2001-02-03T04:05:06", Qt::ISODate));
+}
+
+void HeaderMetaDataTest::testUnsupportedFormat()
+{
+    HeaderMetaData metaData;
+    QVERIFY(!HeaderMetaData::load(pathForTestFile("4frames.gif"), &metaData));
+}
@@ -0,0 +1,24 @@
+// SPDX-FileCopyrightText: 2026 Gwenview Developers
+// SPDX-License-Identifier: GPL-2.0-or-later
+
+#ifndef HEADERMETADATATEST_H
+#define HEADERMETADATATEST_H
+
+// Qt
+#include <QObject>
+
+class HeaderMetaDataTest : public QObject
+{
+    Q_OBJECT
+
+private Q_SLOTS:
+    void testJpegDate_data();
+    void testJpegDate();
+    void testJpegOrientation();
+    void testPng();
+    void testPngExif();
+    void testTiff();
+    void testUnsupportedFormat();
+};
+
+#endif /* HEADERMETADATATEST_H */
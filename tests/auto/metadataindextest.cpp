@@ -0,0 +1,188 @@
+// SPDX-FileCopyrightText: 2026 Gwenview Developers
+// SPDX-License-Identifier: GPL-2.0-or-later
+
+#include "metadataindextest.h"
+
+// Qt
+#include <QDateTime>
+#include <QDir>
+#include <QFile>
+#include <QSignalSpy>
+#include <QTemporaryDir>
+#include <QTest>
+
+// KF
+#include <KFileItem>
+
+// Local
+#include "../lib/metadataindex.h"
+#include "testutils.h"
+
+QTEST_MAIN(MetaDataIndexTest)
+
+using namespace Gwenview;
+
+static const QDateTime EXIF_DATETIME = QDateTime::fromString(QStringLiteral("2003-03-10T17:45:21"), Qt::ISODate);
+
+void MetaDataIndexTest::testExtract()
+{
+    KFileItem item(urlForTestFile(QStringLiteral("date/exif-datetimeoriginal.jpg")));
+    const MetaDataIndex::Entry entry = MetaDataIndex::extract(item);
+    QCOMPARE(entry.kind, MimeTypeUtils::KIND_RASTER_IMAGE);
+    QCOMPARE(entry.dateTime, EXIF_DATETIME);
+
+    KFileItem pngItem(urlForTestFile(QStringLiteral("test.png")));
+    QCOMPARE(MetaDataIndex::extract(pngItem).dateTime, pngItem.time(KFileItem::ModificationTime));
+}
+
+void MetaDataIndexTest::testInsertFind()
+{
+    QTemporaryDir indexDir;
+    MetaDataIndex index(indexDir.path());
+    KFileItem item(urlForTestFile(QStringLiteral("test.png")));
+
+    MetaDataIndex::Entry entry;
+    QVERIFY(!index.find(item, &entry));
+
+    MetaDataIndex::Entry inserted;
+    inserted.dateTime = EXIF_DATETIME;
+    inserted.size = QSize(300, 200);
+    inserted.rating = 4;
+    inserted.kind = MimeTypeUtils::KIND_RASTER_IMAGE;
+    index.insert(item, inserted);
+
+    QVERIFY(index.find(item, &entry));
+    QCOMPARE(entry.dateTime, inserted.dateTime);
+    QCOMPARE(entry.size, inserted.size);
+    QCOMPARE(entry.rating, inserted.rating);
+    QCOMPARE(entry.kind, inserted.kind);
+}
+
+void MetaDataIndexTest::testChangedFile()
+{
+    QTemporaryDir indexDir;
+    QTemporaryDir dir;
+    const QString path = dir.path() + QStringLiteral("/file.png");
+    QVERIFY(QFile::copy(pathForTestFile(QStringLiteral("test.png")), path));
+
+    MetaDataIndex index(indexDir.path());
+    const QUrl url = QUrl::fromLocalFile(path);
+    index.insert(KFileItem(url), MetaDataIndex::extract(KFileItem(url)));
+    MetaDataIndex::Entry entry;
+    QVERIFY(index.find(KFileItem(url), &entry));
+
+    {
+        QFile file(path);
+        QVERIFY(file.open(QIODevice::Append));
+        file.write("garbage");
+    }
+    QVERIFY(!index.find(KFileItem(url), &entry));
+}
+
+void MetaDataIndexTest::testPersistence()
+{
+    QTemporaryDir indexDir;
+    KFileItem item(urlForTestFile(QStringLiteral("date/exif-datetimeoriginal.jpg")));
+    {
+        MetaDataIndex index(indexDir.path());
+        index.insert(item, MetaDataIndex::extract(item));
+        index.save();
+    }
+
+    MetaDataIndex index(indexDir.path());
+    QSignalSpy spy(&index, &MetaDataIndex::updated);
+    MetaDataIndex::Entry entry;
+    // The folder is loaded in the background
+    QVERIFY(!index.find(item, &entry));
+    QVERIFY(spy.wait());
+    QCOMPARE(spy.at(0).at(0).value<QList<QUrl>>(), QList<QUrl>{item.url()});
+    QVERIFY(index.find(item, &entry));
+    QCOMPARE(entry.dateTime, EXIF_DATETIME);
+}
+
+void MetaDataIndexTest::testLoad()
+{
+    QTemporaryDir indexDir;
+    KFileItem item(urlForTestFile(QStringLiteral("date/exif-datetimeoriginal.jpg")));
+    {
+        MetaDataIndex index(indexDir.path());
+        index.insert(item, MetaDataIndex::extract(item));
+    }
+
+    MetaDataIndex index(indexDir.path());
+    QSignalSpy spy(&index, &MetaDataIndex::updated);
+    index.load(item.url().adjusted(QUrl::RemoveFilename));
+    QVERIFY(spy.wait());
+    MetaDataIndex::Entry entry;
+    QVERIFY(index.find(item, &entry));
+
+    // Items of a loaded folder are not extracted again
+    index.update({item});
+    QVERIFY(!spy.wait(200));
+}
+
+void MetaDataIndexTest::testUpdate()
+{
+    QTemporaryDir indexDir;
+    MetaDataIndex index(indexDir.path());
+    KFileItem item(urlForTestFile(QStringLiteral("date/exif-datetimeoriginal.jpg")));
+    QSignalSpy spy(&index, &MetaDataIndex::updated);
+
+    index.update({item});
+    QVERIFY(spy.wait());
+    QCOMPARE(spy.at(0).at(0).value<QList<QUrl>>(), QList<QUrl>{item.url()});
+
+    MetaDataIndex::Entry entry;
+    QVERIFY(index.find(item, &entry));
+    QCOMPARE(entry.dateTime, EXIF_DATETIME);
+
+    // Indexed items are not indexed again
+    index.update({item});
+    QVERIFY(!spy.wait(200));
+}
+
+void MetaDataIndexTest::testUnloadFolders()
+{
+    QTemporaryDir indexDir;
+    QTemporaryDir dir;
+    MetaDataIndex index(indexDir.path());
+
+    // More folders than the index keeps in memory
+    QList<KFileItem> items;
+    for (int i = 0; i < 20; ++i) {
+        const QString folder = dir.path() + QStringLiteral("/folder%1").arg(i);
+        QVERIFY(QDir().mkpath(folder));
+        const QString path = folder + QStringLiteral("/file.png");
+        QVERIFY(QFile::copy(pathForTestFile(QStringLiteral("test.png")), path));
+        const KFileItem item(QUrl::fromLocalFile(path));
+        index.insert(item, MetaDataIndex::extract(item));
+        items << item;
+    }
+
+    // Unloaded folders have been saved, and are loaded again
+    for (const KFileItem &item : std::as_const(items)) {
+        MetaDataIndex::Entry entry;
+        QTRY_VERIFY(index.find(item, &entry));
+    }
+}
+
+void MetaDataIndexTest::testPruneIndexFiles()
+{
+    QTemporaryDir indexDir;
+    const QString oldPath = indexDir.path() + QStringLiteral("/old.index");
+    const QString recentPath = indexDir.path() + QStringLiteral("/recent.index");
+    for (const QString &path : {oldPath, recentPath}) {
+        QFile file(path);
+        QVERIFY(file.open(QIODevice::WriteOnly));
+        file.write("data");
+    }
+    {
+        QFile file(oldPath);
+        QVERIFY(file.open(QIODevice::ReadWrite));
+        QVERIFY(file.setFileTime(QDateTime::currentDateTime().addDays(-365), QFileDevice::FileModificationTime));
+    }
+
+    MetaDataIndex index(indexDir.path());
+    QTRY_VERIFY(!QFile::exists(oldPath));
+    QVERIFY(QFile::exists(recentPath));
+}
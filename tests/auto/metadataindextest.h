@@ -0,0 +1,25 @@
+// SPDX-FileCopyrightText: 2026 Gwenview Developers
+// SPDX-License-Identifier: GPL-2.0-or-later
+
+#ifndef METADATAINDEXTEST_H
+#define METADATAINDEXTEST_H
+
+// Qt
+#include <QObject>
+
+class MetaDataIndexTest : public QObject
+{
+    Q_OBJECT
+
+private Q_SLOTS:
+    void testExtract();
+    void testInsertFind();
+    void testChangedFile();
+    void testPersistence();
+    void testLoad();
+    void testUpdate();
+    void testUnloadFolders();
+    void testPruneIndexFiles();
+};
+
+#endif /* METADATAINDEXTEST_H */
@@ -0,0 +1,160 @@
+// SPDX-FileCopyrightText: 2026 Gwenview Developers
+// SPDX-License-Identifier: GPL-2.0-or-later
+
+#include "preloadertest.h"
+
+// Qt
+#include <QBuffer>
+#include <QFile>
+#include <QImage>
+#include <QTest>
+
+// Local
+#include "../app/preloader.h"
+#include "../lib/document/documentfactory.h"
+#include "gwenviewconfig.h"
+#include "testutils.h"
+
+// STL
+#include <algorithm>
+
+QTEST_MAIN(PreloaderTest)
+
+using namespace Gwenview;
+
+static const QSize ViewSize(800, 600);
+
+static QList<QUrl> sorted(QList<QUrl> urls)
+{
+    std::sort(urls.begin(), urls.end());
+    return urls;
+}
+
+QUrl PreloaderTest::createImage(const QString &name, const QColor &color)
+{
+    QImage image(64, 48, QImage::Format_RGB32);
+    image.fill(color);
+    const QString path = mDir.filePath(name);
+    if (!image.save(path, "png")) {
+        return {};
+    }
+    return QUrl::fromLocalFile(path);
+}
+
+void PreloaderTest::initTestCase()
+{
+    QVERIFY(mDir.isValid());
+}
+
+void PreloaderTest::testPreload()
+{
+    const QUrl red = createImage(QStringLiteral("preload-red.png"), Qt::red);
+    const QUrl green = createImage(QStringLiteral("preload-green.png"), Qt::green);
+    const QUrl missing = QUrl::fromLocalFile(mDir.filePath(QStringLiteral("missing.png")));
+
+    // Documents which fail to load are skipped
+    Preloader preloader(nullptr);
+    preloader.preload({red, missing, green}, ViewSize);
+    QTRY_COMPARE(sorted(preloader.preloadedUrls()), sorted({red, green}));
+    QCOMPARE(DocumentFactory::instance()->load(red)->loadingState(), Document::Loaded);
+    QCOMPARE(DocumentFactory::instance()->load(green)->loadingState(), Document::Loaded);
+}
+
+void PreloaderTest::testCancel()
+{
+    const QUrl red = createImage(QStringLiteral("cancel-red.png"), Qt::red);
+    const QUrl green = createImage(QStringLiteral("cancel-green.png"), Qt::green);
+    const QUrl blue = createImage(QStringLiteral("cancel-blue.png"), Qt::blue);
+
+    // Documents leaving the window before they are preloaded are cancelled
+    Preloader preloader(nullptr);
+    preloader.preload({red, green}, ViewSize);
+    preloader.preload({blue}, ViewSize);
+    QTRY_COMPARE(preloader.preloadedUrls(), QList<QUrl>{blue});
+    QTest::qWait(100);
+    QCOMPARE(preloader.preloadedUrls(), QList<QUrl>{blue});
+
+    // Preloaded documents leaving the window are forgotten, the others are
+    // kept
+    preloader.preload({blue, red}, ViewSize);
+    QTRY_COMPARE(sorted(preloader.preloadedUrls()), sorted({blue, red}));
+    preloader.preload({red}, ViewSize);
+    QCOMPARE(preloader.preloadedUrls(), QList<QUrl>{red});
+    preloader.preload({}, ViewSize);
+    QVERIFY(preloader.preloadedUrls().isEmpty());
+}
+
+void PreloaderTest::testBudgetCutOff()
+{
+    // Create a JPEG image claiming to be 60000x60000, the preloader gives up
+    // on it as soon as it knows its size
+    QImage image(16, 16, QImage::Format_RGB32);
+    image.fill(Qt::red);
+    QByteArray data;
+    QBuffer buffer(&data);
+    buffer.open(QIODevice::WriteOnly);
+    QVERIFY(image.save(&buffer, "jpeg"));
+    int pos = 2;
+    while (pos + 9 < data.size() && quint8(data[pos + 1]) != 0xC0) {
+        pos += 2 + (quint8(data[pos + 2]) << 8 | quint8(data[pos + 3]));
+    }
+    QVERIFY(pos + 9 < data.size());
+    for (int offset : {5, 7}) {
+        data[pos + offset] = char(60000 >> 8);
+        data[pos + offset + 1] = char(60000 & 0xff);
+    }
+    const QString hugePath = mDir.filePath(QStringLiteral("huge.jpg"));
+    QFile file(hugePath);
+    QVERIFY(file.open(QIODevice::WriteOnly));
+    file.write(data);
+    file.close();
+    const QUrl huge = QUrl::fromLocalFile(hugePath);
+    const QUrl small = createImage(QStringLiteral("budget-small.png"), Qt::green);
+
+    const int oldPercent = GwenviewConfig::preloadMemoryPercent();
+    GwenviewConfig::setPreloadMemoryPercent(1);
+    Preloader preloader(nullptr);
+
+    // Urls are sorted by priority, those following a document which does not
+    // fit are not preloaded either
+    preloader.preload({huge, small}, QSize(60000, 60000));
+    QTRY_VERIFY(DocumentFactory::instance()->load(huge)->size().isValid());
+    QTest::qWait(100);
+    QVERIFY(preloader.preloadedUrls().isEmpty());
+
+    preloader.preload({small, huge}, QSize(60000, 60000));
+    QTRY_COMPARE(preloader.preloadedUrls(), QList<QUrl>{small});
+    QTest::qWait(100);
+    QCOMPARE(preloader.preloadedUrls(), QList<QUrl>{small});
+
+    // Nothing fits in an empty budget
+    GwenviewConfig::setPreloadMemoryPercent(0);
+    const QUrl other = createImage(QStringLiteral("budget-other.png"), Qt::blue);
+    preloader.preload({other}, ViewSize);
+    QTest::qWait(100);
+    QVERIFY(preloader.preloadedUrls().isEmpty());
+
+    GwenviewConfig::setPreloadMemoryPercent(oldPercent);
+}
+
+void PreloaderTest::testPreloadOffsets()
+{
+    const int oldAhead = GwenviewConfig::preloadAhead();
+    const int oldBehind = GwenviewConfig::preloadBehind();
+
+    GwenviewConfig::setPreloadAhead(2);
+    GwenviewConfig::setPreloadBehind(1);
+    QCOMPARE(Preloader::preloadOffsets(true), QList<int>({1, -1, 2}));
+    QCOMPARE(Preloader::preloadOffsets(false), QList<int>({-1, 1, -2}));
+
+    GwenviewConfig::setPreloadAhead(0);
+    GwenviewConfig::setPreloadBehind(2);
+    QCOMPARE(Preloader::preloadOffsets(true), QList<int>({-1, -2}));
+
+    GwenviewConfig::setPreloadAhead(0);
+    GwenviewConfig::setPreloadBehind(0);
+    QVERIFY(Preloader::preloadOffsets(true).isEmpty());
+
+    GwenviewConfig::setPreloadAhead(oldAhead);
+    GwenviewConfig::setPreloadBehind(oldBehind);
+}
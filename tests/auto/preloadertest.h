@@ -0,0 +1,31 @@
+// SPDX-FileCopyrightText: 2026 Gwenview Developers
+// SPDX-License-Identifier: GPL-2.0-or-later
+
+#ifndef PRELOADERTEST_H
+#define PRELOADERTEST_H
+
+// Qt
+#include <QObject>
+#include <QTemporaryDir>
+#include <QUrl>
+
+class QColor;
+
+class PreloaderTest : public QObject
+{
+    Q_OBJECT
+
+private Q_SLOTS:
+    void initTestCase();
+    void testPreload();
+    void testCancel();
+    void testBudgetCutOff();
+    void testPreloadOffsets();
+
+private:
+    QUrl createImage(const QString &name, const QColor &color);
+
+    QTemporaryDir mDir;
+};
+
+#endif /* PRELOADERTEST_H */
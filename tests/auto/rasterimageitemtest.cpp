@@ -0,0 +1,160 @@
+// SPDX-FileCopyrightText: 2026 Gwenview Developers
+// SPDX-License-Identifier: GPL-2.0-or-later
+
+#include "rasterimageitemtest.h"
+
+// Qt
+#include <QElapsedTimer>
+#include <QGraphicsScene>
+#include <QGraphicsView>
+#include <QImage>
+#include <QPainter>
+#include <QSignalSpy>
+#include <QTest>
+
+// Local
+#include "../lib/document/documentfactory.h"
+#include "../lib/documentview/rasterimageitem.h"
+#include "../lib/documentview/rasterimageview.h"
+#include "testutils.h"
+
+QTEST_MAIN(RasterImageItemTest)
+
+using namespace Gwenview;
+
+static const QSize ImageSize(1000, 800);
+static const QSize ViewSize(400, 300);
+
+static QImage paintItem(RasterImageItem *item)
+{
+    QImage canvas(ViewSize, QImage::Format_ARGB32);
+    canvas.fill(Qt::transparent);
+    QPainter painter(&canvas);
+    item->paint(&painter, nullptr, nullptr);
+    return canvas;
+}
+
+/**
+ * Paints @p item until it has every visible tile, returns false if it still
+ * misses some after a few seconds.
+ */
+static bool waitForTiles(RasterImageItem *item)
+{
+    QElapsedTimer timer;
+    timer.start();
+    while (timer.elapsed() < 5000) {
+        const quint64 missingTileCount = item->paintStatistics().missingTileCount;
+        paintItem(item);
+        if (item->paintStatistics().missingTileCount == missingTileCount) {
+            return true;
+        }
+        QTest::qWait(20);
+    }
+    return false;
+}
+
+void RasterImageItemTest::initTestCase()
+{
+    QVERIFY(mDir.isValid());
+    QImage image(ImageSize, QImage::Format_RGB32);
+    image.fill(Qt::red);
+    QVERIFY(image.save(mDir.filePath(QStringLiteral("red.png")), "png"));
+}
+
+void RasterImageItemTest::init()
+{
+    Document::Ptr doc = DocumentFactory::instance()->load(QUrl::fromLocalFile(mDir.filePath(QStringLiteral("red.png"))));
+    doc->waitUntilLoaded();
+    QCOMPARE(doc->loadingState(), Document::Loaded);
+
+    mScene = std::make_unique<QGraphicsScene>();
+    mGraphicsView = std::make_unique<QGraphicsView>(mScene.get());
+    mGraphicsView->resize(ViewSize);
+    mView = new RasterImageView;
+    mScene->addItem(mView);
+    mView->resize(ViewSize);
+    mView->setZoomToFit(false);
+
+    QSignalSpy completedSpy(mView, &RasterImageView::completed);
+    mView->setDocument(doc);
+    QVERIFY(completedSpy.wait());
+    mView->setZoom(1.0);
+    mView->setScrollPos(QPointF(0, 0));
+
+    const QList<QGraphicsItem *> children = mView->childItems();
+    for (QGraphicsItem *child : children) {
+        if (auto item = dynamic_cast<RasterImageItem *>(child)) {
+            mItem = item;
+        }
+    }
+    QVERIFY(mItem);
+}
+
+void RasterImageItemTest::cleanup()
+{
+    mItem = nullptr;
+    mView = nullptr;
+    mGraphicsView.reset();
+    mScene.reset();
+}
+
+void RasterImageItemTest::testZoomChangeInvalidatesTiles()
+{
+    QVERIFY(waitForTiles(mItem));
+
+    // Tiles prepared for another zoom level cannot be drawn
+    mView->setZoom(0.5);
+    mView->setScrollPos(QPointF(0, 0));
+    RasterImageItem::PaintStatistics before = mItem->paintStatistics();
+    paintItem(mItem);
+    RasterImageItem::PaintStatistics after = mItem->paintStatistics();
+    QVERIFY(after.tileCount > before.tileCount);
+    QCOMPARE(after.missingTileCount - before.missingTileCount, after.tileCount - before.tileCount);
+    QVERIFY(waitForTiles(mItem));
+
+    // The tiles of the first zoom level are still in the cache
+    mView->setZoom(1.0);
+    mView->setScrollPos(QPointF(0, 0));
+    before = mItem->paintStatistics();
+    paintItem(mItem);
+    after = mItem->paintStatistics();
+    QVERIFY(after.tileCount > before.tileCount);
+    QCOMPARE(after.missingTileCount, before.missingTileCount);
+}
+
+void RasterImageItemTest::testPreviewFallback()
+{
+    // No tile is ready yet, the preview is drawn in their place
+    const RasterImageItem::PaintStatistics before = mItem->paintStatistics();
+    QImage canvas = paintItem(mItem);
+    const RasterImageItem::PaintStatistics after = mItem->paintStatistics();
+    QVERIFY(after.missingTileCount > before.missingTileCount);
+    QColor color = canvas.pixelColor(ViewSize.width() / 2, ViewSize.height() / 2);
+    QCOMPARE(color.alpha(), 255);
+    QVERIFY(color.red() > 200 && color.green() < 50 && color.blue() < 50);
+
+    // Drawing the tiles gives the same result
+    QVERIFY(waitForTiles(mItem));
+    canvas = paintItem(mItem);
+    color = canvas.pixelColor(ViewSize.width() / 2, ViewSize.height() / 2);
+    QCOMPARE(color.alpha(), 255);
+    QVERIFY(color.red() > 200 && color.green() < 50 && color.blue() < 50);
+}
+
+void RasterImageItemTest::testStaleTilesAreDropped()
+{
+    // Request the visible tiles, then drop them before their results are
+    // delivered
+    paintItem(mItem);
+    mItem->resetDisplayTransform();
+    QTest::qWait(500);
+
+    // The results of the dropped requests were not kept
+    const RasterImageItem::PaintStatistics before = mItem->paintStatistics();
+    paintItem(mItem);
+    const RasterImageItem::PaintStatistics after = mItem->paintStatistics();
+    QCOMPARE(after.missingTileCount - before.missingTileCount, after.tileCount - before.tileCount);
+
+    // New requests are made for them
+    QVERIFY(waitForTiles(mItem));
+}
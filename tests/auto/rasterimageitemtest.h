@@ -0,0 +1,43 @@
+// SPDX-FileCopyrightText: 2026 Gwenview Developers
+// SPDX-License-Identifier: GPL-2.0-or-later
+
+#ifndef RASTERIMAGEITEMTEST_H
+#define RASTERIMAGEITEMTEST_H
+
+// Qt
+#include <QObject>
+#include <QTemporaryDir>
+
+// STL
+#include <memory>
+
+class QGraphicsScene;
+class QGraphicsView;
+
+namespace Gwenview
+{
+class RasterImageItem;
+class RasterImageView;
+}
+
+class RasterImageItemTest : public QObject
+{
+    Q_OBJECT
+
+private Q_SLOTS:
+    void initTestCase();
+    void init();
+    void cleanup();
+    void testZoomChangeInvalidatesTiles();
+    void testPreviewFallback();
+    void testStaleTilesAreDropped();
+
+private:
+    QTemporaryDir mDir;
+    std::unique_ptr<QGraphicsScene> mScene;
+    std::unique_ptr<QGraphicsView> mGraphicsView;
+    Gwenview::RasterImageView *mView = nullptr;
+    Gwenview::RasterImageItem *mItem = nullptr;
+};
+
+#endif /* RASTERIMAGEITEMTEST_H */
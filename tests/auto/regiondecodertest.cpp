@@ -0,0 +1,117 @@
+// SPDX-FileCopyrightText: 2026 Gwenview Developers
+// SPDX-License-Identifier: GPL-2.0-or-later
+
+#include "regiondecodertest.h"
+
+// Qt
+#include <QBuffer>
+#include <QImage>
+#include <QImageReader>
+#include <QImageWriter>
+#include <QLinearGradient>
+#include <QPainter>
+#include <QTest>
+#include <QtConcurrentMap>
+
+// Local
+#include "../lib/document/regiondecoder.h"
+#include "testutils.h"
+
+QTEST_MAIN(RegionDecoderTest)
+
+using namespace Gwenview;
+
+static QByteArray createImageData(const QSize &size, const char *format, bool progressive = false)
+{
+    QImage image(size, QImage::Format_RGB32);
+    QPainter painter(&image);
+    QLinearGradient gradient(0, 0, size.width(), size.height());
+    gradient.setColorAt(0, Qt::red);
+    gradient.setColorAt(0.5, Qt::green);
+    gradient.setColorAt(1, Qt::blue);
+    painter.fillRect(image.rect(), gradient);
+    painter.end();
+
+    QByteArray data;
+    QBuffer buffer(&data);
+    buffer.open(QIODevice::WriteOnly);
+    QImageWriter writer(&buffer, format);
+    writer.setQuality(100);
+    writer.setProgressiveScanWrite(progressive);
+    writer.write(image);
+    return data;
+}
+
+void RegionDecoderTest::testCanDecodeRegions()
+{
+    QByteArray jpegData = createImageData(QSize(64, 64), "jpeg");
+    QBuffer jpegBuffer(&jpegData);
+    jpegBuffer.open(QIODevice::ReadOnly);
+    QVERIFY(RegionDecoder::canDecodeRegions(jpegData, QImageReader(&jpegBuffer, "jpeg")));
+
+    // Progressive JPEG images are decoded entirely to get any row
+    QByteArray progressiveData = createImageData(QSize(64, 64), "jpeg", true);
+    QBuffer progressiveBuffer(&progressiveData);
+    progressiveBuffer.open(QIODevice::ReadOnly);
+    QVERIFY(!RegionDecoder::canDecodeRegions(progressiveData, QImageReader(&progressiveBuffer, "jpeg")));
+
+    // QImageReader emulates ClipRect for PNG by decoding the whole image
+    QByteArray pngData = createImageData(QSize(64, 64), "png");
+    QBuffer pngBuffer(&pngData);
+    pngBuffer.open(QIODevice::ReadOnly);
+    QVERIFY(!RegionDecoder::canDecodeRegions(pngData, QImageReader(&pngBuffer, "png")));
+}
+
+void RegionDecoderTest::testDecode()
+{
+    const QByteArray data = createImageData(QSize(1024, 768), "jpeg");
+    const QImage fullImage = QImage::fromData(data, "jpeg");
+    QVERIFY(!fullImage.isNull());
+
+    RegionDecoder decoder(data, "jpeg");
+    QCOMPARE(decoder.size(), QSize(1024, 768));
+
+    const QRect rect(100, 200, 300, 150);
+    const QImage region = decoder.decode(rect, rect.size());
+    QCOMPARE(region.size(), rect.size());
+    QVERIFY(TestUtils::fuzzyImageCompare(region.convertedTo(QImage::Format_RGB32), fullImage.copy(rect).convertedTo(QImage::Format_RGB32), 8));
+
+    // Cut from the band decoded for the first region
+    const QRect nextRect(400, 200, 300, 150);
+    const QImage nextRegion = decoder.decode(nextRect, nextRect.size());
+    QCOMPARE(nextRegion.size(), nextRect.size());
+    QVERIFY(TestUtils::fuzzyImageCompare(nextRegion.convertedTo(QImage::Format_RGB32), fullImage.copy(nextRect).convertedTo(QImage::Format_RGB32), 8));
+}
+
+void RegionDecoderTest::testDecodeScaled()
+{
+    const QByteArray data = createImageData(QSize(1024, 768), "jpeg");
+    RegionDecoder decoder(data, "jpeg");
+
+    const QImage region = decoder.decode(QRect(512, 0, 512, 768), QSize(100, 150));
+    QCOMPARE(region.size(), QSize(100, 150));
+}
+
+void RegionDecoderTest::testConcurrentDecode()
+{
+    const QByteArray data = createImageData(QSize(1024, 768), "jpeg");
+    const QImage fullImage = QImage::fromData(data, "jpeg");
+    RegionDecoder decoder(data, "jpeg");
+
+    // Tiles of the same band wait for each other, the bands are decoded in
+    // parallel
+    QList<QRect> rects;
+    for (int y = 0; y < 768; y += 256) {
+        for (int x = 0; x < 1024; x += 256) {
+            rects << QRect(x, y, 256, 256);
+        }
+    }
+    const QList<QImage> regions = QtConcurrent::blockingMapped(rects, [&decoder](const QRect &rect) {
+        return decoder.decode(rect, rect.size());
+    });
+    for (int idx = 0; idx < rects.size(); ++idx) {
+        const QRect &rect = rects.at(idx);
+        QCOMPARE(regions.at(idx).size(), rect.size());
+        QVERIFY(TestUtils::fuzzyImageCompare(regions.at(idx).convertedTo(QImage::Format_RGB32), fullImage.copy(rect).convertedTo(QImage::Format_RGB32), 8));
+    }
+}
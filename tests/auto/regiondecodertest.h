@@ -0,0 +1,21 @@
+// SPDX-FileCopyrightText: 2026 Gwenview Developers
+// SPDX-License-Identifier: GPL-2.0-or-later
+
+#ifndef REGIONDECODERTEST_H
+#define REGIONDECODERTEST_H
+
+// Qt
+#include <QObject>
+
+class RegionDecoderTest : public QObject
+{
+    Q_OBJECT
+
+private Q_SLOTS:
+    void testCanDecodeRegions();
+    void testDecode();
+    void testDecodeScaled();
+    void testConcurrentDecode();
+};
+
+#endif /* REGIONDECODERTEST_H */
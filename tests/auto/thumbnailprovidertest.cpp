@@ -20,11 +20,15 @@ Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
 #include "thumbnailprovidertest.h"
 
 // Qt
+#include <QBuffer>
 #include <QDebug>
 #include <QDir>
 #include <QFile>
 #include <QImage>
+#include <QImageReader>
 #include <QPainter>
+#include <QRandomGenerator>
+#include <QSet>
 #include <QTest>
 
 // KF
@@ -32,7 +36,9 @@ Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
 #include <KIO/DeleteJob>
 
 // Local
+#include "../lib/thumbnailprovider/pngtextreader.h"
 #include "../lib/thumbnailprovider/thumbnailprovider.h"
+#include "../lib/thumbnailprovider/thumbnailwriter.h"
 #include "gwenviewconfig.h"
 #include "testutils.h"
 
@@ -40,6 +46,9 @@ Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
 #include <cerrno>
 #include <cstring>
 
+// STL
+#include <atomic>
+
 using namespace Gwenview;
 
 QTEST_MAIN(ThumbnailProviderTest)
@@ -285,4 +294,283 @@ void ThumbnailProviderTest::testRemoveItemsWhileGenerating()
     loop.exec();
 }
 
+void ThumbnailProviderTest::testStopAndRestart()
+{
+    QDir dir(mSandBox.mPath);
+
+    KFileItemList list;
+    const auto entryInfoList = dir.entryInfoList(QDir::Files);
+    for (const QFileInfo &info : entryInfoList) {
+        QUrl url("file://" + info.absoluteFilePath());
+        KFileItem item(url);
+        list << item;
+    }
+
+    ThumbnailProvider provider;
+    provider.setThumbnailGroup(ThumbnailGroup::Normal);
+    QSignalSpy spy(&provider, SIGNAL(thumbnailLoaded(KFileItem, QPixmap, QSize, qulonglong)));
+    provider.appendItems(list);
+
+    // Cancel generation, then ask again for the same items: thumbnails which
+    // were being generated must still be reported
+    provider.stop();
+    provider.appendItems(list);
+    syncRun(&provider);
+
+    QSet<QUrl> loadedUrls;
+    for (const QVariantList &args : std::as_const(spy)) {
+        loadedUrls << qvariant_cast<KFileItem>(args.at(0)).url();
+    }
+    QCOMPARE(loadedUrls.count(), list.count());
+}
+
+void ThumbnailProviderTest::testPackedStore()
+{
+    GwenviewConfig::setUsePackedThumbnailStore(true);
+    // Reopen the store
+    ThumbnailProvider::setThumbnailBaseDir(mSandBox.mPath + "/thumbnails/");
+
+    QDir dir(mSandBox.mPath);
+    KFileItemList list;
+    const auto entryInfoList = dir.entryInfoList(QDir::Files);
+    for (const QFileInfo &info : entryInfoList) {
+        QUrl url("file://" + info.absoluteFilePath());
+        KFileItem item(url);
+        list << item;
+    }
+
+    {
+        ThumbnailProvider provider;
+        provider.setThumbnailGroup(ThumbnailGroup::Normal);
+        provider.appendItems(list);
+        syncRun(&provider);
+        while (!ThumbnailProvider::isThumbnailWriterEmpty()) {
+            QTest::qWait(100);
+        }
+    }
+
+    // Thumbnails went to the store, not to the freedesktop cache
+    QDir thumbnailDir = ThumbnailProvider::thumbnailBaseDir(ThumbnailGroup::Normal);
+    QVERIFY(thumbnailDir.entryList(QStringList("*.png")).isEmpty());
+    QVERIFY(QFile::exists(ThumbnailProvider::thumbnailBaseDir() + "x-gwenview/thumbnails.index"));
+
+    // Load them again, from the store this time
+    ThumbnailProvider provider;
+    provider.setThumbnailGroup(ThumbnailGroup::Normal);
+    provider.appendItems(list);
+    QSignalSpy spy(&provider, SIGNAL(thumbnailLoaded(KFileItem, QPixmap, QSize, qulonglong)));
+    syncRun(&provider);
+
+    GwenviewConfig::setUsePackedThumbnailStore(false);
+    ThumbnailProvider::setThumbnailBaseDir(mSandBox.mPath + "/thumbnails/");
+
+    QCOMPARE(spy.count(), mSandBox.mSizeHash.size());
+    for (const QVariantList &args : std::as_const(spy)) {
+        const KFileItem item = qvariant_cast<KFileItem>(args.at(0));
+        const QSize size = args.at(2).toSize();
+        QCOMPARE(size, mSandBox.mSizeHash.value(item.url().fileName()));
+    }
+}
+
+void ThumbnailProviderTest::testReadPngText()
+{
+    // Qt compresses texts longer than 40 characters, and uses iTXt chunks for
+    // non-latin1 texts
+    const QString shortText = QStringLiteral("1234");
+    const QString longText = QStringLiteral("file://") + QString(100, QLatin1Char('x'));
+    const QString unicodeText = QStringLiteral("file:///tmp/\u65e5\u672c.png");
+
+    QImage image(32, 32, QImage::Format_RGB32);
+    image.fill(Qt::red);
+    image.setText(QStringLiteral("Thumb::MTime"), shortText);
+    image.setText(QStringLiteral("Thumb::URI"), longText);
+    image.setText(QStringLiteral("Thumb::Mimetype"), unicodeText);
+
+    QBuffer buffer;
+    buffer.open(QIODevice::ReadWrite);
+    QVERIFY(image.save(&buffer, "png"));
+    buffer.seek(0);
+
+    QHash<QString, QString> texts;
+    QVERIFY(PngTextReader::read(&buffer, &texts));
+    QCOMPARE(texts.value(QStringLiteral("Thumb::MTime")), shortText);
+    QCOMPARE(texts.value(QStringLiteral("Thumb::URI")), longText);
+    QCOMPARE(texts.value(QStringLiteral("Thumb::Mimetype")), unicodeText);
+
+    // Not a PNG file
+    QBuffer jpegBuffer;
+    jpegBuffer.open(QIODevice::ReadWrite);
+    QVERIFY(image.save(&jpegBuffer, "jpeg"));
+    jpegBuffer.seek(0);
+    texts.clear();
+    QVERIFY(!PngTextReader::read(&jpegBuffer, &texts));
+}
+
+void ThumbnailProviderTest::testDeriveFromLargerGroup()
+{
+    const KFileItem item(QUrl("file://" + mSandBox.mPath + "/red.png"));
+
+    {
+        ThumbnailProvider provider;
+        provider.setThumbnailGroup(ThumbnailGroup::Large);
+        provider.appendItems({item});
+        syncRun(&provider);
+        while (!ThumbnailProvider::isThumbnailWriterEmpty()) {
+            QTest::qWait(100);
+        }
+    }
+
+    // Paint the large thumbnail, so that we can tell whether the normal one
+    // comes from it or from the original
+    QDir largeDir = ThumbnailProvider::thumbnailBaseDir(ThumbnailGroup::Large);
+    const QStringList largeEntries = largeDir.entryList(QStringList("*.png"));
+    QCOMPARE(largeEntries.count(), 1);
+    const QString largePath = largeDir.filePath(largeEntries.first());
+    QImage largeThumb(largePath);
+    QVERIFY(!largeThumb.isNull());
+    largeThumb.fill(Qt::yellow);
+    QVERIFY(largeThumb.save(largePath, "png"));
+
+    ThumbnailProvider provider;
+    provider.setThumbnailGroup(ThumbnailGroup::Normal);
+    QSignalSpy spy(&provider, SIGNAL(thumbnailLoaded(KFileItem, QPixmap, QSize, qulonglong)));
+    provider.appendItems({item});
+    syncRun(&provider);
+    while (!ThumbnailProvider::isThumbnailWriterEmpty()) {
+        QTest::qWait(100);
+    }
+
+    QCOMPARE(spy.count(), 1);
+    const QPixmap pix = qvariant_cast<QPixmap>(spy.at(0).at(1));
+    QCOMPARE(qMax(pix.width(), pix.height()), ThumbnailGroup::pixelSize(ThumbnailGroup::Normal));
+    QCOMPARE(pix.toImage().pixelColor(pix.width() / 2, pix.height() / 2), QColor(Qt::yellow));
+    QCOMPARE(spy.at(0).at(2).toSize(), mSandBox.mSizeHash.value("red.png"));
+
+    // The derived thumbnail has been cached too
+    QDir normalDir = ThumbnailProvider::thumbnailBaseDir(ThumbnailGroup::Normal);
+    QCOMPARE(normalDir.entryList(QStringList("*.png")).count(), 1);
+}
+
 #include "moc_thumbnailprovidertest.cpp"
+
+/**
+ * Returns an image full of noise, which takes a while to compress
+ */
+static QImage createNoiseImage(int width, int height)
+{
+    QImage image(width, height, QImage::Format_RGB32);
+    for (int y = 0; y < height; ++y) {
+        QRandomGenerator::global()->fillRange(reinterpret_cast<quint32 *>(image.scanLine(y)), width);
+    }
+    return image;
+}
+
+void ThumbnailProviderTest::testWriterKeepsTexts_data()
+{
+    QTest::addColumn<int>("compressionLevel");
+    QTest::newRow("none") << 0;
+    QTest::newRow("default") << 6;
+    QTest::newRow("best") << 9;
+}
+
+void ThumbnailProviderTest::testWriterKeepsTexts()
+{
+    QFETCH(int, compressionLevel);
+
+    // The PNG encoder maps the quality back to the zlib level
+    const int quality = ThumbnailWriter::pngQualityForCompressionLevel(compressionLevel);
+    QCOMPARE((100 - quality) * 9 / 91, compressionLevel);
+
+    const QString uri = QStringLiteral("file://") + mSandBox.mPath + QStringLiteral("/red.png");
+    QImage image = createColoredImage(128, 96, Qt::red);
+    image.setText(QStringLiteral("Thumb::URI"), uri);
+    image.setText(QStringLiteral("Thumb::MTime"), QStringLiteral("1234"));
+    image.setText(QStringLiteral("Thumb::Image::Width"), QStringLiteral("300"));
+
+    const int oldCompressionLevel = GwenviewConfig::thumbnailCompressionLevel();
+    GwenviewConfig::setThumbnailCompressionLevel(compressionLevel);
+    const QString path = mSandBox.mPath + QStringLiteral("/thumbnail.png");
+    {
+        ThumbnailWriter writer;
+        writer.queueThumbnail(path, image);
+        QTRY_VERIFY(writer.isEmpty());
+    }
+    GwenviewConfig::setThumbnailCompressionLevel(oldCompressionLevel);
+
+    QImageReader reader(path, "png");
+    const QImage thumbnail = reader.read();
+    QVERIFY(!thumbnail.isNull());
+    QVERIFY(TestUtils::imageCompare(thumbnail.convertToFormat(QImage::Format_RGB32), image));
+    QCOMPARE(thumbnail.text(QStringLiteral("Thumb::URI")), uri);
+    QCOMPARE(thumbnail.text(QStringLiteral("Thumb::MTime")), QStringLiteral("1234"));
+    QCOMPARE(thumbnail.text(QStringLiteral("Thumb::Image::Width")), QStringLiteral("300"));
+
+    // ThumbnailProvider reads them without decoding the image
+    QFile file(path);
+    QVERIFY(file.open(QIODevice::ReadOnly));
+    QHash<QString, QString> texts;
+    QVERIFY(PngTextReader::read(&file, &texts));
+    QCOMPARE(texts.value(QStringLiteral("Thumb::URI")), uri);
+    QCOMPARE(texts.value(QStringLiteral("Thumb::MTime")), QStringLiteral("1234"));
+}
+
+void ThumbnailProviderTest::testWriterQueueIsBounded()
+{
+    ThumbnailWriter writer;
+    std::atomic<int> writtenCount = 0;
+    connect(
+        &writer,
+        &ThumbnailWriter::thumbnailWritten,
+        this,
+        [&writtenCount]() {
+            ++writtenCount;
+        },
+        Qt::DirectConnection);
+
+    // Thumbnails stay queued until they are written, which takes a while for
+    // these
+    const QImage image = createNoiseImage(512, 512);
+    const int count = 40;
+    int queuedCount = 0;
+    for (; queuedCount < count && !writer.isFull(); ++queuedCount) {
+        writer.queueThumbnail(mSandBox.mPath + QStringLiteral("/thumbnail%1.png").arg(queuedCount), image);
+    }
+    QVERIFY(writer.isFull());
+    QVERIFY(queuedCount < count);
+
+    // Producers resume once thumbnails have been written
+    QTRY_VERIFY(!writer.isFull());
+    QTRY_VERIFY(writer.isEmpty());
+    QCOMPARE(writtenCount.load(), queuedCount);
+    for (int i = 0; i < queuedCount; ++i) {
+        QVERIFY(QFile::exists(mSandBox.mPath + QStringLiteral("/thumbnail%1.png").arg(i)));
+    }
+}
+
+void ThumbnailProviderTest::testWriterWritesRequeuedThumbnail()
+{
+    ThumbnailWriter writer;
+    std::atomic<int> writtenCount = 0;
+    connect(
+        &writer,
+        &ThumbnailWriter::thumbnailWritten,
+        this,
+        [&writtenCount]() {
+            ++writtenCount;
+        },
+        Qt::DirectConnection);
+
+    // Queue a new version while the first one is being written, or is about
+    // to be
+    const QString path = mSandBox.mPath + QStringLiteral("/thumbnail.png");
+    const QImage newImage = createColoredImage(64, 64, Qt::blue);
+    writer.queueThumbnail(path, createNoiseImage(1024, 1024));
+    writer.queueThumbnail(path, newImage);
+    QCOMPARE(writer.value(path).cacheKey(), newImage.cacheKey());
+
+    // The last version ends up on disk, with a single notification
+    QTRY_VERIFY(writer.isEmpty());
+    QCOMPARE(writtenCount.load(), 1);
+    QImage thumbnail(path, "png");
+    QVERIFY(TestUtils::imageCompare(thumbnail.convertToFormat(QImage::Format_RGB32), newImage));
+}
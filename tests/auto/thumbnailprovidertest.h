@@ -50,6 +50,14 @@ private Q_SLOTS:
     void testLoadRemote();
     void testUseEmbeddedOrNot();
     void testRemoveItemsWhileGenerating();
+    void testStopAndRestart();
+    void testPackedStore();
+    void testReadPngText();
+    void testDeriveFromLargerGroup();
+    void testWriterKeepsTexts_data();
+    void testWriterKeepsTexts();
+    void testWriterQueueIsBounded();
+    void testWriterWritesRequeuedThumbnail();
 
 private:
     SandBox mSandBox;
@@ -0,0 +1,143 @@
+// SPDX-FileCopyrightText: 2026 Gwenview Developers
+// SPDX-License-Identifier: GPL-2.0-or-later
+
+#include "thumbnailviewtest.h"
+
+// Qt
+#include <QEventLoop>
+#include <QPixmap>
+#include <QScrollBar>
+#include <QTest>
+
+// KF
+#include <KDirLister>
+
+// Local
+#include "../lib/semanticinfo/sorteddirmodel.h"
+#include "../lib/thumbnailprovider/thumbnailprovider.h"
+#include "../lib/thumbnailview/thumbnailview.h"
+#include "gwenviewconfig.h"
+#include "testutils.h"
+
+QTEST_MAIN(ThumbnailViewTest)
+
+using namespace Gwenview;
+
+static const int ItemCount = 8;
+
+void ThumbnailViewTest::initTestCase()
+{
+    QVERIFY(mDir.isValid());
+    for (int i = 0; i < ItemCount; ++i) {
+        createEmptyFile(mDir.filePath(QStringLiteral("image%1.png").arg(i)));
+    }
+}
+
+static void openDir(SortedDirModel *model, const QString &path)
+{
+    QEventLoop loop;
+    QObject::connect(model->dirLister(), &KDirLister::completed, &loop, &QEventLoop::quit);
+    model->dirLister()->openUrl(QUrl::fromLocalFile(path));
+    loop.exec();
+}
+
+/**
+ * Gives a thumbnail to each item of @p model and returns the indexes
+ */
+static QModelIndexList fillThumbnails(ThumbnailView *view, SortedDirModel *model)
+{
+    QPixmap pix(1024, 1024);
+    pix.fill(Qt::red);
+    QModelIndexList indexes;
+    for (int row = 0; row < model->rowCount(); ++row) {
+        const QModelIndex index = model->index(row, 0);
+        // Creates the entry setThumbnail() fills
+        view->thumbnailForIndex(index);
+        QMetaObject::invokeMethod(view,
+                                  "setThumbnail",
+                                  Qt::DirectConnection,
+                                  Q_ARG(KFileItem, model->itemForIndex(index)),
+                                  Q_ARG(QPixmap, pix),
+                                  Q_ARG(QSize, pix.size()),
+                                  Q_ARG(qulonglong, 0));
+        indexes << index;
+    }
+    return indexes;
+}
+
+void ThumbnailViewTest::testCacheBudget()
+{
+    GwenviewConfig::setThumbnailCacheSize(16);
+    const qint64 budget = 16 * 1024 * 1024;
+
+    SortedDirModel model;
+    openDir(&model, mDir.path());
+    QCOMPARE(model.rowCount(), ItemCount);
+
+    // No item is visible in an empty viewport, so they can all be evicted
+    ThumbnailView view(nullptr);
+    view.setModel(&model);
+    view.resize(0, 0);
+
+    const QModelIndexList indexes = fillThumbnails(&view, &model);
+    QCOMPARE(view.cacheStatistics().missCount, qint64(ItemCount));
+    const QPixmap pix(1024, 1024);
+    const qint64 thumbnailCost = qint64(pix.width()) * pix.height() * pix.depth() / 8;
+    QCOMPARE(view.cacheStatistics().size, ItemCount * thumbnailCost);
+    QCOMPARE(view.cacheStatistics().evictionCount, qint64(0));
+
+    // Trimmed once the burst of thumbnails is over
+    QTRY_VERIFY(view.cacheStatistics().evictionCount > 0);
+    const ThumbnailView::CacheStatistics statistics = view.cacheStatistics();
+    QVERIFY(statistics.size <= budget);
+    QCOMPARE(statistics.evictionCount, (ItemCount * thumbnailCost - budget + thumbnailCost - 1) / thumbnailCost);
+
+    // Once they have not been shown for a while, the remaining thumbnails
+    // are hits and the evicted ones misses. Repaints are not counted.
+    QTest::qWait(1100);
+    for (const QModelIndex &index : indexes) {
+        view.thumbnailForIndex(index);
+        view.thumbnailForIndex(index);
+    }
+    QCOMPARE(view.cacheStatistics().hitCount, ItemCount - statistics.evictionCount);
+    QCOMPARE(view.cacheStatistics().missCount, ItemCount + statistics.evictionCount);
+}
+
+void ThumbnailViewTest::testSkipItemsBehindScroll()
+{
+    QTemporaryDir dir;
+    QVERIFY(dir.isValid());
+    for (int i = 0; i < 500; ++i) {
+        createEmptyFile(dir.filePath(QStringLiteral("image%1.png").arg(i, 3, 10, QLatin1Char('0'))));
+    }
+    ThumbnailProvider::setThumbnailBaseDir(dir.filePath(QStringLiteral("thumbnails/")));
+
+    SortedDirModel model;
+    ThumbnailView view(nullptr);
+    ThumbnailProvider provider;
+    view.setModel(&model);
+    view.setThumbnailProvider(&provider);
+    view.resize(300, 300);
+    view.show();
+    QVERIFY(QTest::qWaitForWindowExposed(&view));
+    openDir(&model, dir.path());
+    QScrollBar *scrollBar = view.verticalScrollBar();
+    QVERIFY(scrollBar->maximum() > 0);
+
+    // Two quick scrolls down give the view its heading
+    scrollBar->setValue(scrollBar->maximum() / 2);
+    scrollBar->setValue(scrollBar->maximum() / 2 + view.viewport()->height() / 4);
+    view.generateThumbnailsForItems();
+
+    const KFileItemList pendingItems = provider.pendingItems();
+    QVERIFY(!pendingItems.isEmpty());
+    bool hasItemsBelow = false;
+    for (const KFileItem &item : pendingItems) {
+        const QRect rect = view.visualRect(model.indexForItem(item));
+        QVERIFY2(rect.bottom() >= 0, qPrintable(item.url().fileName()));
+        hasItemsBelow = hasItemsBelow || rect.top() > view.viewport()->height();
+    }
+    QVERIFY(hasItemsBelow);
+}
+
+#include "moc_thumbnailviewtest.cpp"
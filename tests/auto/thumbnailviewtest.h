@@ -0,0 +1,24 @@
+// SPDX-FileCopyrightText: 2026 Gwenview Developers
+// SPDX-License-Identifier: GPL-2.0-or-later
+
+#ifndef THUMBNAILVIEWTEST_H
+#define THUMBNAILVIEWTEST_H
+
+// Qt
+#include <QObject>
+#include <QTemporaryDir>
+
+class ThumbnailViewTest : public QObject
+{
+    Q_OBJECT
+
+private Q_SLOTS:
+    void initTestCase();
+    void testCacheBudget();
+    void testSkipItemsBehindScroll();
+
+private:
+    QTemporaryDir mDir;
+};
+
+#endif /* THUMBNAILVIEWTEST_H */
@@ -24,6 +24,9 @@ Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
 #include <utime.h>
 
 // Qt
+#include <QSignalSpy>
+#include <QStandardPaths>
+#include <QTemporaryDir>
 #include <QTemporaryFile>
 #include <QTest>
 
@@ -31,6 +34,7 @@ Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
 #include <KFileItem>
 
 // Local
+#include "../lib/metadataindex.h"
 #include "../lib/timeutils.h"
 
 #include "testutils.h"
@@ -44,6 +48,12 @@ static void touchFile(const QString &path)
     utime(QFile::encodeName(path).data(), nullptr);
 }
 
+void TimeUtilsTest::initTestCase()
+{
+    // The index of the application is stored in the cache folder
+    QStandardPaths::setTestModeEnabled(true);
+}
+
 #define NEW_ROW(fileName, dateTime) QTest::newRow(fileName) << fileName << dateTime
 void TimeUtilsTest::testBasic_data()
 {
@@ -93,4 +103,23 @@ void TimeUtilsTest::testCache()
     QCOMPARE(dateTime2, item2.time(KFileItem::ModificationTime));
 }
 
+void TimeUtilsTest::testCachedDateTime()
+{
+    // Use a file which cannot have been indexed yet
+    QTemporaryDir dir;
+    const QString path = dir.path() + QStringLiteral("/image.jpg");
+    QVERIFY(QFile::copy(pathForTestFile(QStringLiteral("date/exif-datetimeoriginal.jpg")), path));
+    KFileItem item(QUrl::fromLocalFile(path));
+
+    // The file is not read, the modification time is returned until the
+    // date has been indexed
+    QCOMPARE(TimeUtils::cachedDateTimeForFileItem(item), item.time(KFileItem::ModificationTime));
+
+    MetaDataIndex *index = MetaDataIndex::instance();
+    QSignalSpy spy(index, &MetaDataIndex::updated);
+    index->update({item});
+    QVERIFY(spy.wait());
+    QCOMPARE(TimeUtils::cachedDateTimeForFileItem(item), QDateTime::fromString(QStringLiteral("2003-03-10T17:45:21"), Qt::ISODate));
+}
+
 #include "moc_timeutilstest.cpp"
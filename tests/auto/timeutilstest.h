@@ -28,9 +28,11 @@ class TimeUtilsTest : public QObject
     Q_OBJECT
 
 private Q_SLOTS:
+    void initTestCase();
     void testBasic();
     void testBasic_data();
     void testCache();
+    void testCachedDateTime();
 };
 
 #endif /* TIMEUTILSTEST_H */